@@ -5,6 +5,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <vector>
+#include <unordered_map>
 #include <errno.h>
 #include <sys/ipc.h> 
 #include <sys/shm.h>
@@ -12,6 +13,9 @@
 #include <unistd.h>
 #include <sched.h>
 #include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #include <omp.h>
 
 #include "readinteger.h"
@@ -23,18 +27,21 @@
 #define MAXCLOSERELAT 6000
 #define MAXCLOSERELATTEMP 450000
 #define MAXNBDIVISOR 25
-#define NBINDIVMAX 100000
+#define NBINDIVMAX 16777216
 #define NBINDIV 100000
 #define NBINDIVEA 1
 #define MAXGEN 1
 #define MAXBREAK 1000
 
-int bestpihatagainstallID[100];
+float * bestpihatagainstall=NULL;
+int * bestpihatagainstallID=NULL;
+int nbbestpihat=0;
+int toprelatives=100;
 int IDbestpihat;
 int IDbestpihat2;
 
-float pihatagainstall[MAXPOP];
-float pihatagainstall2[MAXPOP];
+float * pihatagainstall=NULL;
+float * pihatagainstall2=NULL;
 int nbchrdivider[51][23];
 
 int IDjob=0;
@@ -178,6 +185,1135 @@ int readgenomelocal(char pathfile[],int chr,int run,int step,unsigned char * gen
 
 int nbrelatpihat=0;
 
+int pinthreads=0;
+int threadcpu[1024];
+
+// NUMA nodes and the CPUs of each, as listed in /sys/devices/system/node; CPUs may be numbered contiguously per node or
+// interleaved over the nodes, so the lists are read instead of being guessed from the number of nodes
+#define MAXNUMANODES 64
+int nbnumanodes=0;
+int numanodeid[MAXNUMANODES];
+std::vector<int> numanodecpus[MAXNUMANODES];
+
+// "0-3,8,10-11" style list of the sysfs files
+std::vector<int> readcpulist(const char path[])
+{	std::vector<int> values;
+	FILE * listfile;
+	char line[4096];
+	if ((listfile = fopen(path, "r")) == NULL) return values;
+	if (fgets(line,sizeof(line),listfile)!=NULL)
+	{	char * cursor=line;
+		while (*cursor!='\0' && *cursor!='\n')
+		{	char * end;
+			long first=strtol(cursor,&end,10);
+			if (end==cursor) break;
+			long last=first;
+			cursor=end;
+			if (*cursor=='-')
+			{	last=strtol(cursor+1,&end,10);
+				cursor=end;
+			};
+			for(long value=first;value<=last;value++) values.push_back((int) value);
+			if (*cursor==',') cursor++;
+		};
+	};
+	fclose(listfile);
+	return values;
+}
+
+int numberofnumanodes()
+{	if (nbnumanodes>0) return nbnumanodes;
+	std::vector<int> online=readcpulist("/sys/devices/system/node/online");
+	for(size_t node=0;node<online.size() && nbnumanodes<MAXNUMANODES;node++)
+	{	char path[256];
+		snprintf(path,sizeof(path),"/sys/devices/system/node/node%d/cpulist",online[node]);
+		numanodeid[nbnumanodes]=online[node];
+		numanodecpus[nbnumanodes]=readcpulist(path);
+		nbnumanodes++;
+	};
+	if (nbnumanodes==0)
+	{	numanodeid[0]=0;
+		for(int cpu=0;cpu<get_nprocs();cpu++) numanodecpus[0].push_back(cpu);
+		nbnumanodes=1;
+	};
+	return nbnumanodes;
+}
+
+int nodeofcpu(int cpu)
+{	numberofnumanodes();
+	for(int node=0;node<nbnumanodes;node++)
+	{	for(size_t place=0;place<numanodecpus[node].size();place++) if (numanodecpus[node][place]==cpu) return numanodeid[node];
+	};
+	return -1;
+}
+
+int pinthreadstocpus()
+{	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0,sizeof(allowed),&allowed)!=0) return 1;
+	int nbnode=numberofnumanodes();
+	// spread threads over the sockets: thread t goes to the (t/nbnode)th allowed CPU of node t%nbnode
+	std::vector<int> cpuorder;
+	size_t mostcpus=0;
+	for(int node=0;node<nbnode;node++) if (numanodecpus[node].size()>mostcpus) mostcpus=numanodecpus[node].size();
+	for(size_t place=0;place<mostcpus;place++)
+	{	for(int node=0;node<nbnode;node++)
+		{	if (place<numanodecpus[node].size() && CPU_ISSET(numanodecpus[node][place],&allowed)) cpuorder.push_back(numanodecpus[node][place]);
+		};
+	};
+	if (cpuorder.size()==0) return 1;
+	int nbfail=0;
+	#pragma omp parallel reduction(+:nbfail)
+	{	int thread=omp_get_thread_num();
+		cpu_set_t mask;
+		CPU_ZERO(&mask);
+		CPU_SET(cpuorder[thread%cpuorder.size()],&mask);
+		if (sched_setaffinity(0,sizeof(mask),&mask)!=0) nbfail++;
+		if (thread<1024) threadcpu[thread]=sched_getcpu();
+	}
+	return nbfail>0;
+}
+
+// node of up to 4096 pages spread over a buffer, asked with move_pages without moving them; the last entry counts the pages
+// whose node is unknown (not touched yet, or no NUMA support)
+void countpagenodes(unsigned char * region,unsigned long long bytes,unsigned long long bytespernode[MAXNUMANODES+1])
+{	if (region==NULL || bytes==0) return;
+	unsigned long long pagesize=sysconf(_SC_PAGESIZE);
+	unsigned long long nbpage=(bytes+pagesize-1)/pagesize;
+	unsigned long long nbsample=nbpage<4096 ? nbpage : 4096;
+	std::vector<void *> pages(nbsample);
+	std::vector<int> status(nbsample,-1);
+	for(unsigned long long sample=0;sample<nbsample;sample++) pages[sample]=(void *) (region+sample*nbpage/nbsample*pagesize);
+	if (syscall(SYS_move_pages,0,nbsample,&pages[0],NULL,&status[0],0)!=0)
+	{	bytespernode[MAXNUMANODES]+=bytes;
+		return;
+	};
+	for(unsigned long long sample=0;sample<nbsample;sample++)
+	{	unsigned long long share=bytes/nbsample+(sample<bytes%nbsample ? 1 : 0);
+		if (status[sample]>=0 && status[sample]<MAXNUMANODES) bytespernode[status[sample]]+=share;
+		else bytespernode[MAXNUMANODES]+=share;
+	};
+}
+
+// huge pages behind the large buffers, as -HugePages of the modular program: none, thp (transparent, the default) or hugetlb
+// (reserved pool, transparent huge pages when it is exhausted)
+#define HUGEPAGESNONE 0
+#define HUGEPAGESTHP 1
+#define HUGEPAGESHUGETLB 2
+int hugepages=HUGEPAGESTHP;
+const char * hugepagenames[3]={"none","thp","hugetlb"};
+unsigned long long largebufferbytes=0;
+// regions of the large buffers, to find their mappings in /proc/self/smaps, and the bytes taken from the hugetlb pool
+std::vector<unsigned char *> largebufferstart;
+std::vector<unsigned long long> largebuffersize;
+unsigned long long hugetlbbytes=0;
+
+int parsehugepages(const char name[])
+{	for(int mode=0;mode<3;mode++) if (strcmp(name,hugepagenames[mode])==0) return mode;
+	return -1;
+}
+
+// the PBWT of the chromosomes is built in parallel, so the bookkeeping of the buffers is done in critical(largebuffer)
+unsigned char * allocatelargebuffer(unsigned long long bytes)
+{	// anonymous mapping aligned on 2 MB so that transparent huge pages can back it, pages are only committed when touched
+	unsigned long long hugesize=2*1024*1024;
+	unsigned long long rounded=(bytes+hugesize-1)/hugesize*hugesize;
+	if (hugepages==HUGEPAGESHUGETLB)
+	{	unsigned char * region=(unsigned char *) mmap(NULL,rounded,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE|MAP_HUGETLB,-1,0);
+		if (region!=MAP_FAILED)
+		{
+			#pragma omp critical(largebuffer)
+			{	largebufferbytes+=bytes;
+				hugetlbbytes+=bytes;
+			}
+			return region;
+		};
+	};
+	unsigned char * region=(unsigned char *) mmap(NULL,rounded+hugesize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if (region==MAP_FAILED)
+	{	printf("ERROR: could not map %llu bytes\n",bytes);
+		exit(0);
+	};
+	unsigned long long head=(hugesize-((uintptr_t) region)%hugesize)%hugesize;
+	if (head>0) munmap(region,head);
+	if (hugesize-head>0) munmap(region+head+rounded,hugesize-head);
+	if (hugepages!=HUGEPAGESNONE) madvise(region+head,rounded,MADV_HUGEPAGE);
+	#pragma omp critical(largebuffer)
+	{	largebufferbytes+=bytes;
+		largebufferstart.push_back(region+head);
+		largebuffersize.push_back(bytes);
+	}
+	return region+head;
+}
+
+// unmaps a buffer of allocatelargebuffer, rounded as it was mapped, and drops it from the bookkeeping: a buffer that is not
+// among the regions came from the hugetlb pool
+void releaselargebuffer(unsigned char * buffer,unsigned long long bytes)
+{	unsigned long long hugesize=2*1024*1024;
+	munmap(buffer,(bytes+hugesize-1)/hugesize*hugesize);
+	#pragma omp critical(largebuffer)
+	{	largebufferbytes-=bytes;
+		size_t region=0;
+		while (region<largebufferstart.size() && largebufferstart[region]!=buffer) region++;
+		if (region<largebufferstart.size())
+		{	largebufferstart.erase(largebufferstart.begin()+region);
+			largebuffersize.erase(largebuffersize.begin()+region);
+		} else hugetlbbytes-=bytes;
+	}
+}
+
+// AnonHugePages of the mappings of the large buffers only, capped by their overlap in case the kernel merged a buffer with a
+// neighbouring mapping, plus the buffers from the hugetlb pool
+unsigned long long hugepagebackedbytes()
+{	FILE * smapsfile;
+	unsigned long long total=hugetlbbytes;
+	unsigned long long overlap=0;
+	char line[512];
+	if ((smapsfile = fopen("/proc/self/smaps", "r")) == NULL) return total;
+	while (fgets(line,sizeof(line),smapsfile)!=NULL)
+	{	unsigned long long start=0;
+		unsigned long long end=0;
+		if (sscanf(line,"%llx-%llx ",&start,&end)==2)
+		{	overlap=0;
+			for(size_t buffer=0;buffer<largebufferstart.size();buffer++)
+			{	unsigned long long bufferstart=(uintptr_t) largebufferstart[buffer];
+				unsigned long long low=start>bufferstart ? start : bufferstart;
+				unsigned long long high=end<bufferstart+largebuffersize[buffer] ? end : bufferstart+largebuffersize[buffer];
+				if (high>low) overlap+=high-low;
+			};
+		} else if (overlap>0 && strncmp(line,"AnonHugePages:",strlen("AnonHugePages:"))==0)
+		{	unsigned long long anonhuge=strtoull(line+strlen("AnonHugePages:"),NULL,10)*1024;
+			total+=anonhuge<overlap ? anonhuge : overlap;
+			overlap=0;
+		};
+	};
+	fclose(smapsfile);
+	return total;
+}
+
+// phased output rows, one per individual to phase, kept apart from the input genomes so that
+// individuals phased concurrently never write to the same byte
+unsigned char * phasedgenomes[23];
+int * phasedrowofindiv=NULL;
+char * phasedcommitted=NULL;
+
+void allocatephasedstore(std::vector<int> & indivs)
+{	int nbrow=0;
+	phasedrowofindiv=(int *) malloc(sizeof(int)*NbIndiv);
+	for(int relat=0;relat<NbIndiv;relat++) phasedrowofindiv[relat]=-1;
+	for(size_t i=0;i<indivs.size();i++)
+	{	if (indivs[i]<0 || indivs[i]>=NbIndiv)
+		{	printf("ERROR: individual %d is outside the %d loaded individuals\n",indivs[i],NbIndiv);
+			exit(1);
+		};
+		if (phasedrowofindiv[indivs[i]]<0) phasedrowofindiv[indivs[i]]=nbrow++;
+	};
+	phasedcommitted=(char *) calloc(nbrow+1,1);
+	for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
+	{	unsigned long long rowbytes=nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0);
+		phasedgenomes[chrtemp1]=allocatelargebuffer(rowbytes*(nbrow+1));
+	};
+}
+
+unsigned char * phasedrow(int chr,int ID)
+{	return phasedgenomes[chr]+(unsigned long long) phasedrowofindiv[ID]*(nbsnpperchr[chr]/4+((nbsnpperchr[chr]%4)>0));
+}
+
+void beginphasedindividual(int ID)
+{	// phasing only rewrites the switched heterozygous sites, start from the unphased genotypes
+	for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
+	{	unsigned long long rowbytes=nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0);
+		memcpy(phasedrow(chrtemp1,ID),genomes[chrtemp1]+(unsigned long long) ID*rowbytes,rowbytes);
+	};
+	phasedcommitted[phasedrowofindiv[ID]]=0;
+}
+
+void printplacement()
+{	printf("Processors online %d, NUMA nodes %d, OpenMP threads %d\n",get_nprocs(),numberofnumanodes(),omp_get_max_threads());
+	if (pinthreads)
+	{	printf("Thread -> CPU (node):");
+		for(int thread=0;thread<omp_get_max_threads() && thread<1024;thread++) printf(" %d->%d (%d)",thread,threadcpu[thread],nodeofcpu(threadcpu[thread]));
+		printf("\n");
+	} else printf("Threads are not pinned\n");
+	// where the genome rows first touched by the scanning threads actually are
+	unsigned long long bytespernode[MAXNUMANODES+1]={0};
+	for(int chrtemp1=1;chrtemp1<23;chrtemp1++) countpagenodes(genomes[chrtemp1],(unsigned long long) (1+nbsnpperchr[chrtemp1]/4)*NbIndiv,bytespernode);
+	for(int node=0;node<nbnumanodes;node++)
+	{	int nbthread=0;
+		for(int thread=0;pinthreads && thread<omp_get_max_threads() && thread<1024;thread++) if (nodeofcpu(threadcpu[thread])==numanodeid[node]) nbthread++;
+		printf("Node %d: %d CPUs, %d pinned threads, genomes %.1f MB\n",numanodeid[node],(int) numanodecpus[node].size(),nbthread,
+			numanodeid[node]<MAXNUMANODES ? bytespernode[numanodeid[node]]/1048576.0 : 0.0);
+	};
+	if (bytespernode[MAXNUMANODES]>0) printf("Genomes on no known node: %.1f MB\n",bytespernode[MAXNUMANODES]/1048576.0);
+	printf("Large buffers %.1f MB, of which huge-page backed %.1f MB (huge pages %s)\n",largebufferbytes/1048576.0,hugepagebackedbytes()/1048576.0,hugepagenames[hugepages]);
+}
+
+typedef struct
+{	float pihat;
+	int ID;
+} typerelatpihat;
+
+int betterrelat(typerelatpihat a,typerelatpihat b)
+{	return a.pihat>b.pihat || (a.pihat==b.pihat && a.ID<b.ID);
+}
+
+// min-heap on betterrelat: the root is the worst relative kept so far
+void siftdownrelat(typerelatpihat * heap,int size,int pos)
+{	while (1)
+	{	int worst=pos;
+		int left=2*pos+1;
+		int right=2*pos+2;
+		if (left<size && betterrelat(heap[worst],heap[left])) worst=left;
+		if (right<size && betterrelat(heap[worst],heap[right])) worst=right;
+		if (worst==pos) return;
+		typerelatpihat temp=heap[pos];heap[pos]=heap[worst];heap[worst]=temp;
+		pos=worst;
+	};
+}
+
+void pushrelat(typerelatpihat * heap,int * size,int k,typerelatpihat candidate)
+{	if (candidate.pihat!=candidate.pihat) return;
+	if (*size<k)
+	{	int pos=(*size)++;
+		heap[pos]=candidate;
+		while (pos>0 && betterrelat(heap[(pos-1)/2],heap[pos]))
+		{	typerelatpihat temp=heap[pos];heap[pos]=heap[(pos-1)/2];heap[(pos-1)/2]=temp;
+			pos=(pos-1)/2;
+		};
+	}
+	else if (betterrelat(candidate,heap[0]))
+	{	heap[0]=candidate;
+		siftdownrelat(heap,*size,0);
+	};
+}
+
+// K best relatives, best first, ties to the lower ID: one bounded heap per thread merged at the end, O(NbIndiv log K)
+int selecttoprelatives(float * pihat,int nbindiv,int k,float * bestvalue,int * bestID)
+{	int nbthreads=omp_get_max_threads();
+	typerelatpihat * heaps=(typerelatpihat *) malloc(sizeof(typerelatpihat)*k*(unsigned long long) (nbthreads+1));
+	int * heapsize=(int *) calloc(nbthreads,sizeof(int));
+	#pragma omp parallel
+	{	int thread=omp_get_thread_num();
+		#pragma omp for schedule(static)
+		for(int relat=0;relat<nbindiv;relat++)
+		{	typerelatpihat candidate;
+			candidate.pihat=pihat[relat];
+			candidate.ID=relat;
+			pushrelat(heaps+(unsigned long long) thread*k,&heapsize[thread],k,candidate);
+		};
+	}
+	typerelatpihat * merged=heaps+(unsigned long long) nbthreads*k;
+	int nbmerged=0;
+	for(int thread=0;thread<nbthreads;thread++)
+	{	for(int pos=0;pos<heapsize[thread];pos++) pushrelat(merged,&nbmerged,k,heaps[(unsigned long long) thread*k+pos]);
+	};
+	int nbbest=nbmerged;
+	for(int pos=nbbest-1;pos>=0;pos--)
+	{	bestvalue[pos]=merged[0].pihat;
+		bestID[pos]=merged[0].ID;
+		merged[0]=merged[--nbmerged];
+		siftdownrelat(merged,nbmerged,0);
+	};
+	free(heaps);
+	free(heapsize);
+	return nbbest;
+}
+
+// per SNP, the PIHAT contribution of every (focal dosage, relative dosage) pair and the window-scoring term of every
+// (relative allele, focal allele) pair: both depend only on the MAF, so they are computed once and indexed by every focal
+float * cohortpihatcontri[23]={NULL};
+double * cohortpconttab[23]={NULL};
+int cohorttablesready=0;
+const int powersnppihat=3;
+
+void buildcohorttables()
+{	for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
+	{	free(cohortpihatcontri[chrtemp1]);
+		free(cohortpconttab[chrtemp1]);
+		cohortpihatcontri[chrtemp1]=(float *) malloc(sizeof(float)*9*(nbsnpperchrinfile[chrtemp1]+1));
+		cohortpconttab[chrtemp1]=(double *) malloc(sizeof(double)*4*(nbsnpperchrinfile[chrtemp1]+1));
+		#pragma omp parallel for
+		for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)
+		{	float maffloat=1.0*MAF[snp][chrtemp1]/(NbIndiv)/2;
+			if (maffloat>0.5) maffloat=1-maffloat;
+			float maffloatdiviseur=2*(maffloat)*(.5-maffloat/2);
+			// alleles of genotypes 0, 1 and 3; genotype 2 only swaps the two terms of each sum
+			for(int dosage=0;dosage<3;dosage++)
+			{	float pcontribu10=((dosage/2)-maffloat);
+				float pcontribu11=((dosage>0)-maffloat);
+				float * entry=cohortpihatcontri[chrtemp1]+snp*9+dosage*3;
+				entry[0]=pcontribu10*(-maffloat)*2/maffloatdiviseur+pcontribu11*(-maffloat)*2/maffloatdiviseur;
+				entry[1]=pcontribu10*	(1-maffloat*2)/maffloatdiviseur+pcontribu11*	(1-maffloat*2)/maffloatdiviseur;
+				entry[2]=pcontribu10*	((2)-maffloat*2)/maffloatdiviseur+pcontribu11*	((2)-maffloat*2)/maffloatdiviseur;
+			};
+
+			double mafdouble=1.0*MAF[snp][chrtemp1]/MAXPOP/2;
+			double mafdoublediviseur=(mafdouble)*(2-mafdouble*2)/3*2;
+			for(int allelerelat=0;allelerelat<2;allelerelat++)
+			{	for(int allelefocal=0;allelefocal<2;allelefocal++)
+				{	cohortpconttab[chrtemp1][snp*4+allelerelat*2+allelefocal]=pow(((allelerelat)-mafdouble)/mafdoublediviseur*((allelefocal)-1.0*mafdouble),1.0/powersnppihat);
+				};
+			};
+		};
+	};
+	cohorttablesready=1;
+}
+
+// runs of SNPs where a focal haplotype and a relative haplotype carry the same allele, SNPs start to end-1; the pairing is the
+// index of nbindivmatchseg: focal low/relative low, focal low/relative high, focal high/relative low, focal high/relative high,
+// low being the allele in bit 0 of the genotype and high the allele in bit 1
+typedef struct
+{	int start;
+	int end;
+	int relat;
+	int pairing;
+} typematchrun;
+
+// relatives scanned per thread at least, below which a parallel region per 64-SNP word costs more than it saves
+#define PARALLELSCANRELAT 1024
+
+// gathers the even bits of 32 2-bit genotypes into the low 32 bits
+uint64_t evenbitsof(uint64_t genotypes)
+{	genotypes&=0x5555555555555555ULL;
+	genotypes=(genotypes|(genotypes>>1))&0x3333333333333333ULL;
+	genotypes=(genotypes|(genotypes>>2))&0x0F0F0F0F0F0F0F0FULL;
+	genotypes=(genotypes|(genotypes>>4))&0x00FF00FF00FF00FFULL;
+	genotypes=(genotypes|(genotypes>>8))&0x0000FFFF0000FFFFULL;
+	return (genotypes|(genotypes>>16))&0x00000000FFFFFFFFULL;
+}
+
+// low and high allele planes of SNPs 64*word to 64*word+63 of a packed row, one bit per SNP
+void haplotypeplanes(unsigned char * row,unsigned long long rowbytes,int word,uint64_t planes[2])
+{	unsigned char bytes[16]={0};
+	unsigned long long firstbyte=(unsigned long long) word*16;
+	memcpy(bytes,row+firstbyte,firstbyte+16<=rowbytes ? 16 : rowbytes-firstbyte);
+	uint64_t first32,last32;
+	memcpy(&first32,bytes,8);
+	memcpy(&last32,bytes+8,8);
+	planes[0]=evenbitsof(first32)|(evenbitsof(last32)<<32);
+	planes[1]=evenbitsof(first32>>1)|(evenbitsof(last32>>1)<<32);
+}
+
+// bit-parallel scan of SNPs firstsnp to endsnp-1 of one relative row against the focal planes: each pairing XORs one 64-SNP word
+// of allele planes, count-trailing-zeros jumps to the first and last mismatch of the word, and the runs in between are only
+// looked at one by one when they hold minlength matching SNPs. openstart[pairing] is the start of the run open at firstsnp
+// (firstsnp if none) and becomes the start of the run open at endsnp; the runs a mismatch closes before endsnp with at least
+// minlength SNPs are appended to runs, in SNP order for each pairing
+void scanmatchruns(unsigned char * row,unsigned long long rowbytes,uint64_t * focalplanes[2],int relat,int firstsnp,int endsnp,int minlength,int openstart[4],std::vector<typematchrun> & runs)
+{	for(int word=firstsnp/64;word*64<endsnp;word++)
+	{	uint64_t planes[2];
+		haplotypeplanes(row,rowbytes,word,planes);
+		int wordstart=word*64;
+		int firstbit=firstsnp>wordstart ? firstsnp-wordstart : 0;
+		int endbit=endsnp-wordstart<64 ? endsnp-wordstart : 64;
+		uint64_t valid=(endbit==64 ? ~0ULL : (1ULL<<endbit)-1)&(~0ULL<<firstbit);
+		for(int pairing=0;pairing<4;pairing++)
+		{	uint64_t mismatch=(focalplanes[pairing>>1][word]^planes[pairing&1])&valid;
+			if (mismatch==0) continue;
+			int firstmismatch=__builtin_ctzll(mismatch);
+			int lastmismatch=63-__builtin_clzll(mismatch);
+			typematchrun run;
+			run.relat=relat;
+			run.pairing=pairing;
+			run.start=openstart[pairing];
+			run.end=wordstart+firstmismatch;
+			if (run.end-run.start>=minlength) runs.push_back(run);
+			openstart[pairing]=wordstart+lastmismatch+1;
+			if (lastmismatch-firstmismatch<=minlength) continue;
+			// matches strictly between the first and the last mismatch, then bit i kept when SNPs i to i+minlength-1 all match
+			uint64_t match=~mismatch&(~0ULL<<firstmismatch)&((1ULL<<lastmismatch)-1);
+			uint64_t longrun=match;
+			int covered=1;
+			while (covered*2<=minlength)
+			{	longrun&=longrun>>covered;
+				covered*=2;
+			};
+			if (covered<minlength) longrun&=longrun>>(minlength-covered);
+			while (longrun)
+			{	int startbit=__builtin_ctzll(longrun);
+				int stopbit=startbit+__builtin_ctzll(~(match>>startbit));
+				run.start=wordstart+startbit;
+				run.end=wordstart+stopbit;
+				runs.push_back(run);
+				longrun&=~0ULL<<stopbit;
+			};
+		};
+	};
+}
+
+// Fenwick tree over positions 0 to size-1, tree holding size+1 entries
+void fenwickadd(int * tree,int size,int position,int value)
+{	for(position++;position<=size;position+=position&(-position)) tree[position]+=value;
+}
+
+// sum over positions 0 to position
+int fenwickprefix(int * tree,int position)
+{	int sum=0;
+	for(position++;position>0;position-=position&(-position)) sum+=tree[position];
+	return sum;
+}
+
+// positional Burrows-Wheeler transform of the 2*NbIndiv haplotypes of a chromosome, haplotype 2*relat+bit being the allele in
+// that bit of the genotype: column snp holds the alleles at snp of the haplotypes sorted on their prefixes read backwards from
+// snp-1, so the haplotypes carrying the same alleles as a query over SNPs first to snp form one interval of the order after snp,
+// narrowed SNP by SNP with two rank queries. Ranks are sampled every PBWTRANKWORDS words of a column, and the order itself every
+// PBWTSAMPLESTEP SNPs to recover which haplotypes an interval holds
+#define PBWTRANKWORDS 8
+#define PBWTSAMPLESTEP 256
+#define PBWTVERSION 1
+typedef struct
+{	int nbsnp;
+	int nbhap;
+	int nbwords;
+	int nbblocks;
+	uint64_t fingerprint;
+	uint64_t * columns;
+	uint32_t * zerosbefore;
+	int * order;
+} typepbwt;
+
+typepbwt pbwt[23];
+int usepbwt=0;
+
+// fingerprint of the genome rows of a chromosome, kept with the structures built from them to tell when they are out of date
+uint64_t genomefingerprint(int chr,int nbsnp)
+{	unsigned long long rowbytes=nbsnpperchr[chr]/4+((nbsnpperchr[chr]%4)>0);
+	uint64_t hash=0xcbf29ce484222325ULL^((uint64_t) NbIndiv<<32)^(uint64_t) nbsnp;
+	for(int relat=0;relat<NbIndiv;relat++)
+	{	unsigned char * row=genomes[chr]+(unsigned long long) relat*rowbytes;
+		unsigned long long byte=0;
+		for(;byte+8<=rowbytes;byte+=8)
+		{	uint64_t chunk;
+			memcpy(&chunk,row+byte,8);
+			hash=(hash^chunk)*0x100000001b3ULL;
+			hash^=hash>>29;
+		};
+		for(;byte<rowbytes;byte++) hash=(hash^row[byte])*0x100000001b3ULL;
+	};
+	return hash;
+}
+
+unsigned long long pbwtcolumnbytes(typepbwt * index)
+{	return (unsigned long long) index->nbsnp*index->nbwords*sizeof(uint64_t);
+}
+
+unsigned long long pbwtrankbytes(typepbwt * index)
+{	return ((unsigned long long) index->nbsnp*(index->nbblocks+1)*sizeof(uint32_t)+7)/8*8;
+}
+
+unsigned long long pbwtorderbytes(typepbwt * index)
+{	return ((unsigned long long) ((index->nbsnp+PBWTSAMPLESTEP-1)/PBWTSAMPLESTEP+1)*index->nbhap*sizeof(int)+7)/8*8;
+}
+
+// number of haplotypes carrying allele 0 at snp among positions 0 to position-1 of the order before snp
+uint32_t pbwtzeros(typepbwt * index,int snp,int position)
+{	uint64_t * column=index->columns+(unsigned long long) snp*index->nbwords;
+	int block=position/(64*PBWTRANKWORDS);
+	uint32_t zeros=index->zerosbefore[(unsigned long long) snp*(index->nbblocks+1)+block];
+	for(int word=block*PBWTRANKWORDS;word<position/64;word++) zeros+=64-__builtin_popcountll(column[word]);
+	if (position%64) zeros+=position%64-__builtin_popcountll(column[position/64]&((1ULL<<(position%64))-1));
+	return zeros;
+}
+
+// narrows the interval first to end-1 of the order before snp to its haplotypes carrying allele at snp, in the order after snp
+void pbwtextend(typepbwt * index,int snp,int allele,int * first,int * end)
+{	uint32_t zerosfirst=pbwtzeros(index,snp,*first);
+	uint32_t zerosend=pbwtzeros(index,snp,*end);
+	if (allele==0)
+	{	*first=zerosfirst;
+		*end=zerosend;
+	} else
+	{	uint32_t zeros=index->zerosbefore[(unsigned long long) snp*(index->nbblocks+1)+index->nbblocks];
+		*first=zeros+*first-zerosfirst;
+		*end=zeros+*end-zerosend;
+	};
+}
+
+// haplotype at a position of the order before snp, following it forward to the next sampled order
+int pbwthaplotype(typepbwt * index,int snp,int position)
+{	while (snp%PBWTSAMPLESTEP!=0 && snp<index->nbsnp)
+	{	int allele=(index->columns[(unsigned long long) snp*index->nbwords+position/64]>>(position%64))&1;
+		int end=position+1;
+		pbwtextend(index,snp,allele,&position,&end);
+		snp++;
+	};
+	return index->order[(unsigned long long) ((snp+PBWTSAMPLESTEP-1)/PBWTSAMPLESTEP)*index->nbhap+position];
+}
+
+// number of haplotypes of the cohort carrying the alleles of a query haplotype (one bit per SNP) over SNPs firstsnp to endsnp-1
+int pbwtmatchcount(typepbwt * index,uint64_t * haplotype,int firstsnp,int endsnp)
+{	int first=0;
+	int end=index->nbhap;
+	for(int snp=firstsnp;snp<endsnp && first<end;snp++) pbwtextend(index,snp,(haplotype[snp/64]>>(snp%64))&1,&first,&end);
+	return end-first;
+}
+
+// set-maximal matches of a query haplotype with at least minlength SNPs: for every SNP where no haplotype carrying the query's
+// alleles since start goes on, the haplotypes of that interval are reported as runs start to snp-1, relat being the individual
+// and the pairing focalhaplotype*2 plus the bit of its haplotype, then start moves to the first SNP from which some haplotype
+// still carries the query's alleles up to snp
+void pbwtsetmaximalmatches(typepbwt * index,uint64_t * haplotype,int focalhaplotype,int minlength,std::vector<typematchrun> & runs)
+{	int start=0;
+	int first=0;
+	int end=index->nbhap;
+	for(int snp=0;snp<=index->nbsnp;snp++)
+	{	int allele=snp<index->nbsnp ? (haplotype[snp/64]>>(snp%64))&1 : 0;
+		int nextfirst=first;
+		int nextend=end;
+		if (snp<index->nbsnp) pbwtextend(index,snp,allele,&nextfirst,&nextend);
+		if (snp<index->nbsnp && nextfirst<nextend)
+		{	first=nextfirst;
+			end=nextend;
+			continue;
+		};
+		if (snp>start && snp-start>=minlength)
+		{	for(int position=first;position<end;position++)
+			{	int hap=pbwthaplotype(index,snp,position);
+				typematchrun run={start,snp,hap/2,focalhaplotype*2+(hap&1)};
+				runs.push_back(run);
+			};
+		};
+		if (snp==index->nbsnp) break;
+		// the matches ending at snp start between start+1 and snp, or nowhere when no haplotype carries the allele at snp
+		int low=start+1;
+		int high=snp+1;
+		while (low<high)
+		{	int middle=(low+high)/2;
+			if (pbwtmatchcount(index,haplotype,middle,snp+1)>0) high=middle;
+			else low=middle+1;
+		};
+		start=low;
+		first=0;
+		end=index->nbhap;
+		for(int snprun=start;snprun<=snp;snprun++) pbwtextend(index,snprun,(haplotype[snprun/64]>>(snprun%64))&1,&first,&end);
+	};
+}
+
+// one pass over the SNPs of a chromosome: the order before each SNP is split stably on the alleles it carries there
+void sizepbwt(int chr,typepbwt * index)
+{	index->nbsnp=nbsnpperchrinfile[chr];
+	index->nbhap=2*NbIndiv;
+	index->nbwords=(index->nbhap+63)/64;
+	index->nbblocks=(index->nbwords+PBWTRANKWORDS-1)/PBWTRANKWORDS;
+}
+
+void buildpbwt(int chr,typepbwt * index)
+{	int nbsnp=nbsnpperchrinfile[chr];
+	unsigned long long rowbytes=nbsnpperchr[chr]/4+((nbsnpperchr[chr]%4)>0);
+	sizepbwt(chr,index);
+	index->fingerprint=genomefingerprint(chr,nbsnp);
+	index->columns=(uint64_t *) allocatelargebuffer(pbwtcolumnbytes(index));
+	index->zerosbefore=(uint32_t *) allocatelargebuffer(pbwtrankbytes(index));
+	index->order=(int *) allocatelargebuffer(pbwtorderbytes(index));
+	int * order=(int *) malloc(sizeof(int)*index->nbhap);
+	int * ones=(int *) malloc(sizeof(int)*index->nbhap);
+	uint64_t * alleles=(uint64_t *) malloc(sizeof(uint64_t)*index->nbhap);
+	for(int hap=0;hap<index->nbhap;hap++) order[hap]=hap;
+	for(int snp=0;snp<nbsnp;snp++)
+	{	if (snp%64==0)
+		{	for(int relat=0;relat<NbIndiv;relat++) haplotypeplanes(genomes[chr]+(unsigned long long) relat*rowbytes,rowbytes,snp/64,alleles+2*relat);
+		};
+		if (snp%PBWTSAMPLESTEP==0) memcpy(index->order+(unsigned long long) (snp/PBWTSAMPLESTEP)*index->nbhap,order,sizeof(int)*index->nbhap);
+		uint64_t * column=index->columns+(unsigned long long) snp*index->nbwords;
+		uint32_t * zerosbefore=index->zerosbefore+(unsigned long long) snp*(index->nbblocks+1);
+		memset(column,0,sizeof(uint64_t)*index->nbwords);
+		int nbzero=0;
+		int nbone=0;
+		for(int position=0;position<index->nbhap;position++)
+		{	if (position%(64*PBWTRANKWORDS)==0) zerosbefore[position/(64*PBWTRANKWORDS)]=nbzero;
+			int hap=order[position];
+			if ((alleles[hap]>>(snp%64))&1)
+			{	column[position/64]|=1ULL<<(position%64);
+				ones[nbone++]=hap;
+			} else order[nbzero++]=hap;
+		};
+		zerosbefore[index->nbblocks]=nbzero;
+		memcpy(order+nbzero,ones,sizeof(int)*nbone);
+	};
+	memcpy(index->order+(unsigned long long) ((nbsnp+PBWTSAMPLESTEP-1)/PBWTSAMPLESTEP)*index->nbhap,order,sizeof(int)*index->nbhap);
+	free(order);
+	free(ones);
+	free(alleles);
+}
+
+// cache file: a header with the cohort size and, per chromosome, the SNP count, the genome fingerprint and the offset of its
+// columns, ranks and sampled orders, stored as built so that a run maps them instead of building them again
+typedef struct
+{	char magic[8];
+	int version;
+	int nbindiv;
+	long long offset[23];
+	int nbsnp[23];
+	uint64_t fingerprint[23];
+} typepbwtheader;
+
+int loadpbwtcache(char path[],int loaded[23])
+{	int file=open(path,O_RDONLY);
+	if (file<0) return 1;
+	struct stat status;
+	typepbwtheader header;
+	if (fstat(file,&status)!=0 || status.st_size<(off_t) sizeof(header) || read(file,&header,sizeof(header))!=(ssize_t) sizeof(header) ||
+			memcmp(header.magic,"PBWTIDX",8)!=0 || header.version!=PBWTVERSION || header.nbindiv!=NbIndiv)
+	{	close(file);
+		return 1;
+	};
+	unsigned char * mapped=(unsigned char *) mmap(NULL,status.st_size,PROT_READ,MAP_SHARED,file,0);
+	close(file);
+	if (mapped==MAP_FAILED) return 1;
+	#pragma omp parallel for schedule(dynamic,1)
+	for(int chr=1;chr<23;chr++)
+	{	typepbwt index;
+		index.nbsnp=header.nbsnp[chr];
+		index.nbhap=2*NbIndiv;
+		index.nbwords=(index.nbhap+63)/64;
+		index.nbblocks=(index.nbwords+PBWTRANKWORDS-1)/PBWTRANKWORDS;
+		index.fingerprint=header.fingerprint[chr];
+		if (index.nbsnp!=nbsnpperchrinfile[chr] || header.offset[chr]<(long long) sizeof(header) ||
+				header.offset[chr]+pbwtcolumnbytes(&index)+pbwtrankbytes(&index)+pbwtorderbytes(&index)>(unsigned long long) status.st_size ||
+				index.fingerprint!=genomefingerprint(chr,index.nbsnp)) continue;
+		index.columns=(uint64_t *) (mapped+header.offset[chr]);
+		index.zerosbefore=(uint32_t *) (mapped+header.offset[chr]+pbwtcolumnbytes(&index));
+		index.order=(int *) (mapped+header.offset[chr]+pbwtcolumnbytes(&index)+pbwtrankbytes(&index));
+		pbwt[chr]=index;
+		loaded[chr]=1;
+	};
+	return 0;
+}
+
+// written next to the cache and renamed over it, so that a mapping of the previous file stays valid
+int savepbwtcache(char path[])
+{	char temppath[512];
+	snprintf(temppath,sizeof(temppath),"%s.tmp",path);
+	FILE * file;
+	if ((file=fopen(temppath,"wb"))==NULL) return 1;
+	typepbwtheader header;
+	memset(&header,0,sizeof(header));
+	memcpy(header.magic,"PBWTIDX",8);
+	header.version=PBWTVERSION;
+	header.nbindiv=NbIndiv;
+	long long offset=sizeof(header);
+	for(int chr=1;chr<23;chr++)
+	{	header.offset[chr]=offset;
+		header.nbsnp[chr]=pbwt[chr].nbsnp;
+		header.fingerprint[chr]=pbwt[chr].fingerprint;
+		offset+=pbwtcolumnbytes(&pbwt[chr])+pbwtrankbytes(&pbwt[chr])+pbwtorderbytes(&pbwt[chr]);
+	};
+	int error=fwrite(&header,sizeof(header),1,file)!=1;
+	for(int chr=1;chr<23 && !error;chr++)
+	{	error=fwrite(pbwt[chr].columns,1,pbwtcolumnbytes(&pbwt[chr]),file)!=pbwtcolumnbytes(&pbwt[chr]) ||
+			fwrite(pbwt[chr].zerosbefore,1,pbwtrankbytes(&pbwt[chr]),file)!=pbwtrankbytes(&pbwt[chr]) ||
+			fwrite(pbwt[chr].order,1,pbwtorderbytes(&pbwt[chr]),file)!=pbwtorderbytes(&pbwt[chr]);
+	};
+	if (fclose(file)!=0) error=1;
+	if (error || rename(temppath,path)!=0)
+	{	remove(temppath);
+		return 1;
+	};
+	return 0;
+}
+
+// MemAvailable of /proc/meminfo, 0 when it cannot be read
+unsigned long long availablememory()
+{	FILE * meminfo;
+	unsigned long long available=0;
+	char line[256];
+	if ((meminfo = fopen("/proc/meminfo", "r")) == NULL) return 0;
+	while (fgets(line,sizeof(line),meminfo)!=NULL)
+	{	if (strncmp(line,"MemAvailable:",strlen("MemAvailable:"))==0) available=strtoull(line+strlen("MemAvailable:"),NULL,10)*1024;
+	};
+	fclose(meminfo);
+	return available;
+}
+
+// every chromosome is taken from the cache when it matches the genomes, the others are built in parallel, one chromosome per
+// thread, and the cache is rewritten when any was built. The index takes about 1.2 times the genome store, so nothing is built
+// when the chromosomes to build do not fit in the available memory, and 1 is returned to count segments by scanning instead
+int preparepbwt(char path[])
+{	double start=omp_get_wtime();
+	int loaded[23]={0};
+	if (strlen(path)>0 && loadpbwtcache(path,loaded)!=0) printf("PBWT cache %s not usable, building every chromosome\n",path);
+	unsigned long long needed=0;
+	for(int chr=1;chr<23;chr++)
+	{	if (loaded[chr]) continue;
+		typepbwt size;
+		sizepbwt(chr,&size);
+		needed+=pbwtcolumnbytes(&size)+pbwtrankbytes(&size)+pbwtorderbytes(&size);
+	};
+	unsigned long long available=availablememory();
+	if (available>0 && needed>available)
+	{	printf("WARNING: the PBWT needs %.1f MB but %.1f MB are available, segments are counted by scanning the cohort\n",needed/1048576.0,available/1048576.0);
+		return 1;
+	};
+	int nbbuilt=0;
+	#pragma omp parallel for schedule(dynamic,1) reduction(+:nbbuilt)
+	for(int chr=1;chr<23;chr++)
+	{	if (loaded[chr]) continue;
+		buildpbwt(chr,&pbwt[chr]);
+		nbbuilt++;
+	};
+	unsigned long long bytes=0;
+	for(int chr=1;chr<23;chr++) bytes+=pbwtcolumnbytes(&pbwt[chr])+pbwtrankbytes(&pbwt[chr])+pbwtorderbytes(&pbwt[chr]);
+	printf("PBWT: %d chromosome(s) built, %d from cache, %.1f MB, %.2f seconds\n",nbbuilt,22-nbbuilt,bytes/1048576.0,omp_get_wtime()-start);
+	if (nbbuilt>0 && strlen(path)>0 && savepbwtcache(path)!=0) printf("WARNING: could not write PBWT cache %s\n",path);
+	return 0;
+}
+
+// share of the cohort below which a segment shared with a relative is rare, doubled after a possible phase error
+double ratetoconsiderseg=0.00001;
+double ratetoconsidersegPE=2*ratetoconsiderseg;
+
+// rare-segment spectrum: rarelength[chr][(snp*2+pe)*2] is one more than the longest match ending at snp that maxothers[pe]+2
+// haplotypes of the cohort share, maxothers[pe] being half of the carriers below NbIndiv*ratetoconsiderseg (ratetoconsidersegPE
+// for pe 1). Over a segment that long no haplotype of the cohort has more than maxothers[pe] others matching it, so the two
+// focal haplotypes have fewer carriers than the threshold together and the segment is rare without counting them. That holds
+// while each focal haplotype is one of the cohort over the segment; once the correction has swapped the focal inside it, a
+// focal haplotype is a mosaic that up to maxothers[pe]+1 haplotypes of the cohort can match, and rarelength[chr][(snp*2+pe)*2+1]
+// is the length over which no maxothers[pe]+1 of them share a match. Shorter segments are not taken as rare even when few
+// relatives carry this focal's, so the lookup finds a part of the rare segments
+#define RARELENGTHNEVER 65535
+unsigned short * rarelength[23];
+int userarespectrum=0;
+
+// after the column of snp, the haplotypes at positions a to a+carriers of the order share SNPs max(divergence[a+1..a+carriers])
+// to snp; the longest match shared by carriers+1 haplotypes is found with a sliding maximum over the divergences
+int longestsharedmatch(int * divergence,int nbhap,int snp,int carriers,int * deque)
+{	if (carriers>=nbhap) return 0;
+	int latest=snp+1;
+	int head=0;
+	int tail=0;
+	for(int position=1;position<nbhap;position++)
+	{	while (tail>head && divergence[deque[tail-1]]<=divergence[position]) tail--;
+		deque[tail++]=position;
+		if (position>=carriers)
+		{	while (deque[head]<=position-carriers) head++;
+			if (divergence[deque[head]]<latest) latest=divergence[deque[head]];
+		};
+	};
+	return snp+1-latest;
+}
+
+// replays the PBWT columns with the divergence update of the PBWT paper: a haplotype's match with the one before it in the
+// order after snp starts at the latest start met since the previous haplotype carrying the same allele
+void buildrarespectrum(int chr)
+{	typepbwt * index=&pbwt[chr];
+	int nbhap=index->nbhap;
+	int * divergence=(int *) calloc(nbhap,sizeof(int));
+	int * nextdivergence=(int *) malloc(sizeof(int)*nbhap);
+	int * deque=(int *) malloc(sizeof(int)*nbhap);
+	rarelength[chr]=(unsigned short *) malloc(sizeof(unsigned short)*4*(index->nbsnp+1));
+	int maxothers[2];
+	maxothers[0]=ceil(NbIndiv*ratetoconsiderseg)>0 ? ((int) ceil(NbIndiv*ratetoconsiderseg)-1)/2 : -1;
+	maxothers[1]=ceil(NbIndiv*ratetoconsidersegPE)>0 ? ((int) ceil(NbIndiv*ratetoconsidersegPE)-1)/2 : -1;
+	for(int snp=0;snp<index->nbsnp;snp++)
+	{	uint64_t * column=index->columns+(unsigned long long) snp*index->nbwords;
+		int nbzero=index->zerosbefore[(unsigned long long) snp*(index->nbblocks+1)+index->nbblocks];
+		int nextzero=0;
+		int nextone=nbzero;
+		int startzero=snp+1;
+		int startone=snp+1;
+		for(int position=0;position<nbhap;position++)
+		{	if (divergence[position]>startzero) startzero=divergence[position];
+			if (divergence[position]>startone) startone=divergence[position];
+			if ((column[position/64]>>(position%64))&1)
+			{	nextdivergence[nextone++]=startone;
+				startone=0;
+			} else
+			{	nextdivergence[nextzero++]=startzero;
+				startzero=0;
+			};
+		};
+		int * swap=divergence;
+		divergence=nextdivergence;
+		nextdivergence=swap;
+		for(int pe=0;pe<2;pe++)
+		{	for(int mosaic=0;mosaic<2;mosaic++)
+			{	int length=maxothers[pe]-mosaic>=0 ? longestsharedmatch(divergence,nbhap,snp,maxothers[pe]+1-mosaic,deque)+1 : RARELENGTHNEVER;
+				rarelength[chr][(snp*2+pe)*2+mosaic]=length<RARELENGTHNEVER ? length : RARELENGTHNEVER;
+			};
+		};
+	};
+	free(divergence);
+	free(nextdivergence);
+	free(deque);
+}
+
+// for each SNP, the first SNP of the longest stretch ending there over which the focal's two haplotypes are those of its genome
+// row, in either order; a match starting before it runs over a phase switch of the correction
+void focalpurestarts(int chr,int ID,int * purestart)
+{	unsigned long long rowbytes=nbsnpperchr[chr]/4+((nbsnpperchr[chr]%4)>0);
+	unsigned char * row=genomes[chr]+(unsigned long long) ID*rowbytes;
+	int start=0;
+	int lasthet=-1;
+	int lastswapped=0;
+	for(int snp=0;snp<nbsnpperchrinfile[chr];snp++)
+	{	int original=(row[snp/4]>>((snp%4)*2))&3;
+		if ((original&1)!=(original>>1))
+		{	int swapped=genomeoffpss[0][snp][chr]!=original;
+			if (lasthet>=0 && swapped!=lastswapped) start=lasthet+1;
+			lasthet=snp;
+			lastswapped=swapped;
+		};
+		purestart[snp]=start;
+	};
+}
+
+void preparerarespectrum()
+{	double start=omp_get_wtime();
+	#pragma omp parallel for schedule(dynamic,1)
+	for(int chr=1;chr<23;chr++) buildrarespectrum(chr);
+	printf("Rare-segment spectrum built in %.2f seconds\n",omp_get_wtime()-start);
+}
+
+// pairwise segment database: for two individuals and a chromosome, the rare segments the correction found between their
+// haplotypes. A record holds the pair, the lower ID first, a fingerprint of the haplotypes of each of them when the correction
+// started, and the focal with a fingerprint of the relatives it did not count as carriers; its segments pair the haplotypes of the
+// first with those of the second as they were then. The walk only depends on these and on the cohort, so a correction of the same
+// focal with all of them the same replays the record instead of walking the SNPs and gives what the walk gives. The phase changes
+// come again from the segments: the focal is swapped from the start of a segment on a focal haplotype other than the one of the
+// segment before it, as the walk does. With segmentdbreverse, a pair with no record of its own focal replays the first record of
+// the other one from the same haplotypes, whose segments were counted against the other focal's carriers. The header holds the
+// version of the cohort: the genome fingerprint of every chromosome with the settings, and the file is emptied when it does not match
+#define SEGMENTDBVERSION 3
+typedef struct
+{	char magic[8];
+	int version;
+	int nbindiv;
+	uint64_t cohortversion;
+} typesegmentdbheader;
+
+// a record, followed by its nbevent events; first is lower than second and focal is one of them
+typedef struct
+{	int first;
+	int second;
+	int chr;
+	int nbevent;
+	int focal;
+	uint64_t firststate;
+	uint64_t secondstate;
+	uint64_t excludedstate;
+} typesegmentrecord;
+
+// a rare segment of SNPs start to end-1, with the haplotype of the first individual of the record in bit 1 of pairing and that of
+// the second in bit 0, and the carriers the focal that found it counted (-1 when the rare-segment spectrum only bounded them).
+// In the walk of the correction, pairing is that of typematchrun and -1 is a phase change: the focal is swapped from start on and
+// the correction goes on after end
+typedef struct
+{	int pairing;
+	int start;
+	int end;
+	int count;
+} typesegmentevent;
+
+int usesegmentdb=0;
+int segmentdbreverse=0;
+
+void printsegment(int chr,int type,int snp,int length,int count)
+{	if (count>=0) printf("chr %d segment type %d at snp %d of lenght %d as only %d indivs has it\n",chr,type,snp,length,count);
+	else printf("chr %d segment type %d at snp %d of lenght %d as rare in the cohort\n",chr,type,snp,length);
+}
+int segmentdbfile=-1;
+unsigned char * segmentdbmapped=NULL;
+unsigned long long segmentdbmappedsize=0;
+unsigned long long segmentdbend=0;
+std::unordered_map<uint64_t,unsigned long long> segmentdbindex;
+// with segmentdbreverse, the first record of each pair and haplotypes whichever the focal
+std::unordered_map<uint64_t,unsigned long long> segmentdbpairindex;
+
+uint64_t segmentdbhash(uint64_t hash,uint64_t value)
+{	hash=(hash^value)*0x100000001b3ULL;
+	return hash^(hash>>29);
+}
+
+uint64_t segmentdbpairkey(int first,int second,int chr,uint64_t firststate,uint64_t secondstate)
+{	uint64_t hash=segmentdbhash(0xcbf29ce484222325ULL,((uint64_t) first<<32)|(uint32_t) second);
+	return segmentdbhash(segmentdbhash(segmentdbhash(hash,chr),firststate),secondstate);
+}
+
+uint64_t segmentdbkey(int first,int second,int chr,uint64_t firststate,uint64_t secondstate,int focal,uint64_t excludedstate)
+{	return segmentdbhash(segmentdbhash(segmentdbpairkey(first,second,chr,firststate,secondstate),focal),excludedstate);
+}
+
+// indexes a record at offset; inside critical(segmentdb) once the file is open
+void indexsegmentrecord(typesegmentrecord * record,unsigned long long offset)
+{	segmentdbindex[segmentdbkey(record->first,record->second,record->chr,record->firststate,record->secondstate,record->focal,record->excludedstate)]=offset;
+	if (segmentdbreverse) segmentdbpairindex.insert(std::make_pair(segmentdbpairkey(record->first,record->second,record->chr,record->firststate,record->secondstate),offset));
+}
+
+// fingerprint of the individuals the correction of a focal leaves out of the carriers: the focal and its close relatives
+uint64_t excludedfingerprint(int ID)
+{	uint64_t hash=segmentdbhash(0xcbf29ce484222325ULL,NbIndiv);
+	for(int relat=0;relat<NbIndiv;relat++) if (!(relat!=ID && pihatagainstall[relat]<seuilpihat[0])) hash=segmentdbhash(hash,relat);
+	return hash;
+}
+
+// fingerprint of the phased genotypes of ID on a chromosome, 32 SNPs per word: those of the focal as corrected so far when focal
+// is set, otherwise those of the cohort, which the focal starts from
+uint64_t haplotypefingerprint(int chr,int ID,int focal)
+{	uint64_t hash=segmentdbhash(0xcbf29ce484222325ULL,nbsnpperchrinfile[chr]);
+	unsigned char * row=genomes[chr]+(unsigned long long) ID*(nbsnpperchr[chr]/4+((nbsnpperchr[chr]%4)>0));
+	uint64_t word=0;
+	for(int snp=0;snp<nbsnpperchrinfile[chr];snp++)
+	{	int code=focal ? genomeoffpss[0][snp][chr]&3 : (row[snp/4]>>((snp%4)*2))&3;
+		word|=(uint64_t) code<<((snp%32)*2);
+		if (snp%32==31 || snp==nbsnpperchrinfile[chr]-1)
+		{	hash=segmentdbhash(hash,word);
+			word=0;
+		};
+	};
+	return hash;
+}
+
+uint64_t cohortversion()
+{	uint64_t fingerprint[23]={0};
+	#pragma omp parallel for schedule(dynamic,1)
+	for(int chr=1;chr<23;chr++) fingerprint[chr]=pbwt[chr].columns!=NULL ? pbwt[chr].fingerprint : genomefingerprint(chr,nbsnpperchrinfile[chr]);
+	uint64_t version=segmentdbhash(0xcbf29ce484222325ULL,SEGMENTDBVERSION);
+	for(int chr=1;chr<23;chr++) version=segmentdbhash(version,fingerprint[chr]);
+	uint64_t rate;
+	memcpy(&rate,&ratetoconsiderseg,sizeof(rate));
+	version=segmentdbhash(version,rate);
+	memcpy(&rate,&ratetoconsidersegPE,sizeof(rate));
+	version=segmentdbhash(version,rate);
+	return segmentdbhash(version,userarespectrum);
+}
+
+// maps the records of the file and indexes them; a record cut by an interrupted run is dropped and new records are appended
+int opensegmentdb(char path[])
+{	double start=omp_get_wtime();
+	typesegmentdbheader expected;
+	memset(&expected,0,sizeof(expected));
+	memcpy(expected.magic,"SEGMTDB",8);
+	expected.version=SEGMENTDBVERSION;
+	expected.nbindiv=NbIndiv;
+	expected.cohortversion=cohortversion();
+	int file=open(path,O_RDWR|O_CREAT|O_APPEND,0644);
+	if (file<0) return 1;
+	struct stat status;
+	typesegmentdbheader header;
+	if (fstat(file,&status)!=0)
+	{	close(file);
+		return 1;
+	};
+	unsigned long long size=status.st_size;
+	unsigned long long end=sizeof(header);
+	int valid=size>=sizeof(header) && pread(file,&header,sizeof(header),0)==(ssize_t) sizeof(header) && memcmp(&header,&expected,sizeof(header))==0;
+	if (valid && size>sizeof(header))
+	{	unsigned char * mapped=(unsigned char *) mmap(NULL,size,PROT_READ,MAP_SHARED,file,0);
+		if (mapped==MAP_FAILED)
+		{	close(file);
+			return 1;
+		};
+		while (end+sizeof(typesegmentrecord)<=size)
+		{	typesegmentrecord * record=(typesegmentrecord *) (mapped+end);
+			unsigned long long next=end+sizeof(typesegmentrecord)+(unsigned long long) record->nbevent*sizeof(typesegmentevent);
+			if (record->nbevent<0 || next>size) break;
+			indexsegmentrecord(record,end);
+			end=next;
+		};
+		segmentdbmapped=mapped;
+		segmentdbmappedsize=size;
+	};
+	if (!valid)
+	{	if (ftruncate(file,0)!=0 || write(file,&expected,sizeof(expected))!=(ssize_t) sizeof(expected))
+		{	close(file);
+			return 1;
+		};
+		if (size>0) printf("Segment database %s was built on other genomes or settings, starting it again\n",path);
+	} else if (end<size && ftruncate(file,end)!=0)
+	{	close(file);
+		return 1;
+	};
+	segmentdbend=valid ? end : sizeof(expected);
+	segmentdbfile=file;
+	usesegmentdb=1;
+	printf("Segment database: %zu record(s), %.2f seconds\n",segmentdbindex.size(),omp_get_wtime()-start);
+	return 0;
+}
+
+// maps the file again up to its end, so that the records appended since it was mapped can be read; inside critical(segmentdb)
+int remapsegmentdb()
+{	if (segmentdbfile<0) return 1;
+	unsigned char * mapped=(unsigned char *) mmap(NULL,segmentdbend,PROT_READ,MAP_SHARED,segmentdbfile,0);
+	if (mapped==MAP_FAILED) return 1;
+	if (segmentdbmapped!=NULL) munmap(segmentdbmapped,segmentdbmappedsize);
+	segmentdbmapped=mapped;
+	segmentdbmappedsize=segmentdbend;
+	return 0;
+}
+
+// record at offset, mapping the file again when it was appended since; inside critical(segmentdb)
+typesegmentrecord * segmentrecordat(unsigned long long offset)
+{	if (offset>=segmentdbmappedsize && remapsegmentdb()!=0) return NULL;
+	return (typesegmentrecord *) (segmentdbmapped+offset);
+}
+
+// events of the record of a focal and relative, a chromosome, the haplotypes of both and the relatives left out of the carriers,
+// or with segmentdbreverse of the first record of the pair from the same haplotypes, 0 if there is none. They are copied, as
+// another chromosome may map the file again while they are replayed
+int findsegments(int focal,int relat,int chr,uint64_t focalstate,uint64_t relatstate,uint64_t excludedstate,std::vector<typesegmentevent> & events)
+{	int first=focal<relat ? focal : relat;
+	int second=focal<relat ? relat : focal;
+	uint64_t firststate=focal<relat ? focalstate : relatstate;
+	uint64_t secondstate=focal<relat ? relatstate : focalstate;
+	int found=0;
+	#pragma omp critical(segmentdb)
+	{	std::unordered_map<uint64_t,unsigned long long>::iterator entry=segmentdbindex.find(segmentdbkey(first,second,chr,firststate,secondstate,focal,excludedstate));
+		typesegmentrecord * record=entry!=segmentdbindex.end() ? segmentrecordat(entry->second) : NULL;
+		if (record!=NULL && (record->focal!=focal || record->excludedstate!=excludedstate)) record=NULL;
+		if (record==NULL && segmentdbreverse)
+		{	entry=segmentdbpairindex.find(segmentdbpairkey(first,second,chr,firststate,secondstate));
+			if (entry!=segmentdbpairindex.end()) record=segmentrecordat(entry->second);
+		};
+		if (record!=NULL && record->first==first && record->second==second && record->chr==chr && record->firststate==firststate && record->secondstate==secondstate)
+		{	events.assign((typesegmentevent *) (record+1),(typesegmentevent *) (record+1)+record->nbevent);
+			found=1;
+		};
+	}
+	return found;
+}
+
+// the segments of the walk of focal against relat, with its pairings on the haplotypes they started from and without the phase
+// changes, in one write per record so that the chromosomes corrected in parallel do not interleave theirs; the record is indexed
+// at once and later corrections of the pair in this run replay it
+void storesegments(int focal,int relat,int chr,uint64_t focalstate,uint64_t relatstate,uint64_t excludedstate,std::vector<typesegmentevent> & walk)
+{	std::vector<typesegmentevent> events;
+	int changes=0;
+	for(size_t event=0;event<walk.size();event++)
+	{	if (walk[event].pairing<0)
+		{	changes++;
+			continue;
+		};
+		int focalhap=(walk[event].pairing>>1)^(changes&1);
+		int relathap=walk[event].pairing&1;
+		typesegmentevent segment=walk[event];
+		segment.pairing=focal<relat ? (focalhap<<1)|relathap : (relathap<<1)|focalhap;
+		events.push_back(segment);
+	};
+	typesegmentrecord record;
+	memset(&record,0,sizeof(record));
+	record.first=focal<relat ? focal : relat;
+	record.second=focal<relat ? relat : focal;
+	record.chr=chr;
+	record.nbevent=events.size();
+	record.focal=focal;
+	record.firststate=focal<relat ? focalstate : relatstate;
+	record.secondstate=focal<relat ? relatstate : focalstate;
+	record.excludedstate=excludedstate;
+	std::vector<unsigned char> buffer(sizeof(record)+events.size()*sizeof(typesegmentevent));
+	memcpy(&buffer[0],&record,sizeof(record));
+	if (events.size()>0) memcpy(&buffer[sizeof(record)],&events[0],events.size()*sizeof(typesegmentevent));
+	#pragma omp critical(segmentdb)
+	{	if (segmentdbfile>=0 && write(segmentdbfile,&buffer[0],buffer.size())!=(ssize_t) buffer.size())
+		{	printf("WARNING: could not write to the segment database, no more segments are recorded\n");
+			close(segmentdbfile);
+			segmentdbfile=-1;
+		} else if (segmentdbfile>=0)
+		{	indexsegmentrecord(&record,segmentdbend);
+			segmentdbend+=buffer.size();
+		};
+	}
+}
+
 int loadsegment(int ID,int numtrio,int IDp1loop,int IDp2loop,int lenminseg,int version,int gentostart,char pathresult[])
 {	int parametercombine=0;
 	int parametercalculfromparent=0;
@@ -216,32 +1352,35 @@ int loadsegment(int ID,int numtrio,int IDp1loop,int IDp2loop,int lenminseg,int v
 
 	int relatpihatP1[MAXCLOSERELATTEMP];
 	int relatpihatP2[MAXCLOSERELAT];
-	int relatpihatID[MAXPOP];
+	std::vector<int> relatpihatID(NbIndiv);
 	int relatpihatchr[MAXCLOSERELAT][23][2];
 	int seuilscore=1;
 	int powersegment=1;
 
-	for(int IDrun=0;IDrun<MAXPOP;IDrun++)
+	for(int IDrun=0;IDrun<NbIndiv;IDrun++)
 	{	relatpihatID[IDrun]=-1;
 	};
 
 	int64_t segnum=0;
 
-	FILE * MAFfile;
-	if ((MAFfile = fopen("/pl/active/KellerLab/Emmanuel/gameticphasing/MAF.txt", "r")) == NULL)
-	{	if (printdetail) printf("file triofile is not found\n");
-		return (1);
-	};
+	// the MAF only depends on the genomes: it is read and counted for the first focal only
 	int chr=1;
-	do
-	{	chr=readinteger(MAFfile);
-		if (chr<23)
-		{	int snp=readinteger(MAFfile);
-			MAF[snp][chr]=readinteger(MAFfile);
-
+	if (!cohorttablesready)
+	{	FILE * MAFfile;
+		if ((MAFfile = fopen("/pl/active/KellerLab/Emmanuel/gameticphasing/MAF.txt", "r")) == NULL)
+		{	if (printdetail) printf("file triofile is not found\n");
+			return (1);
 		};
-	} while (chr<23);
-	fclose(MAFfile);
+		do
+		{	chr=readinteger(MAFfile);
+			if (chr<23)
+			{	int snp=readinteger(MAFfile);
+				MAF[snp][chr]=readinteger(MAFfile);
+
+			};
+		} while (chr<23);
+		fclose(MAFfile);
+	};
 
 	uint64_t averageofaverage[23];
 	char number[100];
@@ -249,66 +1388,96 @@ int loadsegment(int ID,int numtrio,int IDp1loop,int IDp2loop,int lenminseg,int v
 	int nbseg=0;
 	int segstarttemp[24];
 
-	float bestpihatagainstall[100]={-1};
-
-	for(int relat=0;relat<MAXPOP;relat++)
+	for(int relat=0;relat<NbIndiv;relat++)
 	{	pihatagainstall[relat]=0;
 
 	};
 
 	printf("Search for relatives\n");
-	for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
-	{
-		#pragma omp parallel for
-		for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)
-		{	MAF[snp][chrtemp1]=0;
+	if (!cohorttablesready)
+	{	for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
+		{
+			#pragma omp parallel for
+			for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)
+			{	MAF[snp][chrtemp1]=0;
+			};
 		};
-	};
-	for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
-	{
-		#pragma omp parallel for
-		for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)
-		{	for(int relat=0;relat<NbIndiv;relat++)
-			{	int snpvalue0=(*((genomes[chrtemp1]+(unsigned long long) relat*(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0)) )+snp/4)>>(((snp%4)*2)))&3;
-				MAF[snp][chrtemp1]=MAF[snp][chrtemp1]+(snpvalue0>>1)+(snpvalue0&1);
+		for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
+		{
+			#pragma omp parallel for
+			for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)
+			{	for(int relat=0;relat<NbIndiv;relat++)
+				{	int snpvalue0=(*((genomes[chrtemp1]+(unsigned long long) relat*(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0)) )+snp/4)>>(((snp%4)*2)))&3;
+					MAF[snp][chrtemp1]=MAF[snp][chrtemp1]+(snpvalue0>>1)+(snpvalue0&1);
+				};
 			};
 		};
+		buildcohorttables();
 	};
 		int relat=ID;
 
+	// contributions of the focal are tabulated per SNP for every chromosome first, then relatives are split across threads once
+	// and each thread sweeps all chromosomes of its own relatives: one fork/join per focal instead of one per chromosome
+	float * tabpihatcontri[23];
+	unsigned long long nbsnptotal=0;
 	for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
-	{	for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)		
-		{
-			float maffloat=1.0*MAF[snp][chrtemp1]/(NbIndiv)/2;
-			if (maffloat>0.5) maffloat=1-maffloat;
-			
-			int snpvalue0=(*((genomes[chrtemp1]+(unsigned long long) relat*(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0)) )+snp/4)>>(((snp%4)*2)))&3;
-			
-			int parent0indiv0=(snpvalue0>>1);
-			int parent1indiv0=(snpvalue0&1);
-			float pcontribu10=((parent0indiv0)-maffloat);
-			float pcontribu11=((parent1indiv0)-maffloat);
-			float maffloatdiviseur=2*(maffloat)*(.5-maffloat/2);
-
-			float tabpihatcontri[3];
-			tabpihatcontri[0]=pcontribu10*(-maffloat)*2/maffloatdiviseur+pcontribu11*(-maffloat)*2/maffloatdiviseur;
-			tabpihatcontri[1]=pcontribu10*	(1-maffloat*2)/maffloatdiviseur+pcontribu11*	(1-maffloat*2)/maffloatdiviseur;
-			tabpihatcontri[2]=pcontribu10*	((2)-maffloat*2)/maffloatdiviseur+pcontribu11*	((2)-maffloat*2)/maffloatdiviseur;
-			int multiplerelat=(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0));
-			int snpdiv4=snp/4;
-			int snpdecal=(((snp%4)*2)); 
+	{	tabpihatcontri[chrtemp1]=(float *) malloc(sizeof(float)*3*(nbsnpperchrinfile[chrtemp1]+1));
+		nbsnptotal=nbsnptotal+nbsnpperchrinfile[chrtemp1];
+		for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)		
+		{	int snpvalue0=(*((genomes[chrtemp1]+(unsigned long long) relat*(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0)) )+snp/4)>>(((snp%4)*2)))&3;
+			float * entry=cohortpihatcontri[chrtemp1]+snp*9+((snpvalue0>>1)+(snpvalue0&1))*3;
+
+			tabpihatcontri[chrtemp1][snp*3]=entry[0];
+			tabpihatcontri[chrtemp1][snp*3+1]=entry[1];
+			tabpihatcontri[chrtemp1][snp*3+2]=entry[2];
+		};
+	};
 
-			#pragma omp parallel for
-			for(int relat2=0;relat2<NbIndiv;relat2++)
-			{	int snpvalue1=(*((genomes[chrtemp1]+(unsigned long long) relat2*multiplerelat )+snpdiv4)>>snpdecal)&3;
-				
-				int parent0indiv1=(snpvalue1&1);
-				int parent1indiv1=(snpvalue1>>1);	
-				pihatagainstall[relat2]=pihatagainstall[relat2]+tabpihatcontri[parent0indiv1+parent1indiv1];	
-			
-			};	
-		};	
+	double pihatstarttime=omp_get_wtime();
+	// each thread sweeps its relatives in tiles: a SNP range whose contributions fill half of L2 is reused by a block of relatives
+	// whose rows fill a quarter of it, while the rows of the next block are prefetched; every relative still adds its SNPs in genome order
+	long l2bytes=sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (l2bytes<=0) l2bytes=1<<20;
+	int pihattilesnps=(int) (l2bytes/2/(3*sizeof(float)))/16*16;
+	#pragma omp parallel
+	{	int nbthreads=omp_get_num_threads();
+		int thread=omp_get_thread_num();
+		int firstrelat=(int) ((int64_t) NbIndiv*thread/nbthreads);
+		int endrelat=(int) ((int64_t) NbIndiv*(thread+1)/nbthreads);
+		for(int relat2=firstrelat;relat2<endrelat;relat2++) pihatagainstall[relat2]=0;
+		for(int chrtemp1=1;chrtemp1<23;chrtemp1++)
+		{	unsigned long long multiplerelat=(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0));
+			float * tabchr=tabpihatcontri[chrtemp1];
+			int nbsnp=nbsnpperchrinfile[chrtemp1];
+			for(int firstsnp=0;firstsnp<nbsnp;firstsnp+=pihattilesnps)
+			{	int endsnp=(firstsnp+pihattilesnps<nbsnp) ? firstsnp+pihattilesnps : nbsnp;
+				int tilerelats=(int) (l2bytes/4/((endsnp-firstsnp)/4+1));
+				if (tilerelats<16) tilerelats=16;
+				for(int firsttilerelat=firstrelat;firsttilerelat<endrelat;firsttilerelat+=tilerelats)
+				{	int endtilerelat=(firsttilerelat+tilerelats<endrelat) ? firsttilerelat+tilerelats : endrelat;
+					int endnexttilerelat=(endtilerelat+tilerelats<endrelat) ? endtilerelat+tilerelats : endrelat;
+					for(int relat2=endtilerelat;relat2<endnexttilerelat;relat2++)
+					{	unsigned char * row=genomes[chrtemp1]+(unsigned long long) relat2*multiplerelat;
+						for(int byte=firstsnp/4;byte<(endsnp+3)/4;byte+=64) __builtin_prefetch(row+byte,0,2);
+					};
+					for(int relat2=firsttilerelat;relat2<endtilerelat;relat2++)
+					{	unsigned char * row=genomes[chrtemp1]+(unsigned long long) relat2*multiplerelat;
+						float pihat=pihatagainstall[relat2];
+						for(int snp=firstsnp;snp<endsnp;snp++)
+						{	int snpvalue1=(row[snp/4]>>((snp%4)*2))&3;
+							int parent0indiv1=(snpvalue1&1);
+							int parent1indiv1=(snpvalue1>>1);
+							pihat=pihat+tabchr[snp*3+parent0indiv1+parent1indiv1];
+						};
+						pihatagainstall[relat2]=pihat;
+					};
+				};
+			};
+		};
 	};
+	double pihatsweeptime=omp_get_wtime()-pihatstarttime;
+	printf("PIHAT sweep: %d relatives x %llu SNPs in %.3f s (%.1f M relative-SNPs/s)\n",NbIndiv,nbsnptotal,pihatsweeptime,pihatsweeptime>0 ? (double) NbIndiv*nbsnptotal/pihatsweeptime/1e6 : 0.0);
+	for(int chrtemp1=1;chrtemp1<23;chrtemp1++) free(tabpihatcontri[chrtemp1]);
 	for(int relat2=0;relat2<NbIndiv;relat2++)
 	{
 		pihatagainstall[relat2]=pihatagainstall[relat2]/2/(330005)-1;
@@ -320,42 +1489,27 @@ int loadsegment(int ID,int numtrio,int IDp1loop,int IDp2loop,int lenminseg,int v
 	{	if (pihatagainstall[relat2]>0.1)
 		{	printf("Relative of %d found: %d with pihat of %f\n",relat,relat2,pihatagainstall[relat2]);
 		}
-		int comparepihat=99;
-		while (pihatagainstall[relat2]>bestpihatagainstall[comparepihat] && comparepihat>-1)
-		{	comparepihat--;
-		};
-		if (comparepihat<99)
-		{	for(int movepihat=99;movepihat>comparepihat;movepihat--)
-			{	bestpihatagainstall[movepihat]=bestpihatagainstall[movepihat-1];
-				bestpihatagainstallID[movepihat]=bestpihatagainstallID[movepihat-1];
-			};
-		}
-		bestpihatagainstall[comparepihat]=pihatagainstall[relat2];
-		bestpihatagainstallID[comparepihat]=relat2;
-
 	};
+	nbbestpihat=selecttoprelatives(pihatagainstall,NbIndiv,toprelatives,bestpihatagainstall,bestpihatagainstallID);
 
+	// every read below stops at the end of the list instead of running past it
 	int compteur=0;
 	for(int comp=0;comp<7;comp++) bestpihat[comp]=0;
-	bestpihat[0]=bestpihatagainstall[compteur];
+	if (nbbestpihat>0) bestpihat[0]=bestpihatagainstall[compteur];
 	int nbtimeIDchange=0;
 
-	do {compteur++;} while (bestpihatagainstall[compteur]>seuilpihat);
+	do {compteur++;} while (compteur<nbbestpihat && bestpihatagainstall[compteur]>seuilpihat);
 	placefirttoconsider=compteur;
-	bestpihat[1]=bestpihatagainstall[compteur];
-	IDbestpihat=bestpihatagainstallID[compteur];
-	IDbestpihat2=bestpihatagainstallID[compteur+1];
-	for(int comp=compteur;comp<compteur+2;comp++)	bestpihat[2]=bestpihat[2]+bestpihatagainstall[comp];
-	for(int comp=compteur;comp<compteur+5;comp++)	bestpihat[3]=bestpihat[3]+bestpihatagainstall[comp];
-	for(int comp=compteur;comp<compteur+10;comp++)	bestpihat[4]=bestpihat[4]+bestpihatagainstall[comp];
-	for(int comp=compteur;comp<compteur+20;comp++)	bestpihat[5]=bestpihat[5]+bestpihatagainstall[comp];
-	for(int comp=compteur;comp<compteur+50;comp++)	bestpihat[6]=bestpihat[6]+bestpihatagainstall[comp];
+	if (compteur<nbbestpihat) bestpihat[1]=bestpihatagainstall[compteur];
+	IDbestpihat=compteur<nbbestpihat ? bestpihatagainstallID[compteur] : -1;
+	IDbestpihat2=compteur+1<nbbestpihat ? bestpihatagainstallID[compteur+1] : -1;
+	for(int comp=compteur;comp<compteur+2 && comp<nbbestpihat;comp++)	bestpihat[2]=bestpihat[2]+bestpihatagainstall[comp];
+	for(int comp=compteur;comp<compteur+5 && comp<nbbestpihat;comp++)	bestpihat[3]=bestpihat[3]+bestpihatagainstall[comp];
+	for(int comp=compteur;comp<compteur+10 && comp<nbbestpihat;comp++)	bestpihat[4]=bestpihat[4]+bestpihatagainstall[comp];
+	for(int comp=compteur;comp<compteur+20 && comp<nbbestpihat;comp++)	bestpihat[5]=bestpihat[5]+bestpihatagainstall[comp];
+	for(int comp=compteur;comp<compteur+50 && comp<nbbestpihat;comp++)	bestpihat[6]=bestpihat[6]+bestpihatagainstall[comp];
 	segstarttemp[0]=0;
 
-	float pihatagainstallchrMP[MAXPOP][2]={0};
-	for(int relat=0;relat<MAXPOP;relat++)
-	{	pihatagainstallchrMP[relat][0]=0;pihatagainstallchrMP[relat][1]=0;
-	}
 	return (1);
 }
 
@@ -623,10 +1777,13 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 					double sumoftabcor=0;
 					int firstexponent;
 					int thirdindice;
-					double pihatagainstallchrMPphaseerror[23][MAXPOP][200][2];
+					// 23*NbIndiv rows of 4 entries per divider of 2 doubles do not fit on any stack, they are mapped on huge pages once
+					// the dividers are known; row chr*NbIndiv+relat starts at entry (chr*NbIndiv+relat)*phaseerrorstride
+					static double (*pihatagainstallchrMPphaseerror)[2]=NULL;
+					static int phaseerrorstride=0;
 					int purcentage;
 					int powerpihatDEGREE4=0;
-					for(int size=0;size<51;size++)
+					for(int size=0;size<50;size++)
 					{	for(int chr=1;chr<23;chr++)
 						{	for(int window=0;window<1;window++)
 							{	chrdivider[size][chr][window].segment=0;
@@ -769,123 +1926,239 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 								};
 							};
 
+							if (placefirttoconsider+relattocompare>=nbbestpihat) continue;
 							int IDrelattocompare=bestpihatagainstallID[placefirttoconsider+relattocompare];
 							if (pihatagainstall[IDrelattocompare]>seuilpihatcorrection	)
-							{
-								#pragma omp parallel for
-								for(int  chrtemp1=22;chrtemp1>0;chrtemp1--)
+							{	// a chromosome that is scanned splits the relatives of every word over the threads, so chromosomes go one
+								// after the other; otherwise each chromosome is a task of its own, the longest first
+								int scanchromosomes=0;
+								uint64_t excludedstate=usesegmentdb ? excludedfingerprint(ID) : 0;
+								for(int  chrtemp1=1;chrtemp1<23;chrtemp1++)
+								{	if (!(userarespectrum && rarelength[chrtemp1]!=NULL) && !(usepbwt && pbwt[chrtemp1].columns!=NULL)) scanchromosomes=1;
+								};
+								#pragma omp parallel for schedule(dynamic,1) if(!scanchromosomes)
+								for(int  chrtemp1=1;chrtemp1<23;chrtemp1++)
 								{	printf("Start correcting chr %d\n",chrtemp1);
-									int nbindivmatchseg[MAXPOP][4];
-									for(int64_t relat=0;relat<(int64_t) NbIndiv;relat++)
-									{	nbindivmatchseg[relat][0]=0;
-										nbindivmatchseg[relat][1]=0;
-										nbindivmatchseg[relat][2]=0;
-										nbindivmatchseg[relat][3]=0;
+									// a pair already corrected from the same haplotypes and carriers gets the segments recorded then, on the
+									// focal haplotypes as swapped by the changes they make
+									uint64_t focalstate=usesegmentdb ? haplotypefingerprint(chrtemp1,ID,1) : 0;
+									uint64_t relatstate=usesegmentdb ? haplotypefingerprint(chrtemp1,IDrelattocompare,0) : 0;
+									std::vector<typesegmentevent> recorded;
+									if (usesegmentdb && findsegments(ID,IDrelattocompare,chrtemp1,focalstate,relatstate,excludedstate,recorded))
+									{	int changes=0;
+										int lastfocalhap=-1;
+										for(size_t event=0;event<recorded.size();event++)
+										{	typesegmentevent segment=recorded[event];
+											int focalhap=(ID<IDrelattocompare ? segment.pairing>>1 : segment.pairing&1)^(changes&1);
+											int pairing=(focalhap<<1)|(ID<IDrelattocompare ? segment.pairing&1 : segment.pairing>>1);
+											printsegment(chrtemp1,pairing<2 ? 1+2*pairing : 2*pairing-2,segment.end-1,segment.end-segment.start,segment.count);
+											for(int spnrun=segment.start-1;spnrun<segment.end;spnrun++) segwithav[chrtemp1][spnrun]=pairing<2 ? 1 : 2;
+											if (lastfocalhap>=0 && focalhap!=lastfocalhap)
+											{	printf("change from %d to %d\n",(segment.end+segment.start)/2-1,nbsnpperchrinfile[chrtemp1]);
+												for(int snprun=segment.start-1;snprun<nbsnpperchrinfile[chrtemp1];snprun++)
+												{	genomeoffpss[0][snprun][chrtemp1]=((genomeoffpss[0][snprun][chrtemp1]&1)<<1)+(genomeoffpss[0][snprun][chrtemp1]>>1);
+												};
+												for(int snprun=segment.end-1;snprun<nbsnpperchrinfile[chrtemp1];snprun++) segwithav[chrtemp1][snprun]=0;
+												changes++;
+											} else lastfocalhap=focalhap;
+										};
+										continue;
 									};
-									int nbsegmentofthislength[NSNPPERCHR]={0};
+									std::vector<typesegmentevent> foundsegments;
+									// the match runs of the scanned relatives come from scanmatchruns one 64-SNP word at a time. Every open run
+									// grows by one SNP per SNP, so the runs of at least L SNPs at snp, which nbindivmatchseg counted with a
+									// histogram of lengths, are the open runs starting at snp-L+1 or before: a Fenwick tree over run starts
+									// takes a run when it may reach 11 SNPs and gives it back at the mismatch that closes it.
+									// With the PBWT of the chromosome nothing is scanned: the relatives sharing the target's segment are the
+									// haplotypes of the cohort left in the interval of the focal haplotype over that segment, less those of
+									// the individuals that are not scanned, the focal itself and its close relatives
+									int nbsnpperchrby4=(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0));
+									int nbwords=(nbsnpperchrinfile[chrtemp1]+63)/64;
+									uint64_t * focalplanes[2];
+									focalplanes[0]=(uint64_t *) calloc(nbwords,sizeof(uint64_t));
+									focalplanes[1]=(uint64_t *) calloc(nbwords,sizeof(uint64_t));
+									for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)
+									{	focalplanes[0][snp/64]|=(uint64_t) (genomeoffpss[0][snp][chrtemp1]&1)<<(snp%64);
+										focalplanes[1][snp/64]|=(uint64_t) (genomeoffpss[0][snp][chrtemp1]>>1)<<(snp%64);
+									};
+									std::vector<int> scannedrelat;
+									int targetscanned=0;
+									for(int relat=0;relat<NbIndiv;relat++) if (relat!=ID && pihatagainstall[relat]<seuilpihat[0] )
+									{	scannedrelat.push_back(relat);
+										if (relat==IDrelattocompare) targetscanned=1;
+									};
+									// the spectrum replaces the carrier counts, the PBWT intervals replace the scan
+									int spectrumquery=userarespectrum && rarelength[chrtemp1]!=NULL;
+									int pbwtquery=!spectrumquery && usepbwt && pbwt[chrtemp1].columns!=NULL;
+									int scanquery=!spectrumquery && !pbwtquery;
+									int * purestart=NULL;
+									if (spectrumquery)
+									{	purestart=(int *) malloc(sizeof(int)*nbsnpperchrinfile[chrtemp1]);
+										focalpurestarts(chrtemp1,ID,purestart);
+									};
+									std::vector<int> excludedrelat;
+									if (pbwtquery) for(int relat=0;relat<NbIndiv;relat++) if (!(relat!=ID && pihatagainstall[relat]<seuilpihat[0])) excludedrelat.push_back(relat);
+									std::vector<uint64_t> excludedmatch(4*excludedrelat.size(),0);
+									std::vector<int> excludedlength(4*excludedrelat.size(),0);
+									// per target pairing and focal haplotype, the PBWT interval of the haplotypes matching over its segment
+									int interval[4][2][2];
+									for(int pairing=0;pairing<4;pairing++) for(int focalhap=0;focalhap<2;focalhap++)
+									{	interval[pairing][focalhap][0]=0;
+										interval[pairing][focalhap][1]=2*NbIndiv;
+									};
+									int segmentcount[4]={0};
+									// per scanned relative and pairing, the start of the open run and the start it has in the tree, -1 if none
+									int (*openstart)[4]=(int (*)[4]) malloc(sizeof(int)*4*(scannedrelat.size()+1));
+									int (*countedstart)[4]=(int (*)[4]) malloc(sizeof(int)*4*(scannedrelat.size()+1));
+									for(size_t scanned=0;scanned<scannedrelat.size();scanned++)
+									{	for(int pairing=0;pairing<4;pairing++)
+										{	openstart[scanned][pairing]=0;
+											countedstart[scanned][pairing]=-1;
+										};
+									};
+									// per thread, the runs closed in the scanned word and the starts it puts in the tree
+									std::vector<std::vector<typematchrun> > closedruns(omp_get_max_threads());
+									std::vector<std::vector<int> > addedstarts(omp_get_max_threads());
+									// starts of the runs closed at each SNP of the scanned word
+									std::vector<int> endingstart[64];
+									int nbstart=nbsnpperchrinfile[chrtemp1]+1;
+									int * runstarts=(int *) calloc(nbstart+1,sizeof(int));
+									int scannedend=0;
+									uint64_t targetmatch[4]={0};
+									int matchlength[4]={0};
 									int typesegment=-1;
 									int lasttypesegment=-1;
 									int endlastsegment[4]={-1};
-									double ratetoconsiderseg=0.0001;
-									double ratetoconsidersegPE=ratetoconsiderseg*2;
-									ratetoconsiderseg=0.00001;
-									ratetoconsidersegPE=2*ratetoconsiderseg;
 									int phaseerrorpossible[4]={0};
 									int breaknubercm=25;
 									for(int snp=0;snp<nbsnpperchrinfile[chrtemp1];snp++)
 									{
-										int snpvalue0=genomeoffpss[0][snp][chrtemp1];
-										int nbsnpperchrby4=(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0));
 										int snpmod4=(((snp%4)*2));
 										int snpdiv4=snp/4;
-
-										for(int64_t relat=0;relat<(int64_t) NbIndiv;relat++) if (relat!=ID && pihatagainstall[relat]<seuilpihat[0] )
-										{	int snpvalue1=(*((genomes[chrtemp1]+(unsigned long long) relat*nbsnpperchrby4 )+snpdiv4)>>snpmod4)&3;
-											if ((snpvalue0&1)==(snpvalue1&1))
-											{	if (nbindivmatchseg[relat][0]<10) nbindivmatchseg[relat][0]++; else
-												nbsegmentofthislength[++nbindivmatchseg[relat][0]]++;
-											} else
-											{	if (nbindivmatchseg[relat][0]<10) nbindivmatchseg[relat][0]=0; else
-												{	for(int lenght=10;lenght<nbindivmatchseg[relat][0]+1;lenght++) nbsegmentofthislength[lenght]--;
-													nbindivmatchseg[relat][0]=0;
-												}
+										if (snp>=scannedend)
+										{	int word=snp/64;
+											scannedend=(word+1)*64<nbsnpperchrinfile[chrtemp1] ? (word+1)*64 : nbsnpperchrinfile[chrtemp1];
+											for(size_t excluded=0;excluded<excludedrelat.size();excluded++)
+											{	uint64_t planes[2];
+												haplotypeplanes(genomes[chrtemp1]+(unsigned long long) excludedrelat[excluded]*nbsnpperchrby4,nbsnpperchrby4,word,planes);
+												for(int pairing=0;pairing<4;pairing++) excludedmatch[excluded*4+pairing]=~(focalplanes[pairing>>1][word]^planes[pairing&1]);
 											};
-											if ((snpvalue0&1)==(snpvalue1>>1))
-											{	if (nbindivmatchseg[relat][1]<10) nbindivmatchseg[relat][1]++;
-												else nbsegmentofthislength[++nbindivmatchseg[relat][1]]++;
-											} else
-											{	if (nbindivmatchseg[relat][1]<10) nbindivmatchseg[relat][1]=0; else
-												{	for(int lenght=1;lenght<nbindivmatchseg[relat][1]+1;lenght++) nbsegmentofthislength[lenght]--;
-													nbindivmatchseg[relat][1]=0;
+											// a run in the tree before its SNPs are reached is not counted, as the queries only go up to snp-10.
+											// Each thread owns the open runs of its relatives and only the tree is updated after the word
+											int nbscanned=scanquery ? scannedrelat.size() : 0;
+											int scanthreads=nbscanned/PARALLELSCANRELAT<omp_get_max_threads() ? nbscanned/PARALLELSCANRELAT : omp_get_max_threads();
+											#pragma omp parallel num_threads(scanthreads) if(scanthreads>1)
+											{	std::vector<typematchrun> & threadclosed=closedruns[omp_get_thread_num()];
+												std::vector<int> & threadstarts=addedstarts[omp_get_thread_num()];
+												threadclosed.clear();
+												threadstarts.clear();
+												#pragma omp for schedule(static)
+												for(int scanned=0;scanned<nbscanned;scanned++)
+												{	if (scanned+16<nbscanned)
+														__builtin_prefetch(genomes[chrtemp1]+(unsigned long long) scannedrelat[scanned+16]*nbsnpperchrby4+word*16,0,2);
+													size_t firstclosed=threadclosed.size();
+													scanmatchruns(genomes[chrtemp1]+(unsigned long long) scannedrelat[scanned]*nbsnpperchrby4,nbsnpperchrby4,
+														focalplanes,scanned,snp,scannedend,10,openstart[scanned],threadclosed);
+													for(size_t run=firstclosed;run<threadclosed.size();run++)
+													{	if (countedstart[scanned][threadclosed[run].pairing]!=threadclosed[run].start) threadstarts.push_back(threadclosed[run].start);
+														countedstart[scanned][threadclosed[run].pairing]=-1;
+													};
+													for(int pairing=0;pairing<4;pairing++)
+													{	if (countedstart[scanned][pairing]<0 && openstart[scanned][pairing]+10<scannedend)
+														{	threadstarts.push_back(openstart[scanned][pairing]);
+															countedstart[scanned][pairing]=openstart[scanned][pairing];
+														};
+													};
 												};
+											}
+											for(size_t thread=0;thread<closedruns.size();thread++)
+											{	for(size_t added=0;added<addedstarts[thread].size();added++) fenwickadd(runstarts,nbstart,addedstarts[thread][added],1);
+												for(size_t run=0;run<closedruns[thread].size();run++) endingstart[closedruns[thread][run].end%64].push_back(closedruns[thread][run].start);
+												addedstarts[thread].clear();
+												closedruns[thread].clear();
 											};
-											if ((snpvalue0>>1)==(snpvalue1&1))
-											{	if (nbindivmatchseg[relat][2]<10) nbindivmatchseg[relat][2]++;
-												else nbsegmentofthislength[++nbindivmatchseg[relat][2]]++;
-											} else
-											{	if (nbindivmatchseg[relat][2]<10) nbindivmatchseg[relat][2]=0;
-												else
-												{	for(int lenght=1;lenght<nbindivmatchseg[relat][2]+1;lenght++) nbsegmentofthislength[lenght]--;
-													nbindivmatchseg[relat][2]=0;
-												}
-											};
-											if ((snpvalue0>>1)==(snpvalue1>>1))
-											{	if (nbindivmatchseg[relat][3]<10) nbindivmatchseg[relat][3]++;
-												else nbsegmentofthislength[++nbindivmatchseg[relat][3]]++;
-											} else
-											{	if (nbindivmatchseg[relat][3]<10) nbindivmatchseg[relat][3]=0;
-												else
-												{	for(int lenght=1;lenght<nbindivmatchseg[relat][3]+1;lenght++) nbsegmentofthislength[lenght]--;
-													nbindivmatchseg[relat][3]=0;
+											uint64_t planes[2];
+											haplotypeplanes(genomes[chrtemp1]+(unsigned long long) IDrelattocompare*nbsnpperchrby4,nbsnpperchrby4,word,planes);
+											for(int pairing=0;pairing<4;pairing++) targetmatch[pairing]=targetscanned ? ~(focalplanes[pairing>>1][word]^planes[pairing&1]) : 0;
+										};
+										for(size_t ending=0;ending<endingstart[snp%64].size();ending++) fenwickadd(runstarts,nbstart,endingstart[snp%64][ending],-1);
+										endingstart[snp%64].clear();
+										for(int pairing=0;pairing<4;pairing++) matchlength[pairing]=((targetmatch[pairing]>>(snp%64))&1) ? matchlength[pairing]+1 : 0;
+										if (pbwtquery)
+										{	for(size_t entry=0;entry<excludedlength.size();entry++) excludedlength[entry]=((excludedmatch[entry]>>(snp%64))&1) ? excludedlength[entry]+1 : 0;
+											for(int pairing=0;pairing<4;pairing++)
+											{	segmentcount[pairing]=0;
+												for(int focalhap=0;focalhap<2;focalhap++)
+												{	if (matchlength[pairing]==0)
+													{	interval[pairing][focalhap][0]=0;
+														interval[pairing][focalhap][1]=2*NbIndiv;
+													} else pbwtextend(&pbwt[chrtemp1],snp,(focalplanes[focalhap][snp/64]>>(snp%64))&1,&interval[pairing][focalhap][0],&interval[pairing][focalhap][1]);
+													segmentcount[pairing]+=interval[pairing][focalhap][1]-interval[pairing][focalhap][0];
 												};
+												if (matchlength[pairing]<=10) continue;
+												for(size_t entry=0;entry<excludedlength.size();entry++) if (excludedlength[entry]>=matchlength[pairing]) segmentcount[pairing]--;
 											};
-										};
+										} else if (scanquery) for(int pairing=0;pairing<4;pairing++) segmentcount[pairing]=matchlength[pairing]>10 ? fenwickprefix(runstarts,snp-matchlength[pairing]+1) : 0;
+										else for(int pairing=0;pairing<4;pairing++) segmentcount[pairing]=-1;
 
 										int relat=IDrelattocompare;
-										if (nbindivmatchseg[relat][0]==0) phaseerrorpossible[0]=0;
-										if (nbindivmatchseg[relat][1]==0) phaseerrorpossible[1]=0;
-										if (nbindivmatchseg[relat][2]==0) phaseerrorpossible[2]=0;
-										if (nbindivmatchseg[relat][3]==0) phaseerrorpossible[3]=0;
+										if (matchlength[0]==0) phaseerrorpossible[0]=0;
+										if (matchlength[1]==0) phaseerrorpossible[1]=0;
+										if (matchlength[2]==0) phaseerrorpossible[2]=0;
+										if (matchlength[3]==0) phaseerrorpossible[3]=0;
 
 										int snpvalue1=(*((genomes[chrtemp1]+(unsigned long long) relat*nbsnpperchrby4 )+snpdiv4)>>snpmod4)&3;
 										int lenght;
-										if (nbindivmatchseg[relat][0]>10 &&
-												nbsegmentofthislength[nbindivmatchseg[relat][0]]<(phaseerrorpossible[0]?NbIndiv*ratetoconsidersegPE:NbIndiv*ratetoconsiderseg) &&
-												nbindivmatchseg[relat][0]>nbindivmatchseg[relat][1] &&
-												nbindivmatchseg[relat][0]>nbindivmatchseg[relat][2] &&
-												nbindivmatchseg[relat][0]>nbindivmatchseg[relat][3]
+										int raresegment[4];
+										for(int pairing=0;pairing<4;pairing++)
+										{	if (spectrumquery) raresegment[pairing]=matchlength[pairing]>=rarelength[chrtemp1][(snp*2+phaseerrorpossible[pairing])*2+(snp-matchlength[pairing]+1<purestart[snp])];
+											else raresegment[pairing]=segmentcount[pairing]<(phaseerrorpossible[pairing]?NbIndiv*ratetoconsidersegPE:NbIndiv*ratetoconsiderseg);
+										};
+										if (matchlength[0]>10 &&
+												raresegment[0] &&
+												matchlength[0]>matchlength[1] &&
+												matchlength[0]>matchlength[2] &&
+												matchlength[0]>matchlength[3]
 												)
-										{	printf("chr %d segment type 1 at snp %d of lenght %d as only %d indivs has it\n",chrtemp1,snp,nbindivmatchseg[relat][0], nbsegmentofthislength[nbindivmatchseg[relat][0]]);
-											lenght=nbindivmatchseg[relat][0];
+										{	printsegment(chrtemp1,1,snp,matchlength[0],segmentcount[0]);
+											lenght=matchlength[0];
 											typesegment=1;
-											for(int spnrun=snp-nbindivmatchseg[relat][0];spnrun<snp+1;spnrun++) segwithav[chrtemp1][spnrun]=1;
+											typesegmentevent segment={0,snp-matchlength[0]+1,snp+1,segmentcount[0]};
+											foundsegments.push_back(segment);
+											for(int spnrun=snp-matchlength[0];spnrun<snp+1;spnrun++) segwithav[chrtemp1][spnrun]=1;
 											endlastsegment[0]=snp;
 
-										} else if (nbindivmatchseg[relat][1]>10 && nbsegmentofthislength[nbindivmatchseg[relat][1]]<(phaseerrorpossible[1]?NbIndiv*ratetoconsidersegPE:NbIndiv*ratetoconsiderseg) &&
-													nbindivmatchseg[relat][1]>nbindivmatchseg[relat][2] &&
-													nbindivmatchseg[relat][1]>nbindivmatchseg[relat][3]
+										} else if (matchlength[1]>10 && raresegment[1] &&
+													matchlength[1]>matchlength[2] &&
+													matchlength[1]>matchlength[3]
 												)
-										{	printf("chr %d segment type 3 at snp %d of lenght %d as only %d indivs has it\n",chrtemp1,snp,nbindivmatchseg[relat][1], nbsegmentofthislength[nbindivmatchseg[relat][1]]);
-											lenght=nbindivmatchseg[relat][1];
+										{	printsegment(chrtemp1,3,snp,matchlength[1],segmentcount[1]);
+											lenght=matchlength[1];
 											typesegment=3;
+											typesegmentevent segment={1,snp-matchlength[1]+1,snp+1,segmentcount[1]};
+											foundsegments.push_back(segment);
 											endlastsegment[1]=snp;
-											for(int spnrun=snp-nbindivmatchseg[relat][1];spnrun<snp+1;spnrun++) segwithav[chrtemp1][spnrun]=1;
-										} else if (nbindivmatchseg[relat][2]>10 && nbsegmentofthislength[nbindivmatchseg[relat][2]]<(phaseerrorpossible[2]?NbIndiv*ratetoconsidersegPE:NbIndiv*ratetoconsiderseg) &&
-													nbindivmatchseg[relat][2]>nbindivmatchseg[relat][3]
+											for(int spnrun=snp-matchlength[1];spnrun<snp+1;spnrun++) segwithav[chrtemp1][spnrun]=1;
+										} else if (matchlength[2]>10 && raresegment[2] &&
+													matchlength[2]>matchlength[3]
 												)
-										{	printf("chr %d segment type 2 at snp %d of lenght %d as only %d indivs has it\n",chrtemp1,snp,nbindivmatchseg[relat][2], nbsegmentofthislength[nbindivmatchseg[relat][2]]);
-											lenght=nbindivmatchseg[relat][2];
+										{	printsegment(chrtemp1,2,snp,matchlength[2],segmentcount[2]);
+											lenght=matchlength[2];
 											typesegment=2;
+											typesegmentevent segment={2,snp-matchlength[2]+1,snp+1,segmentcount[2]};
+											foundsegments.push_back(segment);
 											endlastsegment[2]=snp;
-											for(int spnrun=snp-nbindivmatchseg[relat][2];spnrun<snp+1;spnrun++) segwithav[chrtemp1][spnrun]=2;
+											for(int spnrun=snp-matchlength[2];spnrun<snp+1;spnrun++) segwithav[chrtemp1][spnrun]=2;
 
-										} else if (nbindivmatchseg[relat][3]>10 && nbsegmentofthislength[nbindivmatchseg[relat][3]]<(phaseerrorpossible[3]?NbIndiv*ratetoconsidersegPE:NbIndiv*ratetoconsiderseg)
+										} else if (matchlength[3]>10 && raresegment[3]
 												)
-										{	printf("chr %d segment type 4 at snp %d of lenght %d as only %d indivs has it\n",chrtemp1,snp,nbindivmatchseg[relat][3], nbsegmentofthislength[nbindivmatchseg[relat][3]]);
-											lenght=nbindivmatchseg[relat][3];
+										{	printsegment(chrtemp1,4,snp,matchlength[3],segmentcount[3]);
+											lenght=matchlength[3];
 											typesegment=4;
+											typesegmentevent segment={3,snp-matchlength[3]+1,snp+1,segmentcount[3]};
+											foundsegments.push_back(segment);
 											endlastsegment[3]=snp;
-											for(int spnrun=snp-nbindivmatchseg[relat][3];spnrun<snp+1;spnrun++) segwithav[chrtemp1][spnrun]=2;
+											for(int spnrun=snp-matchlength[3];spnrun<snp+1;spnrun++) segwithav[chrtemp1][spnrun]=2;
 										};
 										if (endlastsegment[0]==snp-1 || endlastsegment[1]==snp-1 || endlastsegment[2]==snp-1 || endlastsegment[3]==snp-1)
 										{	if ((snpvalue1&1)!=(snpvalue1>>1))
@@ -903,6 +2176,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 											if (typesegment==3) end=endlastsegment[1];
 											if (typesegment==4) end=endlastsegment[3];
 											printf("change from %d to %d\n",(end+snp-lenght)/2,nbsnpperchrinfile[chrtemp1]);
+											typesegmentevent change={-1,snp-lenght,end,0};
+											foundsegments.push_back(change);
 
 											for(int snprun=(snp-lenght);snprun<nbsnpperchrinfile[chrtemp1];snprun++)
 											{
@@ -915,20 +2190,43 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 
 											typesegment=-1;
 
-											for(int64_t relat=0;relat<(int64_t) NbIndiv;relat++) if (pihatagainstall[relat]<seuilpihat[0] )
-											{	nbindivmatchseg[relat][0]=0;
-												nbindivmatchseg[relat][1]=0;
-												nbindivmatchseg[relat][2]=0;
-												nbindivmatchseg[relat][3]=0;
+											// every run starts again after this SNP against the corrected focal
+											for(int word=0;word<nbwords;word++)
+											{	focalplanes[0][word]=0;
+												focalplanes[1][word]=0;
+											};
+											for(int snprun=0;snprun<nbsnpperchrinfile[chrtemp1];snprun++)
+											{	focalplanes[0][snprun/64]|=(uint64_t) (genomeoffpss[0][snprun][chrtemp1]&1)<<(snprun%64);
+												focalplanes[1][snprun/64]|=(uint64_t) (genomeoffpss[0][snprun][chrtemp1]>>1)<<(snprun%64);
+											};
+											for(size_t scanned=0;scanned<scannedrelat.size();scanned++)
+											{	for(int pairing=0;pairing<4;pairing++)
+												{	openstart[scanned][pairing]=snp+1;
+													countedstart[scanned][pairing]=-1;
+												};
 											};
-											for(int snprun=0;snprun<nbsnpperchr[chrtemp1];snprun++)
-											{	nbsegmentofthislength[snprun]=0;
+											for(int bit=0;bit<64;bit++) endingstart[bit].clear();
+											memset(runstarts,0,sizeof(int)*(nbstart+1));
+											scannedend=snp+1;
+											for(int pairing=0;pairing<4;pairing++) matchlength[pairing]=0;
+											for(int pairing=0;pairing<4;pairing++) for(int focalhap=0;focalhap<2;focalhap++)
+											{	interval[pairing][focalhap][0]=0;
+												interval[pairing][focalhap][1]=2*NbIndiv;
 											};
+											for(size_t entry=0;entry<excludedlength.size();entry++) excludedlength[entry]=0;
+											if (spectrumquery) focalpurestarts(chrtemp1,ID,purestart);
 
 										} else if (typesegment>-1)
 										{	lasttypesegment=typesegment;
 										};
 									};
+									free(focalplanes[0]);
+									free(focalplanes[1]);
+									free(openstart);
+									free(countedstart);
+									free(runstarts);
+									free(purestart);
+									if (usesegmentdb) storesegments(ID,IDrelattocompare,chrtemp1,focalstate,relatstate,excludedstate,foundsegments);
 								};
 							};
 						};
@@ -1144,51 +2442,61 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 									tabnbphasewrong[chrtemp1][chrdividerrun]=nbphasewrong;
 								};
 							}
-							double pihatagainstallchrMP[MAXPOP][2]={0};
+							static double (*pihatagainstallchrMP)[2]=NULL;
+							if (pihatagainstallchrMP==NULL) pihatagainstallchrMP=(double (*)[2]) allocatelargebuffer((unsigned long long) NbIndiv*2*sizeof(double));
 							 #pragma omp parallel for
-							for(int relat=0;relat<MAXPOP;relat++)
+							for(int relat=0;relat<NbIndiv;relat++)
 							{	pihatagainstallchrMP[relat][0]=0;
 								pihatagainstallchrMP[relat][1]=0;
 							}
 
 							int sizebin=450;
 
+							// a row holds the dividers of the chromosome with the most of them, not 200 entries, so that clearing the
+							// rows of a focal only touches what is used
+							int neededstride=4;
+							for(int chrtemp1=0;chrtemp1<23;chrtemp1++) if (nbchrdivider[breaknubercm][chrtemp1]*4>neededstride) neededstride=nbchrdivider[breaknubercm][chrtemp1]*4;
+							if (neededstride>phaseerrorstride)
+							{	if (pihatagainstallchrMPphaseerror!=NULL) releaselargebuffer((unsigned char *) pihatagainstallchrMPphaseerror,(unsigned long long) 23*NbIndiv*phaseerrorstride*2*sizeof(double));
+								phaseerrorstride=neededstride;
+								pihatagainstallchrMPphaseerror=(double (*)[2]) allocatelargebuffer((unsigned long long) 23*NbIndiv*phaseerrorstride*2*sizeof(double));
+							};
 							#pragma omp parallel for
-							for(int relat=0;relat<MAXPOP;relat++)
-							{	pihatagainstallchrMPphaseerror[0][relat][0][0]=0;
-								pihatagainstallchrMPphaseerror[0][relat][0][1]=0;
+							for(int relat=0;relat<NbIndiv;relat++)
+							{	pihatagainstallchrMPphaseerror[((unsigned long long) 0*NbIndiv+relat)*phaseerrorstride+0][0]=0;
+								pihatagainstallchrMPphaseerror[((unsigned long long) 0*NbIndiv+relat)*phaseerrorstride+0][1]=0;
 								for(int chrdividerrun=0;chrdividerrun<nbchrdivider[breaknubercm][0]*4;chrdividerrun++)
-								{	pihatagainstallchrMPphaseerror[0][relat][chrdividerrun][0]=0;
-									pihatagainstallchrMPphaseerror[0][relat][chrdividerrun][1]=0;
+								{	pihatagainstallchrMPphaseerror[((unsigned long long) 0*NbIndiv+relat)*phaseerrorstride+chrdividerrun][0]=0;
+									pihatagainstallchrMPphaseerror[((unsigned long long) 0*NbIndiv+relat)*phaseerrorstride+chrdividerrun][1]=0;
 								};
 							}
 							int hetsnp=0;
 							double exponentinterchr=1;
-							for(int relat=0;relat<MAXPOP;relat++)
+							for(int relat=0;relat<NbIndiv;relat++)
 							{
 							}
-							for(int relat=0;relat<MAXPOP;relat++)
+							for(int relat=0;relat<NbIndiv;relat++)
 							{	if (pihatagainstall[relat]>0)  printf("PIHAT %d %f %f\n",relat,pihatagainstall[relat],seuilpihat[0]);
 							}
 							float firstexponent=2;
-							int powersnppihat=3;
 
 							for(int  chrtemp1=1;chrtemp1<23;chrtemp1++)
 							{
 								{	hetsnp=0;
 
 									#pragma omp parallel for
-									for(int relat=0;relat<MAXPOP;relat++)
+									for(int relat=0;relat<NbIndiv;relat++)
 									{	for(int chrdividerrun=0;chrdividerrun<nbchrdivider[breaknubercm][chrtemp1]*4;chrdividerrun++)
-										{	pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun][0]=0;
-											pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun][1]=0;
+										{	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun][0]=0;
+											pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun][1]=0;
 										};
 
 									};
 
 									for(int chrdividerrun=0;chrdividerrun<nbchrdivider[breaknubercm][chrtemp1];chrdividerrun++)
-									{	double temp[MAXPOP][4];
-										for(int64_t relat=0;relat<(int64_t) MAXPOP;relat++)
+									{	static double (*temp)[4]=NULL;
+										if (temp==NULL) temp=(double (*)[4]) allocatelargebuffer((unsigned long long) NbIndiv*4*sizeof(double));
+										for(int64_t relat=0;relat<(int64_t) NbIndiv;relat++)
 										{	temp[relat][0]=0;
 											temp[relat][1]=0;
 											temp[relat][2]=0;
@@ -1204,14 +2512,14 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 												int parent0indiv0=(phaseguesedparent1tap[chrtemp1][snp]==1)?(snpvalue0>>1):(snpvalue0&1);
 												int parent1indiv0=(phaseguesedparent1tap[chrtemp1][snp]==1)?(snpvalue0&1):(snpvalue0>>1);
 
-												double pcontribu10=((parent0indiv0)-1.0*maffloat);
-												double pcontribu11=((parent1indiv0)-1.0*maffloat);
 												double maffloatdiviseur=(maffloat)*(2-maffloat*2)/3*2;
+												// the four roots come from the cohort table of this SNP
+												double * cohortterms=cohortpconttab[chrtemp1]+snp*4;
 												double pconttab[4][2];
-												pconttab[0][0]=pow(((0)-maffloat)/maffloatdiviseur*pcontribu10,1.0/powersnppihat);
-												pconttab[0][1]=pow(((0)-maffloat)/maffloatdiviseur*pcontribu11,1.0/powersnppihat);
-												pconttab[1][0]=pow(((1)-maffloat)/maffloatdiviseur*pcontribu10,1.0/powersnppihat);
-												pconttab[1][1]=pow(((1)-maffloat)/maffloatdiviseur*pcontribu11,1.0/powersnppihat);
+												pconttab[0][0]=cohortterms[parent0indiv0];
+												pconttab[0][1]=cohortterms[parent1indiv0];
+												pconttab[1][0]=cohortterms[2+parent0indiv0];
+												pconttab[1][1]=cohortterms[2+parent1indiv0];
 												int nbsnpperchrby4=(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0));
 												int snpmod4=(((snp%4)*2));
 												int snpdiv4=snp/4;
@@ -1224,33 +2532,33 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 														if (pconttab[snpvalue1&1][0]>0) temp[relat][0]=temp[relat][0]+(pconttab[snpvalue1&1][0]);
 														else temp[relat][0]=0;
 														if (temp[relat][0]<0) temp[relat][0]=0;
-														else if (pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][0]<temp[relat][0])
+														else if (pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][0]<temp[relat][0])
 														{
-															pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][0]=temp[relat][0];
+															pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][0]=temp[relat][0];
 														}
 
 														if (pconttab[snpvalue1>>1][0]>0) temp[relat][1]=temp[relat][1]+(pconttab[snpvalue1>>1][0]);
 														else temp[relat][1]=0;
 														if (temp[relat][1]<0) temp[relat][1]=0;
-														else if (pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+1][0]<temp[relat][1])
+														else if (pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+1][0]<temp[relat][1])
 														{
-															pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+1][0]=temp[relat][1];
+															pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+1][0]=temp[relat][1];
 														};
 
 														if (pconttab[snpvalue1&1][1]>0) temp[relat][2]=temp[relat][2]+(pconttab[snpvalue1&1][1]);
 														else temp[relat][2]=0;
 														if (temp[relat][2]<0) temp[relat][2]=0;
-														else if (pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][0]<temp[relat][2])
+														else if (pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][0]<temp[relat][2])
 														{
-															pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][0]=temp[relat][2];
+															pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][0]=temp[relat][2];
 														}
 
 														if (pconttab[snpvalue1>>1][1]>0) temp[relat][3]=temp[relat][3]+(pconttab[snpvalue1>>1][1]);
 														else temp[relat][3]=0;
 														if (temp[relat][3]<0) temp[relat][3]=0;
-														else if (pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+3][0]<temp[relat][3])
+														else if (pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+3][0]<temp[relat][3])
 														{
-															pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+3][0]=temp[relat][3];
+															pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+3][0]=temp[relat][3];
 														};
 													} else
 													{	printf("%d %f %f\n",relat,pihatagainstall[relat],pihatagainstall2[relat]);
@@ -1258,33 +2566,33 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 												};
 											};
 										}; printf("%d %d %d %f %f \n",chrtemp1,0,chrdividerrun,
-																	pihatagainstallchrMPphaseerror[chrtemp1][0][chrdividerrun*4][0],
-																	pihatagainstallchrMPphaseerror[chrtemp1][0][chrdividerrun*4+2][0]);
+																	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+0)*phaseerrorstride+chrdividerrun*4][0],
+																	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+0)*phaseerrorstride+chrdividerrun*4+2][0]);
 										printf("%d %d %d %f %f \n",chrtemp1,0,chrdividerrun,
-																	pihatagainstallchrMPphaseerror[chrtemp1][1][chrdividerrun*4][0],
-																	pihatagainstallchrMPphaseerror[chrtemp1][1][chrdividerrun*4+2][0]);
+																	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+1)*phaseerrorstride+chrdividerrun*4][0],
+																	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+1)*phaseerrorstride+chrdividerrun*4+2][0]);
 										#pragma omp parallel for
 										for(int relat=0;relat<NbIndiv;relat++)
 										{	if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011 )
 											{	int value=0;
 
-												{	pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][value]=
-																					(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][value]>pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+1][value]?
-																													pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][value]:
-																													pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+1][value]);
-													pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][value]=
-																					(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][value]>pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+3][value]?
-																													pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][value]:
-																													pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+3][value]);
+												{	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][value]=
+																					(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][value]>pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+1][value]?
+																													pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][value]:
+																													pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+1][value]);
+													pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][value]=
+																					(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][value]>pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+3][value]?
+																													pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][value]:
+																													pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+3][value]);
 												};
 											};
 										};
 										printf("%d %d %d %f %f \n",chrtemp1,0,chrdividerrun,
-																	pihatagainstallchrMPphaseerror[chrtemp1][0][chrdividerrun*4][0],
-																	pihatagainstallchrMPphaseerror[chrtemp1][0][chrdividerrun*4+2][0]);
+																	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+0)*phaseerrorstride+chrdividerrun*4][0],
+																	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+0)*phaseerrorstride+chrdividerrun*4+2][0]);
 										printf("%d %d %d %f %f \n",chrtemp1,0,chrdividerrun,
-																	pihatagainstallchrMPphaseerror[chrtemp1][1][chrdividerrun*4][0],
-																	pihatagainstallchrMPphaseerror[chrtemp1][1][chrdividerrun*4+2][0]);
+																	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+1)*phaseerrorstride+chrdividerrun*4][0],
+																	pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+1)*phaseerrorstride+chrdividerrun*4+2][0]);
 									};
 								};
 							};
@@ -1305,18 +2613,18 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 										sumall[chrtemp1][chrdividerrun][1][value]=0;
 										sumallsquare[chrtemp1][chrdividerrun][0][value]=0;
 										sumallsquare[chrtemp1][chrdividerrun][1][value]=0;
-										for(int relat=0;relat<MAXPOP;relat++)
+										for(int relat=0;relat<NbIndiv;relat++)
 											if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011  )
 										{	sumall[chrtemp1][chrdividerrun][0][value]=sumall[chrtemp1][chrdividerrun][0][value]+
-												pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][value]),firstexponent)*
-													(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][value]>0?1:-1);
+												pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][value]),firstexponent)*
+													(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][value]>0?1:-1);
 											sumall[chrtemp1][chrdividerrun][1][value]=sumall[chrtemp1][chrdividerrun][1][value]+
-												pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][value]),firstexponent)*
-													(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][value]>0?1:-1);
+												pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][value]),firstexponent)*
+													(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][value]>0?1:-1);
 											sumallsquare[chrtemp1][chrdividerrun][0][value]=sumallsquare[chrtemp1][chrdividerrun][0][value]+
-												pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][value]),firstexponent*2);
+												pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][value]),firstexponent*2);
 											sumallsquare[chrtemp1][chrdividerrun][1][value]=sumallsquare[chrtemp1][chrdividerrun][1][value]+
-												pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][value]),firstexponent*2);
+												pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][value]),firstexponent*2);
 										};
 									};
 								};
@@ -1349,8 +2657,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 								{	for(int chrdividerrun=0;chrdividerrun<nbchrdivider[breaknubercm][chrtemp1];chrdividerrun++)
 									{
 										double thresholdseg=seuil1*(chrdivider[breaknubercm][chrtemp1][chrdividerrun].end-chrdivider[breaknubercm][chrtemp1][chrdividerrun].start);
-										if (pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][0]>thresholdseg || pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][0]>thresholdseg)
-										{	if (pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][0]<thresholdseg || pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][0]<thresholdseg)
+										if (pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][0]>thresholdseg || pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][0]>thresholdseg)
+										{	if (pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][0]<thresholdseg || pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][0]<thresholdseg)
 											{	countseg[chrtemp1][chrdividerrun]++;
 
 											};
@@ -1373,8 +2681,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 												if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011  )
 											{	nbelem++;
 												sumproduct=sumproduct+
-															pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][0]),firstexponent)*
-															pow(fabs(pihatagainstallchrMPphaseerror[chrtemp2][relat][chrdividerrun2*4][0]),firstexponent);
+															pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][0]),firstexponent)*
+															pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp2*NbIndiv+relat)*phaseerrorstride+chrdividerrun2*4][0]),firstexponent);
 											};
 											double  cor1=(((nbelem)*sumproduct-sumall[chrtemp1][chrdividerrun][0][0]*sumall[chrtemp2][chrdividerrun2][0][0])/
 														sqrt(((nbelem)*sumallsquare[chrtemp1][chrdividerrun][0][0]-sumall[chrtemp1][chrdividerrun][0][0]*sumall[chrtemp1][chrdividerrun][0][0])*
@@ -1386,8 +2694,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 											for(int relat=0;relat<NbIndiv;relat++)
 												if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011  )
 											{	nbelem++;
-												sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][0]),firstexponent)*
-																	  pow(fabs(pihatagainstallchrMPphaseerror[chrtemp2][relat][chrdividerrun2*4+2][0]),firstexponent);
+												sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][0]),firstexponent)*
+																	  pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp2*NbIndiv+relat)*phaseerrorstride+chrdividerrun2*4+2][0]),firstexponent);
 											};
 											double  cor2=(((nbelem)*sumproduct-sumall[chrtemp1][chrdividerrun][0][0]*sumall[chrtemp2][chrdividerrun2][1][0])/
 														sqrt(((nbelem)*sumallsquare[chrtemp1][chrdividerrun][0][0]-sumall[chrtemp1][chrdividerrun][0][0]*sumall[chrtemp1][chrdividerrun][0][0])*
@@ -1398,8 +2706,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 											for(int relat=0;relat<NbIndiv;relat++)
 												if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011  )
 											{	nbelem++;
-												sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][0]),firstexponent)*
-																	  pow(fabs(pihatagainstallchrMPphaseerror[chrtemp2][relat][chrdividerrun2*4+2][0]),firstexponent);
+												sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][0]),firstexponent)*
+																	  pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp2*NbIndiv+relat)*phaseerrorstride+chrdividerrun2*4+2][0]),firstexponent);
 											};
 											double  cor3=(((nbelem)*sumproduct-sumall[chrtemp1][chrdividerrun][1][0]*sumall[chrtemp2][chrdividerrun2][1][0])/
 														sqrt(((nbelem)*sumallsquare[chrtemp1][chrdividerrun][1][0]-sumall[chrtemp1][chrdividerrun][1][0]*sumall[chrtemp1][chrdividerrun][1][0])*
@@ -1410,8 +2718,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 											for(int relat=0;relat<NbIndiv;relat++)
 												if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011 )
 											{	nbelem++;
-												sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][0]),firstexponent)*
-																	  pow(fabs(pihatagainstallchrMPphaseerror[chrtemp2][relat][chrdividerrun2*4][0]),firstexponent);
+												sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][0]),firstexponent)*
+																	  pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp2*NbIndiv+relat)*phaseerrorstride+chrdividerrun2*4][0]),firstexponent);
 											};
 											double  cor4=(((nbelem)*sumproduct-sumall[chrtemp1][chrdividerrun][1][0]*sumall[chrtemp2][chrdividerrun2][0][0])/
 														sqrt(((nbelem)*sumallsquare[chrtemp1][chrdividerrun][1][0]-sumall[chrtemp1][chrdividerrun][1][0]*sumall[chrtemp1][chrdividerrun][1][0])*
@@ -1503,13 +2811,13 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 									{
 
 										for(int value=0;value<2;value++)
-										{	double p1=pow(fabs(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]>0?1:-1);
-											double p2=pow(fabs(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]>0?1:-1);
-											double p3=pow(fabs(pihatagainstallchrMPphaseerror[chrmax2][relat][dividmax2*4][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[chrmax2][relat][dividmax2*4][value]>0?1:-1);
-											double p4=pow(fabs(pihatagainstallchrMPphaseerror[chrmax2][relat][dividmax2*4+2][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[chrmax2][relat][dividmax2*4+2][value]>0?1:-1);
+										{	double p1=pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]>0?1:-1);
+											double p2=pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]>0?1:-1);
+											double p3=pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax2*NbIndiv+relat)*phaseerrorstride+dividmax2*4][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax2*NbIndiv+relat)*phaseerrorstride+dividmax2*4][value]>0?1:-1);
+											double p4=pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax2*NbIndiv+relat)*phaseerrorstride+dividmax2*4+2][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax2*NbIndiv+relat)*phaseerrorstride+dividmax2*4+2][value]>0?1:-1);
 
-											pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]=pow(fabs(p1+p3),1.0/mergingexponent[value])*(p1+p3>0?1:-1);
-											pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]=pow(fabs(p2+p4),1.0/mergingexponent[value])*(p2+p4>0?1:-1);
+											pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]=pow(fabs(p1+p3),1.0/mergingexponent[value])*(p1+p3>0?1:-1);
+											pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]=pow(fabs(p2+p4),1.0/mergingexponent[value])*(p2+p4>0?1:-1);
 
 										};
 									}
@@ -1537,12 +2845,12 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 									{	for(int value=0;value<2;value++)
 										{
 
-											double p1=pow(fabs(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]>0?1:-1);
-											double p2=pow(fabs(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]>0?1:-1);
-											double p3=pow(fabs(pihatagainstallchrMPphaseerror[chrmax2][relat][dividmax2*4][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[chrmax2][relat][dividmax2*4][value]>0?1:-1);
-											double p4=pow(fabs(pihatagainstallchrMPphaseerror[chrmax2][relat][dividmax2*4+2][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[chrmax2][relat][dividmax2*4+2][value]>0?1:-1);
-											pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]=pow(fabs(p1+p4),1.0/mergingexponent[value])*(p1+p4>0?1:-1);
-											pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]=pow(fabs(p2+p3),1.0/mergingexponent[value])*(p2+p3>0?1:-1);
+											double p1=pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]>0?1:-1);
+											double p2=pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]>0?1:-1);
+											double p3=pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax2*NbIndiv+relat)*phaseerrorstride+dividmax2*4][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax2*NbIndiv+relat)*phaseerrorstride+dividmax2*4][value]>0?1:-1);
+											double p4=pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax2*NbIndiv+relat)*phaseerrorstride+dividmax2*4+2][value]),mergingexponent[value])*(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax2*NbIndiv+relat)*phaseerrorstride+dividmax2*4+2][value]>0?1:-1);
+											pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]=pow(fabs(p1+p4),1.0/mergingexponent[value])*(p1+p4>0?1:-1);
+											pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]=pow(fabs(p2+p3),1.0/mergingexponent[value])*(p2+p3>0?1:-1);
 
 										};
 									};
@@ -1559,13 +2867,13 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 									if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011 )
 								{	for(int value=0;value<2;value++)
 									{	sumall[chrmax1][dividmax1][0][value]=sumall[chrmax1][dividmax1][0][value]+
-											pow(fabs(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]),firstexponent*(0.3+0.7))*
-												(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]>0?1:-1);
+											pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]),firstexponent*(0.3+0.7))*
+												(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]>0?1:-1);
 										sumall[chrmax1][dividmax1][1][value]=sumall[chrmax1][dividmax1][1][value]+
-											pow(fabs(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]),firstexponent*(0.3+0.7))*
-											(pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]>0?1:-1);
-										sumallsquare[chrmax1][dividmax1][0][value]=sumallsquare[chrmax1][dividmax1][0][value]+ pow((pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4][value]),firstexponent*2);
-										sumallsquare[chrmax1][dividmax1][1][value]=sumallsquare[chrmax1][dividmax1][1][value]+ pow((pihatagainstallchrMPphaseerror[chrmax1][relat][dividmax1*4+2][value]),firstexponent*2);
+											pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]),firstexponent*(0.3+0.7))*
+											(pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]>0?1:-1);
+										sumallsquare[chrmax1][dividmax1][0][value]=sumallsquare[chrmax1][dividmax1][0][value]+ pow((pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4][value]),firstexponent*2);
+										sumallsquare[chrmax1][dividmax1][1][value]=sumallsquare[chrmax1][dividmax1][1][value]+ pow((pihatagainstallchrMPphaseerror[((unsigned long long) chrmax1*NbIndiv+relat)*phaseerrorstride+dividmax1*4+2][value]),firstexponent*2);
 
 									};
 								};
@@ -1584,8 +2892,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 											if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011  )
 										{	nbelem++;
 											sumproduct=sumproduct+
-														pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][0]),firstexponent)*
-														pow(fabs(pihatagainstallchrMPphaseerror[chrtemp2][relat][chrdividerrun2*4][0]),firstexponent);
+														pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][0]),firstexponent)*
+														pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp2*NbIndiv+relat)*phaseerrorstride+chrdividerrun2*4][0]),firstexponent);
 										};
 										double  cor1=(((nbelem)*sumproduct-sumall[chrtemp1][chrdividerrun][0][0]*sumall[chrtemp2][chrdividerrun2][0][0])/
 													sqrt(((nbelem)*sumallsquare[chrtemp1][chrdividerrun][0][0]-sumall[chrtemp1][chrdividerrun][0][0]*sumall[chrtemp1][chrdividerrun][0][0])*
@@ -1597,8 +2905,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 										for(int relat=0;relat<NbIndiv;relat++)
 											if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011  )
 										{	nbelem++;
-											sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4][0]),firstexponent*(0.3+0.7))*
-																  pow(fabs(pihatagainstallchrMPphaseerror[chrtemp2][relat][chrdividerrun2*4+2][0]),firstexponent*(0.3+0.7));
+											sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4][0]),firstexponent*(0.3+0.7))*
+																  pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp2*NbIndiv+relat)*phaseerrorstride+chrdividerrun2*4+2][0]),firstexponent*(0.3+0.7));
 										};
 										double  cor2=(((nbelem)*sumproduct-sumall[chrtemp1][chrdividerrun][0][0]*sumall[chrtemp2][chrdividerrun2][1][0])/
 													sqrt(((nbelem)*sumallsquare[chrtemp1][chrdividerrun][0][0]-sumall[chrtemp1][chrdividerrun][0][0]*sumall[chrtemp1][chrdividerrun][0][0])*
@@ -1610,8 +2918,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 										for(int relat=0;relat<NbIndiv;relat++)
 											if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011  )
 										{	nbelem++;
-											sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][0]),firstexponent*(0.3+0.7))*
-																  pow(fabs(pihatagainstallchrMPphaseerror[chrtemp2][relat][chrdividerrun2*4+2][0]),firstexponent*(0.3+0.7));
+											sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][0]),firstexponent*(0.3+0.7))*
+																  pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp2*NbIndiv+relat)*phaseerrorstride+chrdividerrun2*4+2][0]),firstexponent*(0.3+0.7));
 										};
 										double  cor3=(((nbelem)*sumproduct-sumall[chrtemp1][chrdividerrun][1][0]*sumall[chrtemp2][chrdividerrun2][1][0])/
 													sqrt(((nbelem)*sumallsquare[chrtemp1][chrdividerrun][1][0]-sumall[chrtemp1][chrdividerrun][1][0]*sumall[chrtemp1][chrdividerrun][1][0])*
@@ -1624,8 +2932,8 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 										for(int relat=0;relat<NbIndiv;relat++)
 											if (pihatagainstall[relat]<seuilpihat[0] && pihatagainstall2[relat]<0.011  )
 										{	nbelem++;
-											sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[chrtemp1][relat][chrdividerrun*4+2][0]),firstexponent*(0.3+0.7))*
-																  pow(fabs(pihatagainstallchrMPphaseerror[chrtemp2][relat][chrdividerrun2*4][0]),firstexponent*(0.3+0.7));
+											sumproduct=sumproduct+pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp1*NbIndiv+relat)*phaseerrorstride+chrdividerrun*4+2][0]),firstexponent*(0.3+0.7))*
+																  pow(fabs(pihatagainstallchrMPphaseerror[((unsigned long long) chrtemp2*NbIndiv+relat)*phaseerrorstride+chrdividerrun2*4][0]),firstexponent*(0.3+0.7));
 										};
 										double  cor4=(((nbelem)*sumproduct-sumall[chrtemp1][chrdividerrun][1][0]*sumall[chrtemp2][chrdividerrun2][0][0])/
 													sqrt(((nbelem)*sumallsquare[chrtemp1][chrdividerrun][1][0]-sumall[chrtemp1][chrdividerrun][1][0]*sumall[chrtemp1][chrdividerrun][1][0])*
@@ -1738,17 +3046,11 @@ int compareressultindivallcombinV15D4(int ID,int chr1, int chr2,int numtrio,floa
 									{	if ((phaseknown+3)/2==2)
 										{	if (genomeoffpss[0][snp][chrtemp1]==1)
 											{	genomeoffpss[0][snp][chrtemp1]=2;
-												*( genomes[chrtemp1]+(unsigned long long) (((((unsigned long long) ID+NBINDIV)*(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0)) )+snp/4)))=
-													(*( genomes[chrtemp1]+(unsigned long long) (((((unsigned long long) ID+NBINDIV)*(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0)) )+snp/4))) &
-														(~(3<<((snp%4)*2))))
-															|	((2)<<((snp%4)*2));
+												*(phasedrow(chrtemp1,ID)+snp/4)=(*(phasedrow(chrtemp1,ID)+snp/4) & (~(3<<((snp%4)*2)))) | ((2)<<((snp%4)*2));
 											}
 											else if (genomeoffpss[0][snp][chrtemp1]==2)
 											{	genomeoffpss[0][snp][chrtemp1]=1;
-												*( genomes[chrtemp1]+(unsigned long long) (((((unsigned long long) ID+NBINDIV)*(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0)) )+snp/4)))=
-													(*( genomes[chrtemp1]+(unsigned long long) (((((unsigned long long) ID+NBINDIV)*(nbsnpperchr[chrtemp1]/4+((nbsnpperchr[chrtemp1]%4)>0)) )+snp/4))) &
-														(~(3<<((snp%4)*2))))
-															|	((1)<<((snp%4)*2));
+												*(phasedrow(chrtemp1,ID)+snp/4)=(*(phasedrow(chrtemp1,ID)+snp/4) & (~(3<<((snp%4)*2)))) | ((1)<<((snp%4)*2));
 											};
 										};
 										if ((phaseknown+3)/2==phaseparent1tap[chrtemp1][snp])
@@ -1835,6 +3137,13 @@ int readListIndiv(const char* filename)
 	return 0;
 }
 
+int outputgenotype(int chr,int person,int snp)
+{	// individuals that were not phased keep their input genotypes
+	if (phasedrowofindiv!=NULL && phasedrowofindiv[person]>=0 && phasedcommitted[phasedrowofindiv[person]])
+		return (*(phasedrow(chr,person)+snp/4)>>((snp%4)*2))&3;
+	return (*((genomes[chr]+(unsigned long long) person*(nbsnpperchr[chr]/4+((nbsnpperchr[chr]%4)>0)) )+snp/4)>>(((snp%4)*2)))&3;
+}
+
 int writeoutput(int chr, char pathoutput[] )
 {	FILE *fp;
     char filename[200];
@@ -1859,8 +3168,7 @@ int writeoutput(int chr, char pathoutput[] )
 			person = listIndivToProcess[i];
 			fprintf(fp,	"%d %d 0 0 -9 0 ",person,person);
 			for(int snp=0;snp<nbsnpperchrinfile[chr];snp++)
-			{	int geno=(*((genomes[chr]+(unsigned long long) person*(nbsnpperchr[chr]/4+((nbsnpperchr[chr]%4)>0)) )+snp/4)>>(((snp%4)*2)))&3;
-				geno=rand()%4;
+			{	int geno=outputgenotype(chr,person,snp);
 				fprintf(fp, "%d %d ", geno%2, geno/2);
 			};
 			fprintf(fp,"\n");
@@ -1872,8 +3180,7 @@ int writeoutput(int chr, char pathoutput[] )
 		for(person=0;person<NbIndiv;person++)
 		{	fprintf(fp,	"%d %d 0 0 -9 0 ",person,person);
 			for(int snp=0;snp<nbsnpperchrinfile[chr];snp++)
-			{	int geno=(*((genomes[chr]+(unsigned long long) person*(nbsnpperchr[chr]/4+((nbsnpperchr[chr]%4)>0)) )+snp/4)>>(((snp%4)*2)))&3;
-				geno=rand()%4;
+			{	int geno=outputgenotype(chr,person,snp);
 				fprintf(fp, "%d %d ", geno%2, geno/2);
 			};
 			fprintf(fp,"\n");
@@ -1890,6 +3197,8 @@ int main(int argc, char *argv[])
 	char PathInput[200];
 	char PathOutput[200];
 	char PathListIndiv[200] = "";
+	char PathPBWTCache[200] = "";
+	char PathSegmentDB[200] = "";
 	
 	for(int input=1;input<argc;input++)
 	{
@@ -1897,6 +3206,20 @@ int main(int argc, char *argv[])
 		else if( strncmp(argv[input], "-PathInput", strlen("-PathInput")) == 0 && input < argc-1) strcpy(PathInput,argv[++input]);
 		else if( strncmp(argv[input], "-PathOutput", strlen("-PathOutput")) == 0 && input < argc-1) strcpy(PathOutput,argv[++input]);
 		else if( strncmp(argv[input], "-ListIndiv", strlen("-ListIndiv")) == 0 && input < argc-1) strcpy(PathListIndiv,argv[++input]);
+		else if( strncmp(argv[input], "-PinThreads", strlen("-PinThreads")) == 0 && input < argc-1) pinthreads=atoi(argv[++input]);
+		else if( strncmp(argv[input], "-HugePages", strlen("-HugePages")) == 0 && input < argc-1)
+		{	hugepages=parsehugepages(argv[++input]);
+			if (hugepages<0)
+			{	printf("ERROR: Unknown huge page mode %s (expected none, thp or hugetlb)\n",argv[input]);
+				exit(0);
+			};
+		}
+		else if( strncmp(argv[input], "-TopRelatives", strlen("-TopRelatives")) == 0 && input < argc-1) toprelatives=atoi(argv[++input]);
+		else if( strncmp(argv[input], "-PBWTCache", strlen("-PBWTCache")) == 0 && input < argc-1) strcpy(PathPBWTCache,argv[++input]);
+		else if( strncmp(argv[input], "-PBWT", strlen("-PBWT")) == 0 && input < argc-1) usepbwt=atoi(argv[++input]);
+		else if( strncmp(argv[input], "-RareSpectrum", strlen("-RareSpectrum")) == 0 && input < argc-1) userarespectrum=atoi(argv[++input]);
+		else if( strncmp(argv[input], "-SegmentDBReverse", strlen("-SegmentDBReverse")) == 0 && input < argc-1) segmentdbreverse=atoi(argv[++input]);
+		else if( strncmp(argv[input], "-SegmentDB", strlen("-SegmentDB")) == 0 && input < argc-1) strcpy(PathSegmentDB,argv[++input]);
 	};
 	if (NbIndiv==0)
 	{	printf("ERROR: Number of indivudals is zero or undefined\n");
@@ -1907,6 +3230,26 @@ int main(int argc, char *argv[])
 	{	printf("ERROR: Number of indivudals is higher than %d\n",NBINDIVMAX);
 		exit(0);
 	}
+	if (toprelatives<1)
+	{	printf("ERROR: -TopRelatives must be at least 1\n");
+		exit(0);
+	}
+	if (userarespectrum && !usepbwt)
+	{	printf("ERROR: -RareSpectrum is built from the PBWT and needs -PBWT 1\n");
+		exit(0);
+	}
+	if (strlen(PathPBWTCache)>0 && !usepbwt)
+	{	printf("ERROR: -PBWTCache holds the PBWT and needs -PBWT 1\n");
+		exit(0);
+	}
+	if (segmentdbreverse && strlen(PathSegmentDB)==0)
+	{	printf("ERROR: -SegmentDBReverse replays records of the segment database and needs -SegmentDB\n");
+		exit(0);
+	}
+	pihatagainstall=(float *) calloc(NbIndiv,sizeof(float));
+	pihatagainstall2=(float *) calloc(NbIndiv,sizeof(float));
+	bestpihatagainstall=(float *) calloc(toprelatives,sizeof(float));
+	bestpihatagainstallID=(int *) calloc(toprelatives,sizeof(int));
 
 	nbsnpperchr[0]=330005;
 	nbsnpperchr[1]=26229;
@@ -1938,12 +3281,32 @@ int main(int argc, char *argv[])
 	float elapsed_secs11 = (float)(step11-step1);
     printf("\nTotal time 1:%f cpu click so %f seconds\n",elapsed_secs11,elapsed_secs11/CLOCKS_PER_SEC );
 
+	if (pinthreads && (getenv("OMP_PROC_BIND")!=NULL || getenv("GOMP_CPU_AFFINITY")!=NULL))
+	{	printf("Thread pinning left to the OpenMP runtime (OMP_PROC_BIND/GOMP_CPU_AFFINITY set)\n");
+		pinthreads=0;
+	};
+	if (pinthreads && pinthreadstocpus()) printf("WARNING: could not pin all threads\n");
 	for(int  chrtemp1=1;chrtemp1<23;chrtemp1++)
-	{	genomes[chrtemp1] = (unsigned char*) calloc ((unsigned long long) (1+nbsnpperchr[chrtemp1]/4)*NbIndiv, sizeof(char));
+	{	unsigned long long rowbytes=1+nbsnpperchr[chrtemp1]/4;
+		genomes[chrtemp1] = allocatelargebuffer(rowbytes*NbIndiv);
+		// first touch in parallel so each block of individuals lands on the node of the thread that scans it
+		#pragma omp parallel for schedule(static)
+		for(int relat=0;relat<NbIndiv;relat++)
+		{	memset(genomes[chrtemp1]+(unsigned long long) relat*rowbytes,0,rowbytes);
+		};
 		readgenomelocal(PathInput,chrtemp1,100+chrtemp1,105,genomes[chrtemp1]);
 
 	};
 	
+	printplacement();
+	if (usepbwt && preparepbwt(PathPBWTCache)!=0)
+	{	usepbwt=0;
+		if (userarespectrum) printf("WARNING: -RareSpectrum is built from the PBWT and is not used\n");
+		userarespectrum=0;
+	};
+	if (userarespectrum) preparerarespectrum();
+	if (strlen(PathSegmentDB)>0 && opensegmentdb(PathSegmentDB)!=0) printf("WARNING: could not open segment database %s, segments are not recorded\n",PathSegmentDB);
+
 	// Lire la liste d'individus si spécifiée
 	if (strlen(PathListIndiv) > 0)
 	{
@@ -1974,12 +3337,15 @@ int main(int argc, char *argv[])
 		}
 	}
 	
+	allocatephasedstore(indivsToProcess);
+
 	// Traiter chaque individu de la liste
 	for (size_t idx = 0; idx < indivsToProcess.size(); idx++)
 	{
 		int indiv = indivsToProcess[idx];
 		int ID = indiv;
 		printf("start individual: %d (%zu/%zu)\n", indiv, idx+1, indivsToProcess.size());
+		beginphasedindividual(indiv);
 		
 		loadsegment( indiv,
 						indiv,
@@ -2003,10 +3369,12 @@ int main(int argc, char *argv[])
 						2,
 						0,
 						PathOutput);
-		for(int  chrtemp1=1;chrtemp1<23;chrtemp1++)
-		{	writeoutput(chrtemp1,PathOutput);
-		};
+		phasedcommitted[phasedrowofindiv[indiv]]=1;
 	}
+	// every phased row is kept in the store, so each file is written once
+	for(int  chrtemp1=1;chrtemp1<23;chrtemp1++)
+	{	writeoutput(chrtemp1,PathOutput);
+	};
 
 	return 0;
 }
@@ -6,6 +6,11 @@
 #ifndef CONFIGURATION_MANAGER_H
 #define CONFIGURATION_MANAGER_H
 
+#include "NumaTopology.h"
+#include "LargeBufferAllocator.h"
+#include "PIHATKernels.h"
+#include "RelativeIdentificationEngine.h"
+#include <cstddef>
 #include <string>
 
 namespace PhasingEngine {
@@ -23,6 +28,30 @@ private:
     bool verboseMode;
     int algorithmVersion;
     float pihatThreshold;
+    NumaPlacementPolicy numaPlacementPolicy;
+    bool pinThreads;
+    HugePagePolicy hugePagePolicy;
+    size_t maxMemoryBytes;
+    std::string scratchPath;
+    PIHATKernel pihatKernel;
+    int pihatBatchSize;
+    std::string relativeIndexPath;
+    std::string relativeIndexBuildPath;
+    int relativeIndexTopK;
+    int topRelativeCount;
+    int pihatScreenStride;
+    float pihatScreenThreshold;
+    bool pihatScreenAudit;
+    bool pihatQuantized;
+    size_t kinshipCacheBytes;
+    bool relativeDegrees;
+    bool kinshipDecomposition;
+    RelativeEstimator relativeEstimator;
+    int lshBandCount;
+    int lshRowsPerBand;
+    int lshBlockSNPCount;
+    bool lshRecallAudit;
+    float lshRecallThreshold;
     
 public:
     ConfigurationManager();
@@ -50,6 +79,76 @@ public:
     
     float getPIHATThreshold() const { return pihatThreshold; }
     void setPIHATThreshold(float threshold) { pihatThreshold = threshold; }
+    
+    NumaPlacementPolicy getNumaPlacementPolicy() const { return numaPlacementPolicy; }
+    void setNumaPlacementPolicy(NumaPlacementPolicy policy) { numaPlacementPolicy = policy; }
+    
+    bool isThreadPinningEnabled() const { return pinThreads; }
+    void setThreadPinningEnabled(bool enabled) { pinThreads = enabled; }
+    
+    HugePagePolicy getHugePagePolicy() const { return hugePagePolicy; }
+    void setHugePagePolicy(HugePagePolicy policy) { hugePagePolicy = policy; }
+    
+    size_t getMaxMemoryBytes() const { return maxMemoryBytes; }
+    void setMaxMemoryBytes(size_t bytes) { maxMemoryBytes = bytes; }
+    
+    std::string getScratchPath() const;
+    void setScratchPath(const std::string& path) { scratchPath = path; }
+    
+    PIHATKernel getPIHATKernel() const { return pihatKernel; }
+    void setPIHATKernel(PIHATKernel kernel) { pihatKernel = kernel; }
+    
+    int getPIHATBatchSize() const { return pihatBatchSize; }
+    void setPIHATBatchSize(int size) { pihatBatchSize = size; }
+    
+    std::string getRelativeIndexPath() const { return relativeIndexPath; }
+    void setRelativeIndexPath(const std::string& path) { relativeIndexPath = path; }
+    
+    std::string getRelativeIndexBuildPath() const { return relativeIndexBuildPath; }
+    void setRelativeIndexBuildPath(const std::string& path) { relativeIndexBuildPath = path; }
+    
+    int getRelativeIndexTopK() const { return relativeIndexTopK; }
+    void setRelativeIndexTopK(int topK) { relativeIndexTopK = topK; }
+    
+    int getTopRelativeCount() const { return topRelativeCount; }
+    void setTopRelativeCount(int count) { topRelativeCount = count; }
+    
+    int getPIHATScreenStride() const { return pihatScreenStride; }
+    void setPIHATScreenStride(int stride) { pihatScreenStride = stride; }
+    
+    float getPIHATScreenThreshold() const { return pihatScreenThreshold; }
+    void setPIHATScreenThreshold(float threshold) { pihatScreenThreshold = threshold; }
+    
+    bool isPIHATScreenAuditEnabled() const { return pihatScreenAudit; }
+    void setPIHATScreenAudit(bool enabled) { pihatScreenAudit = enabled; }
+    
+    bool isPIHATQuantized() const { return pihatQuantized; }
+    void setPIHATQuantized(bool enabled) { pihatQuantized = enabled; }
+    
+    size_t getKinshipCacheBytes() const { return kinshipCacheBytes; }
+    void setKinshipCacheBytes(size_t bytes) { kinshipCacheBytes = bytes; }
+    
+    bool isRelativeDegreesEnabled() const { return relativeDegrees; }
+    void setRelativeDegrees(bool enabled) { relativeDegrees = enabled; }
+    
+    bool isKinshipDecompositionEnabled() const { return kinshipDecomposition; }
+    void setKinshipDecomposition(bool enabled) { kinshipDecomposition = enabled; }
+    
+    RelativeEstimator getRelativeEstimator() const { return relativeEstimator; }
+    void setRelativeEstimator(RelativeEstimator estimator) { relativeEstimator = estimator; }
+    
+    int getLSHBandCount() const { return lshBandCount; }
+    void setLSHBandCount(int bands) { lshBandCount = bands; }
+    
+    int getLSHRowsPerBand() const { return lshRowsPerBand; }
+    void setLSHRowsPerBand(int rows) { lshRowsPerBand = rows; }
+    
+    int getLSHBlockSNPCount() const { return lshBlockSNPCount; }
+    void setLSHBlockSNPCount(int snps) { lshBlockSNPCount = snps; }
+    
+    bool isLSHRecallAuditEnabled() const { return lshRecallAudit; }
+    float getLSHRecallThreshold() const { return lshRecallThreshold; }
+    void setLSHRecallThreshold(float threshold) { lshRecallAudit = true; lshRecallThreshold = threshold; }
 };
 
 }
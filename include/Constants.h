@@ -13,7 +13,7 @@ namespace Constants {
     constexpr int MAXCLOSERELAT = 6000;
     constexpr int MAXCLOSERELATTEMP = 450000;
     constexpr int MAXNBDIVISOR = 25;
-    constexpr int NBINDIVMAX = 100000;
+    constexpr int NBINDIVMAX = 16777216;
     constexpr int NBINDIV = 100000;
     constexpr int NBINDIVEA = 1;
     constexpr int MAXGEN = 1;
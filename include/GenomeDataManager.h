@@ -9,9 +9,12 @@
 #include "Interfaces.h"
 #include "Constants.h"
 #include <cstddef>
+#include <vector>
 
 namespace PhasingEngine {
 
+class LargeBufferAllocator;
+
 /**
  * @class GenomeDataManager
  * @brief Comprehensive genome data management with validation and caching
@@ -24,13 +27,22 @@ private:
     int snpCountInFile[Constants::NUM_CHROMOSOMES];
     int numberOfIndividuals;
     int minorAlleleFrequency[Constants::NSNPPERCHR][Constants::NUM_CHROMOSOMES];
+    // PIHAT contribution of every (focal dosage, relative dosage) pair per SNP,
+    // derived from the MAF and rebuilt when it changes
+    std::vector<float> contributionTables[Constants::NUM_CHROMOSOMES];
+    // Same per focal allele, for the haplotype decomposition of the sums
+    std::vector<float> haplotypeContributionTables[Constants::NUM_CHROMOSOMES];
+    bool contributionTableValid[Constants::NUM_CHROMOSOMES];
     int genomeOffspringData[3][Constants::NSNPPERCHR][Constants::NUM_CHROMOSOMES];
     bool isInitialized;
+    LargeBufferAllocator* bufferAllocator;
     
+    void releaseGenomeBuffer(int chromosome);
     void validateChromosomeIndex(int chromosome) const;
     void validateIndividualIndex(int individual) const;
     void validateSNPIndex(int chromosome, int snpIndex) const;
     size_t calculateGenomeBufferSize(int chromosome) const;
+    void buildContributionTables(int chromosome);
     
 public:
     GenomeDataManager();
@@ -48,6 +60,8 @@ public:
     bool loadFromFile(const char* pathfile, int chromosome, int nbIndiv);
     void setGenomeBuffer(int chromosome, unsigned char* buffer);
     unsigned char* getGenomeBuffer(int chromosome) const;
+    size_t getBytesPerIndividual(int chromosome) const;
+    void setBufferAllocator(LargeBufferAllocator* allocator) { bufferAllocator = allocator; }
     
     int getSNPCountPerChr(int chromosome) const;
     void setSNPCountPerChr(int chromosome, int count);
@@ -58,6 +72,22 @@ public:
     int getMAF(int snpIndex, int chromosome) const;
     void setMAF(int snpIndex, int chromosome, int value);
     void computeMAFForChromosome(int chromosome);
+    /// Entries per SNP of a contribution table: focal dosage x 3 + relative dosage
+    static const int CONTRIBUTION_ENTRIES = 9;
+    /**
+     * Cohort PIHAT contributions of a chromosome, CONTRIBUTION_ENTRIES per SNP.
+     * They depend only on the MAF, so every focal reads the same table; it is
+     * built on first use after the MAF changed. Not safe to call concurrently.
+     */
+    const float* getContributionTable(int chromosome);
+    /// Entries per SNP of a haplotype table: focal allele x 3 + relative dosage
+    static const int HAPLOTYPE_CONTRIBUTION_ENTRIES = 6;
+    /**
+     * Share of one focal haplotype in the contributions, built with the table
+     * above. The entries of the two alleles of a focal genotype add up to its
+     * dosage entry.
+     */
+    const float* getHaplotypeContributionTable(int chromosome);
     
     int getGenomeOffspring(int index, int snpIndex, int chromosome) const;
     void setGenomeOffspring(int index, int snpIndex, int chromosome, int value);
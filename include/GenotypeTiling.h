@@ -0,0 +1,174 @@
+/**
+ * @file GenotypeTiling.h
+ * @brief Cache-sized tiles of relatives x SNPs for sweeps over the genome store
+ */
+
+#ifndef GENOTYPE_TILING_H
+#define GENOTYPE_TILING_H
+
+#include "Constants.h"
+#include <cstddef>
+#include <cstdint>
+#include <omp.h>
+
+namespace PhasingEngine {
+
+/**
+ * @struct GenotypeTile
+ * @brief SNPs [firstSNP, endSNP) of one chromosome for relatives [firstRelative, endRelative)
+ */
+struct GenotypeTile {
+    int chromosome;
+    int firstSNP;
+    int endSNP;
+    int firstRelative;
+    int endRelative;
+};
+
+/**
+ * @class CacheMissCounter
+ * @brief Last-level cache references and misses of the calling thread
+ * @details Counting starts when the counter is constructed. The events are
+ *          opened with perf_event_open, so no library is needed; where the
+ *          kernel or the hypervisor does not expose them, isAvailable() is
+ *          false, reads return 0 and later counters do not retry.
+ */
+class CacheMissCounter {
+private:
+    int referencesFd;
+    int missesFd;
+
+public:
+    CacheMissCounter();
+    ~CacheMissCounter();
+    CacheMissCounter(const CacheMissCounter&) = delete;
+    CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+    bool isAvailable() const { return referencesFd >= 0 && missesFd >= 0; }
+    void read(uint64_t& references, uint64_t& misses) const;
+};
+
+/**
+ * @class GenotypeTiling
+ * @brief Walks a sweep over the individual-major genome store tile by tile
+ * @details A sweep reads, for every relative, its row of packed genotypes and
+ *          per-SNP state shared by all relatives (the focal's tables). Going
+ *          through the rows one relative at a time streams the whole shared
+ *          state once per relative, and going SNP by SNP touches a different
+ *          row, so a different cache line, for every relative. Tiles cut both
+ *          axes: the SNP range of a tile is chosen so that its shared state
+ *          fills half of the L2 cache and is reused by every relative of the
+ *          thread, and the relatives of a tile so that their row bytes fill a
+ *          quarter of it. While a tile is visited, the rows of the next one are
+ *          prefetched into L2.
+ *
+ *          Tiles are visited chromosome by chromosome, SNP range by SNP range,
+ *          so every relative still sees its SNPs in genome order. Tile bounds
+ *          are multiples of snpAlignment except at the end of a chromosome, and
+ *          of relativeAlignment from the first relative of the thread.
+ */
+class GenotypeTiling {
+private:
+    const char* name;
+    const unsigned char* buffers[Constants::NUM_CHROMOSOMES];
+    size_t bytesPerIndividual[Constants::NUM_CHROMOSOMES];
+    int snpCounts[Constants::NUM_CHROMOSOMES];
+    int relativeAlignment;
+    int tileSNPs;
+    int tileRelatives;
+
+    // Accumulated over every run since the last resetStatistics()
+    int runCount;
+    double tileCount;
+    double relativeSNPCount;
+    double runSeconds;
+    double cacheReferences;
+    double cacheMisses;
+    bool countersAvailable;
+
+    bool firstTile(int firstRelative, int endRelative, GenotypeTile& tile) const;
+    bool nextTile(int firstRelative, int endRelative, GenotypeTile& tile) const;
+    void prefetchTile(const GenotypeTile& tile) const;
+    void threadRange(int firstRelative, int endRelative, int& threadFirst, int& threadEnd) const;
+    void recordRun(double seconds, double tiles, double relativeSNPs, uint64_t references, uint64_t misses,
+                   bool counted);
+
+public:
+    explicit GenotypeTiling(const char* sweepName);
+
+    /**
+     * Sizes the tiles of a store. sharedBytesPerSNP is what every relative of
+     * a tile reads for each SNP besides its own row; tile SNP ranges are
+     * multiples of snpAlignment and relative blocks of relativeAlignment.
+     */
+    void plan(const unsigned char* const genomeBuffers[Constants::NUM_CHROMOSOMES],
+              const size_t rowBytes[Constants::NUM_CHROMOSOMES],
+              const int chromosomeSNPCounts[Constants::NUM_CHROMOSOMES],
+              size_t sharedBytesPerSNP, int snpAlignment, int relativeAlignment);
+
+    /// Visits the tiles of relatives [firstRelative, endRelative) on the calling thread
+    template<typename Visit>
+    double forEachTile(int firstRelative, int endRelative, Visit&& visit) const {
+        GenotypeTile tile;
+        double tiles = 0.0;
+        bool more = firstTile(firstRelative, endRelative, tile);
+        while(more) {
+            GenotypeTile current = tile;
+            more = nextTile(firstRelative, endRelative, tile);
+            if(more) {
+                prefetchTile(tile);
+            }
+            visit(current);
+            tiles++;
+        }
+        return tiles;
+    }
+
+    /**
+     * Splits relatives [firstRelative, endRelative) into one contiguous range
+     * of whole alignment blocks per OpenMP thread, visits each range's tiles
+     * and counts the cache events of all threads.
+     */
+    template<typename Visit>
+    void run(int firstRelative, int endRelative, Visit&& visit) {
+        double startTime = omp_get_wtime();
+        double tiles = 0.0;
+        uint64_t references = 0;
+        uint64_t misses = 0;
+        bool counted = true;
+        #pragma omp parallel reduction(+:tiles, references, misses) reduction(&&:counted)
+        {
+            CacheMissCounter counter;
+            int threadFirst, threadEnd;
+            threadRange(firstRelative, endRelative, threadFirst, threadEnd);
+            tiles += forEachTile(threadFirst, threadEnd, visit);
+            uint64_t threadReferences, threadMisses;
+            counter.read(threadReferences, threadMisses);
+            references += threadReferences;
+            misses += threadMisses;
+            counted = counted && counter.isAvailable();
+        }
+        double relativeSNPs = 0.0;
+        for(int chr = 1; chr < Constants::NUM_CHROMOSOMES; chr++) {
+            if(buffers[chr] != nullptr) {
+                relativeSNPs += (double)snpCounts[chr] * (endRelative - firstRelative);
+            }
+        }
+        recordRun(omp_get_wtime() - startTime, tiles, relativeSNPs, references, misses, counted);
+    }
+
+    int getTileSNPs() const { return tileSNPs; }
+    int getTileRelatives() const { return tileRelatives; }
+    int getRunCount() const { return runCount; }
+    /// Last-level cache misses per reference over all runs, or -1 without counters
+    double getMissRate() const;
+    void printReport(const char* kernelName) const;
+    void resetStatistics();
+
+    /// L2 size of the calling CPU, 1 MB when the system does not tell
+    static size_t getL2CacheBytes();
+};
+
+}
+
+#endif // GENOTYPE_TILING_H
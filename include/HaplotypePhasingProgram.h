@@ -8,11 +8,20 @@
 
 #include <memory>
 #include "ConfigurationManager.h"
+#include "MemoryBudgetPlanner.h"
 
 namespace PhasingEngine {
 
+class NumaTopology;
+class LargeBufferAllocator;
 class GenomeDataManager;
+class PhasedHaplotypeStore;
+class PIHATEngine;
 class RelativeIdentificationEngine;
+class RelativeIndex;
+class MinHashIndex;
+class KinshipCache;
+class RelationshipClassifier;
 class PhasingAlgorithmEngine;
 class OutputFileWriter;
 
@@ -22,15 +31,29 @@ class OutputFileWriter;
  */
 class HaplotypePhasingProgram {
 private:
+    std::unique_ptr<NumaTopology> numaTopology;
+    std::unique_ptr<LargeBufferAllocator> bufferAllocator;
     std::unique_ptr<GenomeDataManager> genomeDataManager;
+    std::unique_ptr<PhasedHaplotypeStore> phasedStore;
+    std::unique_ptr<PIHATEngine> pihatEngine;
     std::unique_ptr<RelativeIdentificationEngine> relativeEngine;
+    std::unique_ptr<RelativeIndex> relativeIndex;
+    std::unique_ptr<MinHashIndex> candidateIndex;
+    std::unique_ptr<KinshipCache> kinshipCache;
+    std::unique_ptr<RelationshipClassifier> relationshipClassifier;
     std::unique_ptr<PhasingAlgorithmEngine> phasingEngine;
     std::unique_ptr<OutputFileWriter> outputWriter;
     std::unique_ptr<ConfigurationManager> configuration;
+    std::unique_ptr<MemoryBudgetPlanner> memoryPlanner;
+    MemoryPlan memoryPlan;
     
     void initializeSNPCounts();
     void initializeChromosomeDividers();
     bool validateInputFiles() const;
+    bool planMemory();
+    bool usesKinshipDecomposition() const;
+    bool prepareRelativeIndex(bool& indexOnly);
+    void reportMemoryPlacement() const;
     void logExecutionStatistics(clock_t startTime, clock_t endTime) const;
     
 public:
@@ -0,0 +1,78 @@
+/**
+ * @file KingRelativeFinder.h
+ * @brief KING-robust kinship from popcounts over genotype bit-planes
+ */
+
+#ifndef KING_RELATIVE_FINDER_H
+#define KING_RELATIVE_FINDER_H
+
+#include "RelativeIdentificationEngine.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PhasingEngine {
+
+class GenomeDataManager;
+
+/**
+ * @class KingRelativeFinder
+ * @brief Relative search with the KING-robust kinship estimator
+ * @details The genome of every individual is recoded once into two bit-planes
+ *          spanning all chromosomes: H (heterozygous) and A (homozygous for the
+ *          counted allele). For a focal f and a relative r, 64 SNPs at a time,
+ *              N(Aa,Aa) = popcount(H_f & H_r)
+ *              IBS0     = popcount(A_f & ~(H_r | A_r) | A_r & ~(H_f | A_f))
+ *          and phi = (N(Aa,Aa) - 2 IBS0) / (N(Aa)_f + N(Aa)_r). No allele
+ *          frequency enters the estimate, which keeps it unbiased under
+ *          population structure. The value stored as PIHAT is 2 phi (self 1,
+ *          first degree 0.5, unrelated 0), so the top-K selection, thresholds
+ *          and accessors of RelativeIdentificationEngine apply unchanged.
+ */
+class KingRelativeFinder : public RelativeIdentificationEngine {
+public:
+    /// Instruction set of the popcount kernel
+    enum class PopcountKernel {
+        GENERIC,    ///< Compiler builtin without hardware popcount
+        POPCNT,     ///< 64-bit POPCNT, one word at a time
+        AVX512      ///< VPOPCNTDQ, eight words at a time
+    };
+
+private:
+    GenomeDataManager* genomeDataManager;
+    // Per individual: wordsPerPlane words of H followed by wordsPerPlane words of A
+    std::vector<uint64_t> bitPlanes;
+    std::vector<int> heterozygousCounts;
+    std::vector<int> ibs0Counts;
+    std::vector<int> hetHetCounts;
+    size_t wordsPerPlane;
+    int64_t planeSNPCount;
+    PopcountKernel kernel;
+
+    int focalCount;
+    double relativeSNPCount;
+    double sweepSeconds;
+    double lastSweepSeconds;
+    double lastRelativeSNPCount;
+
+    void buildBitPlanes();
+
+public:
+    explicit KingRelativeFinder(GenomeDataManager* gdm);
+    virtual ~KingRelativeFinder() = default;
+
+    virtual void computePIHATMatrix() override;
+    virtual RelativeEstimator getEstimator() const override { return RelativeEstimator::KING_ROBUST; }
+    virtual double getLastThroughput() const override;
+    virtual void printThroughputReport() const override;
+
+    /// Counts of the last focal against a relative
+    int getIBS0Count(int relativeID) const;
+    int getHetHetCount(int relativeID) const;
+    PopcountKernel getKernel() const { return kernel; }
+    static const char* getKernelName(PopcountKernel kernel);
+};
+
+}
+
+#endif // KING_RELATIVE_FINDER_H
@@ -0,0 +1,78 @@
+/**
+ * @file KinshipCache.h
+ * @brief PIHAT rows of earlier focals, reused for the symmetric pairs of later ones
+ */
+
+#ifndef KINSHIP_CACHE_H
+#define KINSHIP_CACHE_H
+
+#include <cstddef>
+#include <vector>
+
+namespace PhasingEngine {
+
+/**
+ * @class KinshipCache
+ * @brief Symmetric reuse of PIHAT values across the focals of one run
+ * @details PIHAT is symmetric: the sweep of focal i against relative j sums the
+ *          same per-SNP products as the sweep of j against i, only in another
+ *          float rounding. Once a focal's row is computed it is kept, and a
+ *          later focal reads its value against every cached individual from
+ *          those rows. Only the span from the first to the last individual
+ *          without a cached row is swept, so with focals phased in ID order
+ *          focal k sweeps relatives k to N - 1 and the cost of a run halves.
+ *
+ *          Rows are admitted until the capacity is used up and are never
+ *          evicted: the oldest rows are the lowest IDs, which keep the swept
+ *          span a suffix. The MAF is derived from the genome store, which does
+ *          not change during a run, so no row goes stale. Lookups and inserts
+ *          are serialized, so several threads may share one cache.
+ */
+class KinshipCache {
+private:
+    int numberOfIndividuals;
+    size_t capacityBytes;
+    size_t cachedBytes;
+    // rows[focal] is empty until the focal's normalized PIHAT row is stored
+    std::vector<std::vector<float>> rows;
+    int rowCount;
+
+    double lookupCount;
+    double hitCount;
+    double sweptPairCount;
+    double sweepSeconds;
+    double savedSeconds;
+
+public:
+    KinshipCache();
+    virtual ~KinshipCache() = default;
+
+    /// capacity bounds the bytes of stored rows; 0 disables the cache
+    void configure(int individuals, size_t capacity);
+    bool isEnabled() const { return capacityBytes > 0 && numberOfIndividuals > 0; }
+    void clear();
+
+    /**
+     * Writes every value the cache holds for focal into pihat and returns in
+     * [firstMissing, endMissing) the span that still has to be swept (empty
+     * when the whole row was served).
+     */
+    void fillRow(int focal, float* pihat, int count, int& firstMissing, int& endMissing);
+    /// Keeps the focal's complete row if the capacity allows
+    void storeRow(int focal, const float* pihat, int count);
+    /**
+     * Accounts one focal: hits values came from the cache and swept relatives
+     * took seconds. Time saved is estimated from the average cost of a swept pair.
+     */
+    void recordQuery(int hits, int swept, double seconds);
+
+    double getHitRate() const { return lookupCount > 0.0 ? hitCount / lookupCount : 0.0; }
+    double getSavedSeconds() const { return savedSeconds; }
+    size_t getMemoryBytes() const { return cachedBytes; }
+    static size_t estimateMemoryBytes(int individuals, size_t capacity);
+    void printReport() const;
+};
+
+}
+
+#endif // KINSHIP_CACHE_H
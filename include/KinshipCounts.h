@@ -0,0 +1,64 @@
+/**
+ * @file KinshipCounts.h
+ * @brief KING-robust pair counts over heterozygous and homozygous bit masks
+ */
+
+#ifndef KINSHIP_COUNTS_H
+#define KINSHIP_COUNTS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace PhasingEngine {
+
+/**
+ * @namespace KinshipCounts
+ * @brief Shared counting step of KingRelativeFinder and RelationshipClassifier
+ * @details Each individual is described by two masks over the same SNP bits:
+ *          H, set where it is heterozygous, and A, set where it is homozygous
+ *          for the counted allele. Every other SNP covered by the masks is
+ *          homozygous for the other allele, so bits past the last SNP must be
+ *          clear in the masks of both individuals. For a focal f and relative r
+ *              N(Aa,Aa) = popcount(H_f & H_r)
+ *              IBS0     = popcount(A_f & ~(H_r | A_r) | A_r & ~(H_f | A_f))
+ *          The bit layout does not matter as long as both sides share it:
+ *          KingRelativeFinder uses dense bit-planes, RelationshipClassifier the
+ *          low bit of each 2-bit genotype code.
+ */
+namespace KinshipCounts {
+
+    /// Counts of one focal-relative pair
+    struct PairCounts {
+        int hetHet;     ///< SNPs heterozygous in both individuals
+        int ibs0;       ///< SNPs homozygous for opposite alleles
+    };
+
+    /// SNPs where one individual is homozygous for each allele
+    inline uint64_t opposingHomozygotes(uint64_t focalHet, uint64_t focalAlt,
+                                        uint64_t relativeHet, uint64_t relativeAlt) {
+        return (focalAlt & ~(relativeHet | relativeAlt)) | (relativeAlt & ~(focalHet | focalAlt));
+    }
+
+    __attribute__((always_inline))
+    inline void addPairWord(PairCounts& counts, uint64_t focalHet, uint64_t focalAlt,
+                            uint64_t relativeHet, uint64_t relativeAlt) {
+        counts.hetHet += __builtin_popcountll(focalHet & relativeHet);
+        counts.ibs0 += __builtin_popcountll(opposingHomozygotes(focalHet, focalAlt, relativeHet, relativeAlt));
+    }
+
+    /// Planes of words words of H followed by words words of A, per individual.
+    /// Inlined so that the target of the caller decides which instruction
+    /// __builtin_popcountll becomes
+    __attribute__((always_inline))
+    inline PairCounts countPairWords(const uint64_t* focal, const uint64_t* relative, size_t words) {
+        PairCounts counts = {0, 0};
+        for(size_t word = 0; word < words; word++) {
+            addPairWord(counts, focal[word], focal[words + word], relative[word], relative[words + word]);
+        }
+        return counts;
+    }
+}
+
+}
+
+#endif // KINSHIP_COUNTS_H
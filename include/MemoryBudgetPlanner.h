@@ -0,0 +1,108 @@
+/**
+ * @file MemoryBudgetPlanner.h
+ * @brief Up-front estimate of the memory footprint and choice of a run layout that fits
+ */
+
+#ifndef MEMORY_BUDGET_PLANNER_H
+#define MEMORY_BUDGET_PLANNER_H
+
+#include "Constants.h"
+#include "RelativeIdentificationEngine.h"
+#include <cstddef>
+
+namespace PhasingEngine {
+
+/**
+ * @enum GenomeStorageMode
+ * @brief Where the packed genome buffers live
+ */
+enum class GenomeStorageMode {
+    IN_MEMORY,      ///< Anonymous memory, fully resident
+    OUT_OF_CORE     ///< File-backed mappings in the scratch directory, paged in on demand
+};
+
+/**
+ * @struct MemoryPlan
+ * @brief Footprint of every large consumer and the layout chosen to fit the budget
+ */
+struct MemoryPlan {
+    size_t genomeStoreBytes;        ///< Resident part of the packed input genomes
+    size_t phasedStoreBytes;        ///< Phased rows of one chunk of individuals
+    size_t sharedStateBytes;        ///< Engines and per-SNP tables allocated once
+    size_t jobContextBytes;         ///< Stack and private buffers of one worker thread
+    size_t correlationBytes;        ///< Window correlation matrix of one phasing job
+    size_t outputBufferBytes;       ///< Row and stream buffers of the PED writer
+    size_t totalBytes;              ///< Sum of the above for the chosen layout
+    int threadCount;                ///< OpenMP threads to run with
+    int chunkSize;                  ///< Individuals phased before their rows are written out
+    GenomeStorageMode storageMode;
+
+    MemoryPlan() : genomeStoreBytes(0), phasedStoreBytes(0), sharedStateBytes(0),
+                   jobContextBytes(0), correlationBytes(0), outputBufferBytes(0),
+                   totalBytes(0), threadCount(1), chunkSize(0),
+                   storageMode(GenomeStorageMode::IN_MEMORY) {}
+};
+
+/**
+ * @class MemoryBudgetPlanner
+ * @brief Computes the footprint of a run before anything is allocated
+ * @details Candidate layouts are tried from fastest to leanest: all threads in
+ *          memory, then smaller phasing chunks, then fewer threads, then the
+ *          genome store out of core. The first layout under the budget wins.
+ *          A per-focal PIHAT sweep reads every chromosome of every relative
+ *          for each focal, so out of core the whole store is its working set
+ *          and that layout is only tried when relatives come from elsewhere.
+ */
+class MemoryBudgetPlanner {
+private:
+    size_t maxMemoryBytes;
+    int numberOfIndividuals;
+    int maxThreads;
+    int pihatBatchSize;
+    int pihatScreenStride;
+    bool pihatQuantized;
+    size_t kinshipCacheBytes;
+    bool kinshipDecomposition;
+    RelativeEstimator relativeEstimator;
+    bool perFocalSweep;
+    int minHashBandCount;
+    int minHashBlockSNPCount;
+    size_t threadStackBytes;
+    int snpCountPerChromosome[Constants::NUM_CHROMOSOMES];
+
+    size_t computeGenomeRowBytes() const;
+    size_t computeLargestChromosomeBytes() const;
+    void estimate(MemoryPlan& plan) const;
+    static size_t detectThreadStackBytes();
+
+public:
+    MemoryBudgetPlanner();
+
+    bool plan(MemoryPlan& result) const;
+    void printPlan(const MemoryPlan& plan) const;
+
+    void setMaxMemoryBytes(size_t bytes) { maxMemoryBytes = bytes; }
+    size_t getMaxMemoryBytes() const { return maxMemoryBytes; }
+    void setNumberOfIndividuals(int count) { numberOfIndividuals = count; }
+    void setMaxThreads(int threads) { maxThreads = threads > 0 ? threads : 1; }
+    void setSNPCountPerChr(int chromosome, int count);
+    void setPIHATBatchSize(int size) { pihatBatchSize = size > 0 ? size : 1; }
+    void setPIHATScreenStride(int stride) { pihatScreenStride = stride > 0 ? stride : 0; }
+    void setRelativeEstimator(RelativeEstimator estimator) { relativeEstimator = estimator; }
+    /// Whether the relatives of each focal are found by sweeping the whole genome store
+    void setPerFocalSweep(bool enabled) { perFocalSweep = enabled; }
+    /// Quantized PIHAT keeps int16 copies of the tables and scores one focal per pass
+    void setPIHATQuantized(bool enabled) { pihatQuantized = enabled; }
+    /// Capacity of the kinship cache, 0 when it is off
+    void setKinshipCacheBytes(size_t bytes) { kinshipCacheBytes = bytes; }
+    void setKinshipDecomposition(bool enabled) { kinshipDecomposition = enabled; }
+    /// Bands of the MinHash candidate index, 0 when it is not built
+    void setMinHashIndex(int bands, int blockSNPs) { minHashBandCount = bands; minHashBlockSNPCount = blockSNPs; }
+
+    static bool parseMemorySize(const char* text, size_t& bytes);
+    static const char* getStorageModeName(GenomeStorageMode mode);
+};
+
+}
+
+#endif // MEMORY_BUDGET_PLANNER_H
@@ -0,0 +1,111 @@
+/**
+ * @file MinHashIndex.h
+ * @brief MinHash signatures of haplotype shingles with banded buckets for candidate relatives
+ */
+
+#ifndef MINHASH_INDEX_H
+#define MINHASH_INDEX_H
+
+#include "Constants.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PhasingEngine {
+
+class GenomeDataManager;
+
+/**
+ * @class MinHashIndex
+ * @brief Sublinear retrieval of the individuals that may be related to a focal
+ * @details Every chromosome is cut into blocks of blockSNPCount SNPs and every
+ *          block into windows of SHINGLE_SNPS SNPs. A shingle is the allele
+ *          pattern of one haplotype over one window. Relatives carry identical
+ *          haplotypes on their IBD segments, so within a block where a pair is
+ *          IBD their shingle sets overlap by about a third (one haplotype of
+ *          each shared out of four). Shingles seen on a single haplotype, or on
+ *          more than MAX_SHINGLE_FREQUENCY of them, tell nothing about
+ *          relatedness and are dropped before hashing.
+ *
+ *          The shingles of an individual in a block are summarised by
+ *          bandCount x rowsPerBand MinHash values, and each band of rows is
+ *          hashed into one bucket key. Two individuals become candidates when
+ *          they share a key in any band of any block, which happens with
+ *          probability 1 - (1 - J^rows)^bands for a block of Jaccard
+ *          similarity J. Keys are kept sorted per block and band, so a query
+ *          costs one binary search per band and block plus the bucket sizes,
+ *          independently of the cohort size.
+ */
+class MinHashIndex {
+private:
+    GenomeDataManager* genomeDataManager;
+    int bandCount;
+    int rowsPerBand;
+    int blockSNPCount;
+    int numberOfIndividuals;
+
+    struct Block {
+        int chromosome;
+        int firstSNP;
+        int snpCount;
+    };
+    std::vector<Block> blocks;
+    // keys[(block * bandCount + band) * N + individual]; 0 marks an empty signature
+    std::vector<uint32_t> keys;
+    // Individuals of each block and band sorted by key, same layout as keys;
+    // the bucketSizes[block * bandCount + band] first ones have a signature
+    std::vector<int> buckets;
+    std::vector<int> bucketSizes;
+
+    // Candidates of the last query, marked with the query stamp
+    std::vector<unsigned int> candidateStamps;
+    unsigned int queryStamp;
+
+    double buildSeconds;
+    int queryCount;
+    double candidateCount;
+    double querySeconds;
+    bool auditRecall;
+    float auditThreshold;
+    int auditedFocalCount;
+    double auditedRelativeCount;
+    double recalledRelativeCount;
+
+    void hashBlock(int block, std::vector<uint32_t>& signatures) const;
+
+public:
+    /// SNPs per shingle, one allele pattern bit each
+    static const int SHINGLE_SNPS = 32;
+    /// Shingles on a larger fraction of the haplotypes are not indexed
+    static constexpr double MAX_SHINGLE_FREQUENCY = 0.01;
+
+    explicit MinHashIndex(GenomeDataManager* gdm);
+    virtual ~MinHashIndex() = default;
+
+    void configure(int bands, int rows, int blockSNPs);
+    bool build();
+    bool isBuilt() const { return !keys.empty(); }
+
+    /// Individuals sharing a bucket with the focal, the focal itself included
+    void findCandidates(int focalIndividual, std::vector<int>& candidates);
+    bool isCandidate(int individual) const;
+
+    /// Queries are checked against the exhaustive sweep when auditing recall
+    void setRecallAudit(bool enabled, float threshold) { auditRecall = enabled; auditThreshold = threshold; }
+    bool isAuditingRecall() const { return auditRecall; }
+    /**
+     * Compares the last query with exhaustive PIHAT values: every other
+     * individual above the audit threshold is a true relative, recalled if it
+     * was a candidate.
+     */
+    void recordRecall(int focalIndividual, const float* exactPIHAT, int count);
+
+    int getBlockCount() const { return (int)blocks.size(); }
+    size_t getMemoryBytes() const;
+    static size_t estimateMemoryBytes(int blockCount, int individuals, int bands);
+    void printReport() const;
+};
+
+}
+
+#endif // MINHASH_INDEX_H
@@ -0,0 +1,79 @@
+/**
+ * @file NumaTopology.h
+ * @brief NUMA topology detection, thread pinning and memory placement
+ */
+
+#ifndef NUMA_TOPOLOGY_H
+#define NUMA_TOPOLOGY_H
+
+#include <cstddef>
+#include <vector>
+
+namespace PhasingEngine {
+
+/**
+ * @enum NumaPlacementPolicy
+ * @brief How the pages of a large buffer are distributed over NUMA nodes
+ */
+enum class NumaPlacementPolicy {
+    NONE,           ///< Leave placement to the kernel (first thread to write wins)
+    FIRST_TOUCH,    ///< Rows are touched by the OpenMP thread that later scans them
+    INTERLEAVE      ///< Pages are interleaved round-robin over all nodes
+};
+
+/**
+ * @struct NumaNode
+ * @brief One NUMA node with the CPUs this process is allowed to run on
+ */
+struct NumaNode {
+    int id;                 ///< Kernel node identifier
+    std::vector<int> cpus;  ///< Allowed CPUs attached to this node
+    size_t memoryBytes;     ///< Total memory of the node (0 if unknown)
+
+    NumaNode() : id(0), memoryBytes(0) {}
+};
+
+/**
+ * @class NumaTopology
+ * @brief Detects the machine topology, pins OpenMP threads and places buffers
+ * @details Uses sysfs and raw syscalls only, so no libnuma dependency is needed.
+ *          On single-node machines every operation degrades to a no-op.
+ */
+class NumaTopology {
+private:
+    std::vector<NumaNode> nodes;
+    std::vector<int> threadCPU;
+    std::vector<int> threadNode;
+    int onlineProcessors;
+    bool threadsPinned;
+    NumaPlacementPolicy placementPolicy;
+
+    void detectNodesFromSysfs(const std::vector<int>& allowedCPUs);
+    static std::vector<int> parseCPUList(const char* list);
+    int findNodeOfCPU(int cpu) const;
+
+public:
+    NumaTopology();
+
+    void detect();
+    bool pinThreads();
+    void placeRegion(unsigned char* region, size_t bytes, size_t rowBytes, size_t rowCount) const;
+    void queryPageNodes(const unsigned char* region, size_t bytes,
+                        std::vector<size_t>& bytesPerNode) const;
+    void printPlacementReport() const;
+
+    int getNodeCount() const { return (int)nodes.size(); }
+    int getOnlineProcessorCount() const { return onlineProcessors; }
+    const NumaNode& getNode(int index) const { return nodes[index]; }
+    bool areThreadsPinned() const { return threadsPinned; }
+
+    NumaPlacementPolicy getPlacementPolicy() const { return placementPolicy; }
+    void setPlacementPolicy(NumaPlacementPolicy policy) { placementPolicy = policy; }
+
+    static bool parsePlacementPolicy(const char* name, NumaPlacementPolicy& policy);
+    static const char* getPlacementPolicyName(NumaPlacementPolicy policy);
+};
+
+}
+
+#endif // NUMA_TOPOLOGY_H
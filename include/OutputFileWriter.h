@@ -12,6 +12,7 @@
 namespace PhasingEngine {
 
 class GenomeDataManager;
+class PhasedHaplotypeStore;
 
 /**
  * @class OutputFileWriter
@@ -20,16 +21,20 @@ class GenomeDataManager;
 class OutputFileWriter {
 private:
     GenomeDataManager* genomeDataManager;
+    PhasedHaplotypeStore* phasedStore;
     std::string outputDirectory;
     bool validateOutputPath(const char* path) const;
     void writePEDHeader(FILE* file, int chromosome) const;
     void writePEDRow(FILE* file, int individualID, int chromosome) const;
+    int getOutputGenotype(int chromosome, int individualID, int snpIndex) const;
     
 public:
-    explicit OutputFileWriter(GenomeDataManager* gdm);
+    OutputFileWriter(GenomeDataManager* gdm, PhasedHaplotypeStore* store);
     virtual ~OutputFileWriter() = default;
     
     bool writeOutput(int chromosome, const char* outputPath);
+    bool writeOutputRange(int chromosome, const char* outputPath,
+                          int firstIndividual, int count, bool append);
     bool writeOutputBatch(const std::vector<int>& chromosomes, const char* outputPath);
     void setOutputDirectory(const std::string& directory) { outputDirectory = directory; }
     std::string getOutputDirectory() const { return outputDirectory; }
@@ -0,0 +1,257 @@
+/**
+ * @file PIHATEngine.h
+ * @brief Genome-wide PIHAT sweep of one focal individual against every relative
+ */
+
+#ifndef PIHAT_ENGINE_H
+#define PIHAT_ENGINE_H
+
+#include "Constants.h"
+#include "GenotypeTiling.h"
+#include "PIHATKernels.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PhasingEngine {
+
+class GenomeDataManager;
+
+/**
+ * @class PIHATEngine
+ * @brief Scores all relatives of a focal individual in a single parallel region
+ * @details The focal's contribution to each of the three relative genotype sums
+ *          is tabulated per SNP for every chromosome up front. Relatives are then
+ *          split across the threads once, and each thread sweeps all SNPs of all
+ *          chromosomes for its own relatives with a private accumulator, so there
+ *          is one fork/join per focal and every PIHAT value is written exactly
+ *          once. Relatives are summed chromosome by chromosome in SNP order, which
+ *          keeps the results bit-identical to the per-chromosome sweep.
+ *          The sweep itself runs on the widest SIMD kernel the CPU supports
+ *          unless a kernel is forced with setKernel(). Each thread walks its
+ *          relatives in GenotypeTiling tiles, so the tables of a SNP range stay
+ *          in L2 while all of them are summed over it.
+ *
+ *          With a batch size B > 1 and a focal queue, the first request for a
+ *          queued focal scores it together with the next B - 1 queued focals:
+ *          the table entry of each SNP holds B contributions side by side, so
+ *          every genotype byte loaded from the store feeds B accumulators and
+ *          the store is streamed once per B focals. Later requests for those
+ *          focals are answered from the batch, with identical values.
+ *
+ *          With screening enabled, every relative is first scored on a thinned
+ *          copy of the store holding one SNP in screenStride. The sum over the
+ *          remaining SNPs is estimated from the thinned sum, and the null
+ *          variance of the focal's per-SNP contributions gives an upper bound on
+ *          the estimation error. The kept SNPs of odd and even chromosomes form
+ *          two independent halves that must agree for every relative; when they
+ *          disagree more than independent SNPs allow (LD, departures from
+ *          Hardy-Weinberg), the bound of that focal is widened accordingly. A second thinned sweep
+ *          sums the squared deviations from the null mean, which widens the
+ *          bound of pairs more variable than unrelated ones, such as relatives
+ *          sharing rare alleles on IBD segments. Only relatives whose
+ *          upper bound reaches the screening threshold are swept exactly; the
+ *          others keep the estimate, which is below the threshold.
+ *          The bound is a statistical one (screenSigmas standard deviations of
+ *          the estimation error), not a worst case: a pair above the threshold
+ *          can be pruned with small probability, so screening is approximate.
+ *          The audit sweeps every pair exactly as well and counts those lost.
+ *
+ *          In quantized mode each block of PIHATKernels::QUANTIZED_BLOCK_SNPS
+ *          SNPs gets the scale s = max|contribution| / QUANTIZED_MAX and its
+ *          entries are rounded to int16 multiples of s. A relative picks one
+ *          entry per SNP, so its sum differs from the sum of the float entries
+ *          by at most the sum over blocks of (SNPs in block) x (largest rounding
+ *          error in block), at most s/2 per SNP, plus the rounding of the
+ *          running float sum: one fused multiply-add per block, each off by
+ *          half an ulp of at most the sum of (SNPs in block) x QUANTIZED_MAX x s.
+ *          That bound is computed for every focal and divided by
+ *          2 x PIHAT_NORMALIZATION_FACTOR to give the PIHAT bound.
+ *
+ *          With decomposition enabled, the exact single-focal sweep also splits
+ *          every relative's sum by chromosome and by focal haplotype: each
+ *          entry of the focal's dosage is the sum of one term per allele, and
+ *          the haplotype table holds the term of the allele on the focal's
+ *          first haplotype. That share is accumulated next to the genome-wide
+ *          sum in the same pass over the genotype bytes; the second
+ *          haplotype's share is the rest of the chromosome's sum. Relatives
+ *          served by a batch, a screen estimate, the quantized sweep or a
+ *          cache get their parts from decomposeRelatives() once ranked.
+ */
+class PIHATEngine {
+private:
+    GenomeDataManager* genomeDataManager;
+    std::vector<float> contributions[Constants::NUM_CHROMOSOMES];
+    size_t snpsPerRelative;
+    PIHATKernel requestedKernel;
+    PIHATKernel activeKernel;
+
+    // Focals scored together in one pass over the genome store
+    int batchSize;
+    int batchStride;
+    int batchRelativeCount;
+    int batchFirstRelative;
+    int batchEndRelative;
+    std::vector<int> focalQueue;
+    std::vector<int> batchFocals;
+    std::vector<float> batchPIHAT;
+
+    // Two-stage screening on every screenStride-th SNP
+    int screenStride;
+    float screenThreshold;
+    float screenSigmas;
+    std::vector<unsigned char> screenRows[Constants::NUM_CHROMOSOMES];
+    std::vector<float> screenContributions[Constants::NUM_CHROMOSOMES];
+    std::vector<float> screenSquares[Constants::NUM_CHROMOSOMES];
+    int screenSNPCounts[Constants::NUM_CHROMOSOMES];
+    // Null mean and variance of the raw sum, per focal slot, over all SNPs and
+    // over the kept SNPs of even (half 0) and odd (half 1) chromosomes
+    std::vector<double> nullMean;
+    std::vector<double> nullVariance;
+    std::vector<double> screenMean[2];
+    std::vector<double> screenVariance[2];
+    std::vector<float> screenSecondHalf;
+    std::vector<float> screenSquareSums[2];
+    bool screenAudit;
+    std::vector<float> screenAuditRow;
+    std::vector<float> screenBounds;
+    std::vector<int> candidates;
+
+    // Fixed-point sweep: int16 copies of the tables with one scale per block
+    bool quantized;
+    std::vector<int16_t> quantizedContributions[Constants::NUM_CHROMOSOMES];
+    std::vector<float> blockScales[Constants::NUM_CHROMOSOMES];
+    double lastQuantizationBound;
+    double maxQuantizationBound;
+
+    // Per-chromosome, per-haplotype parts of each relative's sum; a row is
+    // valid for the focal recorded next to it
+    bool decompose;
+    std::vector<float> haplotypeContributions[Constants::NUM_CHROMOSOMES];
+    std::vector<float> decomposition;
+    std::vector<int> decompositionFocals;
+    double sweptDecompositionCount;
+    double rankedDecompositionCount;
+
+    // One tiling per kernel family, planned for the store and tables of each sweep
+    GenotypeTiling pihatTiling;
+    GenotypeTiling batchTiling;
+    GenotypeTiling quantizedTiling;
+    GenotypeTiling decomposedTiling;
+
+    // Accumulated over every focal scored since the last resetStatistics()
+    int focalCount;
+    double relativeSNPCount;
+    double sweepSeconds;
+    double lastSweepSeconds;
+    double lastRelativeSNPCount;
+    double screenedPairCount;
+    double exactPairCount;
+    double auditAbovePairCount;
+    double auditLostPairCount;
+    double auditMaxErrorRatio;
+
+    void tabulateContributions(const int* focals, int focalCountInTable, int stride);
+    void prepareSweep(PIHATSweep& sweep, int stride) const;
+    void recordSweep(double seconds, int focals, int numberOfRelatives);
+    bool computeBatch(int focalIndividual, int firstRelative, int endRelative, int numberOfRelatives);
+    void sweepRelatives(const PIHATSweep& sweep, int firstRelative, int endRelative, float* output);
+    void buildScreenRows();
+    void sweepScreened(const PIHATSweep& sweep, int focalCountInTable, int numberOfRelatives, float* output);
+    void quantizeContributions();
+    PIHATKernel resolveQuantizedKernel() const;
+    void sweepQuantized(const PIHATSweep& sweep, int firstRelative, int endRelative, float* output);
+    void tabulateHaplotypeContributions(int focalIndividual);
+    void prepareDecomposition(int numberOfRelatives);
+    void sweepDecomposed(const PIHATSweep& sweep, int focalIndividual, int firstRelative, int endRelative,
+                         float* output);
+
+public:
+    explicit PIHATEngine(GenomeDataManager* gdm);
+    virtual ~PIHATEngine() = default;
+
+    void computePIHAT(int focalIndividual, float* pihat, int numberOfRelatives);
+    /**
+     * Raw sums of relatives firstRelative to endRelative - 1 only, e.g. those a
+     * kinship cache cannot serve; the other entries of pihat are left as they
+     * are. Batches cover the same range for every focal. Screening calibrates
+     * on every relative, so it sweeps the whole row.
+     */
+    void computePIHATRange(int focalIndividual, int firstRelative, int endRelative,
+                           float* pihat, int numberOfRelatives);
+    /**
+     * Exact raw sums of the listed relatives only, e.g. the candidates of a
+     * MinHash query. The others get 0, which normalizes to a PIHAT of -1.
+     */
+    void computePIHATForRelatives(int focalIndividual, const std::vector<int>& relatives,
+                                  float* pihat, int numberOfRelatives);
+    /// Raw sum of a relative to the PIHAT reported to the user
+    static float normalize(float rawSum) { return rawSum / 2.0f / Constants::PIHAT_NORMALIZATION_FACTOR - 1.0f; }
+
+    /// Unsupported kernels fall back to the best supported one
+    void setKernel(PIHATKernel kernel);
+    PIHATKernel getRequestedKernel() const { return requestedKernel; }
+    PIHATKernel getActiveKernel() const { return activeKernel; }
+
+    /// Focals per genome pass, clamped to [1, PIHATKernels::MAX_BATCH]
+    void setBatchSize(int size);
+    int getBatchSize() const { return batchSize; }
+    /// Order in which focals will be requested; batches are taken from it
+    void setFocalQueue(const std::vector<int>& focals);
+    /// Drops batched results, e.g. after the MAF or the genome store changed
+    void invalidateBatch();
+
+    /**
+     * Screens relatives on one SNP in stride (0 disables screening). Relatives
+     * whose PIHAT bound stays below threshold get the estimate instead of the
+     * exact value; sigmas is the width of the bound in null standard deviations.
+     */
+    void setScreening(int stride, float threshold, float sigmas = DEFAULT_SCREEN_SIGMAS);
+    int getScreenStride() const { return screenStride; }
+    float getScreenThreshold() const { return screenThreshold; }
+    static constexpr float DEFAULT_SCREEN_SIGMAS = 6.0f;
+    /// Also sweeps every screened pair exactly and counts the pairs above the threshold the screen pruned
+    void setScreenAudit(bool enabled) { screenAudit = enabled; }
+    bool isAuditingScreen() const { return screenAudit && screenStride > 0; }
+    double getLostScreenPairCount() const { return auditLostPairCount; }
+    void printScreenAuditReport() const;
+
+    /**
+     * Sums int16 contributions in integers instead of floats. Results no longer
+     * depend on the kernel, and every PIHAT is within getQuantizationBound()
+     * of the float sweep's exact sum. Focal batching and screening do not apply.
+     */
+    void setQuantized(bool enabled);
+    bool isQuantized() const { return quantized; }
+    /// Worst-case PIHAT error of the last quantized focal, and the largest so far
+    double getQuantizationBound() const { return lastQuantizationBound; }
+    double getMaxQuantizationBound() const { return maxQuantizationBound; }
+
+    /**
+     * Splits each relative's sum into DECOMPOSITION_ENTRIES parts, chromosome
+     * by chromosome against each focal haplotype (0 from the high bit of the
+     * genotype code, 1 from the low bit), during the exact single-focal sweep.
+     */
+    void setDecomposition(bool enabled);
+    bool isDecomposing() const { return decompose; }
+    /// Computes the parts of the listed relatives the last sweep did not split
+    void decomposeRelatives(int focalIndividual, const std::vector<int>& relatives, int numberOfRelatives);
+    /**
+     * Raw parts of a relative's sum for the focal, entry (chr - 1) * 2 +
+     * haplotype; nullptr when that pair was not decomposed. The parts of a
+     * relative add up to its raw sum up to float rounding.
+     */
+    const float* getDecomposition(int focalIndividual, int relativeID) const;
+
+    double getLastThroughput() const;
+    /// Forgets the last sweep, so that a focal answered from a batch or a cache reports none
+    void clearLastSweep();
+    double getAverageThroughput() const;
+    int getFocalCount() const { return focalCount; }
+    void printThroughputReport() const;
+    void resetStatistics();
+};
+
+}
+
+#endif // PIHAT_ENGINE_H
@@ -0,0 +1,126 @@
+/**
+ * @file PIHATKernels.h
+ * @brief Scalar and SIMD kernels summing PIHAT contributions over packed genotype rows
+ */
+
+#ifndef PIHAT_KERNELS_H
+#define PIHAT_KERNELS_H
+
+#include "Constants.h"
+#include "GenotypeTiling.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace PhasingEngine {
+
+/**
+ * @enum PIHATKernel
+ * @brief Instruction set used for the PIHAT sweep
+ */
+enum class PIHATKernel {
+    AUTO,       ///< Widest kernel the CPU supports
+    SCALAR,     ///< One relative at a time
+    AVX2,       ///< 8 relatives per 256-bit register
+    AVX512      ///< 16 relatives per 512-bit register
+};
+
+/**
+ * @struct PIHATSweep
+ * @brief Genome rows and per-SNP lookup tables of one focal individual
+ * @details tables[chr] holds three entries per SNP, the focal's contribution for
+ *          a relative carrying 0, 1 or 2 copies of the allele, and must be
+ *          readable for PIHATKernels::TABLE_PADDING floats past the last SNP.
+ *          For a batch each entry is focalStride floats, one per focal.
+ *          haplotypeTables[chr] holds the share of the focal's first haplotype
+ *          in each entry, with the same layout and padding.
+ *          Without a tile, kernels sum every SNP of every chromosome from zero.
+ *          With one they only sum the tile's SNPs and add them to the sums
+ *          already in their outputs, so visiting the tiles of a GenotypeTiling
+ *          in order gives the same floats as the whole-genome call.
+ */
+struct PIHATSweep {
+    int focalStride;
+    const unsigned char* buffers[Constants::NUM_CHROMOSOMES];
+    const float* tables[Constants::NUM_CHROMOSOMES];
+    size_t bytesPerIndividual[Constants::NUM_CHROMOSOMES];
+    int snpCounts[Constants::NUM_CHROMOSOMES];
+    /// Quantized tables: int16 entries for genotype codes 0-3 of each SNP, one scale per block of SNPs
+    const int16_t* quantizedTables[Constants::NUM_CHROMOSOMES];
+    const float* blockScales[Constants::NUM_CHROMOSOMES];
+    const float* haplotypeTables[Constants::NUM_CHROMOSOMES];
+    const GenotypeTile* tile;
+};
+
+namespace PIHATKernels {
+    /// Floats the SIMD kernels may read past the table of the last SNP
+    constexpr int TABLE_PADDING = 16;
+    /// Most focals scored in one pass over the genome store
+    constexpr int MAX_BATCH = 16;
+    /// Largest quantized entry: QUANTIZED_RUN of them still fit an int16 sum
+    constexpr int QUANTIZED_MAX = 8191;
+    constexpr int QUANTIZED_RUN = 4;
+    /// SNPs sharing one scale, a multiple of the 16 SNPs read per gather
+    constexpr int QUANTIZED_BLOCK_SNPS = 256;
+    /// Tiles of the float kernels start on a gathered 32-bit word
+    constexpr int TILE_SNP_ALIGNMENT = 16;
+    /// Indexed by the 2-bit genotype code rather than the dosage, so that a
+    /// 64-bit broadcast of a SNP's entries serves any lane's low code bits
+    constexpr int QUANTIZED_ENTRIES = 4;
+    /// Floats per relative in a decomposition: haplotypes 0 and 1 of chromosomes 1 to 22
+    constexpr int DECOMPOSITION_ENTRIES = 2 * (Constants::NUM_CHROMOSOMES - 1);
+
+    /**
+     * Each kernel writes the raw sum of relatives [firstRelative, firstRelative + count).
+     * Every relative is summed chromosome by chromosome in SNP order with plain
+     * float additions, one relative per lane, so all kernels give bit-identical results.
+     */
+    void sweepScalar(const PIHATSweep& sweep, int firstRelative, int count, float* pihat);
+    void sweepAVX2(const PIHATSweep& sweep, int firstRelative, int count, float* pihat);
+    void sweepAVX512(const PIHATSweep& sweep, int firstRelative, int count, float* pihat);
+
+    /**
+     * Decomposing kernels also write, for every relative, its sum over each
+     * chromosome against each focal haplotype to
+     * decomposition[r * DECOMPOSITION_ENTRIES + (chr - 1) * 2 + haplotype].
+     * The genome-wide sum in pihat is accumulated exactly as by the kernels
+     * above, so it stays bit-identical to theirs. Between the tiles of a
+     * chromosome, its two entries hold the running first-haplotype part and
+     * the genome-wide sum at the chromosome's start.
+     */
+    void sweepDecomposedScalar(const PIHATSweep& sweep, int firstRelative, int count, float* pihat, float* decomposition);
+    void sweepDecomposedAVX2(const PIHATSweep& sweep, int firstRelative, int count, float* pihat, float* decomposition);
+    void sweepDecomposedAVX512(const PIHATSweep& sweep, int firstRelative, int count, float* pihat, float* decomposition);
+
+    /**
+     * Batched kernels write the sum of relative r for focal slot b to
+     * pihat[r * focalStride + b]. Each genotype byte is decoded once and feeds
+     * focalStride accumulators, which the AVX2 kernel keeps in registers
+     * (focalStride must be a multiple of 8 there).
+     */
+    void sweepBatchScalar(const PIHATSweep& sweep, int firstRelative, int count, float* pihat);
+    void sweepBatchAVX2(const PIHATSweep& sweep, int firstRelative, int count, float* pihat);
+
+    /**
+     * Quantized kernels sum the int16 entries of each block of
+     * QUANTIZED_BLOCK_SNPS SNPs exactly in integers (int16 for QUANTIZED_RUN
+     * SNPs, then int32), and add block sum x block scale to a float with one
+     * fused multiply-add per block. Integer sums do not depend on the order of
+     * the additions, so all quantized kernels give bit-identical results. The
+     * AVX2 kernel scores 16 relatives per register and the AVX-512 kernel 32
+     * (AVX-512BW), twice the float kernels. Tiles must start on a block.
+     */
+    void sweepQuantizedScalar(const PIHATSweep& sweep, int firstRelative, int count, float* pihat);
+    void sweepQuantizedAVX2(const PIHATSweep& sweep, int firstRelative, int count, float* pihat);
+    void sweepQuantizedAVX512(const PIHATSweep& sweep, int firstRelative, int count, float* pihat);
+    int getQuantizedLaneCount(PIHATKernel kernel);
+
+    int getLaneCount(PIHATKernel kernel);
+    bool isSupported(PIHATKernel kernel);
+    PIHATKernel resolve(PIHATKernel requested);
+    bool parseKernel(const char* name, PIHATKernel& kernel);
+    const char* getKernelName(PIHATKernel kernel);
+}
+
+}
+
+#endif // PIHAT_KERNELS_H
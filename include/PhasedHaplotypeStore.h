@@ -0,0 +1,61 @@
+/**
+ * @file PhasedHaplotypeStore.h
+ * @brief Output buffer holding the phased genotypes of the individuals being phased
+ */
+
+#ifndef PHASED_HAPLOTYPE_STORE_H
+#define PHASED_HAPLOTYPE_STORE_H
+
+#include "Constants.h"
+#include <cstddef>
+#include <vector>
+
+namespace PhasingEngine {
+
+class GenomeDataManager;
+class LargeBufferAllocator;
+
+/**
+ * @class PhasedHaplotypeStore
+ * @brief One packed row per phased individual, separate from the input genomes
+ * @details Rows use the 2-bit layout of the genome buffers and are padded to a
+ *          whole byte, so no two individuals ever share a byte. Workers phasing
+ *          different individuals can therefore write their rows concurrently
+ *          without locking. A row starts as a copy of the unphased genotypes and
+ *          is marked committed once its individual has been phased.
+ */
+class PhasedHaplotypeStore {
+private:
+    GenomeDataManager* genomeDataManager;
+    LargeBufferAllocator* bufferAllocator;
+    unsigned char* rows[Constants::NUM_CHROMOSOMES];
+    size_t bytesPerRow[Constants::NUM_CHROMOSOMES];
+    std::vector<int> rowOfIndividual;
+    std::vector<int> individualOfRow;
+    std::vector<unsigned char> committedRows;
+
+    void releaseRows(int chromosome);
+    unsigned char* getRow(int chromosome, int individual) const;
+
+public:
+    explicit PhasedHaplotypeStore(GenomeDataManager* gdm);
+    virtual ~PhasedHaplotypeStore();
+
+    bool initialize(const std::vector<int>& individuals);
+    void beginIndividual(int individual);
+    void commitIndividual(int individual);
+
+    int getGenotype(int chromosome, int individual, int snpIndex) const;
+    void setGenotype(int chromosome, int individual, int snpIndex, int genotype);
+
+    bool contains(int individual) const;
+    bool isCommitted(int individual) const;
+    int getRowCount() const { return (int)individualOfRow.size(); }
+    int getIndividualOfRow(int row) const { return individualOfRow[row]; }
+    void setBufferAllocator(LargeBufferAllocator* allocator) { bufferAllocator = allocator; }
+    void reset();
+};
+
+}
+
+#endif // PHASED_HAPLOTYPE_STORE_H
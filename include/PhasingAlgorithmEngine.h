@@ -10,20 +10,36 @@
 #include "ChromosomeDivider.h"
 #include "Constants.h"
 #include <memory>
+#include <vector>
 
 namespace PhasingEngine {
 
 class GenomeDataManager;
 class RelativeIdentificationEngine;
+class PhasedHaplotypeStore;
+class PIHATEngine;
 
 /**
  * @class PhasingAlgorithmEngine
  * @brief Core phasing algorithm implementation with multiple strategies
+ * @details Relatives and windows are scored from the kinship decomposition of
+ *          the relative search, the PIHAT sums of every ranked relative per
+ *          chromosome and focal haplotype, so no genotype is read again here.
+ *          A relative related through one parent shares that parent's
+ *          haplotype on every chromosome: the difference between its two
+ *          haplotype sums on two chromosomes has the same sign across such
+ *          relatives when the first haplotypes of both come from the same
+ *          parent, and opposite signs otherwise. The decomposition has one
+ *          part per chromosome, so a chromosome is oriented as a whole: all
+ *          of its dividers take the same orientation, and a switch error
+ *          inside a chromosome is not corrected.
  */
 class PhasingAlgorithmEngine {
 private:
     GenomeDataManager* genomeDataManager;
     RelativeIdentificationEngine* relativeEngine;
+    PhasedHaplotypeStore* phasedStore;
+    PIHATEngine* pihatEngine;
     ChromosomeDivider chromosomeDividers[50][Constants::NUM_CHROMOSOMES][20];
     int chromosomeDividerCounts[51][Constants::NUM_CHROMOSOMES];
     float pihatThresholds[3];
@@ -31,20 +47,30 @@ private:
     int jobIdentifier;
     int relativeCount;
     int breakpointCount;
+    // The MAF depends only on the genome store, so it is loaded once per run
+    bool cohortMAFReady;
+    // Ranked relatives used for the current individual and the chromosomes
+    // whose haplotypes were swapped
+    std::vector<int> consideredRelatives;
+    bool chromosomeSwapped[Constants::NUM_CHROMOSOMES];
     
     std::unique_ptr<IPhasingStrategy> currentStrategy;
     
     void initializeChromosomeDividers();
     void loadGenomeOffspringData(int individualID, int parent1ID, int parent2ID);
     void processPhasingCorrections(int individualID, int relativeID);
+    void collectConsideredRelatives();
+    double getHaplotypeBalance(const float* parts, int chromosome) const;
     void mergeChromosomeWindows(int breakpointIndex);
     void applyPhasingToGenome(int individualID, int breakpointIndex);
+    /// Writes to correlationMatrix[0] the cosine of the two chromosomes' haplotype balances over the relatives
     void computeCorrelationMatrix(int chromosome1, int chromosome2, 
                                  double* correlationMatrix) const;
     void optimizeWindowMerging(int breakpointIndex);
     
 public:
-    PhasingAlgorithmEngine(GenomeDataManager* gdm, RelativeIdentificationEngine* rie);
+    PhasingAlgorithmEngine(GenomeDataManager* gdm, RelativeIdentificationEngine* rie,
+                           PhasedHaplotypeStore* store, PIHATEngine* pihat);
     virtual ~PhasingAlgorithmEngine();
     
     bool loadSegment(int individualID, int trioNumber, int parent1ID, int parent2ID,
@@ -58,12 +84,15 @@ public:
     
     void setPhasingStrategy(std::unique_ptr<IPhasingStrategy> strategy);
     void setVerboseOutput(bool enabled) { verboseOutput = enabled; }
+    void setRelativeEngine(RelativeIdentificationEngine* rie) { relativeEngine = rie; cohortMAFReady = false; }
     bool isVerboseOutput() const { return verboseOutput; }
     
     ChromosomeDivider* getChromosomeDivider(int sizeIndex, int chromosome, int window);
     int getChromosomeDividerCount(int sizeIndex, int chromosome) const;
     void setChromosomeDividerCount(int sizeIndex, int chromosome, int count);
     
+    int getConsideredRelativeCount() const { return (int)consideredRelatives.size(); }
+    
     void setRelativeCount(int count) { relativeCount = count; }
     int getRelativeCount() const { return relativeCount; }
     void setBreakpointCount(int count) { breakpointCount = count; }
@@ -0,0 +1,94 @@
+/**
+ * @file RelationshipClassifier.h
+ * @brief Relationship degree of ranked relatives from IBS0 and IBS2 counts
+ */
+
+#ifndef RELATIONSHIP_CLASSIFIER_H
+#define RELATIONSHIP_CLASSIFIER_H
+
+#include "Constants.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace PhasingEngine {
+
+class GenomeDataManager;
+struct RelativeCandidate;
+
+/**
+ * @enum RelationshipDegree
+ * @brief Relationship inferred between a focal and one of its relatives
+ */
+enum class RelationshipDegree {
+    UNRELATED,          ///< Kinship below the third-degree range
+    THIRD_DEGREE,       ///< First cousins and the like
+    SECOND_DEGREE,      ///< Half siblings, grandparents, avuncular
+    FULL_SIBLING,       ///< First degree with opposite homozygotes
+    PARENT_OFFSPRING,   ///< First degree without opposite homozygotes
+    DUPLICATE           ///< The focal itself or a monozygotic twin
+};
+
+/**
+ * @struct RelativeClass
+ * @brief Identity-by-state counts of a focal-relative pair and its degree
+ */
+struct RelativeClass {
+    int relativeID;
+    int ibs0;           ///< SNPs where the two are opposite homozygotes
+    int ibs2;           ///< SNPs where the two genotypes are identical
+    int snpCount;
+    float kinship;      ///< KING-robust phi
+    RelationshipDegree degree;
+};
+
+/**
+ * @class RelationshipClassifier
+ * @brief Tells parent-offspring from siblings and distant relatives
+ * @details PIHAT ranks relatives but does not separate a parent from a full
+ *          sibling. For every ranked relative the classifier counts, 32 SNPs
+ *          per 64-bit word of the genome store, the opposite homozygotes
+ *          (IBS0), identical genotypes (IBS2) and shared heterozygotes, with the
+ *          KinshipCounts step KingRelativeFinder uses. Kinship
+ *          is the KING-robust phi = (N(Aa,Aa) - 2 IBS0) / (N(Aa)_f + N(Aa)_r),
+ *          and the degree follows the KING ranges: above 2^-1.5 duplicate,
+ *          above 2^-2.5 first degree, above 2^-3.5 second, above 2^-4.5 third.
+ *          A parent and child always share an allele, so first-degree pairs
+ *          with an IBS0 rate under PARENT_OFFSPRING_MAX_IBS0 are parent-offspring
+ *          and the others full siblings, who are IBD0 on a quarter of the genome.
+ *          Only the ranked relatives are read, a few rows per focal, so the
+ *          cost stays far below that of the sweep that ranked them.
+ */
+class RelationshipClassifier {
+private:
+    GenomeDataManager* genomeDataManager;
+    // Focal genotype words of every swept chromosome, one after the other
+    std::vector<uint64_t> focalWords;
+    size_t wordOffsets[Constants::NUM_CHROMOSOMES];
+
+    int focalCount;
+    double relativeCount;
+    double classifySeconds;
+    double degreeCounts[6];
+
+public:
+    /// Largest IBS0 rate of a parent-offspring pair, genotyping errors included
+    static constexpr float PARENT_OFFSPRING_MAX_IBS0 = 0.005f;
+
+    explicit RelationshipClassifier(GenomeDataManager* gdm);
+    virtual ~RelationshipClassifier() = default;
+
+    /// Counts and classifies the focal against each listed relative, in order,
+    /// skipping the focal itself
+    void classify(int focalIndividual, const std::vector<RelativeCandidate>& relatives,
+                  std::vector<RelativeClass>& classes);
+    static RelationshipDegree classifyCounts(float kinship, int ibs0, int snpCount);
+    static const char* getDegreeName(RelationshipDegree degree);
+
+    double getClassifiedCount() const { return relativeCount; }
+    void printReport() const;
+};
+
+}
+
+#endif // RELATIONSHIP_CLASSIFIER_H
@@ -8,25 +8,66 @@
 
 #include "Interfaces.h"
 #include "Constants.h"
+#include "RelationshipClassifier.h"
+#include <vector>
 
 namespace PhasingEngine {
 
+class PIHATEngine;
+class RelativeIndex;
+class MinHashIndex;
+class KinshipCache;
+
+/**
+ * @enum RelativeEstimator
+ * @brief Kinship estimator behind the relative search
+ */
+enum class RelativeEstimator {
+    PIHAT,          ///< MAF-weighted genome-wide PIHAT sweep
+    KING_ROBUST     ///< KING-robust kinship from genotype bit-plane popcounts
+};
+
+/**
+ * @struct RelativeCandidate
+ * @brief A relative of the focal individual and its PIHAT
+ */
+struct RelativeCandidate {
+    int relativeID;
+    float pihat;
+};
+
 /**
  * @class RelativeIdentificationEngine
  * @brief Advanced relative identification using PIHAT computation
  * @implements IRelativeFinder
+ * @details Only the K best relatives are ranked (K = 100 unless set with
+ *          setTopRelativeCount()). They are kept in bounded heaps while the
+ *          PIHAT vector is scanned, so ranking costs O(N log K) instead of
+ *          sorting every candidate.
  */
 class RelativeIdentificationEngine : public IRelativeFinder {
+protected:
+    std::vector<float> pihatMatrix;
+    bool isComputed;
+    
 private:
-    float pihatMatrix[Constants::MAXPOP];
-    float pihatMatrixSecondary[Constants::MAXPOP];
-    int bestRelativeIDs[100];
+    std::vector<float> pihatMatrixSecondary;
+    std::vector<RelativeCandidate> topRelatives;
+    int topRelativeCount;
     int primaryBestRelativeID;
     int secondaryBestRelativeID;
     int firstConsiderationIndex;
-    bool isComputed;
+    int focalIndividual;
+    PIHATEngine* pihatEngine;
+    const RelativeIndex* relativeIndex;
+    MinHashIndex* candidateIndex;
+    KinshipCache* kinshipCache;
+    RelationshipClassifier* classifier;
+    std::vector<RelativeClass> relativeClasses;
+    std::vector<int> candidates;
+    std::vector<float> exhaustivePIHAT;
     
-    void sortRelativesByPIHAT();
+    void selectBestRelatives();
     void updateBestRelativeRankings();
     
 public:
@@ -39,9 +80,31 @@ public:
     virtual int getBestRelativeID(int rank) const override;
     virtual float getPIHATValue(int individualID) const override;
     
+    virtual RelativeEstimator getEstimator() const { return RelativeEstimator::PIHAT; }
+    /// Relative x SNP pairs per second of the last focal's sweep, 0 when no sweep ran for it
+    virtual double getLastThroughput() const;
+    virtual void printThroughputReport() const;
+    static bool parseEstimator(const char* name, RelativeEstimator& estimator);
+    static const char* getEstimatorName(RelativeEstimator estimator);
+    
     // Extended interface
+    void resize(int numberOfIndividuals);
+    void setPIHATEngine(PIHATEngine* engine) { pihatEngine = engine; }
+    /// A precomputed index replaces the genome-wide sweep for the focals it covers
+    void setRelativeIndex(const RelativeIndex* index) { relativeIndex = index; }
+    bool hasRelativeIndex() const { return relativeIndex != nullptr; }
+    /// Restricts the exact sweep to the focal's MinHash candidates
+    void setCandidateIndex(MinHashIndex* index) { candidateIndex = index; }
+    /// Serves pairs of earlier focals from their rows; only the rest is swept
+    void setKinshipCache(KinshipCache* cache) { kinshipCache = cache; }
+    /// Classifies the ranked relatives of every focal by relationship degree
+    void setRelationshipClassifier(RelationshipClassifier* relationshipClassifier) { classifier = relationshipClassifier; }
+    void setFocalIndividual(int individualID) { focalIndividual = individualID; }
+    int getFocalIndividual() const { return focalIndividual; }
+    int getNumberOfIndividuals() const { return (int)pihatMatrix.size(); }
     void reset();
     void accumulatePIHAT(int relativeID, float contribution);
+    void setPIHAT(int relativeID, float value);
     void setPIHAT2(int relativeID, float value);
     float getPIHAT2(int relativeID) const;
     
@@ -49,6 +112,27 @@ public:
     int getSecondaryBestRelativeID() const { return secondaryBestRelativeID; }
     int getFirstConsiderationIndex() const { return firstConsiderationIndex; }
     
+    /// Relatives ranked by identifyBestRelatives(), at least 1
+    void setTopRelativeCount(int count) { topRelativeCount = count < 1 ? 1 : count; }
+    int getTopRelativeCount() const { return topRelativeCount; }
+    /// Ranked relatives above PIHAT 0.1, best first
+    const std::vector<RelativeCandidate>& getTopRelatives() const { return topRelatives; }
+    /// Counts and degree of each ranked relative, same order; empty without a classifier
+    const std::vector<RelativeClass>& getRelativeClasses() const { return relativeClasses; }
+    /**
+     * Raw PIHAT sums of a relative of the focal per chromosome and focal
+     * haplotype, entry (chr - 1) * 2 + haplotype, when the PIHAT engine
+     * decomposes; every ranked relative has one. nullptr otherwise.
+     */
+    const float* getKinshipDecomposition(int relativeID) const;
+    
+    /**
+     * Writes the k relatives with the highest value above minimum to best,
+     * best first with ties broken by the lower ID. NaN values are skipped.
+     */
+    static void selectTopRelatives(const float* pihat, int count, int k, float minimum,
+                                   std::vector<RelativeCandidate>& best);
+    
     int getRelativeCountAboveThreshold(float threshold) const;
     bool hasComputed() const { return isComputed; }
 };
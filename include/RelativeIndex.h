@@ -0,0 +1,84 @@
+/**
+ * @file RelativeIndex.h
+ * @brief Persisted top-K relatives of every individual, memory-mapped at run time
+ */
+
+#ifndef RELATIVE_INDEX_H
+#define RELATIVE_INDEX_H
+
+#include "Constants.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace PhasingEngine {
+
+class GenomeDataManager;
+class PIHATEngine;
+
+/**
+ * @struct RelativeIndexHeader
+ * @brief Fixed-size header at the start of an index file
+ */
+struct RelativeIndexHeader {
+    char magic[8];                  ///< "PHRELIDX"
+    uint32_t version;
+    uint32_t topK;                  ///< Entries stored per individual
+    int64_t numberOfIndividuals;
+    int64_t snpCount;               ///< SNPs swept per relative, guards against another panel
+    uint64_t genotypeFingerprint;   ///< Hash of every genome row, guards against another cohort of the same shape
+};
+
+/**
+ * @struct RelativeIndexEntry
+ * @brief One relative of an individual and its normalized PIHAT
+ */
+struct RelativeIndexEntry {
+    int32_t relativeID;             ///< -1 pads lists of cohorts smaller than topK
+    float pihat;
+};
+
+/**
+ * @class RelativeIndex
+ * @brief All-vs-all kinship reduced to the K best relatives of each individual
+ * @details The header is followed by numberOfIndividuals lists of topK entries,
+ *          each sorted by decreasing PIHAT (ties by relative ID). Every list
+ *          includes the individual itself, as the genome-wide sweep does. The
+ *          file is written once by build() and mapped read-only by open(), so
+ *          looking up a focal costs one page fault instead of a genome pass.
+ */
+class RelativeIndex {
+private:
+    GenomeDataManager* genomeDataManager;
+    unsigned char* mapping;
+    size_t mappingBytes;
+    const RelativeIndexHeader* header;
+    const RelativeIndexEntry* entries;
+
+    static const char MAGIC[8];
+    static const uint32_t VERSION = 2;
+
+    int64_t computeSNPCount() const;
+    uint64_t computeGenotypeFingerprint() const;
+
+public:
+    /// PIHAT given to relatives that are not in a focal's list
+    static constexpr float UNLISTED_PIHAT = -1.0f;
+
+    explicit RelativeIndex(GenomeDataManager* gdm);
+    virtual ~RelativeIndex();
+
+    bool build(const std::string& path, int topK, PIHATEngine* pihatEngine);
+    bool open(const std::string& path);
+    void close();
+
+    bool isOpen() const { return mapping != nullptr; }
+    int getTopK() const { return header != nullptr ? (int)header->topK : 0; }
+    const RelativeIndexEntry* getRelatives(int individual) const;
+    bool fillPIHAT(int individual, std::vector<float>& pihat) const;
+};
+
+}
+
+#endif // RELATIVE_INDEX_H
@@ -19,7 +19,7 @@
  * @param file File pointer to read from
  * @return The integer read, or INT32_MAX if EOF is reached
  */
-INT readinteger(FILE * file)
+inline INT readinteger(FILE * file)
 {	
     INT ID = 0;
     char carac;
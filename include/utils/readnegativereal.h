@@ -22,7 +22,7 @@
  * @param file File pointer to read from
  * @return The floating point number read, or FLT_MAX if EOF is reached
  */
-double readnegativereal(FILE * file)
+inline double readnegativereal(FILE * file)
 {	
     double ID = 0;
     char carac;
@@ -21,7 +21,7 @@
  * @param file File pointer to read from
  * @return The floating point number read, or FLT_MAX if EOF is reached
  */
-float readreal(FILE * file)
+inline float readreal(FILE * file)
 {	
     float ID = 0;
     char carac;
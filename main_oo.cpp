@@ -39,6 +39,29 @@ int main(int argc, char* argv[]) {
             std::cerr << "  -PathOutput <path>    : Output file path prefix" << std::endl;
             std::cerr << "  -PathMAF <path>       : MAF file path (optional)" << std::endl;
             std::cerr << "  -Verbose <0|1>        : Enable verbose output" << std::endl;
+            std::cerr << "  -NumaPolicy <policy>  : none, firsttouch or interleave" << std::endl;
+            std::cerr << "  -PinThreads <0|1>     : Pin OpenMP threads to CPUs" << std::endl;
+            std::cerr << "  -HugePages <mode>     : none, thp or hugetlb" << std::endl;
+            std::cerr << "  -MaxMemory <size>     : Memory budget, e.g. 64G (MB if no unit)" << std::endl;
+            std::cerr << "  -ScratchPath <dir>    : Directory for out-of-core buffers" << std::endl;
+            std::cerr << "  -PIHATKernel <kernel> : auto, scalar, avx2 or avx512" << std::endl;
+            std::cerr << "  -PIHATBatch <1-16>    : Focal individuals per genome pass" << std::endl;
+            std::cerr << "  -BuildRelativeIndex <file> : Write the top relatives of everyone and exit" << std::endl;
+            std::cerr << "  -RelativeIndexTopK <K>: Relatives kept per individual (default 100)" << std::endl;
+            std::cerr << "  -RelativeIndex <file> : Use a prebuilt relative index" << std::endl;
+            std::cerr << "  -TopRelatives <K>     : Relatives ranked per individual (default 100)" << std::endl;
+            std::cerr << "  -PIHATScreen <N>      : Screen relatives on one SNP in N (0 = off)" << std::endl;
+            std::cerr << "  -PIHATScreenThreshold <pihat>: Lowest PIHAT kept exact (default 0.022)" << std::endl;
+            std::cerr << "  -PIHATScreenAudit <0|1>: Also sweep every pair exactly and count pairs the screen lost" << std::endl;
+            std::cerr << "  -RelativeFinder <pihat|king>: Kinship estimator of the relative search (default pihat)" << std::endl;
+            std::cerr << "  -LSHBands <b>         : MinHash bands for candidate relatives (0 = exhaustive)" << std::endl;
+            std::cerr << "  -LSHRows <r>          : MinHash values per band (default 2)" << std::endl;
+            std::cerr << "  -LSHBlockSNPs <n>     : SNPs per MinHash block (default 10000)" << std::endl;
+            std::cerr << "  -LSHRecall <pihat>    : Report candidate recall against the exhaustive sweep" << std::endl;
+            std::cerr << "  -PIHATQuantized <0|1> : Sum int16 fixed-point PIHAT contributions (default: 0)" << std::endl;
+            std::cerr << "  -KinshipCache <size>  : Reuse PIHAT rows of earlier focals, e.g. 4G (0 = off)" << std::endl;
+            std::cerr << "  -RelativeDegrees <0|1>: Classify ranked relatives by degree (default: 1)" << std::endl;
+            std::cerr << "  -KinshipDecomposition <0|1>: Split PIHAT by chromosome and haplotype (default: 1)" << std::endl;
             return 1;
         }
         
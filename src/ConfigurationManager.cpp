@@ -5,6 +5,8 @@
 
 #include "../include/ConfigurationManager.h"
 #include "../include/Constants.h"
+#include "../include/MemoryBudgetPlanner.h"
+#include "../include/MinHashIndex.h"
 #include <cstring>
 #include <cstdio>
 
@@ -13,7 +15,13 @@ using namespace PhasingEngine::Constants;
 
 ConfigurationManager::ConfigurationManager()
     : numberOfIndividuals(0), verboseMode(true), algorithmVersion(2),
-      pihatThreshold(DEFAULT_PIHAT_THRESHOLD) {
+      pihatThreshold(DEFAULT_PIHAT_THRESHOLD),
+      numaPlacementPolicy(NumaPlacementPolicy::FIRST_TOUCH), pinThreads(false),
+      hugePagePolicy(HugePagePolicy::TRANSPARENT), maxMemoryBytes(0),
+      pihatKernel(PIHATKernel::AUTO), pihatBatchSize(8),
+      relativeIndexTopK(100), topRelativeCount(100),
+      pihatScreenStride(0), pihatScreenThreshold(0.022f), pihatScreenAudit(false), pihatQuantized(false), kinshipCacheBytes(0), relativeDegrees(true), kinshipDecomposition(true), relativeEstimator(RelativeEstimator::PIHAT),
+      lshBandCount(0), lshRowsPerBand(2), lshBlockSNPCount(10000), lshRecallAudit(false), lshRecallThreshold(0.1f) {
 }
 
 bool ConfigurationManager::parseCommandLineArguments(int argc, char* argv[]) {
@@ -28,6 +36,71 @@ bool ConfigurationManager::parseCommandLineArguments(int argc, char* argv[]) {
             mafFilePath = std::string(argv[++i]);
         } else if(strncmp(argv[i], "-Verbose", strlen("-Verbose")) == 0 && i < argc - 1) {
             verboseMode = (atoi(argv[++i]) != 0);
+        } else if(strncmp(argv[i], "-NumaPolicy", strlen("-NumaPolicy")) == 0 && i < argc - 1) {
+            if(!NumaTopology::parsePlacementPolicy(argv[++i], numaPlacementPolicy)) {
+                printf("ERROR: Unknown NUMA policy %s (expected none, firsttouch or interleave)\n", argv[i]);
+                return false;
+            }
+        } else if(strncmp(argv[i], "-PinThreads", strlen("-PinThreads")) == 0 && i < argc - 1) {
+            pinThreads = (atoi(argv[++i]) != 0);
+        } else if(strncmp(argv[i], "-HugePages", strlen("-HugePages")) == 0 && i < argc - 1) {
+            if(!LargeBufferAllocator::parseHugePagePolicy(argv[++i], hugePagePolicy)) {
+                printf("ERROR: Unknown huge page mode %s (expected none, thp or hugetlb)\n", argv[i]);
+                return false;
+            }
+        } else if(strncmp(argv[i], "-MaxMemory", strlen("-MaxMemory")) == 0 && i < argc - 1) {
+            if(!MemoryBudgetPlanner::parseMemorySize(argv[++i], maxMemoryBytes)) {
+                printf("ERROR: Invalid memory size %s (expected e.g. 64G, 512M or megabytes)\n", argv[i]);
+                return false;
+            }
+        } else if(strncmp(argv[i], "-ScratchPath", strlen("-ScratchPath")) == 0 && i < argc - 1) {
+            scratchPath = std::string(argv[++i]);
+        } else if(strncmp(argv[i], "-PIHATKernel", strlen("-PIHATKernel")) == 0 && i < argc - 1) {
+            if(!PIHATKernels::parseKernel(argv[++i], pihatKernel)) {
+                printf("ERROR: Unknown PIHAT kernel %s (expected auto, scalar, avx2 or avx512)\n", argv[i]);
+                return false;
+            }
+        } else if(strncmp(argv[i], "-PIHATBatch", strlen("-PIHATBatch")) == 0 && i < argc - 1) {
+            pihatBatchSize = atoi(argv[++i]);
+        } else if(strncmp(argv[i], "-RelativeIndexTopK", strlen("-RelativeIndexTopK")) == 0 && i < argc - 1) {
+            relativeIndexTopK = atoi(argv[++i]);
+        } else if(strncmp(argv[i], "-RelativeIndex", strlen("-RelativeIndex")) == 0 && i < argc - 1) {
+            relativeIndexPath = std::string(argv[++i]);
+        } else if(strncmp(argv[i], "-BuildRelativeIndex", strlen("-BuildRelativeIndex")) == 0 && i < argc - 1) {
+            relativeIndexBuildPath = std::string(argv[++i]);
+        } else if(strncmp(argv[i], "-TopRelatives", strlen("-TopRelatives")) == 0 && i < argc - 1) {
+            topRelativeCount = atoi(argv[++i]);
+        } else if(strncmp(argv[i], "-PIHATScreenAudit", strlen("-PIHATScreenAudit")) == 0 && i < argc - 1) {
+            pihatScreenAudit = atoi(argv[++i]) != 0;
+        } else if(strncmp(argv[i], "-PIHATScreenThreshold", strlen("-PIHATScreenThreshold")) == 0 && i < argc - 1) {
+            pihatScreenThreshold = (float)atof(argv[++i]);
+        } else if(strncmp(argv[i], "-PIHATScreen", strlen("-PIHATScreen")) == 0 && i < argc - 1) {
+            pihatScreenStride = atoi(argv[++i]);
+        } else if(strncmp(argv[i], "-PIHATQuantized", strlen("-PIHATQuantized")) == 0 && i < argc - 1) {
+            pihatQuantized = atoi(argv[++i]) != 0;
+        } else if(strncmp(argv[i], "-RelativeDegrees", strlen("-RelativeDegrees")) == 0 && i < argc - 1) {
+            relativeDegrees = atoi(argv[++i]) != 0;
+        } else if(strncmp(argv[i], "-KinshipDecomposition", strlen("-KinshipDecomposition")) == 0 && i < argc - 1) {
+            kinshipDecomposition = atoi(argv[++i]) != 0;
+        } else if(strncmp(argv[i], "-KinshipCache", strlen("-KinshipCache")) == 0 && i < argc - 1) {
+            if(!MemoryBudgetPlanner::parseMemorySize(argv[++i], kinshipCacheBytes)) {
+                printf("ERROR: Invalid memory size %s (expected e.g. 4G, 512M or megabytes)\n", argv[i]);
+                return false;
+            }
+        } else if(strncmp(argv[i], "-RelativeFinder", strlen("-RelativeFinder")) == 0 && i < argc - 1) {
+            if(!RelativeIdentificationEngine::parseEstimator(argv[++i], relativeEstimator)) {
+                printf("ERROR: Unknown relative finder %s (expected pihat or king)\n", argv[i]);
+                return false;
+            }
+        } else if(strncmp(argv[i], "-LSHBands", strlen("-LSHBands")) == 0 && i < argc - 1) {
+            lshBandCount = atoi(argv[++i]);
+        } else if(strncmp(argv[i], "-LSHRows", strlen("-LSHRows")) == 0 && i < argc - 1) {
+            lshRowsPerBand = atoi(argv[++i]);
+        } else if(strncmp(argv[i], "-LSHBlockSNPs", strlen("-LSHBlockSNPs")) == 0 && i < argc - 1) {
+            lshBlockSNPCount = atoi(argv[++i]);
+        } else if(strncmp(argv[i], "-LSHRecall", strlen("-LSHRecall")) == 0 && i < argc - 1) {
+            lshRecallAudit = true;
+            lshRecallThreshold = (float)atof(argv[++i]);
         }
     }
     return validateConfiguration();
@@ -42,6 +115,57 @@ bool ConfigurationManager::validateConfiguration() const {
         printf("ERROR: Number of individuals exceeds maximum (%d)\n", NBINDIVMAX);
         return false;
     }
+    if(pihatBatchSize < 1 || pihatBatchSize > PIHATKernels::MAX_BATCH) {
+        printf("ERROR: PIHAT batch size must be between 1 and %d\n", PIHATKernels::MAX_BATCH);
+        return false;
+    }
+    if(relativeIndexTopK < 1) {
+        printf("ERROR: -RelativeIndexTopK must be at least 1\n");
+        return false;
+    }
+    if(topRelativeCount < 1) {
+        printf("ERROR: -TopRelatives must be at least 1\n");
+        return false;
+    }
+    if(relativeEstimator != RelativeEstimator::PIHAT
+       && (!relativeIndexPath.empty() || !relativeIndexBuildPath.empty())) {
+        printf("ERROR: The relative index holds PIHAT values and needs -RelativeFinder pihat\n");
+        return false;
+    }
+    if(lshBandCount < 0 || lshRowsPerBand < 1) {
+        printf("ERROR: -LSHBands must be 0 (off) or positive and -LSHRows at least 1\n");
+        return false;
+    }
+    if(lshBlockSNPCount < MinHashIndex::SHINGLE_SNPS) {
+        printf("ERROR: -LSHBlockSNPs must be at least %d\n", MinHashIndex::SHINGLE_SNPS);
+        return false;
+    }
+    if(lshBandCount > 0 && (relativeEstimator != RelativeEstimator::PIHAT || !relativeIndexPath.empty()
+                            || !relativeIndexBuildPath.empty() || pihatScreenStride > 0)) {
+        printf("ERROR: -LSHBands verifies candidates with the exact PIHAT sweep and cannot be combined with "
+               "-RelativeFinder king, the relative index or -PIHATScreen\n");
+        return false;
+    }
+    if(pihatScreenStride < 0) {
+        printf("ERROR: -PIHATScreen must be 0 (off) or a positive SNP stride\n");
+        return false;
+    }
+    if(pihatScreenAudit && pihatScreenStride == 0) {
+        printf("ERROR: -PIHATScreenAudit checks the screen and needs -PIHATScreen\n");
+        return false;
+    }
+    if(pihatQuantized && (pihatScreenStride > 0 || relativeEstimator != RelativeEstimator::PIHAT
+                          || !relativeIndexBuildPath.empty())) {
+        printf("ERROR: -PIHATQuantized replaces the float PIHAT sweep and cannot be combined with "
+               "-PIHATScreen, -RelativeFinder king or -BuildRelativeIndex (the index stores exact values)\n");
+        return false;
+    }
+    if(kinshipCacheBytes > 0 && (pihatScreenStride > 0 || lshBandCount > 0 || relativeEstimator != RelativeEstimator::PIHAT
+                                 || !relativeIndexPath.empty())) {
+        printf("ERROR: -KinshipCache reuses exact PIHAT rows and cannot be combined with -PIHATScreen, -LSHBands, "
+               "-RelativeFinder king or -RelativeIndex\n");
+        return false;
+    }
     if(inputPath.empty()) {
         printf("ERROR: Input path not specified\n");
         return false;
@@ -54,3 +178,15 @@ bool ConfigurationManager::validateConfiguration() const {
 }
 
 
+
+std::string ConfigurationManager::getScratchPath() const {
+    if(!scratchPath.empty()) {
+        return scratchPath;
+    }
+    // Default to the directory of the output prefix
+    size_t slash = outputPath.find_last_of('/');
+    if(slash == std::string::npos) {
+        return ".";
+    }
+    return slash == 0 ? "/" : outputPath.substr(0, slash);
+}
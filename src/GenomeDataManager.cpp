@@ -7,21 +7,27 @@
 #include "../include/GenomeFileLoader.h"
 #include "../include/Exceptions.h"
 #include "../include/ErrorCodes.h"
+#include "../include/LargeBufferAllocator.h"
 #include <cstdlib>
 #include <cstring>
 #include <omp.h>
 #include <string>
+#include <vector>
 
 using namespace PhasingEngine;
 using namespace PhasingEngine::Constants;
 using namespace PhasingEngine::ErrorCodes;
 
+const int GenomeDataManager::CONTRIBUTION_ENTRIES;
+const int GenomeDataManager::HAPLOTYPE_CONTRIBUTION_ENTRIES;
+
 GenomeDataManager::GenomeDataManager() 
-    : numberOfIndividuals(0), isInitialized(false) {
+    : numberOfIndividuals(0), isInitialized(false), bufferAllocator(nullptr) {
     for(int i = 0; i < NUM_CHROMOSOMES; i++) {
         genomes[i] = nullptr;
         snpCountPerChromosome[i] = 0;
         snpCountInFile[i] = 0;
+        contributionTableValid[i] = false;
     }
     for(int i = 0; i < NSNPPERCHR; i++) {
         for(int j = 0; j < NUM_CHROMOSOMES; j++) {
@@ -33,13 +39,22 @@ GenomeDataManager::GenomeDataManager()
 
 GenomeDataManager::~GenomeDataManager() {
     for(int i = 0; i < NUM_CHROMOSOMES; i++) {
-        if(genomes[i] != nullptr) {
-            free(genomes[i]);
-            genomes[i] = nullptr;
-        }
+        releaseGenomeBuffer(i);
     }
 }
 
+void GenomeDataManager::releaseGenomeBuffer(int chromosome) {
+    if(genomes[chromosome] == nullptr) {
+        return;
+    }
+    if(bufferAllocator != nullptr && bufferAllocator->owns(genomes[chromosome])) {
+        bufferAllocator->release(genomes[chromosome]);
+    } else {
+        free(genomes[chromosome]);
+    }
+    genomes[chromosome] = nullptr;
+}
+
 void GenomeDataManager::validateChromosomeIndex(int chromosome) const {
     if(chromosome < 1 || chromosome >= NUM_CHROMOSOMES) {
         throw PhasingException("Invalid chromosome index: " + std::to_string(chromosome),
@@ -63,9 +78,12 @@ void GenomeDataManager::validateSNPIndex(int chromosome, int snpIndex) const {
 }
 
 size_t GenomeDataManager::calculateGenomeBufferSize(int chromosome) const {
+    return getBytesPerIndividual(chromosome) * numberOfIndividuals;
+}
+
+size_t GenomeDataManager::getBytesPerIndividual(int chromosome) const {
     int snpCount = snpCountPerChromosome[chromosome];
-    size_t bytesPerIndividual = (snpCount / 4) + ((snpCount % 4) > 0 ? 1 : 0);
-    return bytesPerIndividual * numberOfIndividuals;
+    return (snpCount / 4) + ((snpCount % 4) > 0 ? 1 : 0);
 }
 
 bool GenomeDataManager::initializeChromosome(int chromosome, int snpCount, int nbIndiv) {
@@ -80,11 +98,15 @@ bool GenomeDataManager::initializeChromosome(int chromosome, int snpCount, int n
         numberOfIndividuals = nbIndiv;
         
         size_t bufferSize = calculateGenomeBufferSize(chromosome);
-        if(genomes[chromosome] != nullptr) {
-            free(genomes[chromosome]);
-        }
+        releaseGenomeBuffer(chromosome);
         
-        genomes[chromosome] = (unsigned char*)calloc(bufferSize, sizeof(unsigned char));
+        if(bufferAllocator != nullptr) {
+            genomes[chromosome] = bufferAllocator->allocate(bufferSize, getBytesPerIndividual(chromosome),
+                                                            numberOfIndividuals,
+                                                            "genome chr " + std::to_string(chromosome));
+        } else {
+            genomes[chromosome] = (unsigned char*)calloc(bufferSize, sizeof(unsigned char));
+        }
         if(genomes[chromosome] == nullptr) {
             throw PhasingException("Memory allocation failed for chromosome " + std::to_string(chromosome),
                                   ErrorCodes::PhasingError::MEMORY_ALLOCATION_FAILED);
@@ -134,6 +156,13 @@ void GenomeDataManager::setGenotype(int chromosome, int individual, int snpIndex
     *bytePtr = (*bytePtr & (~(3 << bitShift))) | ((genotype & 3) << bitShift);
 }
 
+int GenomeDataManager::getSNPCount(int chromosome) const {
+    if(chromosome >= 1 && chromosome < NUM_CHROMOSOMES) {
+        return snpCountInFile[chromosome];
+    }
+    return 0;
+}
+
 bool GenomeDataManager::isValidChromosome(int chromosome) const {
     return chromosome >= 1 && chromosome < NUM_CHROMOSOMES;
 }
@@ -150,23 +179,94 @@ void GenomeDataManager::computeMAFForChromosome(int chromosome) {
         minorAlleleFrequency[snp][chromosome] = 0;
     }
     
-    #pragma omp parallel for
-    for(int snp = 0; snp < snpCountInFile[chromosome]; snp++) {
+    if(genomes[chromosome] == nullptr) {
+        return;
+    }
+    
+    // Each thread streams a contiguous block of individual rows into private
+    // counts, so the genome buffer is read once in memory order
+    int snpCount = snpCountInFile[chromosome];
+    size_t bytesPerIndividual = getBytesPerIndividual(chromosome);
+    #pragma omp parallel
+    {
+        std::vector<int> alleleCounts(snpCount, 0);
+        #pragma omp for schedule(static)
         for(int individual = 0; individual < numberOfIndividuals; individual++) {
-            int genotype = getGenotype(chromosome, individual, snp);
-            minorAlleleFrequency[snp][chromosome] += (genotype >> 1) + (genotype & 1);
+            const unsigned char* row = genomes[chromosome] + (size_t)individual * bytesPerIndividual;
+            for(int snp = 0; snp < snpCount; snp++) {
+                int genotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+                alleleCounts[snp] += (genotype >> 1) + (genotype & 1);
+            }
+        }
+        #pragma omp critical
+        for(int snp = 0; snp < snpCount; snp++) {
+            minorAlleleFrequency[snp][chromosome] += alleleCounts[snp];
         }
     }
+    contributionTableValid[chromosome] = false;
+}
+
+const float* GenomeDataManager::getContributionTable(int chromosome) {
+    validateChromosomeIndex(chromosome);
+    if(!contributionTableValid[chromosome]) {
+        buildContributionTables(chromosome);
+    }
+    return contributionTables[chromosome].data();
+}
+
+const float* GenomeDataManager::getHaplotypeContributionTable(int chromosome) {
+    validateChromosomeIndex(chromosome);
+    if(!contributionTableValid[chromosome]) {
+        buildContributionTables(chromosome);
+    }
+    return haplotypeContributionTables[chromosome].data();
+}
+
+void GenomeDataManager::buildContributionTables(int chromosome) {
+    int snpCount = snpCountInFile[chromosome];
+    contributionTables[chromosome].assign((size_t)snpCount * CONTRIBUTION_ENTRIES, 0.0f);
+    haplotypeContributionTables[chromosome].assign((size_t)snpCount * HAPLOTYPE_CONTRIBUTION_ENTRIES, 0.0f);
+    float* table = contributionTables[chromosome].data();
+    float* haplotypeTable = haplotypeContributionTables[chromosome].data();
+    #pragma omp parallel for schedule(static)
+    for(int snp = 0; snp < snpCount; snp++) {
+        float mafValue = 1.0f * minorAlleleFrequency[snp][chromosome] / (numberOfIndividuals) / 2.0f;
+        if(mafValue > 0.5f) mafValue = 1.0f - mafValue;
+        float mafDivisor = 2.0f * mafValue * (0.5f - mafValue / 2.0f);
+        for(int focalDosage = 0; focalDosage < 3; focalDosage++) {
+            // Alleles of genotype codes 0, 1 and 3; code 2 swaps the
+            // heterozygous alleles, which leaves each sum unchanged
+            int parent0Allele = focalDosage / 2;
+            int parent1Allele = focalDosage > 0 ? 1 : 0;
+            float contribution0 = ((parent0Allele) - mafValue);
+            float contribution1 = ((parent1Allele) - mafValue);
+            float* entries = table + (size_t)snp * CONTRIBUTION_ENTRIES + focalDosage * 3;
+            entries[0] = contribution0 * (-mafValue) * 2.0f / mafDivisor +
+                         contribution1 * (-mafValue) * 2.0f / mafDivisor;
+            entries[1] = contribution0 * (1.0f - mafValue * 2.0f) / mafDivisor +
+                         contribution1 * (1.0f - mafValue * 2.0f) / mafDivisor;
+            entries[2] = contribution0 * (2.0f - mafValue * 2.0f) / mafDivisor +
+                         contribution1 * (2.0f - mafValue * 2.0f) / mafDivisor;
+        }
+        // One term of the sums above per focal allele, with the same float
+        // operations, so the two haplotype entries add up to the dosage entry
+        for(int allele = 0; allele < 2; allele++) {
+            float contribution = ((allele) - mafValue);
+            float* entries = haplotypeTable + (size_t)snp * HAPLOTYPE_CONTRIBUTION_ENTRIES + allele * 3;
+            entries[0] = contribution * (-mafValue) * 2.0f / mafDivisor;
+            entries[1] = contribution * (1.0f - mafValue * 2.0f) / mafDivisor;
+            entries[2] = contribution * (2.0f - mafValue * 2.0f) / mafDivisor;
+        }
+    }
+    contributionTableValid[chromosome] = true;
 }
 
 void GenomeDataManager::reset() {
     for(int i = 0; i < NUM_CHROMOSOMES; i++) {
-        if(genomes[i] != nullptr) {
-            free(genomes[i]);
-            genomes[i] = nullptr;
-        }
+        releaseGenomeBuffer(i);
         snpCountPerChromosome[i] = 0;
         snpCountInFile[i] = 0;
+        contributionTableValid[i] = false;
     }
     isInitialized = false;
 }
@@ -202,6 +302,7 @@ void GenomeDataManager::setMAF(int snpIndex, int chromosome, int value) {
     if(snpIndex >= 0 && snpIndex < NSNPPERCHR && 
        chromosome >= 1 && chromosome < NUM_CHROMOSOMES) {
         minorAlleleFrequency[snpIndex][chromosome] = value;
+        contributionTableValid[chromosome] = false;
     }
 }
 
@@ -225,7 +326,22 @@ void GenomeDataManager::setGenomeOffspring(int index, int snpIndex, int chromoso
 void GenomeDataManager::setNumberOfIndividuals(int count) {
     if(count > 0 && count <= NBINDIVMAX) {
         numberOfIndividuals = count;
+        for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+            contributionTableValid[chr] = false;
+        }
+    }
+}
+
+void GenomeDataManager::setGenomeBuffer(int chromosome, unsigned char* buffer) {
+    validateChromosomeIndex(chromosome);
+    genomes[chromosome] = buffer;
+}
+
+unsigned char* GenomeDataManager::getGenomeBuffer(int chromosome) const {
+    if(chromosome >= 1 && chromosome < NUM_CHROMOSOMES) {
+        return genomes[chromosome];
     }
+    return nullptr;
 }
 
 bool GenomeDataManager::loadFromFile(const char* pathfile, int chromosome, int nbIndiv) {
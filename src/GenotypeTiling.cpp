@@ -0,0 +1,219 @@
+/**
+ * @file GenotypeTiling.cpp
+ * @brief Implementation of GenotypeTiling and CacheMissCounter
+ */
+
+#include "../include/GenotypeTiling.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+namespace {
+    const size_t CACHE_LINE_BYTES = 64;
+    // Set once an event could not be opened, so that sweeps stop asking
+    std::atomic<bool> countersUnsupported(false);
+
+    int openCacheEvent(uint64_t config) {
+        perf_event_attr attributes;
+        memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = config;
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        return (int)syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+    }
+
+    uint64_t readCacheEvent(int fd) {
+        uint64_t value = 0;
+        if(fd < 0 || ::read(fd, &value, sizeof(value)) != (ssize_t)sizeof(value)) {
+            return 0;
+        }
+        return value;
+    }
+}
+
+CacheMissCounter::CacheMissCounter() : referencesFd(-1), missesFd(-1) {
+    if(countersUnsupported.load(std::memory_order_relaxed)) {
+        return;
+    }
+    referencesFd = openCacheEvent(PERF_COUNT_HW_CACHE_REFERENCES);
+    missesFd = referencesFd >= 0 ? openCacheEvent(PERF_COUNT_HW_CACHE_MISSES) : -1;
+    if(!isAvailable()) {
+        countersUnsupported.store(true, std::memory_order_relaxed);
+    }
+}
+
+CacheMissCounter::~CacheMissCounter() {
+    if(referencesFd >= 0) close(referencesFd);
+    if(missesFd >= 0) close(missesFd);
+}
+
+void CacheMissCounter::read(uint64_t& references, uint64_t& misses) const {
+    if(!isAvailable()) {
+        references = 0;
+        misses = 0;
+        return;
+    }
+    references = readCacheEvent(referencesFd);
+    misses = readCacheEvent(missesFd);
+}
+
+GenotypeTiling::GenotypeTiling(const char* sweepName)
+    : name(sweepName), relativeAlignment(1), tileSNPs(0), tileRelatives(0), runCount(0), tileCount(0.0),
+      relativeSNPCount(0.0), runSeconds(0.0), cacheReferences(0.0), cacheMisses(0.0), countersAvailable(true) {
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        buffers[chr] = nullptr;
+        bytesPerIndividual[chr] = 0;
+        snpCounts[chr] = 0;
+    }
+}
+
+size_t GenotypeTiling::getL2CacheBytes() {
+    long bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return bytes > 0 ? (size_t)bytes : (size_t)1 << 20;
+}
+
+void GenotypeTiling::plan(const unsigned char* const genomeBuffers[NUM_CHROMOSOMES],
+                          const size_t rowBytes[NUM_CHROMOSOMES],
+                          const int chromosomeSNPCounts[NUM_CHROMOSOMES],
+                          size_t sharedBytesPerSNP, int snpAlignment, int relativeAlignmentValue) {
+    int longest = 0;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        buffers[chr] = genomeBuffers[chr];
+        bytesPerIndividual[chr] = rowBytes[chr];
+        snpCounts[chr] = chromosomeSNPCounts[chr];
+        if(buffers[chr] != nullptr) {
+            longest = std::max(longest, snpCounts[chr]);
+        }
+    }
+    size_t l2Bytes = getL2CacheBytes();
+    snpAlignment = std::max(4, snpAlignment);
+    relativeAlignment = std::max(1, relativeAlignmentValue);
+
+    // Half of L2 for the shared state, a whole chromosome when it fits
+    size_t snps = l2Bytes / 2 / std::max((size_t)1, sharedBytesPerSNP);
+    snps = std::max((size_t)snpAlignment, snps / snpAlignment * snpAlignment);
+    tileSNPs = (int)std::min(snps, (size_t)std::max(longest, snpAlignment));
+
+    // A quarter for the rows of a tile, another for the prefetched next tile
+    size_t tileRowBytes = (size_t)tileSNPs / 4 + 1;
+    size_t relatives = l2Bytes / 4 / tileRowBytes;
+    tileRelatives = (int)std::max((size_t)relativeAlignment, relatives / relativeAlignment * relativeAlignment);
+}
+
+bool GenotypeTiling::firstTile(int firstRelative, int endRelative, GenotypeTile& tile) const {
+    if(firstRelative >= endRelative || tileSNPs <= 0) {
+        return false;
+    }
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        if(buffers[chr] != nullptr && snpCounts[chr] > 0) {
+            tile.chromosome = chr;
+            tile.firstSNP = 0;
+            tile.endSNP = std::min(tileSNPs, snpCounts[chr]);
+            tile.firstRelative = firstRelative;
+            tile.endRelative = std::min(firstRelative + tileRelatives, endRelative);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool GenotypeTiling::nextTile(int firstRelative, int endRelative, GenotypeTile& tile) const {
+    // Relatives first, so that the SNP range's shared state is reused by all of them
+    if(tile.endRelative < endRelative) {
+        tile.firstRelative = tile.endRelative;
+        tile.endRelative = std::min(tile.firstRelative + tileRelatives, endRelative);
+        return true;
+    }
+    tile.firstRelative = firstRelative;
+    tile.endRelative = std::min(firstRelative + tileRelatives, endRelative);
+    if(tile.endSNP < snpCounts[tile.chromosome]) {
+        tile.firstSNP = tile.endSNP;
+        tile.endSNP = std::min(tile.firstSNP + tileSNPs, snpCounts[tile.chromosome]);
+        return true;
+    }
+    for(int chr = tile.chromosome + 1; chr < NUM_CHROMOSOMES; chr++) {
+        if(buffers[chr] != nullptr && snpCounts[chr] > 0) {
+            tile.chromosome = chr;
+            tile.firstSNP = 0;
+            tile.endSNP = std::min(tileSNPs, snpCounts[chr]);
+            return true;
+        }
+    }
+    return false;
+}
+
+void GenotypeTiling::prefetchTile(const GenotypeTile& tile) const {
+    size_t rowBytes = bytesPerIndividual[tile.chromosome];
+    size_t firstByte = (size_t)tile.firstSNP / 4;
+    size_t endByte = std::min(rowBytes, ((size_t)tile.endSNP + 3) / 4);
+    const unsigned char* row = buffers[tile.chromosome] + (size_t)tile.firstRelative * rowBytes;
+    for(int relativeID = tile.firstRelative; relativeID < tile.endRelative; relativeID++, row += rowBytes) {
+        // One prefetch into L2 per line, from the line holding the first byte
+        uintptr_t line = (uintptr_t)(row + firstByte) & ~(uintptr_t)(CACHE_LINE_BYTES - 1);
+        for(; line < (uintptr_t)(row + endByte); line += CACHE_LINE_BYTES) {
+            __builtin_prefetch((const void*)line, 0, 2);
+        }
+    }
+}
+
+void GenotypeTiling::threadRange(int firstRelative, int endRelative, int& threadFirst, int& threadEnd) const {
+    int threads = omp_get_num_threads();
+    int thread = omp_get_thread_num();
+    int blocks = (endRelative - firstRelative + relativeAlignment - 1) / relativeAlignment;
+    int firstBlock = (int)((int64_t)blocks * thread / threads);
+    int endBlock = (int)((int64_t)blocks * (thread + 1) / threads);
+    threadFirst = std::min(endRelative, firstRelative + firstBlock * relativeAlignment);
+    threadEnd = std::min(endRelative, firstRelative + endBlock * relativeAlignment);
+}
+
+void GenotypeTiling::recordRun(double seconds, double tiles, double relativeSNPs, uint64_t references,
+                               uint64_t misses, bool counted) {
+    runCount++;
+    runSeconds += seconds;
+    tileCount += tiles;
+    relativeSNPCount += relativeSNPs;
+    cacheReferences += (double)references;
+    cacheMisses += (double)misses;
+    countersAvailable = countersAvailable && counted;
+}
+
+double GenotypeTiling::getMissRate() const {
+    if(!countersAvailable || cacheReferences <= 0.0) {
+        return -1.0;
+    }
+    return cacheMisses / cacheReferences;
+}
+
+void GenotypeTiling::printReport(const char* kernelName) const {
+    if(runCount == 0) {
+        return;
+    }
+    printf("%s tiles (%s): up to %d SNPs x %d relatives, %.0f tile(s) over %d sweep(s), %.1f M relative-SNPs/s",
+           name, kernelName, tileSNPs, tileRelatives, tileCount, runCount,
+           runSeconds > 0.0 ? relativeSNPCount / runSeconds / 1e6 : 0.0);
+    double missRate = getMissRate();
+    if(missRate >= 0.0) {
+        printf(", %.2f%% of %.3e LLC references missed\n", 100.0 * missRate, cacheReferences);
+    } else {
+        printf(", cache counters unavailable\n");
+    }
+}
+
+void GenotypeTiling::resetStatistics() {
+    runCount = 0;
+    tileCount = 0.0;
+    relativeSNPCount = 0.0;
+    runSeconds = 0.0;
+    cacheReferences = 0.0;
+    cacheMisses = 0.0;
+    countersAvailable = true;
+}
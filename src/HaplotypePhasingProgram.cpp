@@ -4,8 +4,18 @@
  */
 
 #include "../include/HaplotypePhasingProgram.h"
+#include "../include/NumaTopology.h"
+#include "../include/LargeBufferAllocator.h"
 #include "../include/GenomeDataManager.h"
+#include "../include/PhasedHaplotypeStore.h"
+#include "../include/MemoryBudgetPlanner.h"
+#include "../include/PIHATEngine.h"
 #include "../include/RelativeIdentificationEngine.h"
+#include "../include/KingRelativeFinder.h"
+#include "../include/RelativeIndex.h"
+#include "../include/MinHashIndex.h"
+#include "../include/KinshipCache.h"
+#include "../include/RelationshipClassifier.h"
 #include "../include/PhasingAlgorithmEngine.h"
 #include "../include/OutputFileWriter.h"
 #include "../include/ConfigurationManager.h"
@@ -14,18 +24,33 @@
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <algorithm>
 #include <memory>
+#include <omp.h>
+#include <vector>
 
 using namespace PhasingEngine;
 using namespace PhasingEngine::Constants;
 
 HaplotypePhasingProgram::HaplotypePhasingProgram() {
+    numaTopology = std::make_unique<NumaTopology>();
+    bufferAllocator = std::make_unique<LargeBufferAllocator>(numaTopology.get());
     genomeDataManager = std::make_unique<GenomeDataManager>();
+    genomeDataManager->setBufferAllocator(bufferAllocator.get());
+    phasedStore = std::make_unique<PhasedHaplotypeStore>(genomeDataManager.get());
+    phasedStore->setBufferAllocator(bufferAllocator.get());
+    pihatEngine = std::make_unique<PIHATEngine>(genomeDataManager.get());
     relativeEngine = std::make_unique<RelativeIdentificationEngine>();
+    relativeEngine->setPIHATEngine(pihatEngine.get());
+    relativeIndex = std::make_unique<RelativeIndex>(genomeDataManager.get());
+    candidateIndex = std::make_unique<MinHashIndex>(genomeDataManager.get());
+    kinshipCache = std::make_unique<KinshipCache>();
+    relationshipClassifier = std::make_unique<RelationshipClassifier>(genomeDataManager.get());
     phasingEngine = std::make_unique<PhasingAlgorithmEngine>(
-        genomeDataManager.get(), relativeEngine.get());
-    outputWriter = std::make_unique<OutputFileWriter>(genomeDataManager.get());
+        genomeDataManager.get(), relativeEngine.get(), phasedStore.get(), pihatEngine.get());
+    outputWriter = std::make_unique<OutputFileWriter>(genomeDataManager.get(), phasedStore.get());
     configuration = std::make_unique<ConfigurationManager>();
+    memoryPlanner = std::make_unique<MemoryBudgetPlanner>();
 }
 
 HaplotypePhasingProgram::~HaplotypePhasingProgram() {
@@ -37,9 +62,41 @@ bool HaplotypePhasingProgram::initialize(int argc, char* argv[]) {
         return false;
     }
     
+    // The PIHAT engine is the default finder; the other estimators replace it
+    if(configuration->getRelativeEstimator() == RelativeEstimator::KING_ROBUST) {
+        relativeEngine = std::make_unique<KingRelativeFinder>(genomeDataManager.get());
+        phasingEngine->setRelativeEngine(relativeEngine.get());
+    }
+    
     genomeDataManager->setNumberOfIndividuals(configuration->getNumberOfIndividuals());
+    relativeEngine->resize(configuration->getNumberOfIndividuals());
+    relativeEngine->setTopRelativeCount(configuration->getTopRelativeCount());
     phasingEngine->setVerboseOutput(configuration->isVerboseMode());
     
+    numaTopology->detect();
+    numaTopology->setPlacementPolicy(configuration->getNumaPlacementPolicy());
+    bufferAllocator->setHugePagePolicy(configuration->getHugePagePolicy());
+    pihatEngine->setKernel(configuration->getPIHATKernel());
+    pihatEngine->setBatchSize(configuration->getPIHATBatchSize());
+    pihatEngine->setQuantized(configuration->isPIHATQuantized());
+    kinshipCache->configure(configuration->getNumberOfIndividuals(), configuration->getKinshipCacheBytes());
+    if(kinshipCache->isEnabled()) {
+        relativeEngine->setKinshipCache(kinshipCache.get());
+    }
+    if(configuration->isRelativeDegreesEnabled()) {
+        relativeEngine->setRelationshipClassifier(relationshipClassifier.get());
+    }
+    pihatEngine->setDecomposition(usesKinshipDecomposition());
+    // The relative index stores exact values, so it is built without screening
+    if(configuration->getRelativeIndexBuildPath().empty()) {
+        pihatEngine->setScreening(configuration->getPIHATScreenStride(), configuration->getPIHATScreenThreshold());
+        pihatEngine->setScreenAudit(configuration->isPIHATScreenAuditEnabled());
+        if(configuration->getPIHATScreenStride() > 0 && !configuration->isPIHATScreenAuditEnabled()) {
+            printf("Warning: -PIHATScreen is approximate; pairs above the threshold are kept with high probability, "
+                   "not always (-PIHATScreenAudit 1 counts the losses)\n");
+        }
+    }
+    
     return true;
 }
 
@@ -64,29 +121,26 @@ bool HaplotypePhasingProgram::execute() {
     
     initializeSNPCounts();
     
+    if(!planMemory()) {
+        return false;
+    }
+    
     if(configuration->isVerboseMode()) {
         printf("Loading genome data from: %s\n", configuration->getInputPath().c_str());
     }
     
     for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
         int snpCount = genomeDataManager->getSNPCountPerChr(chr);
-        size_t bufferSize = ((size_t)snpCount / 4 + ((snpCount % 4) > 0 ? 1 : 0)) * 
-                           configuration->getNumberOfIndividuals();
-        unsigned char* buffer = (unsigned char*)calloc(bufferSize, sizeof(unsigned char));
-        
-        if(buffer == nullptr) {
+        if(!genomeDataManager->initializeChromosome(chr, snpCount, configuration->getNumberOfIndividuals())) {
             printf("Error: Memory allocation failed for chromosome %d\n", chr);
             return false;
         }
         
-        genomeDataManager->setGenomeBuffer(chr, buffer);
-        
         if(!GenomeFileLoader::loadGenome(configuration->getInputPath().c_str(), chr,
-                                        buffer, configuration->getNumberOfIndividuals(),
+                                        genomeDataManager->getGenomeBuffer(chr),
+                                        configuration->getNumberOfIndividuals(),
                                         genomeDataManager->getSNPCountPerChrArray(),
                                         genomeDataManager->getSNPCountInFileArray())) {
-            free(buffer);
-            genomeDataManager->setGenomeBuffer(chr, nullptr);
             return false;
         }
     }
@@ -95,9 +149,15 @@ bool HaplotypePhasingProgram::execute() {
     if(configuration->isVerboseMode()) {
         float elapsed = (float)(loadTime - startTime) / CLOCKS_PER_SEC;
         printf("Genome loading completed in %.2f seconds\n", elapsed);
+        reportMemoryPlacement();
+    }
+    
+    bool indexOnly = false;
+    if(!prepareRelativeIndex(indexOnly)) {
+        return false;
     }
     
-    if(!processIndividuals()) {
+    if(!indexOnly && !processIndividuals()) {
         return false;
     }
     
@@ -107,32 +167,130 @@ bool HaplotypePhasingProgram::execute() {
     return true;
 }
 
+// The decomposition splits PIHAT sums, which only the PIHAT sweep computes
+bool HaplotypePhasingProgram::usesKinshipDecomposition() const {
+    return configuration->isKinshipDecompositionEnabled()
+           && configuration->getRelativeEstimator() == RelativeEstimator::PIHAT
+           && configuration->getRelativeIndexPath().empty()
+           && configuration->getRelativeIndexBuildPath().empty();
+}
+
+bool HaplotypePhasingProgram::planMemory() {
+    memoryPlanner->setMaxMemoryBytes(configuration->getMaxMemoryBytes());
+    memoryPlanner->setNumberOfIndividuals(configuration->getNumberOfIndividuals());
+    memoryPlanner->setMaxThreads(omp_get_max_threads());
+    memoryPlanner->setPIHATBatchSize(configuration->getPIHATBatchSize());
+    memoryPlanner->setPIHATScreenStride(configuration->getRelativeIndexBuildPath().empty()
+                                        ? configuration->getPIHATScreenStride() : 0);
+    memoryPlanner->setRelativeEstimator(configuration->getRelativeEstimator());
+    // KING-robust sweeps its bit-planes and a relative index needs no sweep at all
+    memoryPlanner->setPerFocalSweep(configuration->getRelativeEstimator() == RelativeEstimator::PIHAT
+                                    && configuration->getRelativeIndexPath().empty());
+    memoryPlanner->setPIHATQuantized(configuration->isPIHATQuantized());
+    memoryPlanner->setKinshipCacheBytes(configuration->getKinshipCacheBytes());
+    memoryPlanner->setKinshipDecomposition(usesKinshipDecomposition());
+    memoryPlanner->setMinHashIndex(configuration->getLSHBandCount(), configuration->getLSHBlockSNPCount());
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        memoryPlanner->setSNPCountPerChr(chr, genomeDataManager->getSNPCountPerChr(chr));
+    }
+    
+    if(!memoryPlanner->plan(memoryPlan)) {
+        memoryPlanner->printPlan(memoryPlan);
+        printf("ERROR: No run layout fits in -MaxMemory %.1f MB, the leanest one needs %.1f MB\n",
+               configuration->getMaxMemoryBytes() / 1048576.0, memoryPlan.totalBytes / 1048576.0);
+        return false;
+    }
+    if(configuration->isVerboseMode() || configuration->getMaxMemoryBytes() > 0) {
+        memoryPlanner->printPlan(memoryPlan);
+    }
+    
+    omp_set_num_threads(memoryPlan.threadCount);
+    if(memoryPlan.storageMode == GenomeStorageMode::OUT_OF_CORE) {
+        bufferAllocator->setBackingDirectory(configuration->getScratchPath());
+    }
+    
+    // Threads are pinned before any genome page is touched so that first-touch
+    // placement puts each block of individuals on the node that scans it
+    if(configuration->isThreadPinningEnabled()) {
+        numaTopology->pinThreads();
+    }
+    return true;
+}
+
+bool HaplotypePhasingProgram::prepareRelativeIndex(bool& indexOnly) {
+    // Building the index is a preprocessing run of its own: no phasing follows
+    indexOnly = !configuration->getRelativeIndexBuildPath().empty();
+    if(indexOnly) {
+        return relativeIndex->build(configuration->getRelativeIndexBuildPath(),
+                                    configuration->getRelativeIndexTopK(), pihatEngine.get());
+    }
+    if(!configuration->getRelativeIndexPath().empty()) {
+        if(!relativeIndex->open(configuration->getRelativeIndexPath())) {
+            return false;
+        }
+        relativeEngine->setRelativeIndex(relativeIndex.get());
+        if(configuration->isVerboseMode()) {
+            printf("Relative search served from %s (top %d relatives per individual)\n",
+                   configuration->getRelativeIndexPath().c_str(), relativeIndex->getTopK());
+        }
+    }
+    // MinHash candidates replace the exhaustive sweep with an exact sweep of a few relatives
+    if(configuration->getLSHBandCount() > 0) {
+        candidateIndex->configure(configuration->getLSHBandCount(), configuration->getLSHRowsPerBand(),
+                                  configuration->getLSHBlockSNPCount());
+        candidateIndex->setRecallAudit(configuration->isLSHRecallAuditEnabled(), configuration->getLSHRecallThreshold());
+        if(!candidateIndex->build()) {
+            return false;
+        }
+        relativeEngine->setCandidateIndex(candidateIndex.get());
+        if(configuration->isVerboseMode()) {
+            candidateIndex->printReport();
+        }
+    }
+    return true;
+}
+
 bool HaplotypePhasingProgram::processIndividuals() {
     int numberOfIndividuals = configuration->getNumberOfIndividuals();
+    int chunkSize = memoryPlan.chunkSize > 0 ? memoryPlan.chunkSize : numberOfIndividuals;
     
-    for(int individual = 0; individual < numberOfIndividuals; individual++) {
-        if(configuration->isVerboseMode()) {
-            printf("Processing individual %d of %d\n", individual + 1, numberOfIndividuals);
+    for(int chunkStart = 0; chunkStart < numberOfIndividuals; chunkStart += chunkSize) {
+        int chunkEnd = std::min(numberOfIndividuals, chunkStart + chunkSize);
+        std::vector<int> individualsToPhase;
+        for(int individual = chunkStart; individual < chunkEnd; individual++) {
+            individualsToPhase.push_back(individual);
         }
-        
-        if(!phasingEngine->loadSegment(individual, individual, individual, individual,
-                                      0, configuration->getAlgorithmVersion(), 0,
-                                      configuration->getInputPath().c_str())) {
-            printf("Warning: Failed to load segment for individual %d\n", individual);
-            continue;
+        if(!phasedStore->initialize(individualsToPhase)) {
+            return false;
         }
+        pihatEngine->setFocalQueue(individualsToPhase);
         
-        int relativeCount = relativeEngine->getRelativeCountAboveThreshold(0.1f);
-        phasingEngine->setRelativeCount(relativeCount);
-        phasingEngine->setBreakpointCount(1000);
-        
-        phasingEngine->executePhasingAlgorithm(individual, 1, 0, individual, 0.0f, 0,
-                                              individual, individual, 0,
-                                              configuration->getAlgorithmVersion(), 0,
-                                              configuration->getOutputPath().c_str());
+        for(int individual = chunkStart; individual < chunkEnd; individual++) {
+            if(configuration->isVerboseMode()) {
+                printf("Processing individual %d of %d\n", individual + 1, numberOfIndividuals);
+            }
+            
+            if(!phasingEngine->loadSegment(individual, individual, individual, individual,
+                                          0, configuration->getAlgorithmVersion(), 0,
+                                          configuration->getInputPath().c_str())) {
+                printf("Warning: Failed to load segment for individual %d\n", individual);
+                continue;
+            }
+            
+            int relativeCount = (int)relativeEngine->getTopRelatives().size();
+            phasingEngine->setRelativeCount(relativeCount);
+            phasingEngine->setBreakpointCount(1000);
+            
+            phasingEngine->executePhasingAlgorithm(individual, 1, 0, individual, 0.0f, 0,
+                                                  individual, individual, 0,
+                                                  configuration->getAlgorithmVersion(), 0,
+                                                  configuration->getOutputPath().c_str());
+        }
         
+        // The rows of this chunk are final: append them so the store can be reused
         for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
-            outputWriter->writeOutput(chr, configuration->getOutputPath().c_str());
+            outputWriter->writeOutputRange(chr, configuration->getOutputPath().c_str(),
+                                           chunkStart, chunkEnd - chunkStart, chunkStart > 0);
         }
     }
     
@@ -150,17 +308,57 @@ bool HaplotypePhasingProgram::validateInputFiles() const {
 }
 
 void HaplotypePhasingProgram::logExecutionStatistics(clock_t startTime, clock_t endTime) const {
+    // Recall is what an audit run is for, so it is reported even when quiet
+    if(candidateIndex->isBuilt() && candidateIndex->isAuditingRecall() && !configuration->isVerboseMode()) {
+        candidateIndex->printReport();
+    }
+    if(pihatEngine->isAuditingScreen() && !configuration->isVerboseMode()) {
+        pihatEngine->printScreenAuditReport();
+    }
     if(configuration->isVerboseMode()) {
         float totalTime = (float)(endTime - startTime) / CLOCKS_PER_SEC;
         printf("\n=== Execution Statistics ===\n");
         printf("Total execution time: %.2f seconds\n", totalTime);
         printf("Number of individuals processed: %d\n", configuration->getNumberOfIndividuals());
+        size_t largeBytes = bufferAllocator->getAllocatedBytes();
+        size_t hugeBytes = bufferAllocator->queryHugePageBackedBytes();
+        printf("Huge-page backed memory: %.1f MB of %.1f MB (%.1f%%, mode %s)\n",
+               hugeBytes / 1048576.0, largeBytes / 1048576.0,
+               largeBytes > 0 ? 100.0 * hugeBytes / largeBytes : 0.0,
+               LargeBufferAllocator::getHugePagePolicyName(bufferAllocator->getHugePagePolicy()));
+        relativeEngine->printThroughputReport();
+        if(kinshipCache->isEnabled()) {
+            kinshipCache->printReport();
+        }
+        if(configuration->isRelativeDegreesEnabled()) {
+            relationshipClassifier->printReport();
+        }
+        if(candidateIndex->isBuilt()) {
+            candidateIndex->printReport();
+        }
         printf("Output directory: %s\n", configuration->getOutputPath().c_str());
         printf("===========================\n");
     }
 }
 
+void HaplotypePhasingProgram::reportMemoryPlacement() const {
+    numaTopology->printPlacementReport();
+    bufferAllocator->printPlacementReport();
+}
+
 void HaplotypePhasingProgram::shutdown() {
+    if(relativeEngine) {
+        relativeEngine->setRelativeIndex(nullptr);
+        relativeEngine->setCandidateIndex(nullptr);
+        relativeEngine->setKinshipCache(nullptr);
+        relativeEngine->setRelationshipClassifier(nullptr);
+    }
+    if(relativeIndex) {
+        relativeIndex->close();
+    }
+    if(phasedStore) {
+        phasedStore->reset();
+    }
     if(genomeDataManager) {
         genomeDataManager->reset();
     }
@@ -0,0 +1,181 @@
+/**
+ * @file KingRelativeFinder.cpp
+ * @brief Implementation of KingRelativeFinder
+ */
+
+#include "../include/KingRelativeFinder.h"
+#include "../include/GenomeDataManager.h"
+#include "../include/Constants.h"
+#include "../include/KinshipCounts.h"
+#include <algorithm>
+#include <cstdio>
+#include <immintrin.h>
+#include <omp.h>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+namespace {
+
+using KinshipCounts::PairCounts;
+using KinshipCounts::countPairWords;
+
+// One body for the generic and POPCNT kernels
+PairCounts countPairGeneric(const uint64_t* focal, const uint64_t* relative, size_t words) {
+    return countPairWords(focal, relative, words);
+}
+
+__attribute__((target("popcnt")))
+PairCounts countPairPopcnt(const uint64_t* focal, const uint64_t* relative, size_t words) {
+    return countPairWords(focal, relative, words);
+}
+
+__attribute__((target("popcnt,avx512f,avx512vpopcntdq")))
+PairCounts countPairAVX512(const uint64_t* focal, const uint64_t* relative, size_t words) {
+    __m512i hetHet = _mm512_setzero_si512();
+    __m512i ibs0 = _mm512_setzero_si512();
+    size_t word = 0;
+    for(; word + 8 <= words; word += 8) {
+        __m512i focalHet = _mm512_loadu_si512(focal + word);
+        __m512i focalAlt = _mm512_loadu_si512(focal + words + word);
+        __m512i relativeHet = _mm512_loadu_si512(relative + word);
+        __m512i relativeAlt = _mm512_loadu_si512(relative + words + word);
+        hetHet = _mm512_add_epi64(hetHet, _mm512_popcnt_epi64(_mm512_and_si512(focalHet, relativeHet)));
+        __m512i opposite = _mm512_or_si512(
+            _mm512_andnot_si512(_mm512_or_si512(relativeHet, relativeAlt), focalAlt),
+            _mm512_andnot_si512(_mm512_or_si512(focalHet, focalAlt), relativeAlt));
+        ibs0 = _mm512_add_epi64(ibs0, _mm512_popcnt_epi64(opposite));
+    }
+    PairCounts counts = {(int)_mm512_reduce_add_epi64(hetHet), (int)_mm512_reduce_add_epi64(ibs0)};
+    for(; word < words; word++) {
+        KinshipCounts::addPairWord(counts, focal[word], focal[words + word], relative[word], relative[words + word]);
+    }
+    return counts;
+}
+
+}
+
+KingRelativeFinder::KingRelativeFinder(GenomeDataManager* gdm)
+    : genomeDataManager(gdm), wordsPerPlane(0), planeSNPCount(0), kernel(PopcountKernel::GENERIC),
+      focalCount(0), relativeSNPCount(0.0), sweepSeconds(0.0), lastSweepSeconds(0.0),
+      lastRelativeSNPCount(0.0) {
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq")
+       && __builtin_cpu_supports("popcnt")) {
+        kernel = PopcountKernel::AVX512;
+    } else if(__builtin_cpu_supports("popcnt")) {
+        kernel = PopcountKernel::POPCNT;
+    }
+}
+
+void KingRelativeFinder::buildBitPlanes() {
+    int nbIndiv = genomeDataManager->getNumberOfIndividuals();
+    planeSNPCount = 0;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        if(genomeDataManager->getGenomeBuffer(chr) != nullptr) {
+            planeSNPCount += genomeDataManager->getSNPCount(chr);
+        }
+    }
+    wordsPerPlane = (size_t)(planeSNPCount + 63) / 64;
+    bitPlanes.assign((size_t)nbIndiv * 2 * wordsPerPlane, 0);
+    heterozygousCounts.assign(nbIndiv, 0);
+
+    // Chromosomes follow each other in the planes; bit positions only need to
+    // match between individuals
+    #pragma omp parallel for schedule(static)
+    for(int individual = 0; individual < nbIndiv; individual++) {
+        uint64_t* het = bitPlanes.data() + (size_t)individual * 2 * wordsPerPlane;
+        uint64_t* alt = het + wordsPerPlane;
+        int64_t position = 0;
+        for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+            const unsigned char* buffer = genomeDataManager->getGenomeBuffer(chr);
+            if(buffer == nullptr) continue;
+            const unsigned char* row = buffer + (size_t)individual * genomeDataManager->getBytesPerIndividual(chr);
+            int snpCount = genomeDataManager->getSNPCount(chr);
+            for(int snp = 0; snp < snpCount; snp++, position++) {
+                int genotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+                uint64_t bit = (uint64_t)1 << (position % 64);
+                if((genotype & 1) != (genotype >> 1)) {
+                    het[position / 64] |= bit;
+                } else if(genotype == 3) {
+                    alt[position / 64] |= bit;
+                }
+            }
+        }
+        int heterozygous = 0;
+        for(size_t word = 0; word < wordsPerPlane; word++) {
+            heterozygous += __builtin_popcountll(het[word]);
+        }
+        heterozygousCounts[individual] = heterozygous;
+    }
+}
+
+void KingRelativeFinder::computePIHATMatrix() {
+    int focal = getFocalIndividual();
+    int nbIndiv = genomeDataManager->getNumberOfIndividuals();
+    if(focal < 0 || focal >= nbIndiv) {
+        return;
+    }
+    if(heterozygousCounts.size() != (size_t)nbIndiv) {
+        buildBitPlanes();
+    }
+    int numberOfRelatives = std::min(nbIndiv, (int)pihatMatrix.size());
+    ibs0Counts.assign(numberOfRelatives, 0);
+    hetHetCounts.assign(numberOfRelatives, 0);
+
+    const uint64_t* focalPlanes = bitPlanes.data() + (size_t)focal * 2 * wordsPerPlane;
+    double startTime = omp_get_wtime();
+    #pragma omp parallel for schedule(static)
+    for(int relativeID = 0; relativeID < numberOfRelatives; relativeID++) {
+        const uint64_t* relativePlanes = bitPlanes.data() + (size_t)relativeID * 2 * wordsPerPlane;
+        PairCounts counts;
+        switch(kernel) {
+            case PopcountKernel::AVX512:
+                counts = countPairAVX512(focalPlanes, relativePlanes, wordsPerPlane);
+                break;
+            case PopcountKernel::POPCNT:
+                counts = countPairPopcnt(focalPlanes, relativePlanes, wordsPerPlane);
+                break;
+            default:
+                counts = countPairGeneric(focalPlanes, relativePlanes, wordsPerPlane);
+                break;
+        }
+        ibs0Counts[relativeID] = counts.ibs0;
+        hetHetCounts[relativeID] = counts.hetHet;
+        int heterozygous = heterozygousCounts[focal] + heterozygousCounts[relativeID];
+        float kinship = heterozygous > 0 ? (float)(counts.hetHet - 2 * counts.ibs0) / heterozygous : 0.0f;
+        pihatMatrix[relativeID] = 2.0f * kinship;
+    }
+    lastSweepSeconds = omp_get_wtime() - startTime;
+    lastRelativeSNPCount = (double)numberOfRelatives * planeSNPCount;
+    focalCount++;
+    relativeSNPCount += lastRelativeSNPCount;
+    sweepSeconds += lastSweepSeconds;
+    isComputed = true;
+}
+
+int KingRelativeFinder::getIBS0Count(int relativeID) const {
+    return relativeID >= 0 && relativeID < (int)ibs0Counts.size() ? ibs0Counts[relativeID] : 0;
+}
+
+int KingRelativeFinder::getHetHetCount(int relativeID) const {
+    return relativeID >= 0 && relativeID < (int)hetHetCounts.size() ? hetHetCounts[relativeID] : 0;
+}
+
+double KingRelativeFinder::getLastThroughput() const {
+    return lastSweepSeconds > 0.0 ? lastRelativeSNPCount / lastSweepSeconds : 0.0;
+}
+
+void KingRelativeFinder::printThroughputReport() const {
+    printf("KING-robust sweeps: %d focal(s), %.3e relative x SNP pairs in %.3f s (%.1f M relative-SNPs/s, %s kernel)\n",
+           focalCount, relativeSNPCount, sweepSeconds,
+           sweepSeconds > 0.0 ? relativeSNPCount / sweepSeconds / 1e6 : 0.0, getKernelName(kernel));
+}
+
+const char* KingRelativeFinder::getKernelName(PopcountKernel kernel) {
+    switch(kernel) {
+        case PopcountKernel::GENERIC: return "generic";
+        case PopcountKernel::POPCNT: return "popcnt";
+        case PopcountKernel::AVX512: return "avx512-vpopcntdq";
+    }
+    return "unknown";
+}
@@ -0,0 +1,104 @@
+/**
+ * @file KinshipCache.cpp
+ * @brief Implementation of KinshipCache
+ */
+
+#include "../include/KinshipCache.h"
+#include <algorithm>
+#include <cstdio>
+
+using namespace PhasingEngine;
+
+KinshipCache::KinshipCache()
+    : numberOfIndividuals(0), capacityBytes(0), cachedBytes(0), rowCount(0), lookupCount(0.0),
+      hitCount(0.0), sweptPairCount(0.0), sweepSeconds(0.0), savedSeconds(0.0) {
+}
+
+void KinshipCache::configure(int individuals, size_t capacity) {
+    numberOfIndividuals = std::max(0, individuals);
+    capacityBytes = capacity;
+    clear();
+}
+
+void KinshipCache::clear() {
+    #pragma omp critical(KinshipCache)
+    {
+        rows.assign(isEnabled() ? numberOfIndividuals : 0, std::vector<float>());
+        rowCount = 0;
+        cachedBytes = 0;
+    }
+}
+
+void KinshipCache::fillRow(int focal, float* pihat, int count, int& firstMissing, int& endMissing) {
+    firstMissing = 0;
+    endMissing = count;
+    if(!isEnabled() || focal < 0 || focal >= numberOfIndividuals) {
+        return;
+    }
+    count = std::min(count, numberOfIndividuals);
+    #pragma omp critical(KinshipCache)
+    {
+        if(!rows[focal].empty()) {
+            std::copy(rows[focal].begin(), rows[focal].begin() + count, pihat);
+            firstMissing = endMissing = 0;
+        } else {
+            firstMissing = count;
+            endMissing = 0;
+            for(int relativeID = 0; relativeID < count; relativeID++) {
+                if(!rows[relativeID].empty()) {
+                    pihat[relativeID] = rows[relativeID][focal];
+                } else {
+                    firstMissing = std::min(firstMissing, relativeID);
+                    endMissing = relativeID + 1;
+                }
+            }
+            if(firstMissing >= endMissing) {
+                firstMissing = endMissing = 0;
+            }
+        }
+    }
+}
+
+void KinshipCache::storeRow(int focal, const float* pihat, int count) {
+    if(!isEnabled() || focal < 0 || focal >= numberOfIndividuals || count < numberOfIndividuals) {
+        return;
+    }
+    size_t rowBytes = (size_t)numberOfIndividuals * sizeof(float);
+    #pragma omp critical(KinshipCache)
+    {
+        if(rows[focal].empty() && cachedBytes + rowBytes <= capacityBytes) {
+            rows[focal].assign(pihat, pihat + numberOfIndividuals);
+            cachedBytes += rowBytes;
+            rowCount++;
+        }
+    }
+}
+
+void KinshipCache::recordQuery(int hits, int swept, double seconds) {
+    #pragma omp critical(KinshipCache)
+    {
+        lookupCount += hits + swept;
+        hitCount += hits;
+        sweptPairCount += swept;
+        sweepSeconds += seconds;
+        if(sweptPairCount > 0.0) {
+            savedSeconds += hits * sweepSeconds / sweptPairCount;
+        }
+    }
+}
+
+size_t KinshipCache::estimateMemoryBytes(int individuals, size_t capacity) {
+    if(capacity == 0 || individuals <= 0) {
+        return 0;
+    }
+    size_t rowBytes = (size_t)individuals * sizeof(float);
+    size_t storedRows = std::min((size_t)individuals, capacity / rowBytes);
+    return storedRows * rowBytes + (size_t)individuals * sizeof(std::vector<float>);
+}
+
+void KinshipCache::printReport() const {
+    printf("Kinship cache: %d of %d rows (%.1f MB), %.0f of %.0f focal-relative values served (%.2f%% hit rate), "
+           "about %.2f s of sweeping saved\n",
+           rowCount, numberOfIndividuals, cachedBytes / 1048576.0, hitCount, lookupCount,
+           100.0 * getHitRate(), savedSeconds);
+}
@@ -0,0 +1,233 @@
+/**
+ * @file LargeBufferAllocator.cpp
+ * @brief Implementation of LargeBufferAllocator
+ */
+
+#include "../include/LargeBufferAllocator.h"
+#include "../include/NumaTopology.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace PhasingEngine;
+
+constexpr size_t LargeBufferAllocator::HUGE_PAGE_SIZE;
+
+LargeBufferAllocator::LargeBufferAllocator(NumaTopology* numaTopology)
+    : topology(numaTopology), allocatedBytes(0),
+      hugePagePolicy(HugePagePolicy::TRANSPARENT) {
+}
+
+LargeBufferAllocator::~LargeBufferAllocator() {
+    for(auto& entry : allocations) {
+        munmap(entry.second.mappingBase, entry.second.mappingBytes);
+    }
+    allocations.clear();
+}
+
+bool LargeBufferAllocator::mapFileRegion(size_t bytes, Allocation& allocation) const {
+    std::string pattern = backingDirectory + "/phasing-buffer-XXXXXX";
+    std::vector<char> path(pattern.begin(), pattern.end());
+    path.push_back('\0');
+    int fileDescriptor = mkstemp(path.data());
+    if(fileDescriptor < 0) {
+        printf("Error: Cannot create scratch file in %s\n", backingDirectory.c_str());
+        return false;
+    }
+    // The file disappears with the last mapping, even if the run is killed
+    unlink(path.data());
+    if(ftruncate(fileDescriptor, (off_t)bytes) != 0) {
+        close(fileDescriptor);
+        return false;
+    }
+    void* region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+    close(fileDescriptor);
+    if(region == MAP_FAILED) {
+        return false;
+    }
+    allocation.mappingBase = static_cast<unsigned char*>(region);
+    allocation.mappingBytes = bytes;
+    allocation.fileBacked = true;
+    return true;
+}
+
+bool LargeBufferAllocator::mapRegion(size_t bytes, Allocation& allocation) const {
+    if(!backingDirectory.empty()) {
+        return mapFileRegion(bytes, allocation);
+    }
+
+    size_t roundedBytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    if(hugePagePolicy == HugePagePolicy::HUGETLBFS) {
+        void* region = mmap(nullptr, roundedBytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(region != MAP_FAILED) {
+            allocation.mappingBase = static_cast<unsigned char*>(region);
+            allocation.mappingBytes = roundedBytes;
+            allocation.explicitHugePages = true;
+            return true;
+        }
+        // No reserved huge pages left: fall through to transparent huge pages
+    }
+
+    if(hugePagePolicy == HugePagePolicy::NONE || bytes < HUGE_PAGE_SIZE) {
+        void* region = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(region == MAP_FAILED) {
+            return false;
+        }
+        allocation.mappingBase = static_cast<unsigned char*>(region);
+        allocation.mappingBytes = bytes;
+        return true;
+    }
+
+    // Over-allocate by one huge page and trim both ends so the region starts
+    // on a 2 MB boundary; otherwise khugepaged can never collapse the first extent
+    size_t mappedBytes = roundedBytes + HUGE_PAGE_SIZE;
+    void* region = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(region == MAP_FAILED) {
+        return false;
+    }
+    uintptr_t start = reinterpret_cast<uintptr_t>(region);
+    uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+    size_t headBytes = aligned - start;
+    size_t tailBytes = mappedBytes - headBytes - roundedBytes;
+    if(headBytes > 0) munmap(region, headBytes);
+    if(tailBytes > 0) munmap(reinterpret_cast<void*>(aligned + roundedBytes), tailBytes);
+
+    allocation.mappingBase = reinterpret_cast<unsigned char*>(aligned);
+    allocation.mappingBytes = roundedBytes;
+    // Fails harmlessly when THP is disabled; the mapping then stays on regular pages
+    madvise(allocation.mappingBase, roundedBytes, MADV_HUGEPAGE);
+    return true;
+}
+
+unsigned char* LargeBufferAllocator::allocate(size_t bytes, size_t rowBytes, size_t rowCount,
+                                              const std::string& label) {
+    if(bytes == 0) {
+        return nullptr;
+    }
+
+    // Anonymous mappings are zero-filled and not yet backed by physical pages
+    Allocation allocation;
+    allocation.bytes = bytes;
+    allocation.mappingBase = nullptr;
+    allocation.mappingBytes = 0;
+    allocation.explicitHugePages = false;
+    allocation.fileBacked = false;
+    allocation.label = label;
+    if(!mapRegion(bytes, allocation)) {
+        return nullptr;
+    }
+
+    unsigned char* buffer = allocation.mappingBase;
+    // Touching a file-backed buffer up front would only force it to be written out
+    if(topology != nullptr && !allocation.fileBacked) {
+        topology->placeRegion(buffer, bytes, rowBytes, rowCount);
+    }
+
+    allocations[buffer] = allocation;
+    allocatedBytes += bytes;
+    return buffer;
+}
+
+void LargeBufferAllocator::release(unsigned char* buffer) {
+    auto entry = allocations.find(buffer);
+    if(entry == allocations.end()) {
+        return;
+    }
+    munmap(entry->second.mappingBase, entry->second.mappingBytes);
+    allocatedBytes -= entry->second.bytes;
+    allocations.erase(entry);
+}
+
+bool LargeBufferAllocator::owns(const unsigned char* buffer) const {
+    return allocations.find(const_cast<unsigned char*>(buffer)) != allocations.end();
+}
+
+size_t LargeBufferAllocator::queryHugePageBackedBytes() const {
+    size_t hugeBytes = 0;
+    for(const auto& entry : allocations) {
+        if(entry.second.explicitHugePages) hugeBytes += entry.second.bytes;
+    }
+
+    FILE* smaps = fopen("/proc/self/smaps", "r");
+    if(smaps == nullptr) {
+        return hugeBytes;
+    }
+
+    // Sum AnonHugePages of every mapping that overlaps one of our THP regions,
+    // capped by the overlap in case the kernel merged it with a neighbour
+    char line[512];
+    size_t overlapBytes = 0;
+    while(fgets(line, sizeof(line), smaps) != nullptr) {
+        unsigned long long start = 0, end = 0;
+        if(sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+            overlapBytes = 0;
+            for(const auto& entry : allocations) {
+                if(entry.second.explicitHugePages || entry.second.fileBacked) continue;
+                unsigned long long regionStart = reinterpret_cast<uintptr_t>(entry.second.mappingBase);
+                unsigned long long regionEnd = regionStart + entry.second.bytes;
+                unsigned long long low = start > regionStart ? start : regionStart;
+                unsigned long long high = end < regionEnd ? end : regionEnd;
+                if(high > low) overlapBytes += (size_t)(high - low);
+            }
+        } else if(overlapBytes > 0 && strncmp(line, "AnonHugePages:", strlen("AnonHugePages:")) == 0) {
+            size_t anonHugeBytes = (size_t)strtoull(line + strlen("AnonHugePages:"), nullptr, 10) * 1024;
+            hugeBytes += anonHugeBytes < overlapBytes ? anonHugeBytes : overlapBytes;
+            overlapBytes = 0;
+        }
+    }
+    fclose(smaps);
+    return hugeBytes;
+}
+
+void LargeBufferAllocator::printPlacementReport() const {
+    if(topology == nullptr) {
+        return;
+    }
+    std::vector<size_t> bytesPerNode;
+    for(const auto& entry : allocations) {
+        topology->queryPageNodes(entry.first, entry.second.bytes, bytesPerNode);
+    }
+
+    printf("Large buffers: %d regions, %.1f MB, huge pages: %s\n",
+           (int)allocations.size(), allocatedBytes / 1048576.0, getHugePagePolicyName(hugePagePolicy));
+    for(size_t node = 0; node + 1 < bytesPerNode.size(); node++) {
+        if(bytesPerNode[node] > 0) {
+            printf("  Node %d: %.1f MB (%.1f%%)\n", (int)node, bytesPerNode[node] / 1048576.0,
+                   allocatedBytes > 0 ? 100.0 * bytesPerNode[node] / allocatedBytes : 0.0);
+        }
+    }
+    if(!bytesPerNode.empty() && bytesPerNode.back() > 0) {
+        printf("  Not resident or unknown: %.1f MB\n", bytesPerNode.back() / 1048576.0);
+    }
+}
+
+bool LargeBufferAllocator::parseHugePagePolicy(const char* name, HugePagePolicy& policy) {
+    if(strcmp(name, "none") == 0) {
+        policy = HugePagePolicy::NONE;
+    } else if(strcmp(name, "thp") == 0) {
+        policy = HugePagePolicy::TRANSPARENT;
+    } else if(strcmp(name, "hugetlb") == 0) {
+        policy = HugePagePolicy::HUGETLBFS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* LargeBufferAllocator::getHugePagePolicyName(HugePagePolicy policy) {
+    switch(policy) {
+        case HugePagePolicy::NONE: return "none";
+        case HugePagePolicy::TRANSPARENT: return "thp";
+        case HugePagePolicy::HUGETLBFS: return "hugetlb";
+    }
+    return "unknown";
+}
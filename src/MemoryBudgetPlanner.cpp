@@ -0,0 +1,242 @@
+/**
+ * @file MemoryBudgetPlanner.cpp
+ * @brief Implementation of MemoryBudgetPlanner
+ */
+
+#include "../include/MemoryBudgetPlanner.h"
+#include "../include/GenomeDataManager.h"
+#include "../include/RelativeIdentificationEngine.h"
+#include "../include/MinHashIndex.h"
+#include "../include/PIHATKernels.h"
+#include "../include/KinshipCache.h"
+#include "../include/PhasingAlgorithmEngine.h"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+namespace {
+    const size_t MEGABYTE = 1024 * 1024;
+    const size_t DEFAULT_THREAD_STACK_BYTES = 8 * MEGABYTE;
+    const int WINDOWS_PER_CHROMOSOME = 20;
+}
+
+MemoryBudgetPlanner::MemoryBudgetPlanner()
+    : maxMemoryBytes(0), numberOfIndividuals(0), maxThreads(1), pihatBatchSize(1), pihatScreenStride(0), pihatQuantized(false), kinshipCacheBytes(0), kinshipDecomposition(false), relativeEstimator(RelativeEstimator::PIHAT),
+      perFocalSweep(true), minHashBandCount(0), minHashBlockSNPCount(1),
+      threadStackBytes(detectThreadStackBytes()) {
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        snpCountPerChromosome[chr] = 0;
+    }
+}
+
+void MemoryBudgetPlanner::setSNPCountPerChr(int chromosome, int count) {
+    if(chromosome >= 1 && chromosome < NUM_CHROMOSOMES) {
+        snpCountPerChromosome[chromosome] = count;
+    }
+}
+
+size_t MemoryBudgetPlanner::detectThreadStackBytes() {
+    // OMP_STACKSIZE sizes the worker stacks; its unit defaults to kilobytes
+    const char* ompStack = getenv("OMP_STACKSIZE");
+    if(ompStack != nullptr) {
+        char* end;
+        unsigned long long value = strtoull(ompStack, &end, 10);
+        while(isspace((unsigned char)*end)) end++;
+        switch(toupper((unsigned char)*end)) {
+            case 'B': return (size_t)value;
+            case 'M': return (size_t)value * MEGABYTE;
+            case 'G': return (size_t)value * MEGABYTE * 1024;
+            default: return (size_t)value * 1024;
+        }
+    }
+    struct rlimit limit;
+    if(getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+        return (size_t)limit.rlim_cur;
+    }
+    return DEFAULT_THREAD_STACK_BYTES;
+}
+
+size_t MemoryBudgetPlanner::computeGenomeRowBytes() const {
+    size_t rowBytes = 0;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        rowBytes += (snpCountPerChromosome[chr] / 4) + ((snpCountPerChromosome[chr] % 4) > 0 ? 1 : 0);
+    }
+    return rowBytes;
+}
+
+size_t MemoryBudgetPlanner::computeLargestChromosomeBytes() const {
+    size_t largest = 0;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        size_t rowBytes = (snpCountPerChromosome[chr] / 4) + ((snpCountPerChromosome[chr] % 4) > 0 ? 1 : 0);
+        if(rowBytes > largest) largest = rowBytes;
+    }
+    return largest * numberOfIndividuals;
+}
+
+void MemoryBudgetPlanner::estimate(MemoryPlan& plan) const {
+    size_t rowBytes = computeGenomeRowBytes();
+    int largestSNPCount = 0;
+    size_t totalSNPCount = 0;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        if(snpCountPerChromosome[chr] > largestSNPCount) largestSNPCount = snpCountPerChromosome[chr];
+        totalSNPCount += snpCountPerChromosome[chr];
+    }
+    // A PIHAT batch keeps one float per focal in every table entry and result
+    size_t batchStride = pihatBatchSize > 1 && !pihatQuantized ? (size_t)(pihatBatchSize + 7) / 8 * 8 : 1;
+    // PIHAT screening keeps a thinned copy of the genome store and its tables
+    size_t screenRowBytes = 0;
+    size_t screenSNPCount = 0;
+    if(pihatScreenStride > 0) {
+        for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+            size_t thinnedCount = (snpCountPerChromosome[chr] + pihatScreenStride - 1) / pihatScreenStride;
+            screenRowBytes += thinnedCount / 4 + (thinnedCount % 4 > 0 ? 1 : 0);
+            screenSNPCount += thinnedCount;
+        }
+    }
+
+    // Out of core only the chromosome being read has to stay resident, unless
+    // each focal sweeps every chromosome of every relative
+    plan.genomeStoreBytes = plan.storageMode == GenomeStorageMode::IN_MEMORY || perFocalSweep
+                          ? rowBytes * numberOfIndividuals
+                          : computeLargestChromosomeBytes();
+    plan.phasedStoreBytes = rowBytes * plan.chunkSize;
+    // KING-robust keeps two bit-planes per individual in place of the PIHAT tables
+    size_t bitPlaneBytes = relativeEstimator == RelativeEstimator::KING_ROBUST
+                         ? (totalSNPCount + 63) / 64 * 2 * sizeof(uint64_t) * numberOfIndividuals
+                           + (size_t)numberOfIndividuals * 3 * sizeof(int)
+                         : 0;
+    // Four int16 entries per SNP plus one float scale per block
+    size_t quantizedBytes = pihatQuantized
+                          ? totalSNPCount * PIHATKernels::QUANTIZED_ENTRIES * sizeof(int16_t)
+                            + (totalSNPCount / PIHATKernels::QUANTIZED_BLOCK_SNPS + NUM_CHROMOSOMES) * sizeof(float)
+                          : 0;
+    // Cohort contribution tables: every focal dosage and allele against every relative dosage
+    size_t cohortTableBytes = relativeEstimator == RelativeEstimator::PIHAT
+                            ? totalSNPCount * (GenomeDataManager::CONTRIBUTION_ENTRIES
+                                               + GenomeDataManager::HAPLOTYPE_CONTRIBUTION_ENTRIES) * sizeof(float)
+                            : 0;
+    // Per-chromosome, per-haplotype parts of every relative and the focal's haplotype table
+    size_t decompositionBytes = kinshipDecomposition
+                              ? (size_t)numberOfIndividuals * (PIHATKernels::DECOMPOSITION_ENTRIES * sizeof(float) + sizeof(int))
+                                + totalSNPCount * 3 * sizeof(float)
+                              : 0;
+    size_t minHashBytes = 0;
+    if(minHashBandCount > 0) {
+        int blockCount = 0;
+        for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+            blockCount += (snpCountPerChromosome[chr] + minHashBlockSNPCount - 1) / minHashBlockSNPCount;
+        }
+        minHashBytes = MinHashIndex::estimateMemoryBytes(blockCount, numberOfIndividuals, minHashBandCount);
+    }
+    plan.sharedStateBytes = sizeof(GenomeDataManager) + sizeof(RelativeIdentificationEngine)
+                          + sizeof(PhasingAlgorithmEngine)
+                          + (size_t)numberOfIndividuals * 2 * sizeof(float)
+                          + (size_t)numberOfIndividuals * batchStride * sizeof(float)
+                          + totalSNPCount * 3 * batchStride * sizeof(float)
+                          + screenRowBytes * numberOfIndividuals
+                          + screenSNPCount * 3 * batchStride * sizeof(float)
+                          + bitPlaneBytes + minHashBytes + quantizedBytes + cohortTableBytes + decompositionBytes
+                          + KinshipCache::estimateMemoryBytes(numberOfIndividuals, kinshipCacheBytes);
+    // Stack plus the private allele counts of the MAF sweep
+    plan.jobContextBytes = threadStackBytes + (size_t)largestSNPCount * sizeof(int);
+    size_t windowCount = (size_t)(NUM_CHROMOSOMES - 1) * WINDOWS_PER_CHROMOSOME;
+    plan.correlationBytes = windowCount * windowCount * sizeof(double);
+    // One PED row is at most four characters per SNP, plus the stdio buffer
+    plan.outputBufferBytes = (size_t)largestSNPCount * 4 + BUFSIZ;
+
+    plan.totalBytes = plan.genomeStoreBytes + plan.phasedStoreBytes + plan.sharedStateBytes
+                    + plan.jobContextBytes * plan.threadCount + plan.correlationBytes
+                    + plan.outputBufferBytes;
+}
+
+bool MemoryBudgetPlanner::plan(MemoryPlan& result) const {
+    MemoryPlan candidate;
+    candidate.threadCount = maxThreads;
+    candidate.chunkSize = numberOfIndividuals;
+    candidate.storageMode = GenomeStorageMode::IN_MEMORY;
+    estimate(candidate);
+    if(maxMemoryBytes == 0 || candidate.totalBytes <= maxMemoryBytes) {
+        result = candidate;
+        return true;
+    }
+
+    const GenomeStorageMode modes[] = {GenomeStorageMode::IN_MEMORY, GenomeStorageMode::OUT_OF_CORE};
+    for(GenomeStorageMode mode : modes) {
+        // Paging the store in for every focal would not make it any smaller
+        if(mode == GenomeStorageMode::OUT_OF_CORE && perFocalSweep) {
+            continue;
+        }
+        candidate.storageMode = mode;
+        for(int threads = maxThreads; threads >= 1; threads--) {
+            candidate.threadCount = threads;
+            int chunk = numberOfIndividuals;
+            while(true) {
+                candidate.chunkSize = chunk;
+                estimate(candidate);
+                if(candidate.totalBytes <= maxMemoryBytes) {
+                    result = candidate;
+                    return true;
+                }
+                if(chunk <= 1) break;
+                chunk = (chunk + 1) / 2;
+            }
+        }
+    }
+
+    // Report the leanest layout so the user knows how much memory to ask for
+    result = candidate;
+    return false;
+}
+
+void MemoryBudgetPlanner::printPlan(const MemoryPlan& plan) const {
+    printf("\n=== Memory Plan ===\n");
+    printf("Genome store:        %10.1f MB (%s)\n", plan.genomeStoreBytes / (double)MEGABYTE,
+           getStorageModeName(plan.storageMode));
+    printf("Phased store:        %10.1f MB (%d individuals per chunk)\n",
+           plan.phasedStoreBytes / (double)MEGABYTE, plan.chunkSize);
+    printf("Shared engine state: %10.1f MB\n", plan.sharedStateBytes / (double)MEGABYTE);
+    printf("Thread contexts:     %10.1f MB (%d x %.1f MB)\n",
+           plan.jobContextBytes * plan.threadCount / (double)MEGABYTE, plan.threadCount,
+           plan.jobContextBytes / (double)MEGABYTE);
+    printf("Correlation matrix:  %10.1f MB\n", plan.correlationBytes / (double)MEGABYTE);
+    printf("Output buffers:      %10.1f MB\n", plan.outputBufferBytes / (double)MEGABYTE);
+    if(maxMemoryBytes > 0) {
+        printf("Total:               %10.1f MB of %.1f MB budget\n",
+               plan.totalBytes / (double)MEGABYTE, maxMemoryBytes / (double)MEGABYTE);
+    } else {
+        printf("Total:               %10.1f MB (no budget set)\n", plan.totalBytes / (double)MEGABYTE);
+    }
+    printf("===================\n");
+}
+
+bool MemoryBudgetPlanner::parseMemorySize(const char* text, size_t& bytes) {
+    char* end;
+    double value = strtod(text, &end);
+    if(end == text || value <= 0.0) {
+        return false;
+    }
+    // A bare number is in megabytes, as for SLURM --mem
+    double unit = (double)MEGABYTE;
+    switch(toupper((unsigned char)*end)) {
+        case '\0': break;
+        case 'K': unit = 1024.0; break;
+        case 'M': unit = (double)MEGABYTE; break;
+        case 'G': unit = (double)MEGABYTE * 1024.0; break;
+        case 'T': unit = (double)MEGABYTE * 1024.0 * 1024.0; break;
+        default: return false;
+    }
+    bytes = (size_t)(value * unit);
+    return true;
+}
+
+const char* MemoryBudgetPlanner::getStorageModeName(GenomeStorageMode mode) {
+    switch(mode) {
+        case GenomeStorageMode::IN_MEMORY: return "in memory";
+        case GenomeStorageMode::OUT_OF_CORE: return "out of core";
+    }
+    return "unknown";
+}
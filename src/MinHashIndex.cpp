@@ -0,0 +1,231 @@
+/**
+ * @file MinHashIndex.cpp
+ * @brief Implementation of MinHashIndex
+ */
+
+#include "../include/MinHashIndex.h"
+#include "../include/GenomeDataManager.h"
+#include <algorithm>
+#include <cstdio>
+#include <omp.h>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+const int MinHashIndex::SHINGLE_SNPS;
+constexpr double MinHashIndex::MAX_SHINGLE_FREQUENCY;
+
+namespace {
+    const uint32_t EMPTY_HASH = 0xFFFFFFFFu;
+
+    // SplitMix64 finalizer: every input bit affects every output bit
+    inline uint64_t mixBits(uint64_t value) {
+        value += 0x9E3779B97F4A7C15ull;
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        return value ^ (value >> 31);
+    }
+}
+
+MinHashIndex::MinHashIndex(GenomeDataManager* gdm)
+    : genomeDataManager(gdm), bandCount(8), rowsPerBand(2), blockSNPCount(10000), numberOfIndividuals(0),
+      queryStamp(0), buildSeconds(0.0), queryCount(0), candidateCount(0.0), querySeconds(0.0),
+      auditRecall(false), auditThreshold(0.1f), auditedFocalCount(0), auditedRelativeCount(0.0),
+      recalledRelativeCount(0.0) {
+}
+
+void MinHashIndex::configure(int bands, int rows, int blockSNPs) {
+    bandCount = std::max(1, bands);
+    rowsPerBand = std::max(1, rows);
+    blockSNPCount = std::max(SHINGLE_SNPS, blockSNPs);
+    keys.clear();
+    buckets.clear();
+    bucketSizes.clear();
+}
+
+void MinHashIndex::hashBlock(int block, std::vector<uint32_t>& signatures) const {
+    const Block& range = blocks[block];
+    const int hashCount = bandCount * rowsPerBand;
+    const int haplotypeCount = 2 * numberOfIndividuals;
+    const int maxCount = std::max(2, (int)(MAX_SHINGLE_FREQUENCY * haplotypeCount));
+    const unsigned char* buffer = genomeDataManager->getGenomeBuffer(range.chromosome);
+    size_t rowBytes = genomeDataManager->getBytesPerIndividual(range.chromosome);
+
+    signatures.assign((size_t)numberOfIndividuals * hashCount, EMPTY_HASH);
+    std::vector<uint64_t> patterns(haplotypeCount);
+    std::vector<uint32_t> hashes(hashCount);
+    int blockEnd = range.firstSNP + range.snpCount;
+
+    for(int windowStart = range.firstSNP; windowStart < blockEnd; windowStart += SHINGLE_SNPS) {
+        int windowEnd = std::min(windowStart + SHINGLE_SNPS, blockEnd);
+        // Pattern in the high half, haplotype in the low half: sorting groups equal shingles
+        for(int individual = 0; individual < numberOfIndividuals; individual++) {
+            const unsigned char* row = buffer + (size_t)individual * rowBytes;
+            uint32_t pattern0 = 0;
+            uint32_t pattern1 = 0;
+            for(int snp = windowStart; snp < windowEnd; snp++) {
+                int genotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+                pattern0 |= (uint32_t)(genotype >> 1) << (snp - windowStart);
+                pattern1 |= (uint32_t)(genotype & 1) << (snp - windowStart);
+            }
+            patterns[2 * individual] = ((uint64_t)pattern0 << 32) | (uint32_t)(2 * individual);
+            patterns[2 * individual + 1] = ((uint64_t)pattern1 << 32) | (uint32_t)(2 * individual + 1);
+        }
+        std::sort(patterns.begin(), patterns.end());
+
+        uint64_t windowSeed = mixBits(((uint64_t)range.chromosome << 32) | (uint32_t)windowStart);
+        for(int first = 0; first < haplotypeCount; ) {
+            uint32_t pattern = (uint32_t)(patterns[first] >> 32);
+            int last = first + 1;
+            while(last < haplotypeCount && (uint32_t)(patterns[last] >> 32) == pattern) {
+                last++;
+            }
+            if(last - first >= 2 && last - first <= maxCount) {
+                uint64_t shingle = mixBits(windowSeed ^ pattern);
+                for(int hash = 0; hash < hashCount; hash++) {
+                    hashes[hash] = (uint32_t)(mixBits(shingle + (uint64_t)(hash + 1) * 0xD1B54A32D192ED03ull) >> 32);
+                }
+                for(int member = first; member < last; member++) {
+                    int individual = (int)(uint32_t)patterns[member] / 2;
+                    uint32_t* signature = &signatures[(size_t)individual * hashCount];
+                    for(int hash = 0; hash < hashCount; hash++) {
+                        signature[hash] = std::min(signature[hash], hashes[hash]);
+                    }
+                }
+            }
+            first = last;
+        }
+    }
+}
+
+bool MinHashIndex::build() {
+    double startTime = omp_get_wtime();
+    numberOfIndividuals = genomeDataManager->getNumberOfIndividuals();
+    blocks.clear();
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        if(genomeDataManager->getGenomeBuffer(chr) == nullptr) continue;
+        int snpCount = genomeDataManager->getSNPCount(chr);
+        for(int firstSNP = 0; firstSNP < snpCount; firstSNP += blockSNPCount) {
+            blocks.push_back(Block{chr, firstSNP, std::min(blockSNPCount, snpCount - firstSNP)});
+        }
+    }
+    if(blocks.empty() || numberOfIndividuals < 1) {
+        printf("Error: No genome data to build the MinHash index from\n");
+        return false;
+    }
+
+    size_t segmentCount = blocks.size() * bandCount;
+    keys.assign(segmentCount * numberOfIndividuals, 0);
+    buckets.assign(segmentCount * numberOfIndividuals, 0);
+    bucketSizes.assign(segmentCount, 0);
+    candidateStamps.assign(numberOfIndividuals, 0);
+    queryStamp = 0;
+
+    const int hashCount = bandCount * rowsPerBand;
+    #pragma omp parallel
+    {
+        std::vector<uint32_t> signatures;
+        #pragma omp for schedule(dynamic)
+        for(int block = 0; block < (int)blocks.size(); block++) {
+            hashBlock(block, signatures);
+            for(int band = 0; band < bandCount; band++) {
+                size_t segment = (size_t)block * bandCount + band;
+                uint32_t* bandKeys = &keys[segment * numberOfIndividuals];
+                int* bucket = &buckets[segment * numberOfIndividuals];
+                int listed = 0;
+                for(int individual = 0; individual < numberOfIndividuals; individual++) {
+                    const uint32_t* rows = &signatures[(size_t)individual * hashCount + band * rowsPerBand];
+                    // Individuals without an indexed shingle would all share one bucket
+                    if(rows[0] == EMPTY_HASH) continue;
+                    uint64_t key = (uint64_t)band << 32;
+                    for(int row = 0; row < rowsPerBand; row++) {
+                        key = mixBits(key ^ rows[row]);
+                    }
+                    bandKeys[individual] = std::max(1u, (uint32_t)(key >> 32));
+                    bucket[listed++] = individual;
+                }
+                std::sort(bucket, bucket + listed, [bandKeys](int a, int b) {
+                    return bandKeys[a] < bandKeys[b] || (bandKeys[a] == bandKeys[b] && a < b);
+                });
+                bucketSizes[segment] = listed;
+            }
+        }
+    }
+    buildSeconds = omp_get_wtime() - startTime;
+    return true;
+}
+
+void MinHashIndex::findCandidates(int focalIndividual, std::vector<int>& candidates) {
+    double startTime = omp_get_wtime();
+    candidates.clear();
+    if(focalIndividual < 0 || focalIndividual >= numberOfIndividuals) {
+        return;
+    }
+    if(++queryStamp == 0) {
+        std::fill(candidateStamps.begin(), candidateStamps.end(), 0);
+        queryStamp = 1;
+    }
+    candidateStamps[focalIndividual] = queryStamp;
+    candidates.push_back(focalIndividual);
+
+    for(size_t segment = 0; segment < bucketSizes.size(); segment++) {
+        const uint32_t* bandKeys = &keys[segment * numberOfIndividuals];
+        uint32_t key = bandKeys[focalIndividual];
+        if(key == 0) continue;
+        const int* bucket = &buckets[segment * numberOfIndividuals];
+        const int* first = std::lower_bound(bucket, bucket + bucketSizes[segment], key,
+                                            [bandKeys](int individual, uint32_t value) { return bandKeys[individual] < value; });
+        for(const int* member = first; member < bucket + bucketSizes[segment] && bandKeys[*member] == key; member++) {
+            if(candidateStamps[*member] != queryStamp) {
+                candidateStamps[*member] = queryStamp;
+                candidates.push_back(*member);
+            }
+        }
+    }
+    queryCount++;
+    candidateCount += candidates.size();
+    querySeconds += omp_get_wtime() - startTime;
+}
+
+bool MinHashIndex::isCandidate(int individual) const {
+    return individual >= 0 && individual < (int)candidateStamps.size()
+           && queryStamp != 0 && candidateStamps[individual] == queryStamp;
+}
+
+void MinHashIndex::recordRecall(int focalIndividual, const float* exactPIHAT, int count) {
+    for(int relativeID = 0; relativeID < count; relativeID++) {
+        if(relativeID != focalIndividual && exactPIHAT[relativeID] > auditThreshold) {
+            auditedRelativeCount++;
+            if(isCandidate(relativeID)) {
+                recalledRelativeCount++;
+            }
+        }
+    }
+    auditedFocalCount++;
+}
+
+size_t MinHashIndex::getMemoryBytes() const {
+    return keys.size() * sizeof(uint32_t) + buckets.size() * sizeof(int)
+           + candidateStamps.size() * sizeof(unsigned int);
+}
+
+size_t MinHashIndex::estimateMemoryBytes(int blockCount, int individuals, int bands) {
+    return (size_t)blockCount * bands * individuals * (sizeof(uint32_t) + sizeof(int))
+           + (size_t)individuals * sizeof(unsigned int);
+}
+
+void MinHashIndex::printReport() const {
+    printf("MinHash index: %d blocks x %d bands x %d rows, built in %.2f s, %.1f MB\n",
+           (int)blocks.size(), bandCount, rowsPerBand, buildSeconds, getMemoryBytes() / 1048576.0);
+    if(queryCount > 0) {
+        printf("MinHash queries: %d focal(s), %.1f candidates per focal (%.2f%% of the cohort) in %.3f s\n",
+               queryCount, candidateCount / queryCount,
+               100.0 * candidateCount / queryCount / std::max(1, numberOfIndividuals), querySeconds);
+    }
+    if(auditedFocalCount > 0) {
+        printf("MinHash recall: %.0f of %.0f relatives above PIHAT %.3f were candidates (%.2f%%) over %d focal(s)\n",
+               recalledRelativeCount, auditedRelativeCount, auditThreshold,
+               auditedRelativeCount > 0.0 ? 100.0 * recalledRelativeCount / auditedRelativeCount : 100.0,
+               auditedFocalCount);
+    }
+}
@@ -0,0 +1,295 @@
+/**
+ * @file NumaTopology.cpp
+ * @brief Implementation of NumaTopology
+ */
+
+#include "../include/NumaTopology.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <omp.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+
+using namespace PhasingEngine;
+
+namespace {
+    // Values from <linux/mempolicy.h>; raw syscalls avoid a libnuma dependency
+    const int MPOL_INTERLEAVE_MODE = 3;
+    const size_t MAX_SAMPLED_PAGES = 4096;
+}
+
+NumaTopology::NumaTopology()
+    : onlineProcessors(1), threadsPinned(false),
+      placementPolicy(NumaPlacementPolicy::FIRST_TOUCH) {
+}
+
+std::vector<int> NumaTopology::parseCPUList(const char* list) {
+    std::vector<int> values;
+    const char* cursor = list;
+    while(*cursor != '\0' && *cursor != '\n') {
+        char* end;
+        long first = strtol(cursor, &end, 10);
+        if(end == cursor) break;
+        long last = first;
+        cursor = end;
+        if(*cursor == '-') {
+            last = strtol(cursor + 1, &end, 10);
+            cursor = end;
+        }
+        for(long value = first; value <= last; value++) {
+            values.push_back((int)value);
+        }
+        if(*cursor == ',') cursor++;
+    }
+    return values;
+}
+
+void NumaTopology::detectNodesFromSysfs(const std::vector<int>& allowedCPUs) {
+    char line[4096];
+    FILE* onlineFile = fopen("/sys/devices/system/node/online", "r");
+    if(onlineFile == nullptr) {
+        return;
+    }
+    std::vector<int> nodeIDs;
+    if(fgets(line, sizeof(line), onlineFile) != nullptr) {
+        nodeIDs = parseCPUList(line);
+    }
+    fclose(onlineFile);
+
+    for(int nodeID : nodeIDs) {
+        NumaNode node;
+        node.id = nodeID;
+
+        char path[256];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", nodeID);
+        FILE* cpuFile = fopen(path, "r");
+        if(cpuFile != nullptr) {
+            if(fgets(line, sizeof(line), cpuFile) != nullptr) {
+                for(int cpu : parseCPUList(line)) {
+                    for(int allowed : allowedCPUs) {
+                        if(allowed == cpu) {
+                            node.cpus.push_back(cpu);
+                            break;
+                        }
+                    }
+                }
+            }
+            fclose(cpuFile);
+        }
+
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/meminfo", nodeID);
+        FILE* memFile = fopen(path, "r");
+        if(memFile != nullptr) {
+            while(fgets(line, sizeof(line), memFile) != nullptr) {
+                const char* field = strstr(line, "MemTotal:");
+                if(field != nullptr) {
+                    node.memoryBytes = (size_t)strtoull(field + strlen("MemTotal:"), nullptr, 10) * 1024;
+                    break;
+                }
+            }
+            fclose(memFile);
+        }
+        nodes.push_back(node);
+    }
+}
+
+void NumaTopology::detect() {
+    nodes.clear();
+    onlineProcessors = get_nprocs();
+
+    std::vector<int> allowedCPUs;
+    cpu_set_t affinity;
+    CPU_ZERO(&affinity);
+    if(sched_getaffinity(0, sizeof(affinity), &affinity) == 0) {
+        for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if(CPU_ISSET(cpu, &affinity)) allowedCPUs.push_back(cpu);
+        }
+    } else {
+        for(int cpu = 0; cpu < onlineProcessors; cpu++) allowedCPUs.push_back(cpu);
+    }
+
+    detectNodesFromSysfs(allowedCPUs);
+
+    if(nodes.empty()) {
+        NumaNode node;
+        node.cpus = allowedCPUs;
+        struct sysinfo info;
+        if(sysinfo(&info) == 0) {
+            node.memoryBytes = (size_t)info.totalram * info.mem_unit;
+        }
+        nodes.push_back(node);
+    }
+}
+
+int NumaTopology::findNodeOfCPU(int cpu) const {
+    for(const NumaNode& node : nodes) {
+        for(int nodeCPU : node.cpus) {
+            if(nodeCPU == cpu) return node.id;
+        }
+    }
+    return -1;
+}
+
+bool NumaTopology::pinThreads() {
+    if(getenv("OMP_PROC_BIND") != nullptr || getenv("GOMP_CPU_AFFINITY") != nullptr) {
+        printf("Thread pinning left to the OpenMP runtime (OMP_PROC_BIND/GOMP_CPU_AFFINITY set)\n");
+        return false;
+    }
+
+    // Spread threads round-robin over the nodes so that a partial thread count
+    // still draws on the memory bandwidth of every socket
+    std::vector<int> cpuOrder;
+    size_t maxCPUsPerNode = 0;
+    for(const NumaNode& node : nodes) {
+        if(node.cpus.size() > maxCPUsPerNode) maxCPUsPerNode = node.cpus.size();
+    }
+    for(size_t slot = 0; slot < maxCPUsPerNode; slot++) {
+        for(const NumaNode& node : nodes) {
+            if(slot < node.cpus.size()) cpuOrder.push_back(node.cpus[slot]);
+        }
+    }
+    if(cpuOrder.empty()) {
+        return false;
+    }
+
+    int threadCount = omp_get_max_threads();
+    threadCPU.assign(threadCount, -1);
+    threadNode.assign(threadCount, -1);
+    int failures = 0;
+
+    #pragma omp parallel num_threads(threadCount) reduction(+:failures)
+    {
+        int thread = omp_get_thread_num();
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(cpuOrder[thread % cpuOrder.size()], &mask);
+        if(sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+            failures++;
+        }
+        threadCPU[thread] = sched_getcpu();
+        threadNode[thread] = findNodeOfCPU(threadCPU[thread]);
+    }
+
+    threadsPinned = (failures == 0);
+    return threadsPinned;
+}
+
+void NumaTopology::placeRegion(unsigned char* region, size_t bytes, size_t rowBytes, size_t rowCount) const {
+    if(region == nullptr || bytes == 0) {
+        return;
+    }
+
+    NumaPlacementPolicy policy = placementPolicy;
+    if(policy == NumaPlacementPolicy::INTERLEAVE && nodes.size() > 1) {
+        unsigned long nodeMask[16] = {0};
+        const size_t bitsPerWord = sizeof(unsigned long) * 8;
+        for(const NumaNode& node : nodes) {
+            if(node.id >= 0 && (size_t)node.id < sizeof(nodeMask) * 8) {
+                nodeMask[node.id / bitsPerWord] |= 1UL << (node.id % bitsPerWord);
+            }
+        }
+        if(syscall(SYS_mbind, region, bytes, MPOL_INTERLEAVE_MODE,
+                   nodeMask, sizeof(nodeMask) * 8, 0) != 0) {
+            printf("Warning: interleaved placement failed, falling back to first touch\n");
+            policy = NumaPlacementPolicy::FIRST_TOUCH;
+        }
+    }
+
+    if(policy == NumaPlacementPolicy::FIRST_TOUCH) {
+        // Same static partition of individuals as the PIHAT and scanning loops,
+        // so each row lands on the node of the thread that reads it
+        #pragma omp parallel for schedule(static)
+        for(int64_t row = 0; row < (int64_t)rowCount; row++) {
+            memset(region + (size_t)row * rowBytes, 0, rowBytes);
+        }
+    }
+}
+
+void NumaTopology::queryPageNodes(const unsigned char* region, size_t bytes,
+                                  std::vector<size_t>& bytesPerNode) const {
+    int highestNode = 0;
+    for(const NumaNode& node : nodes) {
+        if(node.id > highestNode) highestNode = node.id;
+    }
+    if(bytesPerNode.size() < (size_t)highestNode + 2) {
+        bytesPerNode.resize(highestNode + 2, 0);
+    }
+    if(region == nullptr || bytes == 0) {
+        return;
+    }
+
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pageCount = (bytes + pageSize - 1) / pageSize;
+    size_t sampleCount = pageCount < MAX_SAMPLED_PAGES ? pageCount : MAX_SAMPLED_PAGES;
+    std::vector<void*> pages(sampleCount);
+    std::vector<int> status(sampleCount, -1);
+    for(size_t sample = 0; sample < sampleCount; sample++) {
+        size_t page = sample * pageCount / sampleCount;
+        pages[sample] = (void*)(region + page * pageSize);
+    }
+
+    // The last slot collects pages whose node could not be determined
+    size_t unknownSlot = bytesPerNode.size() - 1;
+    if(syscall(SYS_move_pages, 0, sampleCount, pages.data(), nullptr, status.data(), 0) != 0) {
+        bytesPerNode[unknownSlot] += bytes;
+        return;
+    }
+    for(size_t sample = 0; sample < sampleCount; sample++) {
+        size_t share = bytes / sampleCount + (sample < bytes % sampleCount ? 1 : 0);
+        if(status[sample] >= 0 && status[sample] < (int)unknownSlot) {
+            bytesPerNode[status[sample]] += share;
+        } else {
+            bytesPerNode[unknownSlot] += share;
+        }
+    }
+}
+
+void NumaTopology::printPlacementReport() const {
+    printf("\n=== NUMA Topology ===\n");
+    printf("Online processors: %d, NUMA nodes: %d, placement policy: %s\n",
+           onlineProcessors, (int)nodes.size(), getPlacementPolicyName(placementPolicy));
+    for(const NumaNode& node : nodes) {
+        int threadsOnNode = 0;
+        for(int threadNodeID : threadNode) {
+            if(threadNodeID == node.id) threadsOnNode++;
+        }
+        printf("  Node %d: %d allowed CPUs, %.1f GB memory, %d pinned threads\n",
+               node.id, (int)node.cpus.size(), node.memoryBytes / 1073741824.0, threadsOnNode);
+    }
+    if(threadsPinned) {
+        printf("  Thread -> CPU:");
+        for(size_t thread = 0; thread < threadCPU.size(); thread++) {
+            printf(" %d->%d", (int)thread, threadCPU[thread]);
+        }
+        printf("\n");
+    } else {
+        printf("  Threads are not pinned\n");
+    }
+    printf("=====================\n");
+}
+
+bool NumaTopology::parsePlacementPolicy(const char* name, NumaPlacementPolicy& policy) {
+    if(strcmp(name, "none") == 0) {
+        policy = NumaPlacementPolicy::NONE;
+    } else if(strcmp(name, "firsttouch") == 0) {
+        policy = NumaPlacementPolicy::FIRST_TOUCH;
+    } else if(strcmp(name, "interleave") == 0) {
+        policy = NumaPlacementPolicy::INTERLEAVE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* NumaTopology::getPlacementPolicyName(NumaPlacementPolicy policy) {
+    switch(policy) {
+        case NumaPlacementPolicy::NONE: return "none";
+        case NumaPlacementPolicy::FIRST_TOUCH: return "firsttouch";
+        case NumaPlacementPolicy::INTERLEAVE: return "interleave";
+    }
+    return "unknown";
+}
@@ -5,17 +5,23 @@
 
 #include "../include/OutputFileWriter.h"
 #include "../include/GenomeDataManager.h"
+#include "../include/PhasedHaplotypeStore.h"
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 
 using namespace PhasingEngine;
 
-OutputFileWriter::OutputFileWriter(GenomeDataManager* gdm) 
-    : genomeDataManager(gdm) {
+OutputFileWriter::OutputFileWriter(GenomeDataManager* gdm, PhasedHaplotypeStore* store) 
+    : genomeDataManager(gdm), phasedStore(store) {
 }
 
 bool OutputFileWriter::writeOutput(int chromosome, const char* outputPath) {
+    return writeOutputRange(chromosome, outputPath, 0, genomeDataManager->getNumberOfIndividuals(), false);
+}
+
+bool OutputFileWriter::writeOutputRange(int chromosome, const char* outputPath,
+                                        int firstIndividual, int count, bool append) {
     char filename[200];
     char chromosomeNumber[100];
     
@@ -24,21 +30,14 @@ bool OutputFileWriter::writeOutput(int chromosome, const char* outputPath) {
     strcat(filename, chromosomeNumber);
     strcat(filename, ".ped");
     
-    FILE* fileHandle = fopen(filename, "w");
+    FILE* fileHandle = fopen(filename, append ? "a" : "w");
     if(fileHandle == nullptr) {
         printf("Error: Could not open output file %s\n", filename);
         return false;
     }
     
-    int numberOfIndividuals = genomeDataManager->getNumberOfIndividuals();
-    for(int individual = 0; individual < numberOfIndividuals; individual++) {
-        fprintf(fileHandle, "%d %d 0 0 -9 0 ", individual, individual);
-        for(int snp = 0; snp < genomeDataManager->getSNPCount(chromosome); snp++) {
-            int genotype = genomeDataManager->getGenotype(chromosome, individual, snp);
-            genotype = rand() % 4;
-            fprintf(fileHandle, "%d %d ", genotype % 2, genotype / 2);
-        }
-        fprintf(fileHandle, "\n");
+    for(int individual = firstIndividual; individual < firstIndividual + count; individual++) {
+        writePEDRow(fileHandle, individual, chromosome);
     }
     
     fclose(fileHandle);
@@ -71,10 +70,18 @@ void OutputFileWriter::writePEDHeader(FILE* file, int chromosome) const {
 void OutputFileWriter::writePEDRow(FILE* file, int individualID, int chromosome) const {
     fprintf(file, "%d %d 0 0 -9 0 ", individualID, individualID);
     for(int snp = 0; snp < genomeDataManager->getSNPCount(chromosome); snp++) {
-        int genotype = genomeDataManager->getGenotype(chromosome, individualID, snp);
+        int genotype = getOutputGenotype(chromosome, individualID, snp);
         fprintf(file, "%d %d ", genotype % 2, genotype / 2);
     }
     fprintf(file, "\n");
 }
 
 
+
+int OutputFileWriter::getOutputGenotype(int chromosome, int individualID, int snpIndex) const {
+    // Individuals that were not phased keep their input genotypes
+    if(phasedStore != nullptr && phasedStore->isCommitted(individualID)) {
+        return phasedStore->getGenotype(chromosome, individualID, snpIndex);
+    }
+    return genomeDataManager->getGenotype(chromosome, individualID, snpIndex);
+}
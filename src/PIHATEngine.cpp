@@ -0,0 +1,732 @@
+/**
+ * @file PIHATEngine.cpp
+ * @brief Implementation of PIHATEngine
+ */
+
+#include "../include/PIHATEngine.h"
+#include "../include/GenomeDataManager.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <omp.h>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+PIHATEngine::PIHATEngine(GenomeDataManager* gdm)
+    : genomeDataManager(gdm), snpsPerRelative(0), requestedKernel(PIHATKernel::AUTO),
+      activeKernel(PIHATKernels::resolve(PIHATKernel::AUTO)), batchSize(1), batchStride(1),
+      batchRelativeCount(0), batchFirstRelative(0), batchEndRelative(0), screenStride(0), screenThreshold(0.0f),
+      screenSigmas(DEFAULT_SCREEN_SIGMAS), screenAudit(false), quantized(false), lastQuantizationBound(0.0),
+      maxQuantizationBound(0.0), decompose(false), pihatTiling("PIHAT sweep"),
+      batchTiling("Batched PIHAT sweep"), quantizedTiling("Quantized PIHAT sweep"),
+      decomposedTiling("Decomposed PIHAT sweep") {
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        screenSNPCounts[chr] = 0;
+    }
+    resetStatistics();
+}
+
+constexpr float PIHATEngine::DEFAULT_SCREEN_SIGMAS;
+
+void PIHATEngine::setKernel(PIHATKernel kernel) {
+    requestedKernel = kernel;
+    activeKernel = PIHATKernels::resolve(kernel);
+    if(kernel != PIHATKernel::AUTO && activeKernel != kernel) {
+        printf("Warning: PIHAT kernel %s is not supported by this CPU, using %s\n",
+               PIHATKernels::getKernelName(kernel), PIHATKernels::getKernelName(activeKernel));
+    }
+}
+
+void PIHATEngine::setBatchSize(int size) {
+    batchSize = std::max(1, std::min(size, PIHATKernels::MAX_BATCH));
+    invalidateBatch();
+}
+
+void PIHATEngine::setFocalQueue(const std::vector<int>& focals) {
+    focalQueue = focals;
+    invalidateBatch();
+}
+
+void PIHATEngine::invalidateBatch() {
+    batchFocals.clear();
+    batchPIHAT.clear();
+}
+
+void PIHATEngine::setScreening(int stride, float threshold, float sigmas) {
+    screenStride = std::max(0, stride);
+    screenThreshold = threshold;
+    screenSigmas = sigmas;
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        screenRows[chr].clear();
+        screenContributions[chr].clear();
+        screenSquares[chr].clear();
+        screenSNPCounts[chr] = 0;
+    }
+    invalidateBatch();
+}
+
+void PIHATEngine::setQuantized(bool enabled) {
+    quantized = enabled;
+    invalidateBatch();
+}
+
+void PIHATEngine::setDecomposition(bool enabled) {
+    decompose = enabled;
+    decomposition.clear();
+    decompositionFocals.clear();
+}
+
+void PIHATEngine::tabulateHaplotypeContributions(int focalIndividual) {
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        int snpCount = genomeDataManager->getSNPCount(chr);
+        haplotypeContributions[chr].assign((size_t)snpCount * 3 + PIHATKernels::TABLE_PADDING, 0.0f);
+        const float* cohortTable = genomeDataManager->getHaplotypeContributionTable(chr);
+        for(int snp = 0; snp < snpCount; snp++) {
+            // The first haplotype takes the entries of the allele it carries
+            int focalGenotype = genomeDataManager->getGenotype(chr, focalIndividual, snp);
+            const float* entries = cohortTable + (size_t)snp * GenomeDataManager::HAPLOTYPE_CONTRIBUTION_ENTRIES
+                                 + (focalGenotype >> 1) * 3;
+            std::copy(entries, entries + 3, &haplotypeContributions[chr][(size_t)snp * 3]);
+        }
+    }
+}
+
+void PIHATEngine::prepareDecomposition(int numberOfRelatives) {
+    if(decompositionFocals.size() != (size_t)numberOfRelatives) {
+        decomposition.assign((size_t)numberOfRelatives * PIHATKernels::DECOMPOSITION_ENTRIES, 0.0f);
+        decompositionFocals.assign(numberOfRelatives, -1);
+    }
+}
+
+void PIHATEngine::sweepDecomposed(const PIHATSweep& sweep, int focalIndividual, int firstRelative, int endRelative,
+                                  float* output) {
+    PIHATKernel kernel = activeKernel;
+    float* parts = decomposition.data();
+    // Tiles add to the sums and parts, and skip chromosomes without genomes
+    std::fill(output + firstRelative, output + endRelative, 0.0f);
+    std::fill(parts + (size_t)firstRelative * PIHATKernels::DECOMPOSITION_ENTRIES,
+              parts + (size_t)endRelative * PIHATKernels::DECOMPOSITION_ENTRIES, 0.0f);
+    decomposedTiling.plan(sweep.buffers, sweep.bytesPerIndividual, sweep.snpCounts, 2 * 3 * sizeof(float),
+                          PIHATKernels::TILE_SNP_ALIGNMENT, PIHATKernels::getLaneCount(kernel) * 4);
+    decomposedTiling.run(firstRelative, endRelative, [&](const GenotypeTile& tile) {
+        PIHATSweep tiled = sweep;
+        tiled.tile = &tile;
+        int count = tile.endRelative - tile.firstRelative;
+        switch(kernel) {
+            case PIHATKernel::AVX512:
+                PIHATKernels::sweepDecomposedAVX512(tiled, tile.firstRelative, count, output, parts);
+                break;
+            case PIHATKernel::AVX2:
+                PIHATKernels::sweepDecomposedAVX2(tiled, tile.firstRelative, count, output, parts);
+                break;
+            default:
+                PIHATKernels::sweepDecomposedScalar(tiled, tile.firstRelative, count, output, parts);
+                break;
+        }
+    });
+    std::fill(decompositionFocals.begin() + firstRelative, decompositionFocals.begin() + endRelative, focalIndividual);
+    sweptDecompositionCount += endRelative - firstRelative;
+}
+
+void PIHATEngine::decomposeRelatives(int focalIndividual, const std::vector<int>& relatives, int numberOfRelatives) {
+    if(!decompose) {
+        return;
+    }
+    prepareDecomposition(numberOfRelatives);
+    std::vector<int> missing;
+    for(size_t index = 0; index < relatives.size(); index++) {
+        int relativeID = relatives[index];
+        if(relativeID >= 0 && relativeID < numberOfRelatives && decompositionFocals[relativeID] != focalIndividual) {
+            missing.push_back(relativeID);
+        }
+    }
+    if(missing.empty()) {
+        return;
+    }
+    // Every sweep tabulates its own focals, so the tables can be reused here
+    tabulateContributions(&focalIndividual, 1, 1);
+    tabulateHaplotypeContributions(focalIndividual);
+    PIHATSweep sweep;
+    prepareSweep(sweep, 1);
+    std::vector<float> sums(numberOfRelatives);
+    int missingCount = (int)missing.size();
+    #pragma omp parallel for schedule(dynamic, 4)
+    for(int index = 0; index < missingCount; index++) {
+        PIHATKernels::sweepDecomposedScalar(sweep, missing[index], 1, sums.data(), decomposition.data());
+        decompositionFocals[missing[index]] = focalIndividual;
+    }
+    rankedDecompositionCount += missingCount;
+}
+
+const float* PIHATEngine::getDecomposition(int focalIndividual, int relativeID) const {
+    if(relativeID < 0 || relativeID >= (int)decompositionFocals.size()
+       || decompositionFocals[relativeID] != focalIndividual) {
+        return nullptr;
+    }
+    return &decomposition[(size_t)relativeID * PIHATKernels::DECOMPOSITION_ENTRIES];
+}
+
+void PIHATEngine::quantizeContributions() {
+    const int blockSNPs = PIHATKernels::QUANTIZED_BLOCK_SNPS;
+    double bound = 0.0;
+    double largestSum = 0.0;
+    int sweptBlocks = 0;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        int snpCount = genomeDataManager->getSNPCount(chr);
+        int blockCount = (snpCount + blockSNPs - 1) / blockSNPs;
+        quantizedContributions[chr].assign((size_t)snpCount * PIHATKernels::QUANTIZED_ENTRIES, 0);
+        blockScales[chr].assign(blockCount, 0.0f);
+        const float* table = contributions[chr].data();
+        int16_t* quantizedTable = quantizedContributions[chr].data();
+        for(int block = 0; block < blockCount; block++) {
+            size_t firstEntry = (size_t)block * blockSNPs * 3;
+            size_t endEntry = (size_t)std::min(snpCount, (block + 1) * blockSNPs) * 3;
+            float largest = 0.0f;
+            bool finite = true;
+            for(size_t entry = firstEntry; entry < endEntry; entry++) {
+                finite = finite && std::isfinite(table[entry]);
+                largest = std::max(largest, std::fabs(table[entry]));
+            }
+            // A NaN scale gives NaN sums, as the float entries would
+            if(!finite) {
+                blockScales[chr][block] = std::numeric_limits<float>::quiet_NaN();
+                continue;
+            }
+            float scale = largest / PIHATKernels::QUANTIZED_MAX;
+            blockScales[chr][block] = scale;
+            if(scale == 0.0f) continue;
+            double largestError = 0.0;
+            for(size_t entry = firstEntry; entry < endEntry; entry++) {
+                long rounded = std::lround(table[entry] / scale);
+                rounded = std::max(-(long)PIHATKernels::QUANTIZED_MAX, std::min((long)PIHATKernels::QUANTIZED_MAX, rounded));
+                largestError = std::max(largestError, std::fabs((double)table[entry] - (double)rounded * scale));
+                // Genotype codes 1 and 2 are both one copy of the allele
+                size_t snp = entry / 3;
+                int dosage = (int)(entry % 3);
+                int16_t* codes = quantizedTable + snp * PIHATKernels::QUANTIZED_ENTRIES;
+                if(dosage == 0) codes[0] = (int16_t)rounded;
+                if(dosage == 1) codes[1] = codes[2] = (int16_t)rounded;
+                if(dosage == 2) codes[3] = (int16_t)rounded;
+            }
+            if(genomeDataManager->getGenomeBuffer(chr) != nullptr) {
+                bound += largestError * (double)(endEntry - firstEntry) / 3;
+                largestSum += (double)PIHATKernels::QUANTIZED_MAX * scale * (double)(endEntry - firstEntry) / 3;
+                sweptBlocks++;
+            }
+        }
+    }
+    // Block sums are exact integers, each below 2^24 so exact as floats too;
+    // every fused multiply-add into the running float sum then rounds once,
+    // by at most half an ulp of a sum that never exceeds largestSum
+    bound += sweptBlocks * largestSum * (std::numeric_limits<float>::epsilon() / 2);
+    lastQuantizationBound = bound / 2.0 / PIHAT_NORMALIZATION_FACTOR;
+    maxQuantizationBound = std::max(maxQuantizationBound, lastQuantizationBound);
+}
+
+PIHATKernel PIHATEngine::resolveQuantizedKernel() const {
+    if(activeKernel == PIHATKernel::AVX512 && __builtin_cpu_supports("avx512bw")) {
+        return PIHATKernel::AVX512;
+    }
+    if(activeKernel != PIHATKernel::SCALAR && __builtin_cpu_supports("fma")) {
+        return PIHATKernel::AVX2;
+    }
+    return PIHATKernel::SCALAR;
+}
+
+void PIHATEngine::sweepQuantized(const PIHATSweep& sweep, int firstRelative, int endRelative, float* output) {
+    PIHATKernel kernel = resolveQuantizedKernel();
+    std::fill(output + firstRelative, output + endRelative, 0.0f);
+    // Entries and block scales; tiles start on a scale block
+    quantizedTiling.plan(sweep.buffers, sweep.bytesPerIndividual, sweep.snpCounts,
+                         PIHATKernels::QUANTIZED_ENTRIES * sizeof(int16_t) + 1,
+                         PIHATKernels::QUANTIZED_BLOCK_SNPS, PIHATKernels::getQuantizedLaneCount(kernel) * 2);
+    quantizedTiling.run(firstRelative, endRelative, [&](const GenotypeTile& tile) {
+        PIHATSweep tiled = sweep;
+        tiled.tile = &tile;
+        int count = tile.endRelative - tile.firstRelative;
+        switch(kernel) {
+            case PIHATKernel::AVX512:
+                PIHATKernels::sweepQuantizedAVX512(tiled, tile.firstRelative, count, output);
+                break;
+            case PIHATKernel::AVX2:
+                PIHATKernels::sweepQuantizedAVX2(tiled, tile.firstRelative, count, output);
+                break;
+            default:
+                PIHATKernels::sweepQuantizedScalar(tiled, tile.firstRelative, count, output);
+                break;
+        }
+    });
+}
+
+void PIHATEngine::tabulateContributions(const int* focals, int focalCountInTable, int stride) {
+    int nbIndiv = genomeDataManager->getNumberOfIndividuals();
+    snpsPerRelative = 0;
+    if(screenStride > 0) {
+        nullMean.assign(stride, 0.0);
+        nullVariance.assign(stride, 0.0);
+        for(int half = 0; half < 2; half++) {
+            screenMean[half].assign(stride, 0.0);
+            screenVariance[half].assign(stride, 0.0);
+        }
+    }
+
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        int snpCount = genomeDataManager->getSNPCount(chr);
+        bool swept = genomeDataManager->getGenomeBuffer(chr) != nullptr;
+        // Entry (snp, dosage) holds one float per focal; padding lanes stay zero
+        contributions[chr].assign((size_t)snpCount * 3 * stride + PIHATKernels::TABLE_PADDING, 0.0f);
+        if(screenStride > 0) {
+            screenSNPCounts[chr] = (snpCount + screenStride - 1) / screenStride;
+            screenContributions[chr].assign((size_t)screenSNPCounts[chr] * 3 * stride + PIHATKernels::TABLE_PADDING, 0.0f);
+            screenSquares[chr].assign(screenContributions[chr].size(), 0.0f);
+        }
+        // The focal only selects its dosage's row of the cohort table
+        const float* cohortTable = genomeDataManager->getContributionTable(chr);
+        for(int snp = 0; snp < snpCount; snp++) {
+            float alleleFrequency = 1.0f * genomeDataManager->getMAF(snp, chr) / (nbIndiv) / 2.0f;
+            const float* snpTable = cohortTable + (size_t)snp * GenomeDataManager::CONTRIBUTION_ENTRIES;
+
+            for(int slot = 0; slot < focalCountInTable; slot++) {
+                int focalGenotype = genomeDataManager->getGenotype(chr, focals[slot], snp);
+                const float* entries = snpTable + ((focalGenotype >> 1) + (focalGenotype & 1)) * 3;
+
+                float* snpContributions = &contributions[chr][(size_t)snp * 3 * stride + slot];
+                snpContributions[0] = entries[0];
+                snpContributions[stride] = entries[1];
+                snpContributions[2 * stride] = entries[2];
+
+                if(screenStride > 0 && swept) {
+                    // Contribution of an unrelated relative in Hardy-Weinberg equilibrium
+                    double q = alleleFrequency;
+                    double probability[3] = {(1.0 - q) * (1.0 - q), 2.0 * q * (1.0 - q), q * q};
+                    double mean = 0.0;
+                    double square = 0.0;
+                    for(int dosage = 0; dosage < 3; dosage++) {
+                        mean += probability[dosage] * snpContributions[dosage * stride];
+                        square += probability[dosage] * snpContributions[dosage * stride] * snpContributions[dosage * stride];
+                    }
+                    nullMean[slot] += mean;
+                    nullVariance[slot] += square - mean * mean;
+                    if(snp % screenStride == 0) {
+                        screenMean[chr % 2][slot] += mean;
+                        screenVariance[chr % 2][slot] += square - mean * mean;
+                        size_t position = (size_t)(snp / screenStride);
+                        float* screenEntry = &screenContributions[chr][position * 3 * stride + slot];
+                        float* squareEntry = &screenSquares[chr][position * 3 * stride + slot];
+                        for(int dosage = 0; dosage < 3; dosage++) {
+                            double deviation = snpContributions[dosage * stride] - mean;
+                            screenEntry[dosage * stride] = snpContributions[dosage * stride];
+                            squareEntry[dosage * stride] = (float)(deviation * deviation);
+                        }
+                    }
+                }
+            }
+        }
+        if(swept) {
+            snpsPerRelative += snpCount;
+        }
+    }
+}
+
+void PIHATEngine::prepareSweep(PIHATSweep& sweep, int stride) const {
+    sweep.focalStride = stride;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        sweep.buffers[chr] = genomeDataManager->getGenomeBuffer(chr);
+        sweep.tables[chr] = contributions[chr].data();
+        sweep.bytesPerIndividual[chr] = genomeDataManager->getBytesPerIndividual(chr);
+        sweep.snpCounts[chr] = genomeDataManager->getSNPCount(chr);
+        sweep.quantizedTables[chr] = quantizedContributions[chr].data();
+        sweep.blockScales[chr] = blockScales[chr].data();
+        sweep.haplotypeTables[chr] = haplotypeContributions[chr].data();
+    }
+    sweep.tile = nullptr;
+}
+
+void PIHATEngine::sweepRelatives(const PIHATSweep& sweep, int firstRelative, int endRelative, float* output) {
+    const int stride = sweep.focalStride;
+    std::fill(output + (size_t)firstRelative * stride, output + (size_t)endRelative * stride, 0.0f);
+    if(stride > 1) {
+        PIHATKernel kernel = activeKernel == PIHATKernel::SCALAR ? PIHATKernel::SCALAR : PIHATKernel::AVX2;
+        batchTiling.plan(sweep.buffers, sweep.bytesPerIndividual, sweep.snpCounts, 3 * stride * sizeof(float),
+                         PIHATKernels::TILE_SNP_ALIGNMENT, 32);
+        batchTiling.run(firstRelative, endRelative, [&](const GenotypeTile& tile) {
+            PIHATSweep tiled = sweep;
+            tiled.tile = &tile;
+            int count = tile.endRelative - tile.firstRelative;
+            if(kernel == PIHATKernel::SCALAR) {
+                PIHATKernels::sweepBatchScalar(tiled, tile.firstRelative, count, output);
+            } else {
+                PIHATKernels::sweepBatchAVX2(tiled, tile.firstRelative, count, output);
+            }
+        });
+        return;
+    }
+
+    PIHATKernel kernel = activeKernel;
+    // Whole register groups per thread and tile; only the last group can be partial
+    pihatTiling.plan(sweep.buffers, sweep.bytesPerIndividual, sweep.snpCounts, 3 * sizeof(float),
+                     PIHATKernels::TILE_SNP_ALIGNMENT, PIHATKernels::getLaneCount(kernel) * 4);
+    pihatTiling.run(firstRelative, endRelative, [&](const GenotypeTile& tile) {
+        PIHATSweep tiled = sweep;
+        tiled.tile = &tile;
+        int count = tile.endRelative - tile.firstRelative;
+        switch(kernel) {
+            case PIHATKernel::AVX512:
+                PIHATKernels::sweepAVX512(tiled, tile.firstRelative, count, output);
+                break;
+            case PIHATKernel::AVX2:
+                PIHATKernels::sweepAVX2(tiled, tile.firstRelative, count, output);
+                break;
+            default:
+                PIHATKernels::sweepScalar(tiled, tile.firstRelative, count, output);
+                break;
+        }
+    });
+}
+
+void PIHATEngine::buildScreenRows() {
+    int nbIndiv = genomeDataManager->getNumberOfIndividuals();
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        const unsigned char* buffer = genomeDataManager->getGenomeBuffer(chr);
+        if(buffer == nullptr) continue;
+        size_t rowBytes = genomeDataManager->getBytesPerIndividual(chr);
+        int thinnedCount = (genomeDataManager->getSNPCount(chr) + screenStride - 1) / screenStride;
+        size_t thinnedBytes = thinnedCount / 4 + (thinnedCount % 4 > 0);
+        screenRows[chr].assign((size_t)nbIndiv * thinnedBytes, 0);
+        unsigned char* thinned = screenRows[chr].data();
+        #pragma omp parallel for schedule(static)
+        for(int individual = 0; individual < nbIndiv; individual++) {
+            const unsigned char* row = buffer + (size_t)individual * rowBytes;
+            unsigned char* thinnedRow = thinned + (size_t)individual * thinnedBytes;
+            for(int kept = 0; kept < thinnedCount; kept++) {
+                int snp = kept * screenStride;
+                int genotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+                thinnedRow[kept / 4] |= (unsigned char)(genotype << ((kept % 4) * 2));
+            }
+        }
+    }
+}
+
+void PIHATEngine::sweepScreened(const PIHATSweep& sweep, int focalCountInTable, int numberOfRelatives, float* output) {
+    const int stride = sweep.focalStride;
+    bool rowsReady = false;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        rowsReady = rowsReady || !screenRows[chr].empty();
+    }
+    if(!rowsReady) {
+        buildScreenRows();
+    }
+
+    // First half into output, second half alongside, then the squared deviations
+    screenSecondHalf.assign((size_t)numberOfRelatives * stride, 0.0f);
+    for(int half = 0; half < 2; half++) {
+        screenSquareSums[half].assign((size_t)numberOfRelatives * stride, 0.0f);
+        PIHATSweep screen;
+        screen.focalStride = stride;
+        screen.tile = nullptr;
+        for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+            bool inHalf = chr % 2 == half && !screenRows[chr].empty();
+            screen.buffers[chr] = inHalf ? screenRows[chr].data() : nullptr;
+            screen.tables[chr] = screenContributions[chr].data();
+            screen.bytesPerIndividual[chr] = screenSNPCounts[chr] / 4 + (screenSNPCounts[chr] % 4 > 0);
+            screen.snpCounts[chr] = screenSNPCounts[chr];
+        }
+        sweepRelatives(screen, 0, numberOfRelatives, half == 0 ? output : screenSecondHalf.data());
+        for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+            screen.tables[chr] = screenSquares[chr].data();
+        }
+        sweepRelatives(screen, 0, numberOfRelatives, screenSquareSums[half].data());
+    }
+
+    // The unscreened SNPs are estimated by scaling the deviation from the null
+    // mean seen on the screened ones. For independent SNPs the error of that
+    // estimate has variance V_rest * V_all / V_screened under the null. Each
+    // half predicts the same scaled deviation, so their spread across relatives
+    // measures how far the SNPs are from independent; kinship cancels out of it.
+    std::vector<double> scale(focalCountInTable);
+    std::vector<double> errorBound(focalCountInTable);
+    std::vector<double> screenedVariance(focalCountInTable);
+    for(int slot = 0; slot < focalCountInTable; slot++) {
+        double variance0 = screenVariance[0][slot];
+        double variance1 = screenVariance[1][slot];
+        double sum = 0.0;
+        double sumSquares = 0.0;
+        for(int relativeID = 0; relativeID < numberOfRelatives; relativeID++) {
+            size_t index = (size_t)relativeID * stride + slot;
+            double disagreement = (output[index] - screenMean[0][slot]) / variance0
+                                - (screenSecondHalf[index] - screenMean[1][slot]) / variance1;
+            sum += disagreement;
+            sumSquares += disagreement * disagreement;
+        }
+        double observed = sumSquares / numberOfRelatives - (sum / numberOfRelatives) * (sum / numberOfRelatives);
+        double inflation = observed / (1.0 / variance0 + 1.0 / variance1);
+
+        screenedVariance[slot] = variance0 + variance1;
+        scale[slot] = nullVariance[slot] / screenedVariance[slot];
+        errorBound[slot] = screenSigmas * std::sqrt((nullVariance[slot] - screenedVariance[slot]) * scale[slot]
+                                                    * std::max(1.0, inflation));
+    }
+
+    if(screenAudit) {
+        screenBounds.assign((size_t)numberOfRelatives * stride, 0.0f);
+    }
+    candidates.clear();
+    for(int relativeID = 0; relativeID < numberOfRelatives; relativeID++) {
+        bool candidate = false;
+        for(int slot = 0; slot < focalCountInTable; slot++) {
+            size_t index = (size_t)relativeID * stride + slot;
+            double screened = (double)output[index] + screenSecondHalf[index];
+            double estimate = nullMean[slot] + (screened - screenMean[0][slot] - screenMean[1][slot]) * scale[slot];
+            // Pairs whose screened SNPs vary more than the null get a wider bound
+            double pairVariance = ((double)screenSquareSums[0][index] + screenSquareSums[1][index]) / screenedVariance[slot];
+            double bound = errorBound[slot] * std::sqrt(std::max(1.0, pairVariance));
+            // Written so that a NaN bound keeps the relative
+            if(!(normalize((float)(estimate + bound)) < screenThreshold)) {
+                candidate = true;
+            }
+            output[index] = (float)estimate;
+            if(screenAudit) {
+                screenBounds[index] = (float)bound;
+            }
+        }
+        if(candidate) {
+            candidates.push_back(relativeID);
+        }
+    }
+
+    // Exact values of the candidates, one relative per kernel call
+    int candidateCount = (int)candidates.size();
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(int index = 0; index < candidateCount; index++) {
+        if(stride > 1) {
+            PIHATKernels::sweepBatchScalar(sweep, candidates[index], 1, output);
+        } else {
+            PIHATKernels::sweepScalar(sweep, candidates[index], 1, output);
+        }
+    }
+    screenedPairCount += (double)numberOfRelatives * focalCountInTable;
+    exactPairCount += (double)candidateCount * focalCountInTable;
+
+    // Audit: the exact value of every pair, compared with what the screen kept
+    if(screenAudit) {
+        screenAuditRow.assign((size_t)numberOfRelatives * stride, 0.0f);
+        sweepRelatives(sweep, 0, numberOfRelatives, screenAuditRow.data());
+        size_t nextCandidate = 0;
+        for(int relativeID = 0; relativeID < numberOfRelatives; relativeID++) {
+            bool candidate = nextCandidate < candidates.size() && candidates[nextCandidate] == relativeID;
+            if(candidate) {
+                nextCandidate++;
+            }
+            for(int slot = 0; slot < focalCountInTable; slot++) {
+                size_t index = (size_t)relativeID * stride + slot;
+                bool above = normalize(screenAuditRow[index]) >= screenThreshold;
+                auditAbovePairCount += above;
+                if(candidate) {
+                    continue;
+                }
+                auditLostPairCount += above;
+                if(screenBounds[index] > 0.0f) {
+                    double ratio = std::fabs((double)screenAuditRow[index] - output[index]) / screenBounds[index];
+                    auditMaxErrorRatio = std::max(auditMaxErrorRatio, ratio);
+                }
+            }
+        }
+    }
+}
+
+void PIHATEngine::recordSweep(double seconds, int focals, int numberOfRelatives) {
+    lastSweepSeconds = seconds;
+    lastRelativeSNPCount = (double)focals * numberOfRelatives * snpsPerRelative;
+    focalCount += focals;
+    relativeSNPCount += lastRelativeSNPCount;
+    sweepSeconds += seconds;
+}
+
+bool PIHATEngine::computeBatch(int focalIndividual, int firstRelative, int endRelative, int numberOfRelatives) {
+    invalidateBatch();
+    std::vector<int>::const_iterator position = std::find(focalQueue.begin(), focalQueue.end(), focalIndividual);
+    if(position == focalQueue.end()) {
+        return false;
+    }
+    for(; position != focalQueue.end() && (int)batchFocals.size() < batchSize; ++position) {
+        batchFocals.push_back(*position);
+    }
+    if(batchFocals.size() < 2) {
+        invalidateBatch();
+        return false;
+    }
+
+    int focals = (int)batchFocals.size();
+    PIHATKernel kernel = activeKernel == PIHATKernel::SCALAR ? PIHATKernel::SCALAR : PIHATKernel::AVX2;
+    // The SIMD kernel keeps the focals of a relative in whole 8-float registers
+    batchStride = kernel == PIHATKernel::SCALAR ? focals : (focals + 7) / 8 * 8;
+    tabulateContributions(batchFocals.data(), focals, batchStride);
+    batchPIHAT.assign((size_t)numberOfRelatives * batchStride, 0.0f);
+
+    PIHATSweep sweep;
+    prepareSweep(sweep, batchStride);
+
+    double startTime = omp_get_wtime();
+    if(screenStride > 0) {
+        // The screen needs every relative to calibrate its bound
+        firstRelative = 0;
+        endRelative = numberOfRelatives;
+        sweepScreened(sweep, focals, numberOfRelatives, batchPIHAT.data());
+    } else {
+        sweepRelatives(sweep, firstRelative, endRelative, batchPIHAT.data());
+    }
+    recordSweep(omp_get_wtime() - startTime, focals, endRelative - firstRelative);
+    batchRelativeCount = numberOfRelatives;
+    batchFirstRelative = firstRelative;
+    batchEndRelative = endRelative;
+    return true;
+}
+
+void PIHATEngine::computePIHAT(int focalIndividual, float* pihat, int numberOfRelatives) {
+    computePIHATRange(focalIndividual, 0, numberOfRelatives, pihat, numberOfRelatives);
+}
+
+void PIHATEngine::computePIHATRange(int focalIndividual, int firstRelative, int endRelative,
+                                    float* pihat, int numberOfRelatives) {
+    firstRelative = std::max(0, firstRelative);
+    endRelative = std::min(endRelative, numberOfRelatives);
+    if(firstRelative >= endRelative) {
+        return;
+    }
+    if(quantized) {
+        tabulateContributions(&focalIndividual, 1, 1);
+        quantizeContributions();
+        PIHATSweep sweep;
+        prepareSweep(sweep, 1);
+        double startTime = omp_get_wtime();
+        sweepQuantized(sweep, firstRelative, endRelative, pihat);
+        recordSweep(omp_get_wtime() - startTime, 1, endRelative - firstRelative);
+        return;
+    }
+    if(batchSize > 1) {
+        int slot = (int)(std::find(batchFocals.begin(), batchFocals.end(), focalIndividual) - batchFocals.begin());
+        if(slot == (int)batchFocals.size() || batchRelativeCount != numberOfRelatives
+           || firstRelative < batchFirstRelative || endRelative > batchEndRelative) {
+            slot = computeBatch(focalIndividual, firstRelative, endRelative, numberOfRelatives) ? 0 : -1;
+        }
+        if(slot >= 0) {
+            for(int relativeID = firstRelative; relativeID < endRelative; relativeID++) {
+                pihat[relativeID] = batchPIHAT[(size_t)relativeID * batchStride + slot];
+            }
+            return;
+        }
+    }
+
+    tabulateContributions(&focalIndividual, 1, 1);
+    if(decompose && screenStride == 0) {
+        tabulateHaplotypeContributions(focalIndividual);
+        prepareDecomposition(numberOfRelatives);
+    }
+    PIHATSweep sweep;
+    prepareSweep(sweep, 1);
+
+    double startTime = omp_get_wtime();
+    if(screenStride > 0) {
+        firstRelative = 0;
+        endRelative = numberOfRelatives;
+        sweepScreened(sweep, 1, numberOfRelatives, pihat);
+    } else if(decompose) {
+        sweepDecomposed(sweep, focalIndividual, firstRelative, endRelative, pihat);
+    } else {
+        sweepRelatives(sweep, firstRelative, endRelative, pihat);
+    }
+    recordSweep(omp_get_wtime() - startTime, 1, endRelative - firstRelative);
+}
+
+void PIHATEngine::computePIHATForRelatives(int focalIndividual, const std::vector<int>& relatives,
+                                           float* pihat, int numberOfRelatives) {
+    tabulateContributions(&focalIndividual, 1, 1);
+    if(quantized) {
+        quantizeContributions();
+    }
+    PIHATSweep sweep;
+    prepareSweep(sweep, 1);
+
+    double startTime = omp_get_wtime();
+    std::fill(pihat, pihat + numberOfRelatives, 0.0f);
+    int relativeCount = (int)relatives.size();
+    #pragma omp parallel for schedule(dynamic, 16)
+    for(int index = 0; index < relativeCount; index++) {
+        if(relatives[index] < 0 || relatives[index] >= numberOfRelatives) continue;
+        if(quantized) {
+            PIHATKernels::sweepQuantizedScalar(sweep, relatives[index], 1, pihat);
+        } else {
+            PIHATKernels::sweepScalar(sweep, relatives[index], 1, pihat);
+        }
+    }
+    recordSweep(omp_get_wtime() - startTime, 1, relativeCount);
+}
+
+double PIHATEngine::getLastThroughput() const {
+    return lastSweepSeconds > 0.0 ? lastRelativeSNPCount / lastSweepSeconds : 0.0;
+}
+
+void PIHATEngine::clearLastSweep() {
+    lastSweepSeconds = 0.0;
+    lastRelativeSNPCount = 0.0;
+}
+
+double PIHATEngine::getAverageThroughput() const {
+    return sweepSeconds > 0.0 ? relativeSNPCount / sweepSeconds : 0.0;
+}
+
+void PIHATEngine::printThroughputReport() const {
+    printf("PIHAT sweeps: %d focal(s), %.3e relative x SNP pairs in %.3f s (%.1f M relative-SNPs/s, %s kernel, batch %d)\n",
+           focalCount, relativeSNPCount, sweepSeconds, getAverageThroughput() / 1e6,
+           PIHATKernels::getKernelName(activeKernel), quantized ? 1 : batchSize);
+    if(quantized) {
+        printf("PIHAT quantization: int16 entries, %s kernel, worst-case PIHAT error %.2e (largest over all focals)\n",
+               PIHATKernels::getKernelName(resolveQuantizedKernel()), maxQuantizationBound);
+    }
+    if(decompose) {
+        printf("PIHAT decomposition: %d chromosome x haplotype parts per pair, %.0f pair(s) split in the sweep, %.0f after ranking\n",
+               PIHATKernels::DECOMPOSITION_ENTRIES, sweptDecompositionCount, rankedDecompositionCount);
+    }
+    const char* kernelName = PIHATKernels::getKernelName(activeKernel);
+    pihatTiling.printReport(kernelName);
+    batchTiling.printReport(activeKernel == PIHATKernel::SCALAR ? "scalar" : "avx2");
+    quantizedTiling.printReport(PIHATKernels::getKernelName(resolveQuantizedKernel()));
+    decomposedTiling.printReport(kernelName);
+    if(screenedPairCount > 0.0) {
+        printf("PIHAT screening: 1 SNP in %d, %.0f of %.0f focal-relative pairs (%.2f%%) swept exactly\n",
+               screenStride, exactPairCount, screenedPairCount, 100.0 * exactPairCount / screenedPairCount);
+    }
+    if(isAuditingScreen()) {
+        printScreenAuditReport();
+    }
+}
+
+void PIHATEngine::printScreenAuditReport() const {
+    printf("PIHAT screen audit: %.0f of %.0f pair(s) above %.3f pruned by the screen, largest error %.2f of the bound\n",
+           auditLostPairCount, auditAbovePairCount, screenThreshold, auditMaxErrorRatio);
+    if(auditLostPairCount > 0.0) {
+        printf("ERROR: -PIHATScreen lost %.0f pair(s) above the threshold; use a larger threshold margin or a smaller stride\n",
+               auditLostPairCount);
+    }
+}
+
+void PIHATEngine::resetStatistics() {
+    focalCount = 0;
+    relativeSNPCount = 0.0;
+    sweepSeconds = 0.0;
+    lastSweepSeconds = 0.0;
+    lastRelativeSNPCount = 0.0;
+    screenedPairCount = 0.0;
+    exactPairCount = 0.0;
+    auditAbovePairCount = 0.0;
+    auditLostPairCount = 0.0;
+    auditMaxErrorRatio = 0.0;
+    sweptDecompositionCount = 0.0;
+    rankedDecompositionCount = 0.0;
+    pihatTiling.resetStatistics();
+    batchTiling.resetStatistics();
+    quantizedTiling.resetStatistics();
+    decomposedTiling.resetStatistics();
+}
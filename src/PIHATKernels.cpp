@@ -0,0 +1,710 @@
+/**
+ * @file PIHATKernels.cpp
+ * @brief Implementation of the PIHAT sweep kernels
+ */
+
+#include "../include/PIHATKernels.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+namespace {
+
+// Chromosomes and SNPs of one kernel call: the sweep's tile, or the whole genome
+inline int firstChromosome(const PIHATSweep& sweep) {
+    return sweep.tile != nullptr ? sweep.tile->chromosome : 1;
+}
+
+inline int endChromosome(const PIHATSweep& sweep) {
+    return sweep.tile != nullptr ? sweep.tile->chromosome + 1 : NUM_CHROMOSOMES;
+}
+
+inline int firstSNPOf(const PIHATSweep& sweep) {
+    return sweep.tile != nullptr ? sweep.tile->firstSNP : 0;
+}
+
+inline int endSNPOf(const PIHATSweep& sweep, int chromosome) {
+    return sweep.tile != nullptr ? sweep.tile->endSNP : sweep.snpCounts[chromosome];
+}
+
+// A tile continues the sums its predecessors left in the output
+inline float startingSum(const PIHATSweep& sweep, const float* pihat, size_t index) {
+    return sweep.tile != nullptr ? pihat[index] : 0.0f;
+}
+
+// A chromosome split over tiles keeps its running first-haplotype part and
+// the genome-wide sum at its start in its two entries until its last tile
+inline void resumeChromosome(const PIHATSweep& sweep, const float* parts, float sum,
+                             float& chromosomeStart, float& haplotype0Sum) {
+    if(sweep.tile != nullptr && sweep.tile->firstSNP > 0) {
+        haplotype0Sum = parts[0];
+        chromosomeStart = parts[1];
+    } else {
+        haplotype0Sum = 0.0f;
+        chromosomeStart = sum;
+    }
+}
+
+inline void suspendChromosome(const PIHATSweep& sweep, int chromosome, float* parts, float sum,
+                              float chromosomeStart, float haplotype0Sum) {
+    parts[0] = haplotype0Sum;
+    if(sweep.tile != nullptr && sweep.tile->endSNP < sweep.snpCounts[chromosome]) {
+        parts[1] = chromosomeStart;
+    } else {
+        parts[1] = (sum - chromosomeStart) - haplotype0Sum;
+    }
+}
+
+inline float sumRelativeFrom(const PIHATSweep& sweep, int chromosome, int relativeID,
+                             int firstSNP, int endSNP, float sum) {
+    const unsigned char* row = sweep.buffers[chromosome]
+                             + (size_t)relativeID * sweep.bytesPerIndividual[chromosome];
+    const float* table = sweep.tables[chromosome];
+    for(int snp = firstSNP; snp < endSNP; snp++) {
+        int relativeGenotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+        int parent0Relative = (relativeGenotype & 1);
+        int parent1Relative = (relativeGenotype >> 1);
+        sum += table[(size_t)snp * 3 + parent0Relative + parent1Relative];
+    }
+    return sum;
+}
+
+inline float sumDecomposedFrom(const PIHATSweep& sweep, int chromosome, int relativeID,
+                               int firstSNP, int endSNP, float sum, float& haplotype0Sum) {
+    const unsigned char* row = sweep.buffers[chromosome]
+                             + (size_t)relativeID * sweep.bytesPerIndividual[chromosome];
+    const float* table = sweep.tables[chromosome];
+    const float* haplotypeTable = sweep.haplotypeTables[chromosome];
+    for(int snp = firstSNP; snp < endSNP; snp++) {
+        int relativeGenotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+        int parent0Relative = (relativeGenotype & 1);
+        int parent1Relative = (relativeGenotype >> 1);
+        int dosage = parent0Relative + parent1Relative;
+        sum += table[(size_t)snp * 3 + dosage];
+        haplotype0Sum += haplotypeTable[(size_t)snp * 3 + dosage];
+    }
+    return sum;
+}
+
+inline int32_t sumQuantizedFrom(const PIHATSweep& sweep, int chromosome, int relativeID,
+                                int firstSNP, int endSNP) {
+    const unsigned char* row = sweep.buffers[chromosome]
+                             + (size_t)relativeID * sweep.bytesPerIndividual[chromosome];
+    const int16_t* table = sweep.quantizedTables[chromosome];
+    int32_t sum = 0;
+    for(int snp = firstSNP; snp < endSNP; snp++) {
+        int relativeGenotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+        sum += table[(size_t)snp * PIHATKernels::QUANTIZED_ENTRIES + relativeGenotype];
+    }
+    return sum;
+}
+
+// Gathers use 32-bit offsets from the first row of the group
+bool fitsGatherOffsets(const PIHATSweep& sweep, int lanes) {
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        if(sweep.bytesPerIndividual[chr] * (size_t)lanes > (size_t)INT_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+void PIHATKernels::sweepScalar(const PIHATSweep& sweep, int firstRelative, int count, float* pihat) {
+    for(int relativeID = firstRelative; relativeID < firstRelative + count; relativeID++) {
+        float sum = startingSum(sweep, pihat, relativeID);
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            if(sweep.buffers[chr] == nullptr) continue;
+            sum = sumRelativeFrom(sweep, chr, relativeID, firstSNPOf(sweep), endSNPOf(sweep, chr), sum);
+        }
+        pihat[relativeID] = sum;
+    }
+}
+
+// Each lane is one relative. A 32-bit gather fetches the next 16 SNPs of every
+// lane's row; for each SNP the focal's three contributions are loaded once and
+// the lane's allele count picks its entry with a register permute.
+__attribute__((target("avx2")))
+void PIHATKernels::sweepAVX2(const PIHATSweep& sweep, int firstRelative, int count, float* pihat) {
+    const int lanes = 8;
+    if(count < lanes || !fitsGatherOffsets(sweep, lanes)) {
+        sweepScalar(sweep, firstRelative, count, pihat);
+        return;
+    }
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for(int group = firstRelative; group + lanes <= firstRelative + count; group += lanes) {
+        __m256 sums = sweep.tile != nullptr ? _mm256_loadu_ps(pihat + group) : _mm256_setzero_ps();
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            if(sweep.buffers[chr] == nullptr) continue;
+            size_t rowBytes = sweep.bytesPerIndividual[chr];
+            const unsigned char* base = sweep.buffers[chr] + (size_t)group * rowBytes;
+            const float* table = sweep.tables[chr];
+            __m256i offsets = _mm256_mullo_epi32(laneIndex, _mm256_set1_epi32((int)rowBytes));
+            int snpCount = endSNPOf(sweep, chr);
+
+            int snp = firstSNPOf(sweep);
+            for(; snp + 16 <= snpCount && (size_t)(snp / 4) + 4 <= rowBytes; snp += 16) {
+                __m256i codes = _mm256_i32gather_epi32((const int*)(base + snp / 4), offsets, 1);
+                for(int k = 0; k < 16; k++) {
+                    __m256i dosage = _mm256_add_epi32(_mm256_and_si256(codes, one),
+                                                      _mm256_and_si256(_mm256_srli_epi32(codes, 1), one));
+                    __m256 entries = _mm256_loadu_ps(table + (size_t)(snp + k) * 3);
+                    sums = _mm256_add_ps(sums, _mm256_permutevar8x32_ps(entries, dosage));
+                    codes = _mm256_srli_epi32(codes, 2);
+                }
+            }
+            if(snp < snpCount) {
+                float laneSums[8];
+                _mm256_storeu_ps(laneSums, sums);
+                for(int lane = 0; lane < lanes; lane++) {
+                    laneSums[lane] = sumRelativeFrom(sweep, chr, group + lane, snp, snpCount, laneSums[lane]);
+                }
+                sums = _mm256_loadu_ps(laneSums);
+            }
+        }
+        _mm256_storeu_ps(pihat + group, sums);
+    }
+    int done = (count / lanes) * lanes;
+    if(done < count) {
+        sweepScalar(sweep, firstRelative + done, count - done, pihat);
+    }
+}
+
+__attribute__((target("avx512f")))
+void PIHATKernels::sweepAVX512(const PIHATSweep& sweep, int firstRelative, int count, float* pihat) {
+    const int lanes = 16;
+    if(count < lanes || !fitsGatherOffsets(sweep, lanes)) {
+        sweepAVX2(sweep, firstRelative, count, pihat);
+        return;
+    }
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i laneIndex = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    for(int group = firstRelative; group + lanes <= firstRelative + count; group += lanes) {
+        __m512 sums = sweep.tile != nullptr ? _mm512_loadu_ps(pihat + group) : _mm512_setzero_ps();
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            if(sweep.buffers[chr] == nullptr) continue;
+            size_t rowBytes = sweep.bytesPerIndividual[chr];
+            const unsigned char* base = sweep.buffers[chr] + (size_t)group * rowBytes;
+            const float* table = sweep.tables[chr];
+            __m512i offsets = _mm512_mullo_epi32(laneIndex, _mm512_set1_epi32((int)rowBytes));
+            int snpCount = endSNPOf(sweep, chr);
+
+            int snp = firstSNPOf(sweep);
+            for(; snp + 16 <= snpCount && (size_t)(snp / 4) + 4 <= rowBytes; snp += 16) {
+                __m512i codes = _mm512_i32gather_epi32(offsets, (const void*)(base + snp / 4), 1);
+                for(int k = 0; k < 16; k++) {
+                    __m512i dosage = _mm512_add_epi32(_mm512_and_si512(codes, one),
+                                                      _mm512_and_si512(_mm512_srli_epi32(codes, 1), one));
+                    __m512 entries = _mm512_loadu_ps(table + (size_t)(snp + k) * 3);
+                    sums = _mm512_add_ps(sums, _mm512_permutexvar_ps(dosage, entries));
+                    codes = _mm512_srli_epi32(codes, 2);
+                }
+            }
+            if(snp < snpCount) {
+                float laneSums[16];
+                _mm512_storeu_ps(laneSums, sums);
+                for(int lane = 0; lane < lanes; lane++) {
+                    laneSums[lane] = sumRelativeFrom(sweep, chr, group + lane, snp, snpCount, laneSums[lane]);
+                }
+                sums = _mm512_loadu_ps(laneSums);
+            }
+        }
+        _mm512_storeu_ps(pihat + group, sums);
+    }
+    int done = (count / lanes) * lanes;
+    if(done < count) {
+        sweepAVX2(sweep, firstRelative + done, count - done, pihat);
+    }
+}
+
+// Only the first haplotype gets an accumulator: the second one's part is the
+// chromosome's share of the genome-wide sum minus the first's, which keeps
+// the decomposing sweep one lookup per SNP away from the plain one
+void PIHATKernels::sweepDecomposedScalar(const PIHATSweep& sweep, int firstRelative, int count,
+                                         float* pihat, float* decomposition) {
+    for(int relativeID = firstRelative; relativeID < firstRelative + count; relativeID++) {
+        float* parts = decomposition + (size_t)relativeID * DECOMPOSITION_ENTRIES;
+        float sum = startingSum(sweep, pihat, relativeID);
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            float* chromosomeParts = parts + (chr - 1) * 2;
+            float chromosomeStart, haplotype0Sum;
+            resumeChromosome(sweep, chromosomeParts, sum, chromosomeStart, haplotype0Sum);
+            if(sweep.buffers[chr] != nullptr) {
+                sum = sumDecomposedFrom(sweep, chr, relativeID, firstSNPOf(sweep), endSNPOf(sweep, chr),
+                                        sum, haplotype0Sum);
+            }
+            suspendChromosome(sweep, chr, chromosomeParts, sum, chromosomeStart, haplotype0Sum);
+        }
+        pihat[relativeID] = sum;
+    }
+}
+
+// The AVX2 sweep with one more accumulator, reset at every chromosome
+__attribute__((target("avx2")))
+void PIHATKernels::sweepDecomposedAVX2(const PIHATSweep& sweep, int firstRelative, int count,
+                                       float* pihat, float* decomposition) {
+    const int lanes = 8;
+    if(count < lanes || !fitsGatherOffsets(sweep, lanes)) {
+        sweepDecomposedScalar(sweep, firstRelative, count, pihat, decomposition);
+        return;
+    }
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i laneIndex = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    for(int group = firstRelative; group + lanes <= firstRelative + count; group += lanes) {
+        __m256 sums = sweep.tile != nullptr ? _mm256_loadu_ps(pihat + group) : _mm256_setzero_ps();
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            __m256 chromosomeStart = sums;
+            __m256 haplotype0 = _mm256_setzero_ps();
+            float parts[2][8];
+            if(sweep.tile != nullptr && sweep.tile->firstSNP > 0) {
+                for(int lane = 0; lane < lanes; lane++) {
+                    const float* laneParts = decomposition + (size_t)(group + lane) * DECOMPOSITION_ENTRIES + (chr - 1) * 2;
+                    parts[0][lane] = laneParts[0];
+                    parts[1][lane] = laneParts[1];
+                }
+                haplotype0 = _mm256_loadu_ps(parts[0]);
+                chromosomeStart = _mm256_loadu_ps(parts[1]);
+            }
+            if(sweep.buffers[chr] != nullptr) {
+                size_t rowBytes = sweep.bytesPerIndividual[chr];
+                const unsigned char* base = sweep.buffers[chr] + (size_t)group * rowBytes;
+                const float* table = sweep.tables[chr];
+                const float* haplotypeTable = sweep.haplotypeTables[chr];
+                __m256i offsets = _mm256_mullo_epi32(laneIndex, _mm256_set1_epi32((int)rowBytes));
+                int snpCount = endSNPOf(sweep, chr);
+
+                int snp = firstSNPOf(sweep);
+                for(; snp + 16 <= snpCount && (size_t)(snp / 4) + 4 <= rowBytes; snp += 16) {
+                    __m256i codes = _mm256_i32gather_epi32((const int*)(base + snp / 4), offsets, 1);
+                    for(int k = 0; k < 16; k++) {
+                        __m256i dosage = _mm256_add_epi32(_mm256_and_si256(codes, one),
+                                                          _mm256_and_si256(_mm256_srli_epi32(codes, 1), one));
+                        __m256 entries = _mm256_loadu_ps(table + (size_t)(snp + k) * 3);
+                        __m256 haplotypeEntries = _mm256_loadu_ps(haplotypeTable + (size_t)(snp + k) * 3);
+                        sums = _mm256_add_ps(sums, _mm256_permutevar8x32_ps(entries, dosage));
+                        haplotype0 = _mm256_add_ps(haplotype0, _mm256_permutevar8x32_ps(haplotypeEntries, dosage));
+                        codes = _mm256_srli_epi32(codes, 2);
+                    }
+                }
+                if(snp < snpCount) {
+                    float laneSums[8];
+                    float laneParts[8];
+                    _mm256_storeu_ps(laneSums, sums);
+                    _mm256_storeu_ps(laneParts, haplotype0);
+                    for(int lane = 0; lane < lanes; lane++) {
+                        laneSums[lane] = sumDecomposedFrom(sweep, chr, group + lane, snp, snpCount,
+                                                           laneSums[lane], laneParts[lane]);
+                    }
+                    sums = _mm256_loadu_ps(laneSums);
+                    haplotype0 = _mm256_loadu_ps(laneParts);
+                }
+            }
+            _mm256_storeu_ps(parts[0], haplotype0);
+            if(sweep.tile != nullptr && sweep.tile->endSNP < sweep.snpCounts[chr]) {
+                _mm256_storeu_ps(parts[1], chromosomeStart);
+            } else {
+                _mm256_storeu_ps(parts[1], _mm256_sub_ps(_mm256_sub_ps(sums, chromosomeStart), haplotype0));
+            }
+            for(int lane = 0; lane < lanes; lane++) {
+                float* laneParts = decomposition + (size_t)(group + lane) * DECOMPOSITION_ENTRIES + (chr - 1) * 2;
+                laneParts[0] = parts[0][lane];
+                laneParts[1] = parts[1][lane];
+            }
+        }
+        _mm256_storeu_ps(pihat + group, sums);
+    }
+    int done = (count / lanes) * lanes;
+    if(done < count) {
+        sweepDecomposedScalar(sweep, firstRelative + done, count - done, pihat, decomposition);
+    }
+}
+
+__attribute__((target("avx512f")))
+void PIHATKernels::sweepDecomposedAVX512(const PIHATSweep& sweep, int firstRelative, int count,
+                                         float* pihat, float* decomposition) {
+    const int lanes = 16;
+    if(count < lanes || !fitsGatherOffsets(sweep, lanes)) {
+        sweepDecomposedAVX2(sweep, firstRelative, count, pihat, decomposition);
+        return;
+    }
+    const __m512i one = _mm512_set1_epi32(1);
+    const __m512i laneIndex = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+    for(int group = firstRelative; group + lanes <= firstRelative + count; group += lanes) {
+        __m512 sums = sweep.tile != nullptr ? _mm512_loadu_ps(pihat + group) : _mm512_setzero_ps();
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            __m512 chromosomeStart = sums;
+            __m512 haplotype0 = _mm512_setzero_ps();
+            float parts[2][16];
+            if(sweep.tile != nullptr && sweep.tile->firstSNP > 0) {
+                for(int lane = 0; lane < lanes; lane++) {
+                    const float* laneParts = decomposition + (size_t)(group + lane) * DECOMPOSITION_ENTRIES + (chr - 1) * 2;
+                    parts[0][lane] = laneParts[0];
+                    parts[1][lane] = laneParts[1];
+                }
+                haplotype0 = _mm512_loadu_ps(parts[0]);
+                chromosomeStart = _mm512_loadu_ps(parts[1]);
+            }
+            if(sweep.buffers[chr] != nullptr) {
+                size_t rowBytes = sweep.bytesPerIndividual[chr];
+                const unsigned char* base = sweep.buffers[chr] + (size_t)group * rowBytes;
+                const float* table = sweep.tables[chr];
+                const float* haplotypeTable = sweep.haplotypeTables[chr];
+                __m512i offsets = _mm512_mullo_epi32(laneIndex, _mm512_set1_epi32((int)rowBytes));
+                int snpCount = endSNPOf(sweep, chr);
+
+                int snp = firstSNPOf(sweep);
+                for(; snp + 16 <= snpCount && (size_t)(snp / 4) + 4 <= rowBytes; snp += 16) {
+                    __m512i codes = _mm512_i32gather_epi32(offsets, (const void*)(base + snp / 4), 1);
+                    for(int k = 0; k < 16; k++) {
+                        __m512i dosage = _mm512_add_epi32(_mm512_and_si512(codes, one),
+                                                          _mm512_and_si512(_mm512_srli_epi32(codes, 1), one));
+                        __m512 entries = _mm512_loadu_ps(table + (size_t)(snp + k) * 3);
+                        __m512 haplotypeEntries = _mm512_loadu_ps(haplotypeTable + (size_t)(snp + k) * 3);
+                        sums = _mm512_add_ps(sums, _mm512_permutexvar_ps(dosage, entries));
+                        haplotype0 = _mm512_add_ps(haplotype0, _mm512_permutexvar_ps(dosage, haplotypeEntries));
+                        codes = _mm512_srli_epi32(codes, 2);
+                    }
+                }
+                if(snp < snpCount) {
+                    float laneSums[16];
+                    float laneParts[16];
+                    _mm512_storeu_ps(laneSums, sums);
+                    _mm512_storeu_ps(laneParts, haplotype0);
+                    for(int lane = 0; lane < lanes; lane++) {
+                        laneSums[lane] = sumDecomposedFrom(sweep, chr, group + lane, snp, snpCount,
+                                                           laneSums[lane], laneParts[lane]);
+                    }
+                    sums = _mm512_loadu_ps(laneSums);
+                    haplotype0 = _mm512_loadu_ps(laneParts);
+                }
+            }
+            _mm512_storeu_ps(parts[0], haplotype0);
+            if(sweep.tile != nullptr && sweep.tile->endSNP < sweep.snpCounts[chr]) {
+                _mm512_storeu_ps(parts[1], chromosomeStart);
+            } else {
+                _mm512_storeu_ps(parts[1], _mm512_sub_ps(_mm512_sub_ps(sums, chromosomeStart), haplotype0));
+            }
+            for(int lane = 0; lane < lanes; lane++) {
+                float* laneParts = decomposition + (size_t)(group + lane) * DECOMPOSITION_ENTRIES + (chr - 1) * 2;
+                laneParts[0] = parts[0][lane];
+                laneParts[1] = parts[1][lane];
+            }
+        }
+        _mm512_storeu_ps(pihat + group, sums);
+    }
+    int done = (count / lanes) * lanes;
+    if(done < count) {
+        sweepDecomposedAVX2(sweep, firstRelative + done, count - done, pihat, decomposition);
+    }
+}
+
+void PIHATKernels::sweepBatchScalar(const PIHATSweep& sweep, int firstRelative, int count, float* pihat) {
+    const int stride = sweep.focalStride;
+    for(int relativeID = firstRelative; relativeID < firstRelative + count; relativeID++) {
+        float sums[MAX_BATCH];
+        for(int slot = 0; slot < stride; slot++) {
+            sums[slot] = startingSum(sweep, pihat, (size_t)relativeID * stride + slot);
+        }
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            if(sweep.buffers[chr] == nullptr) continue;
+            const unsigned char* row = sweep.buffers[chr] + (size_t)relativeID * sweep.bytesPerIndividual[chr];
+            const float* table = sweep.tables[chr];
+            for(int snp = firstSNPOf(sweep); snp < endSNPOf(sweep, chr); snp++) {
+                int relativeGenotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+                int dosage = (relativeGenotype & 1) + (relativeGenotype >> 1);
+                const float* entry = table + ((size_t)snp * 3 + dosage) * stride;
+                for(int slot = 0; slot < stride; slot++) {
+                    sums[slot] += entry[slot];
+                }
+            }
+        }
+        for(int slot = 0; slot < stride; slot++) {
+            pihat[(size_t)relativeID * stride + slot] = sums[slot];
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void PIHATKernels::sweepBatchAVX2(const PIHATSweep& sweep, int firstRelative, int count, float* pihat) {
+    const int stride = sweep.focalStride;
+    const int registers = stride / 8;
+    for(int relativeID = firstRelative; relativeID < firstRelative + count; relativeID++) {
+        __m256 sums[MAX_BATCH / 8];
+        for(int reg = 0; reg < registers; reg++) {
+            sums[reg] = sweep.tile != nullptr ? _mm256_loadu_ps(pihat + (size_t)relativeID * stride + reg * 8)
+                                              : _mm256_setzero_ps();
+        }
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            if(sweep.buffers[chr] == nullptr) continue;
+            const unsigned char* row = sweep.buffers[chr] + (size_t)relativeID * sweep.bytesPerIndividual[chr];
+            const float* table = sweep.tables[chr];
+            for(int snp = firstSNPOf(sweep); snp < endSNPOf(sweep, chr); snp++) {
+                int relativeGenotype = (row[snp / 4] >> ((snp % 4) * 2)) & 3;
+                int dosage = (relativeGenotype & 1) + (relativeGenotype >> 1);
+                const float* entry = table + ((size_t)snp * 3 + dosage) * stride;
+                for(int reg = 0; reg < registers; reg++) {
+                    sums[reg] = _mm256_add_ps(sums[reg], _mm256_loadu_ps(entry + reg * 8));
+                }
+            }
+        }
+        for(int reg = 0; reg < registers; reg++) {
+            _mm256_storeu_ps(pihat + (size_t)relativeID * stride + reg * 8, sums[reg]);
+        }
+    }
+}
+
+void PIHATKernels::sweepQuantizedScalar(const PIHATSweep& sweep, int firstRelative, int count, float* pihat) {
+    for(int relativeID = firstRelative; relativeID < firstRelative + count; relativeID++) {
+        float sum = startingSum(sweep, pihat, relativeID);
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            if(sweep.buffers[chr] == nullptr) continue;
+            int snpCount = endSNPOf(sweep, chr);
+            for(int first = firstSNPOf(sweep); first < snpCount; first += QUANTIZED_BLOCK_SNPS) {
+                int end = std::min(first + QUANTIZED_BLOCK_SNPS, snpCount);
+                int32_t blockSum = sumQuantizedFrom(sweep, chr, relativeID, first, end);
+                sum = std::fma((float)blockSum, sweep.blockScales[chr][first / QUANTIZED_BLOCK_SNPS], sum);
+            }
+        }
+        pihat[relativeID] = sum;
+    }
+}
+
+// Sixteen relatives per register in 16-bit lanes. Gathers are slow on recent
+// cores, so 32 SNPs of each relative are read with one 64-bit load and split
+// into four 16-bit words of 8 SNPs; a byte shuffle then picks each lane's
+// entry among the four int16 entries of the SNP.
+__attribute__((target("avx2,fma")))
+void PIHATKernels::sweepQuantizedAVX2(const PIHATSweep& sweep, int firstRelative, int count, float* pihat) {
+    const int lanes = 16;
+    if(count < lanes) {
+        sweepQuantizedScalar(sweep, firstRelative, count, pihat);
+        return;
+    }
+    const __m256i codeMask = _mm256_set1_epi16(3);
+    const __m256i byteSpread = _mm256_set1_epi16(0x0202);
+    const __m256i byteOffset = _mm256_set1_epi16(0x0100);
+
+    for(int group = firstRelative; group + lanes <= firstRelative + count; group += lanes) {
+        __m256 sumsLow = sweep.tile != nullptr ? _mm256_loadu_ps(pihat + group) : _mm256_setzero_ps();
+        __m256 sumsHigh = sweep.tile != nullptr ? _mm256_loadu_ps(pihat + group + 8) : _mm256_setzero_ps();
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            if(sweep.buffers[chr] == nullptr) continue;
+            size_t rowBytes = sweep.bytesPerIndividual[chr];
+            const unsigned char* base = sweep.buffers[chr] + (size_t)group * rowBytes;
+            const int16_t* table = sweep.quantizedTables[chr];
+            int snpCount = endSNPOf(sweep, chr);
+
+            for(int first = firstSNPOf(sweep); first < snpCount; first += QUANTIZED_BLOCK_SNPS) {
+                int end = std::min(first + QUANTIZED_BLOCK_SNPS, snpCount);
+                __m256i blockLow = _mm256_setzero_si256();
+                __m256i blockHigh = _mm256_setzero_si256();
+                int snp = first;
+                for(; snp + 32 <= end && (size_t)(snp / 4) + 8 <= rowBytes; snp += 32) {
+                    uint16_t words[4][16];
+                    for(int lane = 0; lane < lanes; lane++) {
+                        uint64_t codes;
+                        memcpy(&codes, base + lane * rowBytes + snp / 4, sizeof(codes));
+                        for(int word = 0; word < 4; word++) {
+                            words[word][lane] = (uint16_t)(codes >> (16 * word));
+                        }
+                    }
+                    for(int word = 0; word < 4; word++) {
+                        __m256i codes = _mm256_loadu_si256((const __m256i*)words[word]);
+                        __m256i run = _mm256_setzero_si256();
+                        for(int k = 0; k < 8; k++) {
+                            __m256i control = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(codes, codeMask), byteSpread),
+                                                               byteOffset);
+                            __m256i entries = _mm256_set1_epi64x(
+                                *(const long long*)(table + (size_t)(snp + word * 8 + k) * QUANTIZED_ENTRIES));
+                            run = _mm256_add_epi16(run, _mm256_shuffle_epi8(entries, control));
+                            codes = _mm256_srli_epi16(codes, 2);
+                            if(k % QUANTIZED_RUN == QUANTIZED_RUN - 1) {
+                                blockLow = _mm256_add_epi32(blockLow, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(run)));
+                                blockHigh = _mm256_add_epi32(blockHigh, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(run, 1)));
+                                run = _mm256_setzero_si256();
+                            }
+                        }
+                    }
+                }
+                if(snp < end) {
+                    int32_t laneSums[16];
+                    _mm256_storeu_si256((__m256i*)laneSums, blockLow);
+                    _mm256_storeu_si256((__m256i*)(laneSums + 8), blockHigh);
+                    for(int lane = 0; lane < lanes; lane++) {
+                        laneSums[lane] += sumQuantizedFrom(sweep, chr, group + lane, snp, end);
+                    }
+                    blockLow = _mm256_loadu_si256((const __m256i*)laneSums);
+                    blockHigh = _mm256_loadu_si256((const __m256i*)(laneSums + 8));
+                }
+                __m256 scale = _mm256_set1_ps(sweep.blockScales[chr][first / QUANTIZED_BLOCK_SNPS]);
+                sumsLow = _mm256_fmadd_ps(_mm256_cvtepi32_ps(blockLow), scale, sumsLow);
+                sumsHigh = _mm256_fmadd_ps(_mm256_cvtepi32_ps(blockHigh), scale, sumsHigh);
+            }
+        }
+        _mm256_storeu_ps(pihat + group, sumsLow);
+        _mm256_storeu_ps(pihat + group + 8, sumsHigh);
+    }
+    int done = (count / lanes) * lanes;
+    if(done < count) {
+        sweepQuantizedScalar(sweep, firstRelative + done, count - done, pihat);
+    }
+}
+
+// Thirty-two relatives per register. The 64-bit code words of the group are
+// staged in four registers of eight relatives and word w of every relative is
+// collected with two 16-bit permutes, without gathers.
+__attribute__((target("avx2,fma,avx512f,avx512bw")))
+void PIHATKernels::sweepQuantizedAVX512(const PIHATSweep& sweep, int firstRelative, int count, float* pihat) {
+    const int lanes = 32;
+    if(count < lanes) {
+        sweepQuantizedAVX2(sweep, firstRelative, count, pihat);
+        return;
+    }
+    // Word w of qword i sits at 16-bit position 4i + w; the second source starts at 32
+    __m512i wordIndex[4];
+    for(int word = 0; word < 4; word++) {
+        int16_t positions[32];
+        for(int lane = 0; lane < 32; lane++) {
+            positions[lane] = (int16_t)(4 * (lane % 16) + word);
+        }
+        wordIndex[word] = _mm512_loadu_si512(positions);
+    }
+
+    for(int group = firstRelative; group + lanes <= firstRelative + count; group += lanes) {
+        __m512 sumsLow = sweep.tile != nullptr ? _mm512_loadu_ps(pihat + group) : _mm512_setzero_ps();
+        __m512 sumsHigh = sweep.tile != nullptr ? _mm512_loadu_ps(pihat + group + 16) : _mm512_setzero_ps();
+        for(int chr = firstChromosome(sweep); chr < endChromosome(sweep); chr++) {
+            if(sweep.buffers[chr] == nullptr) continue;
+            size_t rowBytes = sweep.bytesPerIndividual[chr];
+            const unsigned char* base = sweep.buffers[chr] + (size_t)group * rowBytes;
+            const int16_t* table = sweep.quantizedTables[chr];
+            int snpCount = endSNPOf(sweep, chr);
+
+            for(int first = firstSNPOf(sweep); first < snpCount; first += QUANTIZED_BLOCK_SNPS) {
+                int end = std::min(first + QUANTIZED_BLOCK_SNPS, snpCount);
+                __m512i blockLow = _mm512_setzero_si512();
+                __m512i blockHigh = _mm512_setzero_si512();
+                int snp = first;
+                for(; snp + 32 <= end && (size_t)(snp / 4) + 8 <= rowBytes; snp += 32) {
+                    uint64_t staged[32];
+                    for(int lane = 0; lane < lanes; lane++) {
+                        memcpy(&staged[lane], base + lane * rowBytes + snp / 4, sizeof(uint64_t));
+                    }
+                    __m512i quarter0 = _mm512_loadu_si512(staged);
+                    __m512i quarter1 = _mm512_loadu_si512(staged + 8);
+                    __m512i quarter2 = _mm512_loadu_si512(staged + 16);
+                    __m512i quarter3 = _mm512_loadu_si512(staged + 24);
+                    for(int word = 0; word < 4; word++) {
+                        __m512i lowRelatives = _mm512_permutex2var_epi16(quarter0, wordIndex[word], quarter1);
+                        __m512i highRelatives = _mm512_permutex2var_epi16(quarter2, wordIndex[word], quarter3);
+                        __m512i codes = _mm512_inserti64x4(lowRelatives, _mm512_castsi512_si256(highRelatives), 1);
+                        __m512i run = _mm512_setzero_si512();
+                        for(int k = 0; k < 8; k++) {
+                            // The four entries repeat across the register, so the permute
+                            // only sees the lane's current code in the index bits it uses
+                            __m512i entries = _mm512_set1_epi64(
+                                *(const long long*)(table + (size_t)(snp + word * 8 + k) * QUANTIZED_ENTRIES));
+                            run = _mm512_add_epi16(run, _mm512_permutexvar_epi16(codes, entries));
+                            codes = _mm512_srli_epi16(codes, 2);
+                            if(k % QUANTIZED_RUN == QUANTIZED_RUN - 1) {
+                                blockLow = _mm512_add_epi32(blockLow, _mm512_cvtepi16_epi32(_mm512_castsi512_si256(run)));
+                                blockHigh = _mm512_add_epi32(blockHigh, _mm512_cvtepi16_epi32(_mm512_extracti64x4_epi64(run, 1)));
+                                run = _mm512_setzero_si512();
+                            }
+                        }
+                    }
+                }
+                if(snp < end) {
+                    int32_t laneSums[32];
+                    _mm512_storeu_si512(laneSums, blockLow);
+                    _mm512_storeu_si512(laneSums + 16, blockHigh);
+                    for(int lane = 0; lane < lanes; lane++) {
+                        laneSums[lane] += sumQuantizedFrom(sweep, chr, group + lane, snp, end);
+                    }
+                    blockLow = _mm512_loadu_si512(laneSums);
+                    blockHigh = _mm512_loadu_si512(laneSums + 16);
+                }
+                __m512 scale = _mm512_set1_ps(sweep.blockScales[chr][first / QUANTIZED_BLOCK_SNPS]);
+                sumsLow = _mm512_fmadd_ps(_mm512_cvtepi32_ps(blockLow), scale, sumsLow);
+                sumsHigh = _mm512_fmadd_ps(_mm512_cvtepi32_ps(blockHigh), scale, sumsHigh);
+            }
+        }
+        _mm512_storeu_ps(pihat + group, sumsLow);
+        _mm512_storeu_ps(pihat + group + 16, sumsHigh);
+    }
+    int done = (count / lanes) * lanes;
+    if(done < count) {
+        sweepQuantizedAVX2(sweep, firstRelative + done, count - done, pihat);
+    }
+}
+
+int PIHATKernels::getQuantizedLaneCount(PIHATKernel kernel) {
+    switch(kernel) {
+        case PIHATKernel::AVX512: return 32;
+        case PIHATKernel::AVX2: return 16;
+        default: return 1;
+    }
+}
+
+int PIHATKernels::getLaneCount(PIHATKernel kernel) {
+    switch(kernel) {
+        case PIHATKernel::AVX512: return 16;
+        case PIHATKernel::AVX2: return 8;
+        default: return 1;
+    }
+}
+
+bool PIHATKernels::isSupported(PIHATKernel kernel) {
+    switch(kernel) {
+        case PIHATKernel::AUTO:
+        case PIHATKernel::SCALAR: return true;
+        case PIHATKernel::AVX2: return __builtin_cpu_supports("avx2");
+        case PIHATKernel::AVX512: return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx2");
+    }
+    return false;
+}
+
+PIHATKernel PIHATKernels::resolve(PIHATKernel requested) {
+    if(requested != PIHATKernel::AUTO && isSupported(requested)) {
+        return requested;
+    }
+    if(isSupported(PIHATKernel::AVX512)) return PIHATKernel::AVX512;
+    if(isSupported(PIHATKernel::AVX2)) return PIHATKernel::AVX2;
+    return PIHATKernel::SCALAR;
+}
+
+bool PIHATKernels::parseKernel(const char* name, PIHATKernel& kernel) {
+    if(strcmp(name, "auto") == 0) {
+        kernel = PIHATKernel::AUTO;
+    } else if(strcmp(name, "scalar") == 0) {
+        kernel = PIHATKernel::SCALAR;
+    } else if(strcmp(name, "avx2") == 0) {
+        kernel = PIHATKernel::AVX2;
+    } else if(strcmp(name, "avx512") == 0) {
+        kernel = PIHATKernel::AVX512;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* PIHATKernels::getKernelName(PIHATKernel kernel) {
+    switch(kernel) {
+        case PIHATKernel::AUTO: return "auto";
+        case PIHATKernel::SCALAR: return "scalar";
+        case PIHATKernel::AVX2: return "avx2";
+        case PIHATKernel::AVX512: return "avx512";
+    }
+    return "unknown";
+}
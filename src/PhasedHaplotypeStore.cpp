@@ -0,0 +1,138 @@
+/**
+ * @file PhasedHaplotypeStore.cpp
+ * @brief Implementation of PhasedHaplotypeStore
+ */
+
+#include "../include/PhasedHaplotypeStore.h"
+#include "../include/GenomeDataManager.h"
+#include "../include/LargeBufferAllocator.h"
+#include "../include/Exceptions.h"
+#include "../include/ErrorCodes.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+PhasedHaplotypeStore::PhasedHaplotypeStore(GenomeDataManager* gdm)
+    : genomeDataManager(gdm), bufferAllocator(nullptr) {
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        rows[chr] = nullptr;
+        bytesPerRow[chr] = 0;
+    }
+}
+
+PhasedHaplotypeStore::~PhasedHaplotypeStore() {
+    reset();
+}
+
+void PhasedHaplotypeStore::releaseRows(int chromosome) {
+    if(rows[chromosome] == nullptr) {
+        return;
+    }
+    if(bufferAllocator != nullptr && bufferAllocator->owns(rows[chromosome])) {
+        bufferAllocator->release(rows[chromosome]);
+    } else {
+        free(rows[chromosome]);
+    }
+    rows[chromosome] = nullptr;
+}
+
+bool PhasedHaplotypeStore::initialize(const std::vector<int>& individuals) {
+    reset();
+    int numberOfIndividuals = genomeDataManager->getNumberOfIndividuals();
+    rowOfIndividual.assign(numberOfIndividuals, -1);
+    for(int individual : individuals) {
+        if(individual < 0 || individual >= numberOfIndividuals) {
+            printf("Error: Individual %d is outside the loaded genomes\n", individual);
+            reset();
+            return false;
+        }
+        if(rowOfIndividual[individual] < 0) {
+            rowOfIndividual[individual] = (int)individualOfRow.size();
+            individualOfRow.push_back(individual);
+        }
+    }
+    committedRows.assign(individualOfRow.size(), 0);
+
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        bytesPerRow[chr] = genomeDataManager->getBytesPerIndividual(chr);
+        size_t bufferSize = bytesPerRow[chr] * individualOfRow.size();
+        if(bufferSize == 0) {
+            continue;
+        }
+        if(bufferAllocator != nullptr) {
+            rows[chr] = bufferAllocator->allocate(bufferSize, bytesPerRow[chr], individualOfRow.size(),
+                                                  "phased chr " + std::to_string(chr));
+        } else {
+            rows[chr] = (unsigned char*)calloc(bufferSize, sizeof(unsigned char));
+        }
+        if(rows[chr] == nullptr) {
+            printf("Error: Memory allocation failed for phased haplotypes of chromosome %d\n", chr);
+            reset();
+            return false;
+        }
+    }
+    return true;
+}
+
+unsigned char* PhasedHaplotypeStore::getRow(int chromosome, int individual) const {
+    if(chromosome < 1 || chromosome >= NUM_CHROMOSOMES || rows[chromosome] == nullptr) {
+        throw PhasingException("Invalid chromosome index: " + std::to_string(chromosome),
+                              ErrorCodes::PhasingError::INVALID_CHROMOSOME);
+    }
+    if(!contains(individual)) {
+        throw PhasingException("Individual not in phased store: " + std::to_string(individual),
+                              ErrorCodes::PhasingError::INVALID_INDIVIDUAL);
+    }
+    return rows[chromosome] + (size_t)rowOfIndividual[individual] * bytesPerRow[chromosome];
+}
+
+void PhasedHaplotypeStore::beginIndividual(int individual) {
+    // Phasing only rewrites the switched heterozygous sites, so the row starts
+    // from the unphased genotypes
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        if(rows[chr] == nullptr) continue;
+        const unsigned char* source = genomeDataManager->getGenomeBuffer(chr)
+                                    + (size_t)individual * bytesPerRow[chr];
+        memcpy(getRow(chr, individual), source, bytesPerRow[chr]);
+    }
+    committedRows[rowOfIndividual[individual]] = 0;
+}
+
+void PhasedHaplotypeStore::commitIndividual(int individual) {
+    if(contains(individual)) {
+        committedRows[rowOfIndividual[individual]] = 1;
+    }
+}
+
+int PhasedHaplotypeStore::getGenotype(int chromosome, int individual, int snpIndex) const {
+    const unsigned char* row = getRow(chromosome, individual);
+    return (row[snpIndex / 4] >> ((snpIndex % 4) * 2)) & 3;
+}
+
+void PhasedHaplotypeStore::setGenotype(int chromosome, int individual, int snpIndex, int genotype) {
+    unsigned char* bytePtr = getRow(chromosome, individual) + (snpIndex / 4);
+    int bitShift = (snpIndex % 4) * 2;
+    *bytePtr = (*bytePtr & (~(3 << bitShift))) | ((genotype & 3) << bitShift);
+}
+
+bool PhasedHaplotypeStore::contains(int individual) const {
+    return individual >= 0 && individual < (int)rowOfIndividual.size() && rowOfIndividual[individual] >= 0;
+}
+
+bool PhasedHaplotypeStore::isCommitted(int individual) const {
+    return contains(individual) && committedRows[rowOfIndividual[individual]] != 0;
+}
+
+void PhasedHaplotypeStore::reset() {
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        releaseRows(chr);
+        bytesPerRow[chr] = 0;
+    }
+    rowOfIndividual.clear();
+    individualOfRow.clear();
+    committedRows.clear();
+}
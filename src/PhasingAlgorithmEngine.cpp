@@ -6,6 +6,8 @@
 #include "../include/PhasingAlgorithmEngine.h"
 #include "../include/GenomeDataManager.h"
 #include "../include/RelativeIdentificationEngine.h"
+#include "../include/PIHATEngine.h"
+#include "../include/PhasedHaplotypeStore.h"
 #include "../include/ChromosomeDivider.h"
 #include "../include/Constants.h"
 #include "../include/utils/readinteger.h"
@@ -17,16 +19,24 @@
 using namespace PhasingEngine;
 using namespace PhasingEngine::Constants;
 
-PhasingAlgorithmEngine::PhasingAlgorithmEngine(GenomeDataManager* gdm, RelativeIdentificationEngine* rie)
-    : genomeDataManager(gdm), relativeEngine(rie), verboseOutput(true),
-      jobIdentifier(0), relativeCount(0), breakpointCount(0) {
+PhasingAlgorithmEngine::PhasingAlgorithmEngine(GenomeDataManager* gdm, RelativeIdentificationEngine* rie,
+                                               PhasedHaplotypeStore* store, PIHATEngine* pihat)
+    : genomeDataManager(gdm), relativeEngine(rie), phasedStore(store), pihatEngine(pihat), verboseOutput(true),
+      jobIdentifier(0), relativeCount(0), breakpointCount(0), cohortMAFReady(false) {
     pihatThresholds[0] = DEFAULT_PIHAT_THRESHOLD;
     pihatThresholds[1] = DEFAULT_PIHAT_THRESHOLD;
     pihatThresholds[2] = DEFAULT_PIHAT_THRESHOLD;
     
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        chromosomeSwapped[chr] = false;
+    }
     for(int size = 0; size < 51; size++) {
         for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
             chromosomeDividerCounts[size][chr] = 0;
+        }
+    }
+    for(int size = 0; size < 50; size++) {
+        for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
             for(int window = 0; window < 20; window++) {
                 chromosomeDividers[size][chr][window] = ChromosomeDivider();
             }
@@ -45,25 +55,27 @@ bool PhasingAlgorithmEngine::loadSegment(int individualID, int trioNumber, int p
         printf("Processing segment for individual %d (Job ID: %d)\n", individualID, jobIdentifier);
     }
     
-    const char* mafFilePath = "/pl/active/KellerLab/Emmanuel/gameticphasing/MAF.txt";
-    FILE* mafFile = fopen(mafFilePath, "r");
-    if(mafFile == nullptr) {
-        if(verboseOutput) {
-            printf("Warning: MAF file not found at %s\n", mafFilePath);
+    if(!cohortMAFReady) {
+        const char* mafFilePath = "/pl/active/KellerLab/Emmanuel/gameticphasing/MAF.txt";
+        FILE* mafFile = fopen(mafFilePath, "r");
+        if(mafFile == nullptr) {
+            if(verboseOutput) {
+                printf("Warning: MAF file not found at %s\n", mafFilePath);
+            }
+            return false;
         }
-        return false;
-    }
     
-    int chromosome = 1;
-    do {
-        chromosome = readinteger(mafFile);
-        if(chromosome < NUM_CHROMOSOMES) {
-            int snpIndex = readinteger(mafFile);
-            int mafValue = readinteger(mafFile);
-            genomeDataManager->setMAF(snpIndex, chromosome, mafValue);
-        }
-    } while(chromosome < NUM_CHROMOSOMES);
-    fclose(mafFile);
+        int chromosome = 1;
+        do {
+            chromosome = readinteger(mafFile);
+            if(chromosome < NUM_CHROMOSOMES) {
+                int snpIndex = readinteger(mafFile);
+                int mafValue = readinteger(mafFile);
+                genomeDataManager->setMAF(snpIndex, chromosome, mafValue);
+            }
+        } while(chromosome < NUM_CHROMOSOMES);
+        fclose(mafFile);
+    }
     
     relativeEngine->reset();
     
@@ -73,58 +85,27 @@ bool PhasingAlgorithmEngine::loadSegment(int individualID, int trioNumber, int p
     
     int nbIndiv = genomeDataManager->getNumberOfIndividuals();
     
-    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
-        genomeDataManager->computeMAFForChromosome(chr);
+    // The allele counts only feed the PIHAT sweep, which an index makes unnecessary
+    if(!cohortMAFReady && !relativeEngine->hasRelativeIndex()
+       && relativeEngine->getEstimator() == RelativeEstimator::PIHAT) {
+        for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+            genomeDataManager->computeMAFForChromosome(chr);
+        }
     }
+    cohortMAFReady = true;
     
-    int focalIndividual = individualID;
-    
-    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
-        for(int snp = 0; snp < genomeDataManager->getSNPCount(chr); snp++) {
-            float mafValue = 1.0f * genomeDataManager->getMAF(snp, chr) / (nbIndiv) / 2.0f;
-            if(mafValue > 0.5f) mafValue = 1.0f - mafValue;
-            
-            int focalGenotype = genomeDataManager->getGenotype(chr, focalIndividual, snp);
-            int parent0Allele = (focalGenotype >> 1);
-            int parent1Allele = (focalGenotype & 1);
-            
-            float contribution0 = ((parent0Allele) - mafValue);
-            float contribution1 = ((parent1Allele) - mafValue);
-            float mafDivisor = 2.0f * mafValue * (0.5f - mafValue / 2.0f);
-            
-            float pihatContributions[3];
-            pihatContributions[0] = contribution0 * (-mafValue) * 2.0f / mafDivisor + 
-                                   contribution1 * (-mafValue) * 2.0f / mafDivisor;
-            pihatContributions[1] = contribution0 * (1.0f - mafValue * 2.0f) / mafDivisor + 
-                                   contribution1 * (1.0f - mafValue * 2.0f) / mafDivisor;
-            pihatContributions[2] = contribution0 * (2.0f - mafValue * 2.0f) / mafDivisor + 
-                                   contribution1 * (2.0f - mafValue * 2.0f) / mafDivisor;
-            
-            int bytesPerIndividual = (genomeDataManager->getSNPCountPerChr(chr) / 4) + 
-                                    ((genomeDataManager->getSNPCountPerChr(chr) % 4) > 0 ? 1 : 0);
-            int snpDiv4 = snp / 4;
-            int snpBitShift = ((snp % 4) * 2);
-            
-            #pragma omp parallel for
-            for(int relativeID = 0; relativeID < nbIndiv; relativeID++) {
-                unsigned char* buffer = genomeDataManager->getGenomeBuffer(chr);
-                if(buffer != nullptr) {
-                    size_t offset = (size_t)relativeID * bytesPerIndividual;
-                    int relativeGenotype = (buffer[offset + snpDiv4] >> snpBitShift) & 3;
-                    int parent0Relative = (relativeGenotype & 1);
-                    int parent1Relative = (relativeGenotype >> 1);
-                    relativeEngine->accumulatePIHAT(relativeID, 
-                                                   pihatContributions[parent0Relative + parent1Relative]);
-                }
-            }
-        }
+    // One fork/join for the whole genome: relatives are split across the
+    // threads once and each sweeps every chromosome with a private sum
+    relativeEngine->setFocalIndividual(individualID);
+    relativeEngine->computePIHATMatrix();
+    // A focal answered from an earlier batch or from the kinship cache ran no sweep
+    if(verboseOutput && !relativeEngine->hasRelativeIndex() && relativeEngine->getLastThroughput() > 0.0) {
+        printf("%s sweep: %.1f M relative-SNPs/s\n",
+               relativeEngine->getEstimator() == RelativeEstimator::PIHAT ? "PIHAT" : "KING-robust",
+               relativeEngine->getLastThroughput() / 1e6);
     }
     
     for(int relativeID = 0; relativeID < nbIndiv; relativeID++) {
-        float pihat = relativeEngine->getPIHATValue(relativeID);
-        float normalized = pihat / 2.0f / PIHAT_NORMALIZATION_FACTOR - 1.0f;
-        relativeEngine->accumulatePIHAT(relativeID, -pihat);
-        relativeEngine->accumulatePIHAT(relativeID, normalized);
         relativeEngine->setPIHAT2(relativeID, 0.0f);
     }
     
@@ -169,6 +150,10 @@ int PhasingAlgorithmEngine::executePhasingAlgorithm(int individualID, int chromo
     
     loadGenomeOffspringData(individualID, parent1ID, parent2ID);
     initializeChromosomeDividers();
+    phasedStore->beginIndividual(individualID);
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        chromosomeSwapped[chr] = false;
+    }
     
     int generation = generationStart;
     int64_t bestScore = -1000000;
@@ -178,12 +163,9 @@ int PhasingAlgorithmEngine::executePhasingAlgorithm(int individualID, int chromo
     do {
         int64_t currentScore = 0;
         
-        for(int relativeIndex = 0; relativeIndex < 20 && relativeIndex < relativeCount; relativeIndex++) {
-            int relativeID = relativeEngine->getBestRelativeID(
-                relativeEngine->getFirstConsiderationIndex() + relativeIndex);
-            if(relativeID >= 0 && relativeEngine->getPIHATValue(relativeID) > 0.022f) {
-                processPhasingCorrections(individualID, relativeID);
-            }
+        collectConsideredRelatives();
+        for(size_t index = 0; index < consideredRelatives.size(); index++) {
+            processPhasingCorrections(individualID, consideredRelatives[index]);
         }
         
         int breakpointIndex = 25;
@@ -198,6 +180,7 @@ int PhasingAlgorithmEngine::executePhasingAlgorithm(int individualID, int chromo
         generation++;
     } while(generation < MAXGEN);
     
+    phasedStore->commitIndividual(individualID);
     return 0;
 }
 
@@ -208,33 +191,80 @@ void PhasingAlgorithmEngine::processPhasingCorrections(int individualID, int rel
     }
 }
 
+void PhasingAlgorithmEngine::collectConsideredRelatives() {
+    consideredRelatives.clear();
+    for(int relativeIndex = 0; relativeIndex < 20 && relativeIndex < relativeCount; relativeIndex++) {
+        int relativeID = relativeEngine->getBestRelativeID(
+            relativeEngine->getFirstConsiderationIndex() + relativeIndex);
+        if(relativeID >= 0 && relativeEngine->getPIHATValue(relativeID) > 0.022f) {
+            consideredRelatives.push_back(relativeID);
+        }
+    }
+}
+
+double PhasingAlgorithmEngine::getHaplotypeBalance(const float* parts, int chromosome) const {
+    int snpCount = genomeDataManager->getSNPCount(chromosome);
+    if(snpCount <= 0) {
+        return 0.0;
+    }
+    return ((double)parts[(chromosome - 1) * 2] - parts[(chromosome - 1) * 2 + 1]) / snpCount;
+}
+
 void PhasingAlgorithmEngine::mergeChromosomeWindows(int breakpointIndex) {
+    // Windows span whole chromosomes, the resolution of the decomposition, so
+    // every pair is scored once; all dividers of a chromosome get its orientation
+    double correlations[NUM_CHROMOSOMES][NUM_CHROMOSOMES];
+    int group[NUM_CHROMOSOMES];
+    int orientation[NUM_CHROMOSOMES];
+    for(int chr1 = 1; chr1 < NUM_CHROMOSOMES; chr1++) {
+        group[chr1] = chr1;
+        orientation[chr1] = 1;
+        for(int chr2 = chr1 + 1; chr2 < NUM_CHROMOSOMES; chr2++) {
+            computeCorrelationMatrix(chr1, chr2, &correlations[chr1][chr2]);
+        }
+    }
+    
     int mergeCount = 0;
     do {
         double maxCorrelation = 0.0;
-        int bestChr1 = 1, bestDiv1 = 0, bestChr2 = 1, bestDiv2 = 0;
+        int bestChr1 = 1, bestChr2 = 1;
         
         for(int chr1 = 1; chr1 < NUM_CHROMOSOMES; chr1++) {
-            for(int div1 = 0; div1 < getChromosomeDividerCount(breakpointIndex, chr1) - 1; div1++) {
-                for(int chr2 = chr1 + 1; chr2 < NUM_CHROMOSOMES; chr2++) {
-                    for(int div2 = 0; div2 < getChromosomeDividerCount(breakpointIndex, chr2); div2++) {
-                        double correlation = 0.0;
-                        if(std::abs(correlation) > std::abs(maxCorrelation)) {
-                            maxCorrelation = correlation;
-                            bestChr1 = chr1;
-                            bestDiv1 = div1;
-                            bestChr2 = chr2;
-                            bestDiv2 = div2;
-                        }
-                    }
+            if(getChromosomeDividerCount(breakpointIndex, chr1) == 0) continue;
+            for(int chr2 = chr1 + 1; chr2 < NUM_CHROMOSOMES; chr2++) {
+                if(group[chr2] == group[chr1] || getChromosomeDividerCount(breakpointIndex, chr2) == 0) continue;
+                double correlation = correlations[chr1][chr2];
+                if(std::abs(correlation) > std::abs(maxCorrelation)) {
+                    maxCorrelation = correlation;
+                    bestChr1 = chr1;
+                    bestChr2 = chr2;
                 }
             }
         }
         
         if(std::abs(maxCorrelation) > 0.01) {
+            // Turn the second group so that the pair agrees with the sign
+            int flip = orientation[bestChr1] * orientation[bestChr2] * (maxCorrelation > 0.0 ? 1 : -1);
+            int mergedGroup = group[bestChr2];
+            for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+                if(group[chr] == mergedGroup) {
+                    group[chr] = group[bestChr1];
+                    orientation[chr] *= flip;
+                }
+            }
             mergeCount++;
+        } else {
+            // No pair of windows is correlated enough to merge any further
+            break;
         }
-    } while(mergeCount < 22 * 19 - 1);
+    } while(mergeCount < NUM_CHROMOSOMES - 2);
+    
+    // Orientations refer to the genome store; swaps already applied are undone first
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        for(int div = 0; div < getChromosomeDividerCount(breakpointIndex, chr); div++) {
+            getChromosomeDivider(breakpointIndex, chr, div)->phasing = ((orientation[chr] < 0) != chromosomeSwapped[chr]) ? 1 : 0;
+        }
+    }
 }
 
 void PhasingAlgorithmEngine::applyPhasingToGenome(int individualID, int breakpointIndex) {
@@ -246,14 +276,18 @@ void PhasingAlgorithmEngine::applyPhasingToGenome(int individualID, int breakpoi
             ChromosomeDivider* divider = getChromosomeDivider(breakpointIndex, chr, div);
             int phasingOrientation = divider->phasing;
             
+            if((phasingOrientation + 3) / 2 == 2 && div == 0) {
+                chromosomeSwapped[chr] = !chromosomeSwapped[chr];
+            }
+            
             for(int snp = divider->start; snp < divider->end; snp++) {
                 int genotype = genomeDataManager->getGenomeOffspring(0, snp, chr);
                 if((phasingOrientation + 3) / 2 == 2) {
                     if(genotype == 1) {
-                        genomeDataManager->setGenotype(chr, individualID + NBINDIV, snp, 2);
+                        phasedStore->setGenotype(chr, individualID, snp, 2);
                         genomeDataManager->setGenomeOffspring(0, snp, chr, 2);
                     } else if(genotype == 2) {
-                        genomeDataManager->setGenotype(chr, individualID + NBINDIV, snp, 1);
+                        phasedStore->setGenotype(chr, individualID, snp, 1);
                         genomeDataManager->setGenomeOffspring(0, snp, chr, 1);
                     }
                 }
@@ -307,7 +341,20 @@ void PhasingAlgorithmEngine::setPhasingStrategy(std::unique_ptr<IPhasingStrategy
 
 void PhasingAlgorithmEngine::computeCorrelationMatrix(int chromosome1, int chromosome2, 
                                                      double* correlationMatrix) const {
-    // Implementation for correlation computation
+    double cross = 0.0;
+    double norm1 = 0.0;
+    double norm2 = 0.0;
+    for(size_t index = 0; index < consideredRelatives.size(); index++) {
+        const float* parts = relativeEngine->getKinshipDecomposition(consideredRelatives[index]);
+        if(parts == nullptr) continue;
+        double balance1 = getHaplotypeBalance(parts, chromosome1);
+        double balance2 = getHaplotypeBalance(parts, chromosome2);
+        cross += balance1 * balance2;
+        norm1 += balance1 * balance1;
+        norm2 += balance2 * balance2;
+    }
+    // Not centered: relatives all on one parent's side still carry the signal
+    correlationMatrix[0] = norm1 > 0.0 && norm2 > 0.0 ? cross / std::sqrt(norm1 * norm2) : 0.0;
 }
 
 void PhasingAlgorithmEngine::optimizeWindowMerging(int breakpointIndex) {
@@ -0,0 +1,159 @@
+/**
+ * @file RelationshipClassifier.cpp
+ * @brief Implementation of RelationshipClassifier
+ */
+
+#include "../include/RelationshipClassifier.h"
+#include "../include/RelativeIdentificationEngine.h"
+#include "../include/GenomeDataManager.h"
+#include "../include/KinshipCounts.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <omp.h>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+constexpr float RelationshipClassifier::PARENT_OFFSPRING_MAX_IBS0;
+
+namespace {
+    const uint64_t LOW_BITS = 0x5555555555555555ull;
+
+    // Up to 32 genotype codes of a row; bytes past the row end read as zero
+    inline uint64_t loadWord(const unsigned char* row, size_t rowBytes, size_t word) {
+        uint64_t value = 0;
+        size_t offset = word * 8;
+        memcpy(&value, row + offset, std::min((size_t)8, rowBytes - offset));
+        return value;
+    }
+
+    struct StateMasks {
+        uint64_t homRef;
+        uint64_t het;
+        uint64_t homAlt;
+    };
+
+    // One bit per SNP, at the low bit of its 2-bit code
+    inline StateMasks splitStates(uint64_t codes, uint64_t valid) {
+        uint64_t high = (codes >> 1) & LOW_BITS;
+        uint64_t low = codes & LOW_BITS;
+        return StateMasks{~(high | low) & valid, (high ^ low) & valid, high & low & valid};
+    }
+}
+
+RelationshipClassifier::RelationshipClassifier(GenomeDataManager* gdm)
+    : genomeDataManager(gdm), focalCount(0), relativeCount(0.0), classifySeconds(0.0) {
+    for(int chr = 0; chr < NUM_CHROMOSOMES; chr++) {
+        wordOffsets[chr] = 0;
+    }
+    for(int degree = 0; degree < 6; degree++) {
+        degreeCounts[degree] = 0.0;
+    }
+}
+
+void RelationshipClassifier::classify(int focalIndividual, const std::vector<RelativeCandidate>& relatives,
+                                      std::vector<RelativeClass>& classes) {
+    double startTime = omp_get_wtime();
+    classes.clear();
+    if(focalIndividual < 0 || focalIndividual >= genomeDataManager->getNumberOfIndividuals()) {
+        return;
+    }
+    size_t totalWords = 0;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        wordOffsets[chr] = totalWords;
+        if(genomeDataManager->getGenomeBuffer(chr) != nullptr) {
+            totalWords += (genomeDataManager->getSNPCount(chr) + 31) / 32;
+        }
+    }
+    focalWords.resize(totalWords);
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        const unsigned char* buffer = genomeDataManager->getGenomeBuffer(chr);
+        if(buffer == nullptr) continue;
+        size_t rowBytes = genomeDataManager->getBytesPerIndividual(chr);
+        const unsigned char* row = buffer + (size_t)focalIndividual * rowBytes;
+        size_t words = (genomeDataManager->getSNPCount(chr) + 31) / 32;
+        for(size_t word = 0; word < words; word++) {
+            focalWords[wordOffsets[chr] + word] = loadWord(row, rowBytes, word);
+        }
+    }
+
+    // The sweep ranks the focal against itself too; it is no duplicate of itself
+    std::vector<int> relativeIDs;
+    for(size_t rank = 0; rank < relatives.size(); rank++) {
+        if(relatives[rank].relativeID != focalIndividual) {
+            relativeIDs.push_back(relatives[rank].relativeID);
+        }
+    }
+    classes.resize(relativeIDs.size());
+    int count = (int)relativeIDs.size();
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int index = 0; index < count; index++) {
+        int relativeID = relativeIDs[index];
+        KinshipCounts::PairCounts pair = {0, 0};
+        int ibs2 = 0;
+        int heterozygous = 0;
+        int snpTotal = 0;
+        for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+            const unsigned char* buffer = genomeDataManager->getGenomeBuffer(chr);
+            if(buffer == nullptr) continue;
+            size_t rowBytes = genomeDataManager->getBytesPerIndividual(chr);
+            const unsigned char* row = buffer + (size_t)relativeID * rowBytes;
+            int snpCount = genomeDataManager->getSNPCount(chr);
+            size_t words = (snpCount + 31) / 32;
+            const uint64_t* focal = &focalWords[wordOffsets[chr]];
+            for(size_t word = 0; word < words; word++) {
+                int tail = snpCount - (int)word * 32;
+                uint64_t valid = tail >= 32 ? LOW_BITS : LOW_BITS & (((uint64_t)1 << (2 * tail)) - 1);
+                StateMasks f = splitStates(focal[word], valid);
+                StateMasks r = splitStates(loadWord(row, rowBytes, word), valid);
+                KinshipCounts::addPairWord(pair, f.het, f.homAlt, r.het, r.homAlt);
+                ibs2 += __builtin_popcountll((f.homRef & r.homRef) | (f.het & r.het) | (f.homAlt & r.homAlt));
+                heterozygous += __builtin_popcountll(f.het) + __builtin_popcountll(r.het);
+            }
+            snpTotal += snpCount;
+        }
+        float kinship = heterozygous > 0 ? (float)(pair.hetHet - 2 * pair.ibs0) / heterozygous : 0.0f;
+        classes[index] = RelativeClass{relativeID, pair.ibs0, ibs2, snpTotal, kinship,
+                                       classifyCounts(kinship, pair.ibs0, snpTotal)};
+    }
+
+    for(size_t index = 0; index < classes.size(); index++) {
+        degreeCounts[(int)classes[index].degree]++;
+    }
+    focalCount++;
+    relativeCount += classes.size();
+    classifySeconds += omp_get_wtime() - startTime;
+}
+
+RelationshipDegree RelationshipClassifier::classifyCounts(float kinship, int ibs0, int snpCount) {
+    // KING ranges: bounds halfway between degrees on a log scale
+    if(kinship > 0.354f) return RelationshipDegree::DUPLICATE;
+    if(kinship > 0.177f) {
+        return snpCount > 0 && (float)ibs0 / snpCount < PARENT_OFFSPRING_MAX_IBS0
+               ? RelationshipDegree::PARENT_OFFSPRING : RelationshipDegree::FULL_SIBLING;
+    }
+    if(kinship > 0.0884f) return RelationshipDegree::SECOND_DEGREE;
+    if(kinship > 0.0442f) return RelationshipDegree::THIRD_DEGREE;
+    return RelationshipDegree::UNRELATED;
+}
+
+const char* RelationshipClassifier::getDegreeName(RelationshipDegree degree) {
+    switch(degree) {
+        case RelationshipDegree::UNRELATED: return "unrelated";
+        case RelationshipDegree::THIRD_DEGREE: return "third degree";
+        case RelationshipDegree::SECOND_DEGREE: return "second degree";
+        case RelationshipDegree::FULL_SIBLING: return "full sibling";
+        case RelationshipDegree::PARENT_OFFSPRING: return "parent-offspring";
+        case RelationshipDegree::DUPLICATE: return "duplicate";
+    }
+    return "unknown";
+}
+
+void RelationshipClassifier::printReport() const {
+    printf("Relationship degrees: %.0f ranked relative(s) of %d focal(s) classified in %.3f s:", relativeCount,
+           focalCount, classifySeconds);
+    for(int degree = 5; degree >= 0; degree--) {
+        printf(" %.0f %s%s", degreeCounts[degree], getDegreeName((RelationshipDegree)degree), degree > 0 ? "," : "\n");
+    }
+}
@@ -4,94 +4,216 @@
  */
 
 #include "../include/RelativeIdentificationEngine.h"
+#include "../include/PIHATEngine.h"
+#include "../include/RelativeIndex.h"
+#include "../include/MinHashIndex.h"
+#include "../include/KinshipCache.h"
 #include "../include/Constants.h"
 #include <algorithm>
+#include <cstring>
+#include <omp.h>
 #include <vector>
-#include <utility>
 
 using namespace PhasingEngine;
 using namespace PhasingEngine::Constants;
 
+namespace {
+    // Heap order puts the worst kept relative on top, ready to be evicted
+    bool isBetterRelative(const RelativeCandidate& a, const RelativeCandidate& b) {
+        return a.pihat > b.pihat || (a.pihat == b.pihat && a.relativeID < b.relativeID);
+    }
+
+    void offerRelative(std::vector<RelativeCandidate>& heap, int k, const RelativeCandidate& candidate) {
+        if((int)heap.size() < k) {
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end(), isBetterRelative);
+        } else if(isBetterRelative(candidate, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), isBetterRelative);
+            heap.back() = candidate;
+            std::push_heap(heap.begin(), heap.end(), isBetterRelative);
+        }
+    }
+}
+
 RelativeIdentificationEngine::RelativeIdentificationEngine()
-    : primaryBestRelativeID(-1), secondaryBestRelativeID(-1),
-      firstConsiderationIndex(0), isComputed(false) {
+    : isComputed(false), topRelativeCount(100), primaryBestRelativeID(-1), secondaryBestRelativeID(-1),
+      firstConsiderationIndex(0), focalIndividual(-1), pihatEngine(nullptr), relativeIndex(nullptr),
+      candidateIndex(nullptr), kinshipCache(nullptr), classifier(nullptr) {
     reset();
 }
 
+void RelativeIdentificationEngine::resize(int numberOfIndividuals) {
+    pihatMatrix.assign(numberOfIndividuals, 0.0f);
+    pihatMatrixSecondary.assign(numberOfIndividuals, 0.0f);
+}
+
 void RelativeIdentificationEngine::reset() {
-    for(int i = 0; i < MAXPOP; i++) {
-        pihatMatrix[i] = 0.0f;
-        pihatMatrixSecondary[i] = 0.0f;
-    }
-    for(int i = 0; i < 100; i++) {
-        bestRelativeIDs[i] = -1;
-    }
+    std::fill(pihatMatrix.begin(), pihatMatrix.end(), 0.0f);
+    std::fill(pihatMatrixSecondary.begin(), pihatMatrixSecondary.end(), 0.0f);
+    topRelatives.clear();
+    relativeClasses.clear();
     isComputed = false;
 }
 
 void RelativeIdentificationEngine::accumulatePIHAT(int relativeID, float contribution) {
-    if(relativeID >= 0 && relativeID < MAXPOP) {
+    if(relativeID >= 0 && relativeID < (int)pihatMatrix.size()) {
         pihatMatrix[relativeID] += contribution;
     }
 }
 
+void RelativeIdentificationEngine::setPIHAT(int relativeID, float value) {
+    if(relativeID >= 0 && relativeID < (int)pihatMatrix.size()) {
+        pihatMatrix[relativeID] = value;
+    }
+}
+
 float RelativeIdentificationEngine::getPIHATValue(int individualID) const {
-    if(individualID >= 0 && individualID < MAXPOP) {
+    if(individualID >= 0 && individualID < (int)pihatMatrix.size()) {
         return pihatMatrix[individualID];
     }
     return 0.0f;
 }
 
 void RelativeIdentificationEngine::computePIHATMatrix() {
+    if(pihatEngine != nullptr) {
+        pihatEngine->clearLastSweep();
+    }
+    if(relativeIndex != nullptr && relativeIndex->fillPIHAT(focalIndividual, pihatMatrix)) {
+        isComputed = true;
+        return;
+    }
+    if(candidateIndex != nullptr && pihatEngine != nullptr && focalIndividual >= 0) {
+        candidateIndex->findCandidates(focalIndividual, candidates);
+        pihatEngine->computePIHATForRelatives(focalIndividual, candidates, pihatMatrix.data(), (int)pihatMatrix.size());
+        for(size_t relativeID = 0; relativeID < pihatMatrix.size(); relativeID++) {
+            pihatMatrix[relativeID] = PIHATEngine::normalize(pihatMatrix[relativeID]);
+        }
+        if(candidateIndex->isAuditingRecall()) {
+            exhaustivePIHAT.resize(pihatMatrix.size());
+            pihatEngine->computePIHAT(focalIndividual, exhaustivePIHAT.data(), (int)exhaustivePIHAT.size());
+            for(size_t relativeID = 0; relativeID < exhaustivePIHAT.size(); relativeID++) {
+                exhaustivePIHAT[relativeID] = PIHATEngine::normalize(exhaustivePIHAT[relativeID]);
+            }
+            candidateIndex->recordRecall(focalIndividual, exhaustivePIHAT.data(), (int)exhaustivePIHAT.size());
+        }
+    } else if(kinshipCache != nullptr && kinshipCache->isEnabled() && pihatEngine != nullptr && focalIndividual >= 0) {
+        int count = (int)pihatMatrix.size();
+        int firstMissing;
+        int endMissing;
+        kinshipCache->fillRow(focalIndividual, pihatMatrix.data(), count, firstMissing, endMissing);
+        double startTime = omp_get_wtime();
+        pihatEngine->computePIHATRange(focalIndividual, firstMissing, endMissing, pihatMatrix.data(), count);
+        for(int relativeID = firstMissing; relativeID < endMissing; relativeID++) {
+            pihatMatrix[relativeID] = PIHATEngine::normalize(pihatMatrix[relativeID]);
+        }
+        kinshipCache->recordQuery(count - (endMissing - firstMissing), endMissing - firstMissing,
+                                  omp_get_wtime() - startTime);
+        kinshipCache->storeRow(focalIndividual, pihatMatrix.data(), count);
+    } else if(pihatEngine != nullptr && focalIndividual >= 0) {
+        pihatEngine->computePIHAT(focalIndividual, pihatMatrix.data(), (int)pihatMatrix.size());
+        for(size_t relativeID = 0; relativeID < pihatMatrix.size(); relativeID++) {
+            pihatMatrix[relativeID] = PIHATEngine::normalize(pihatMatrix[relativeID]);
+        }
+    }
     isComputed = true;
 }
 
-void RelativeIdentificationEngine::sortRelativesByPIHAT() {
-    std::vector<std::pair<float, int>> relativePairs;
-    for(int i = 0; i < MAXPOP; i++) {
-        if(pihatMatrix[i] > 0.1f) {
-            relativePairs.push_back({pihatMatrix[i], i});
+double RelativeIdentificationEngine::getLastThroughput() const {
+    return pihatEngine != nullptr ? pihatEngine->getLastThroughput() : 0.0;
+}
+
+void RelativeIdentificationEngine::printThroughputReport() const {
+    if(pihatEngine != nullptr) {
+        pihatEngine->printThroughputReport();
+    }
+}
+
+bool RelativeIdentificationEngine::parseEstimator(const char* name, RelativeEstimator& estimator) {
+    if(strcmp(name, "pihat") == 0) {
+        estimator = RelativeEstimator::PIHAT;
+    } else if(strcmp(name, "king") == 0) {
+        estimator = RelativeEstimator::KING_ROBUST;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* RelativeIdentificationEngine::getEstimatorName(RelativeEstimator estimator) {
+    switch(estimator) {
+        case RelativeEstimator::PIHAT: return "pihat";
+        case RelativeEstimator::KING_ROBUST: return "king";
+    }
+    return "unknown";
+}
+
+void RelativeIdentificationEngine::selectTopRelatives(const float* pihat, int count, int k, float minimum,
+                                                      std::vector<RelativeCandidate>& best) {
+    std::vector<std::vector<RelativeCandidate>> threadHeaps(omp_get_max_threads());
+    #pragma omp parallel
+    {
+        std::vector<RelativeCandidate>& heap = threadHeaps[omp_get_thread_num()];
+        heap.reserve(k);
+        #pragma omp for schedule(static)
+        for(int relativeID = 0; relativeID < count; relativeID++) {
+            // Written so that NaN fails the test
+            if(pihat[relativeID] > minimum) {
+                offerRelative(heap, k, RelativeCandidate{relativeID, pihat[relativeID]});
+            }
         }
     }
-    std::sort(relativePairs.begin(), relativePairs.end(),
-              [](const std::pair<float, int>& a, const std::pair<float, int>& b) {
-                  return a.first > b.first;
-              });
-    
-    for(size_t i = 0; i < std::min(relativePairs.size(), size_t(100)); i++) {
-        bestRelativeIDs[i] = relativePairs[i].second;
+    best.clear();
+    for(size_t thread = 0; thread < threadHeaps.size(); thread++) {
+        for(size_t entry = 0; entry < threadHeaps[thread].size(); entry++) {
+            offerRelative(best, k, threadHeaps[thread][entry]);
+        }
     }
+    std::sort_heap(best.begin(), best.end(), isBetterRelative);
+}
+
+void RelativeIdentificationEngine::selectBestRelatives() {
+    selectTopRelatives(pihatMatrix.data(), (int)pihatMatrix.size(), topRelativeCount, 0.1f, topRelatives);
 }
 
 void RelativeIdentificationEngine::identifyBestRelatives(float threshold) {
-    sortRelativesByPIHAT();
+    selectBestRelatives();
+    if(classifier != nullptr) {
+        classifier->classify(focalIndividual, topRelatives, relativeClasses);
+    }
+    if(pihatEngine != nullptr && pihatEngine->isDecomposing()) {
+        std::vector<int> rankedIDs;
+        for(size_t rank = 0; rank < topRelatives.size(); rank++) {
+            rankedIDs.push_back(topRelatives[rank].relativeID);
+        }
+        pihatEngine->decomposeRelatives(focalIndividual, rankedIDs, (int)pihatMatrix.size());
+    }
     
+    int rankedCount = (int)topRelatives.size();
     int index = 0;
-    while(index < 100 && bestRelativeIDs[index] >= 0 && 
-          pihatMatrix[bestRelativeIDs[index]] > threshold) {
+    while(index < rankedCount && topRelatives[index].pihat > threshold) {
         index++;
     }
     
     firstConsiderationIndex = index;
-    if(index < 100 && bestRelativeIDs[index] >= 0) {
-        primaryBestRelativeID = bestRelativeIDs[index];
-        if(index + 1 < 100 && bestRelativeIDs[index + 1] >= 0) {
-            secondaryBestRelativeID = bestRelativeIDs[index + 1];
-        }
-    }
+    primaryBestRelativeID = index < rankedCount ? topRelatives[index].relativeID : -1;
+    secondaryBestRelativeID = index + 1 < rankedCount ? topRelatives[index + 1].relativeID : -1;
     isComputed = true;
 }
 
+const float* RelativeIdentificationEngine::getKinshipDecomposition(int relativeID) const {
+    return pihatEngine != nullptr ? pihatEngine->getDecomposition(focalIndividual, relativeID) : nullptr;
+}
+
 int RelativeIdentificationEngine::getBestRelativeID(int rank) const {
-    if(rank >= 0 && rank < 100) {
-        return bestRelativeIDs[rank];
+    if(rank >= 0 && rank < (int)topRelatives.size()) {
+        return topRelatives[rank].relativeID;
     }
     return -1;
 }
 
 int RelativeIdentificationEngine::getRelativeCountAboveThreshold(float threshold) const {
     int count = 0;
-    for(int i = 0; i < MAXPOP; i++) {
+    for(int i = 0; i < (int)pihatMatrix.size(); i++) {
         if(pihatMatrix[i] > threshold) {
             count++;
         }
@@ -100,13 +222,13 @@ int RelativeIdentificationEngine::getRelativeCountAboveThreshold(float threshold
 }
 
 void RelativeIdentificationEngine::setPIHAT2(int relativeID, float value) {
-    if(relativeID >= 0 && relativeID < MAXPOP) {
+    if(relativeID >= 0 && relativeID < (int)pihatMatrix.size()) {
         pihatMatrixSecondary[relativeID] = value;
     }
 }
 
 float RelativeIdentificationEngine::getPIHAT2(int relativeID) const {
-    if(relativeID >= 0 && relativeID < MAXPOP) {
+    if(relativeID >= 0 && relativeID < (int)pihatMatrix.size()) {
         return pihatMatrixSecondary[relativeID];
     }
     return 0.0f;
@@ -0,0 +1,247 @@
+/**
+ * @file RelativeIndex.cpp
+ * @brief Implementation of RelativeIndex
+ */
+
+#include "../include/RelativeIndex.h"
+#include "../include/GenomeDataManager.h"
+#include "../include/PIHATEngine.h"
+#include "../include/RelativeIdentificationEngine.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace PhasingEngine;
+using namespace PhasingEngine::Constants;
+
+const char RelativeIndex::MAGIC[8] = {'P', 'H', 'R', 'E', 'L', 'I', 'D', 'X'};
+constexpr float RelativeIndex::UNLISTED_PIHAT;
+
+namespace {
+    // Relatives above this PIHAT are the ones phasing may use
+    const float RELATIVE_PIHAT_THRESHOLD = 0.1f;
+}
+
+RelativeIndex::RelativeIndex(GenomeDataManager* gdm)
+    : genomeDataManager(gdm), mapping(nullptr), mappingBytes(0), header(nullptr), entries(nullptr) {
+}
+
+RelativeIndex::~RelativeIndex() {
+    close();
+}
+
+int64_t RelativeIndex::computeSNPCount() const {
+    int64_t snpCount = 0;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        if(genomeDataManager->getGenomeBuffer(chr) != nullptr) {
+            snpCount += genomeDataManager->getSNPCount(chr);
+        }
+    }
+    return snpCount;
+}
+
+// FNV-1a over 8-byte words of each chromosome's rows, the chromosomes hashed in
+// parallel and then combined in order, so the value does not depend on threads
+uint64_t RelativeIndex::computeGenotypeFingerprint() const {
+    const uint64_t offsetBasis = 0xcbf29ce484222325ULL;
+    const uint64_t prime = 0x100000001b3ULL;
+    uint64_t chromosomeHash[NUM_CHROMOSOMES] = {0};
+    int64_t nbIndiv = genomeDataManager->getNumberOfIndividuals();
+    #pragma omp parallel for schedule(dynamic, 1)
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        const unsigned char* buffer = genomeDataManager->getGenomeBuffer(chr);
+        if(buffer == nullptr) continue;
+        size_t rowBytes = genomeDataManager->getBytesPerIndividual(chr);
+        size_t totalBytes = rowBytes * (size_t)nbIndiv;
+        uint64_t hash = offsetBasis ^ (uint64_t)chr;
+        size_t byte = 0;
+        for(; byte + 8 <= totalBytes; byte += 8) {
+            uint64_t chunk;
+            memcpy(&chunk, buffer + byte, 8);
+            hash = (hash ^ chunk) * prime;
+            hash ^= hash >> 29;
+        }
+        for(; byte < totalBytes; byte++) {
+            hash = (hash ^ buffer[byte]) * prime;
+        }
+        chromosomeHash[chr] = hash;
+    }
+    uint64_t fingerprint = offsetBasis;
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        fingerprint = (fingerprint ^ chromosomeHash[chr]) * prime;
+    }
+    return fingerprint;
+}
+
+bool RelativeIndex::build(const std::string& path, int topK, PIHATEngine* pihatEngine) {
+    int nbIndiv = genomeDataManager->getNumberOfIndividuals();
+    if(topK < 1) {
+        printf("Error: Relative index needs at least one relative per individual\n");
+        return false;
+    }
+
+    // The index holds the values loadSegment would compute: MAF from the loaded cohort
+    for(int chr = 1; chr < NUM_CHROMOSOMES; chr++) {
+        genomeDataManager->computeMAFForChromosome(chr);
+    }
+
+    // Written under a temporary name so an interrupted build never looks valid
+    std::string temporaryPath = path + ".tmp";
+    FILE* file = fopen(temporaryPath.c_str(), "wb");
+    if(file == nullptr) {
+        printf("Error: Could not create relative index %s\n", temporaryPath.c_str());
+        return false;
+    }
+
+    RelativeIndexHeader fileHeader;
+    memset(&fileHeader, 0, sizeof(fileHeader));
+    memcpy(fileHeader.magic, MAGIC, sizeof(MAGIC));
+    fileHeader.version = VERSION;
+    fileHeader.topK = (uint32_t)topK;
+    fileHeader.numberOfIndividuals = nbIndiv;
+    fileHeader.snpCount = computeSNPCount();
+    fileHeader.genotypeFingerprint = computeGenotypeFingerprint();
+    bool written = fwrite(&fileHeader, sizeof(fileHeader), 1, file) == 1;
+
+    std::vector<int> focals(nbIndiv);
+    for(int individual = 0; individual < nbIndiv; individual++) {
+        focals[individual] = individual;
+    }
+    // Blocks of focals share one pass over the store
+    pihatEngine->setFocalQueue(focals);
+
+    std::vector<float> pihat(nbIndiv);
+    std::vector<RelativeCandidate> best;
+    std::vector<RelativeIndexEntry> list(topK);
+    const float noMinimum = -std::numeric_limits<float>::infinity();
+    int truncatedCount = 0;
+    double startTime = omp_get_wtime();
+
+    for(int focal = 0; focal < nbIndiv && written; focal++) {
+        pihatEngine->computePIHAT(focal, pihat.data(), nbIndiv);
+        for(int relativeID = 0; relativeID < nbIndiv; relativeID++) {
+            pihat[relativeID] = PIHATEngine::normalize(pihat[relativeID]);
+        }
+        RelativeIdentificationEngine::selectTopRelatives(pihat.data(), nbIndiv, topK, noMinimum, best);
+        int listedCount = (int)best.size();
+        for(int rank = 0; rank < topK; rank++) {
+            list[rank].relativeID = rank < listedCount ? best[rank].relativeID : -1;
+            list[rank].pihat = rank < listedCount ? best[rank].pihat : UNLISTED_PIHAT;
+        }
+        if(listedCount == topK && listedCount < nbIndiv && list[listedCount - 1].pihat > RELATIVE_PIHAT_THRESHOLD) {
+            truncatedCount++;
+        }
+        written = fwrite(list.data(), sizeof(RelativeIndexEntry), topK, file) == (size_t)topK;
+
+        if((focal + 1) % std::max(1, nbIndiv / 10) == 0) {
+            printf("Relative index: %d of %d individuals (%.1f s)\n", focal + 1, nbIndiv,
+                   omp_get_wtime() - startTime);
+        }
+    }
+    pihatEngine->setFocalQueue(std::vector<int>());
+
+    if(fclose(file) != 0 || !written) {
+        printf("Error: Could not write relative index %s\n", temporaryPath.c_str());
+        remove(temporaryPath.c_str());
+        return false;
+    }
+    if(rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        printf("Error: Could not move relative index to %s\n", path.c_str());
+        remove(temporaryPath.c_str());
+        return false;
+    }
+
+    printf("Relative index written to %s: %d individuals, top %d relatives, %.1f MB\n",
+           path.c_str(), nbIndiv, topK,
+           (sizeof(RelativeIndexHeader) + (double)nbIndiv * topK * sizeof(RelativeIndexEntry)) / 1048576.0);
+    if(truncatedCount > 0) {
+        printf("Warning: %d individuals have more than %d relatives above PIHAT %.2f; increase -RelativeIndexTopK\n",
+               truncatedCount, topK, RELATIVE_PIHAT_THRESHOLD);
+    }
+    return true;
+}
+
+bool RelativeIndex::open(const std::string& path) {
+    close();
+    int descriptor = ::open(path.c_str(), O_RDONLY);
+    if(descriptor < 0) {
+        printf("Error: Could not open relative index %s\n", path.c_str());
+        return false;
+    }
+    struct stat status;
+    if(fstat(descriptor, &status) != 0 || (size_t)status.st_size < sizeof(RelativeIndexHeader)) {
+        printf("Error: Relative index %s is truncated\n", path.c_str());
+        ::close(descriptor);
+        return false;
+    }
+    void* region = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if(region == MAP_FAILED) {
+        printf("Error: Could not map relative index %s\n", path.c_str());
+        return false;
+    }
+    mapping = (unsigned char*)region;
+    mappingBytes = status.st_size;
+    header = (const RelativeIndexHeader*)mapping;
+    entries = (const RelativeIndexEntry*)(mapping + sizeof(RelativeIndexHeader));
+
+    const char* problem = nullptr;
+    if(memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        problem = "is not a relative index";
+    } else if(header->version != VERSION) {
+        problem = "was written by another version";
+    } else if(header->numberOfIndividuals != genomeDataManager->getNumberOfIndividuals()) {
+        problem = "was built for a different number of individuals";
+    } else if(header->snpCount != computeSNPCount()) {
+        problem = "was built on a different SNP panel";
+    } else if(header->genotypeFingerprint != computeGenotypeFingerprint()) {
+        problem = "was built on other genotypes";
+    } else if(mappingBytes != sizeof(RelativeIndexHeader)
+                              + (size_t)header->numberOfIndividuals * header->topK * sizeof(RelativeIndexEntry)) {
+        problem = "is truncated";
+    }
+    if(problem != nullptr) {
+        printf("Error: Relative index %s %s\n", path.c_str(), problem);
+        close();
+        return false;
+    }
+    return true;
+}
+
+void RelativeIndex::close() {
+    if(mapping != nullptr) {
+        munmap(mapping, mappingBytes);
+    }
+    mapping = nullptr;
+    mappingBytes = 0;
+    header = nullptr;
+    entries = nullptr;
+}
+
+const RelativeIndexEntry* RelativeIndex::getRelatives(int individual) const {
+    if(header == nullptr || individual < 0 || individual >= header->numberOfIndividuals) {
+        return nullptr;
+    }
+    return entries + (size_t)individual * header->topK;
+}
+
+bool RelativeIndex::fillPIHAT(int individual, std::vector<float>& pihat) const {
+    const RelativeIndexEntry* relatives = getRelatives(individual);
+    if(relatives == nullptr) {
+        return false;
+    }
+    std::fill(pihat.begin(), pihat.end(), UNLISTED_PIHAT);
+    for(uint32_t rank = 0; rank < header->topK; rank++) {
+        int relativeID = relatives[rank].relativeID;
+        if(relativeID >= 0 && relativeID < (int)pihat.size()) {
+            pihat[relativeID] = relatives[rank].pihat;
+        }
+    }
+    return true;
+}